@@ -12,8 +12,10 @@
 
 */
 #include <stdio.h>
-#include <sched.h>
+#include <string.h>
+#include <libgen.h>
 #include <signal.h>
+#include <sys/signalfd.h>
 #include <stdatomic.h>
 #include <inttypes.h>
 
@@ -31,13 +33,25 @@
 #include "adj_store.h"
 #include "adj_mod.h"
 #include "adj_vdj.h"
+#include "adj_reactor.h"
+#include "adj_evdev.h"
+#include "adj_bpm_tap.h"
+#include "adj_hotplug.h"
+#include "adj_ctl.h"
+#include "adj_rtpmidi.h"
+#include "adj_link.h"
+#include "adj_osc.h"
+#include "adj_capture.h"
+#include "adj_stamp.h"
+#include "adj_audio.h"
+#include "adj_index.h"
 
 static void usage()
 {
     printf("options:\n");
     printf("    -b - set the bpm (default 120.0)\n");
     printf("    -a - auto start, dont wait for space bar\n");
-    printf("    -p - aconnect adj:clock to a midi port, N.B. whitespace in port names e.g. -p 'TR-6S:TR-6S MIDI 1    '\n");
+    printf("    -p - connect adj:clock to a midi port, N.B. whitespace in port names e.g. -p 'TR-6S:TR-6S MIDI 1    '\n");
     printf("    -n - change the name of the sequencer in alsa (default 'adj')\n");
     printf("    -y - use alsa sync feature\n");
     printf("    -k - keyboard input\n");
@@ -45,12 +59,26 @@ static void usage()
     printf("    -j - joystick input from /dev/input/js0\n");
     printf("    -J - joystick input from named device\n");
     printf("    -u - scan usb devices\n");
-    printf("    -i - aconnect a midi port to adj for midi control input, (check /etc/adj-midimap.adjm)\n");
+    printf("    -E - evdev game pad input from named device e.g. /dev/input/event3, mapped by /etc/adj/pads/\n");
+    printf("    -i - connect a midi port to adj-in:control for midi control input, (check /etc/adj-midimap.adjm)\n");
     printf("    -v - connect as a Virtual CDJ to Pioneer decks\n");
     printf("    -N - NIC for Virtual CDJ\n");
     printf("    -M - load controller module\n");
     printf("    -c - read config from /etc/adj.conf\n");
     printf("    -C - read config from any file\n");
+    printf("    -T - record a trace to file, written on exit or kill -USR1, read it with adj-trace\n");
+    printf("    -R - send clocks straight to a rawmidi device e.g. hw:1,0,0, bypassing the sequencer\n");
+    printf("    -m - measure the sequencer's send jitter, printed on exit, to compare with -R\n");
+    printf("    -P - RTP-MIDI session on this udp port, and port + 1, e.g. 5004, network midi peers get clock and send control input\n");
+    printf("    -I - invite an RTP-MIDI peer host:port, implies -P 5004 if not set\n");
+    printf("    -L - join the Ableton Link session on a NIC e.g. eth0, adj leads the session's tempo and bars\n");
+    printf("    -F - follow the Link session's tempo and bars instead of leading\n");
+    printf("    -O - OSC control on this udp port e.g. 9000, bundles run at their timetag\n");
+    printf("    -w - record the CDJs' packets to file, with -v, replay it with adj-replay\n");
+    printf("    -A - lock to the beat of an alsa capture device e.g. hw:1,0, a mixer's booth out playing vinyl\n");
+    printf("    -t - preset tempo and phase for a WAV file analysed by adj-analyse, with -a bar one is its first downbeat\n");
+    printf("    -X - the track index for -t (default %s)\n", ADJ_INDEX_PATH);
+    printf("    -D - daemon mode, no terminal UI, keyboard or modules, control with adjc or adj-tui, modules run in adj-mod, watch with adj-stat (default when run as adjd)\n");
     printf("    -h - display this text\n");
     exit(0);
 }
@@ -61,6 +89,8 @@ static char keyb_input = 0;     // pc keyboard
 static char numpad_input = 0;   // number pad (calculator)
 static char joystick_input = 0; // joystick
 static char scan_usb_input = 0; // scan usb devices for known device
+static char* trace_file = NULL; // written on exit and SIGUSR1
+static char* rawmidi = NULL;    // clocks to a rawmidi device instead of the sequencer
 
 
 static void init_error(char* msg)
@@ -75,7 +105,7 @@ static void init_error_i(const char* msg, int i)
     ui.init_error_handler(&ui, txt);
 }
 
-// may also be called with signal 0
+// teardown on the reactor thread once it returns, sig is the signal that stopped it or 0
 static void signal_exit(int sig)
 {
     adj_running = 0;
@@ -83,6 +113,18 @@ static void signal_exit(int sig)
     adj_midiin_exit();
     adj_js_exit();
     adj_numpad_exit();
+    adj_evdev_exit();
+    adj_hotplug_exit();
+    adj_ctl_exit();
+    adj_rtpmidi_exit();
+    adj_link_exit();
+    adj_osc_exit();
+    adj_capture_exit();
+    adj_stamp_exit();
+    adj_audio_exit();
+    adj_mod_stop_all();
+    adj_reactor_exit();
+    adj_state_unpublish();
 
     ui.exit_handler(&ui, sig);
 
@@ -90,9 +132,24 @@ static void signal_exit(int sig)
         adj_keyb_reset_term();
     }
 
-    // Ctrl+C is not a clean exit because signal handlers cannot interact with atomics
+    if (trace_file && adj_trace_dump(trace_file) != ADJ_OK) {
+        fprintf(stderr, "trace write to %s failed\n", trace_file);
+    }
+
+    adj_histogram_print(adj_midiin_latency(), "midi in latency", stderr);
+    adj_histogram_print(adj_control_latency(), "control latency", stderr);
+    adj_histogram_print(adj_loop_jitter(), "clock loop jitter", stderr);
+    adj_histogram_print(adj_send_jitter(), rawmidi ? "rawmidi send jitter" : "sequencer send jitter", stderr);
+    adj_histogram_print(adj_rtpmidi_latency(), "rtpmidi latency", stderr);
+    adj_histogram_print(adj_rtpmidi_jitter(), "rtpmidi jitter", stderr);
+    adj_histogram_print(adj_stamp_latency(), "beat packet wake latency", stderr);
+    adj_histogram_print(adj_audio_latency(), "audio beat latency", stderr);
+    if (adj_osc_late()) fprintf(stderr, "osc: %i bundles arrived late\n", adj_osc_late());
+    if (adj_capture_count()) fprintf(stderr, "capture: %" PRIu64 " packets\n", adj_capture_count());
+    fprintf(stderr, "wakeups: %.1f/s\n", adj_wakeups_per_second());
+
     // n.b neither adjh, midiin nor keyb shutdown cleanly
-    if (sig == 2) {
+    if (sig == SIGINT) {
         exit(0);
     } else if (sig) {
         exit(1);
@@ -107,6 +164,20 @@ static void data_change_handler(adj_seq_info_t* adj, int idx, char* value)
     adj->ui->data_change_handler(adj->ui, adj, idx, value);
 }
 
+/**
+ * time taken by each stage of startup, reported once everything is running
+ */
+static uint64_t startup_last = 0;
+static char startup_report[256] = "startup ms:";
+
+static void startup_mark(char* stage)
+{
+    uint64_t now = adj_time_nanos();
+    size_t len = strlen(startup_report);
+    snprintf(startup_report + len, sizeof(startup_report) - len, " %s=%" PRIu64, stage, (now - startup_last) / 1000000);
+    startup_last = now;
+}
+
 static void message_handler(adj_seq_info_t* adj, char* message)
 {
     adj->ui->message_handler(adj->ui, adj, message);
@@ -128,19 +199,24 @@ static void tick_handler(adj_seq_info_t* adj, snd_seq_tick_time_t tick)
 static void exit_handler(adj_seq_info_t* adj)
 {
     adj->ui->exit_handler(adj->ui, 0);
-    signal_exit(0);
+    // main() tears down when the reactor returns, adj_exit() may be called from any thread
+    adj_reactor_exit();
 }
 
 static void stop_handler(adj_seq_info_t* adj)
 {
     adj->ui->stop_handler(adj->ui, adj);
     if (adj->vdj) adj_vdj_set_playing(adj, 0);
+    adj_rtpmidi_stop();
+    adj_link_stop();
 }
 
 static void start_handler(adj_seq_info_t* adj)
 {
     adj->ui->start_handler(adj->ui, adj);
     if (adj->vdj) adj_vdj_set_playing(adj, 1);
+    adj_rtpmidi_start();
+    adj_link_start();
 }
 
 static void beat_handler(adj_seq_info_t* adj, unsigned char player_id)
@@ -148,11 +224,35 @@ static void beat_handler(adj_seq_info_t* adj, unsigned char player_id)
     adj->ui->beat_handler(adj->ui, adj, player_id);
 }
 
+/**
+ * signals arrive on a signalfd so they are handled on the reactor thread, not in a signal handler.
+ * SIGUSR1 dumps the trace, SIGINT and SIGTERM stop the clock and the reactor.
+ */
+static int exit_signal = 0;
+
+static void on_signal(int fd, uint32_t events, void* data)
+{
+    struct signalfd_siginfo si;
+    char msg[256];
+
+    if ( read(fd, &si, sizeof(si)) != sizeof(si) ) return;
+    if (si.ssi_signo != SIGUSR1) {
+        exit_signal = si.ssi_signo;
+        adj_exit(data);
+        return;
+    }
+    if ( adj_trace_dump(trace_file) == ADJ_OK ) {
+        snprintf(msg, sizeof(msg), "trace written to %s", trace_file);
+    } else {
+        snprintf(msg, sizeof(msg), "trace write to %s failed", trace_file);
+    }
+    message_handler(data, msg);
+}
+
 int main(int argc, char* argv[])
 {
     int rv;
     char data_change[161];
-    char cli[2048];
     char* out_port_name = NULL;
     char* in_port_name = NULL;
     char auto_start = 0;
@@ -163,12 +263,29 @@ int main(int argc, char* argv[])
     char read_config = 0;
     char* file_name = NULL;
     char* joystick_dev = "/dev/input/js0";
+    char* evdev_dev = NULL;
+    char hotplug = 1;
+    char measure_seq = 0;
+    int rtpmidi_port = 0;
+    char* rtpmidi_peer = NULL;
+    char* link_iface = NULL;
+    char link_follow = 0;
+    int osc_port = 0;
+    char* capture_file = NULL;
+    char* audio_in = NULL;
+    char* track_file = NULL;
+    char* track_index = NULL;
+    adj_index_t tracks = {0};
+    const adj_index_track_t* track = NULL;
+    char daemon_mode = strcmp(basename(argv[0]), "adjd") == 0;
+    adj_rt_profile_t rt = { 0, 0, 0, -1, 0, -1 };
     uint32_t vdj_flags = VDJ_FLAG_DEV_XDJ | VDJ_FLAG_AUTO_ID;
     uint32_t keyb_flags = 0;
     uint32_t numpad_flags = 0;
     uint32_t joystick_flags = 0;
     unsigned int enter_toggles = 0;
     vdj_t* v;
+    startup_last = adj_time_nanos();
     adj_seq_info_t* adj = adj_calloc();
     adj->message_handler = message_handler;
     adj->data_change_handler = data_change_handler;
@@ -182,7 +299,7 @@ int main(int argc, char* argv[])
     // parse command line
 
     int c;
-    while ( ( c = getopt(argc, argv, "b:n:N:M:p:i:C:J:juheykKvac") ) != EOF) {
+    while ( ( c = getopt(argc, argv, "b:n:N:M:p:i:C:J:E:T:R:P:I:L:O:w:A:t:X:juheykKvacDmF") ) != EOF) {
         switch (c) {
             case 'h':
                 usage();
@@ -240,6 +357,48 @@ int main(int argc, char* argv[])
             case 'u':
                 scan_usb_input = 1;
                 break;
+            case 'E':
+                evdev_dev = optarg;
+                break;
+            case 'T':
+                trace_file = optarg;
+                break;
+            case 'D':
+                daemon_mode = 1;
+                break;
+            case 'R':
+                rawmidi = optarg;
+                break;
+            case 'm':
+                measure_seq = 1;
+                break;
+            case 'P':
+                rtpmidi_port = atoi(optarg);
+                break;
+            case 'I':
+                rtpmidi_peer = optarg;
+                break;
+            case 'L':
+                link_iface = optarg;
+                break;
+            case 'F':
+                link_follow = 1;
+                break;
+            case 'O':
+                osc_port = atoi(optarg);
+                break;
+            case 'w':
+                capture_file = optarg;
+                break;
+            case 'A':
+                audio_in = optarg;
+                break;
+            case 't':
+                track_file = optarg;
+                break;
+            case 'X':
+                track_index = optarg;
+                break;
         }
     }
 
@@ -260,60 +419,176 @@ int main(int argc, char* argv[])
             joystick_input |= conf->joystick_in;
             scan_usb_input |= conf->scan_usb_in;
             adj->alsa_sync |= conf->alsa_sync;
+            adj_bpm_tap_phase(conf->tap_phase);
+            if (conf->rt_prio > 0) {
+                rt.clock_prio = conf->rt_prio;
+                rt.command_prio = conf->rt_prio > 1 ? conf->rt_prio - 1 : 1;
+                rt.net_prio = conf->rt_prio > 2 ? conf->rt_prio - 2 : 1;
+            }
+            rt.cpu = conf->rt_cpu;
+            rt.command_cpu = conf->rt_command_cpu;
+            rt.mlock = conf->rt_mlock;
+            if (!trace_file) trace_file = conf->trace_file;
+            if (!rawmidi) rawmidi = conf->rawmidi;
+            measure_seq |= conf->measure_seq;
+            if (!rtpmidi_port) rtpmidi_port = conf->rtpmidi_port;
+            if (!rtpmidi_peer) rtpmidi_peer = conf->rtpmidi_peer;
+            if (!link_iface) link_iface = conf->link_iface;
+            link_follow |= conf->link_follow;
+            if (!osc_port) osc_port = conf->osc_port;
+            if (!capture_file) capture_file = conf->capture_file;
+            if (!audio_in) audio_in = conf->audio_in;
+            if (!track_index) track_index = conf->track_index;
         }
     }
 
+    // block signals before any threads start so they are only ever read from the signalfd
+    sigset_t signal_mask;
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGINT);
+    sigaddset(&signal_mask, SIGTERM);
+    if (trace_file) {
+        sigaddset(&signal_mask, SIGUSR1);
+        adj_trace_enable(1);
+    }
+    pthread_sigmask(SIG_BLOCK, &signal_mask, NULL);
+
+    // before any threads start so they all get locked memory
+    adj_rt_profile(&rt);
+
     adj_load_bpm(adj);
 
+    // a track adj-analyse has seen presets the tempo, for the sequencer and the line-in tracker
+    if (track_file) {
+        uint64_t hash;
+        if (! track_index) track_index = ADJ_INDEX_PATH;
+        if ( adj_index_load(track_index, &tracks) != ADJ_OK ) {
+            fprintf(stderr, "track index %s unavailable\n", track_index);
+        } else if ( adj_index_hash_file(track_file, &hash) != ADJ_OK ) {
+            fprintf(stderr, "%s: not a 16 bit PCM WAV file\n", track_file);
+        } else if ( ! (track = adj_index_find(&tracks, hash)) || track->bpm <= 0.0 ) {
+            fprintf(stderr, "%s: no tempo in %s, run adj-analyse\n", track_file, track_index);
+            track = NULL;
+        } else {
+            adj->bpm = track->bpm;
+        }
+    }
+
     if (numpad_input) keyb_input = 0;
+    // the daemon has no terminal, UIs are clients on the control socket e.g. adj-tui.
+    // Controller modules are loaded by adj-mod, so a module that crashes or blocks cannot take the clock with it.
+    if (daemon_mode) {
+        keyb_input = numpad_input = 0;
+        if (module || scan_usb_input) fprintf(stderr, "the daemon does not load modules, run adj-mod\n");
+        module = NULL;
+        scan_usb_input = 0;
+    }
 
+    // usb scan is slow, run it while alsa and vdj start up
+    if (!module && scan_usb_input) adj_mod_scan_start();
 
     // setup alsa sequencer
     if ( adj_init_alsa(adj) != ADJ_OK ) {
         init_error("alsa init failed");
         return 1;
     }
+    // the sequencer is still used for midi in and hotplug, rawmidi only takes over the clock
+    if (rawmidi) {
+        adj_backend_t* raw = adj_backend_rawmidi(rawmidi);
+        if ( ! raw ) {
+            init_error("rawmidi open failed");
+            return 1;
+        }
+        adj_set_backend(raw);
+    } else if (measure_seq && adj_measure_seq(adj) != ADJ_OK) {
+        fprintf(stderr, "sequencer send jitter unavailable\n");
+    }
+    startup_mark("alsa");
+
+    // input devices register with the reactor as they are initialized
+    if ( adj_reactor_init() != ADJ_OK ) {
+        init_error("input reactor init failed");
+        return 1;
+    }
+
+    int sfd = signalfd(-1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sfd < 0 || adj_reactor_add(sfd, on_signal, adj) != ADJ_OK) {
+        init_error("signalfd failed");
+        return 1;
+    }
 
     // init UI
-    if ( isatty(STDOUT_FILENO) ) {
+    if ( isatty(STDOUT_FILENO) && ! daemon_mode ) {
         initialize_tui(&ui, vdj ? 1 : 0);
     } else {
         initialize_cli(&ui, vdj ? 1 : 0);
     }
 
-    snprintf(data_change, 161, "%s:clock", adj->seq_name);
-    ui.data_item_handler(&ui, ADJ_ITEM_PORT, "alsa port:", data_change);
+    if (rawmidi) {
+        ui.data_item_handler(&ui, ADJ_ITEM_PORT, "rawmidi:", rawmidi);
+    } else {
+        snprintf(data_change, 161, "%s:clock", adj->seq_name);
+        ui.data_item_handler(&ui, ADJ_ITEM_PORT, "alsa port:", data_change);
+    }
 
     snprintf(data_change, 161, "%i:0", adj->client_id);
     ui.data_item_handler(&ui, ADJ_ITEM_CLIENT_ID, "client_id:", data_change);
+    startup_mark("ui");
+
+    // commands from adjc and other client processes, they can restart without touching the clock
+    char ctl = (rv = adj_ctl_init(adj)) == ADJ_OK;
+    if (rv == ADJ_ERR) {
+        // the socket and the state page belong to the adj that answered
+        init_error("already running, use -n to pick another name");
+        return 1;
+    } else if ( ! ctl ) {
+        fprintf(stderr, "control socket unavailable\n");
+    }
+
+    // live state for adj-stat and other monitors
+    snprintf(data_change, 161, "/%s-state", adj->seq_name);
+    if ( adj_state_publish(data_change) != ADJ_OK ) {
+        fprintf(stderr, "shared memory %s unavailable\n", data_change);
+    }
+
+    // ports that appear later, or are unplugged and plugged back in, are connected by hotplug
+    if ( (rv = adj_hotplug_init(adj)) != ADJ_OK ) {
+        init_error_i("error: midi hotplug failed: %i\n", rv);
+        hotplug = 0;
+    }
 
     // wire up midi devices
     if (out_port_name) {
-        cli[2047] = '\0';
-        snprintf(cli, 2047, "aconnect '%s:clock' '%s'", adj->seq_name, out_port_name);
-        if ( system(cli) ) {
-            fprintf(stderr, "aconnect '%s:clock' '%s' failed\n", adj->seq_name, out_port_name);
-            init_error("aconnect out port failed");
-            return 1;
+        if ( adj_connect_out(adj, out_port_name) != ADJ_OK ) {
+            fprintf(stderr, "connect '%s:clock' '%s' failed\n", adj->seq_name, out_port_name);
+            if ( ! hotplug ) {
+                init_error("connect out port failed");
+                return 1;
+            }
+            ui.data_item_handler(&ui, ADJ_ITEM_MIDI_OUT, "midi out:", "waiting");
         } else {
             ui.data_item_handler(&ui, ADJ_ITEM_MIDI_OUT, "midi out:", out_port_name);
         }
     } else {
         adj_wire_midi_out(adj);
     }
+    if (hotplug) adj_hotplug_out(out_port_name);
 
     // wire up midi controllers
     if (in_port_name) {
         if ((rv = adj_midiin(adj)) == ADJ_OK) {
-            cli[2047] = '\0';
-            snprintf(cli, 2047, "aconnect '%s' '%s:clock' ", in_port_name, adj->seq_name);
-            if ( system(cli) ) {
-                fprintf(stderr, "aconnect '%s' '%s:clock' failed\n", in_port_name, adj->seq_name);
-                init_error("aconnect in port failed\n");
-                return 1;
+            snprintf(data_change, 161, "%s:control", adj_midiin_client_name());
+            if ( adj_connect(adj, in_port_name, data_change) != ADJ_OK ) {
+                fprintf(stderr, "connect '%s' '%s' failed\n", in_port_name, data_change);
+                if ( ! hotplug ) {
+                    init_error("connect in port failed\n");
+                    return 1;
+                }
+                ui.data_item_handler(&ui, ADJ_ITEM_MIDI_IN, "midi in:", "waiting");
             } else {
                 ui.data_item_handler(&ui, ADJ_ITEM_MIDI_IN, "midi in:", in_port_name);
             }
+            if (hotplug) adj_hotplug_in(in_port_name);
         } else {
             if (rv == ADJ_SYNTAX) {
                 init_error_i("error: unable to read midi map /etc/adj-midimap.adjmm: %i\n", rv);
@@ -323,7 +598,41 @@ int main(int argc, char* argv[])
         }
     }
 
-    signal(SIGINT, signal_exit);
+    // network midi, control input from peers goes through the midimap so it needs midi in
+    if (rtpmidi_peer && ! rtpmidi_port) rtpmidi_port = ADJ_RTPMIDI_PORT;
+    if (rtpmidi_port) {
+        if ( ! in_port_name && adj_midiin(adj) != ADJ_OK ) {
+            fprintf(stderr, "rtpmidi control input unavailable, no midi map\n");
+        }
+        if ( (rv = adj_rtpmidi_init(adj, rtpmidi_port, rtpmidi_peer)) != ADJ_OK ) {
+            init_error_i("error: rtpmidi init failed: %i\n", rv);
+        } else {
+            snprintf(data_change, 161, "rtpmidi: udp %i", rtpmidi_port);
+            message_handler(adj, data_change);
+        }
+    }
+
+    // Ableton Link
+    if (link_iface) {
+        if ( (rv = adj_link_init(adj, link_iface, link_follow)) != ADJ_OK ) {
+            init_error_i("error: link init failed: %i\n", rv);
+        } else {
+            snprintf(data_change, 161, "link: %s on %s", link_follow ? "following" : "leading", link_iface);
+            message_handler(adj, data_change);
+        }
+    }
+
+    // OSC control surface
+    if (osc_port) {
+        if ( (rv = adj_osc_init(adj, osc_port)) != ADJ_OK ) {
+            init_error_i("error: osc init failed: %i\n", rv);
+        } else {
+            snprintf(data_change, 161, "osc: udp %i", osc_port);
+            message_handler(adj, data_change);
+        }
+    }
+
+    startup_mark("ports");
 
     // Key board handling
     if (keyb_input) {
@@ -357,29 +666,73 @@ int main(int argc, char* argv[])
         }
     }
 
-    // JoyStick handling via modules
-    if (module) {
-        adj_mod_manual_configure(adj, module, joystick_flags);
-    }
-    else if (scan_usb_input) {
+    // evdev game pad
+    if (evdev_dev) {
         if (vdj) joystick_flags |= ADJ_HAS_VDJ;
-        void* exit_fn = adj_mod_autoconfigure(adj, joystick_flags);
-        if ( exit_fn == NULL ) {
-            fprintf(stderr, "no usb joystick found\n");
+        if ( (rv = adj_evdev_input(adj, evdev_dev, joystick_flags)) != ADJ_OK ) {
+            init_error_i("error: evdev init failed: %i\n", rv);
         } else {
-            ui.data_item_handler(&ui, ADJ_ITEM_KEYB, "joystick:", "on");
+            ui.data_item_handler(&ui, ADJ_ITEM_KEYB, "joystick:", "evdev");
         }
     }
 
+    startup_mark("input");
+
     // Virtual CDJ
     if (vdj) {
-        if ( ! (v = adj_vdj_init(adj, iface, vdj_flags, adj->bpm, vdj_offset)) ) {
+        // libvdj's threads inherit the net priority
+        if (rt.net_prio) adj_rt_inherit(rt.net_prio);
+        v = adj_vdj_init(adj, iface, vdj_flags, adj->bpm, vdj_offset);
+        if (rt.net_prio) adj_rt_inherit(0);
+        if ( ! v ) {
             init_error_i("error: vdj start failed: %i\n", 0);
             signal_exit(0);
             return 1;
         } else {
             adj->vdj = v;
         }
+        startup_mark("vdj");
+
+        // ProLink capture, beside libvdj's sockets
+        if (capture_file) {
+            if ( (rv = adj_capture_init(adj, capture_file, v->player_id)) != ADJ_OK ) {
+                init_error_i("error: capture init failed: %i\n", rv);
+            } else {
+                snprintf(data_change, 161, "capture: %s", capture_file);
+                message_handler(adj, data_change);
+            }
+        }
+    }
+
+    // line-in beat lock, at the net priority as it does the same job as libvdj's beat handler
+    if (audio_in) {
+        if (rt.net_prio) adj_rt_inherit(rt.net_prio);
+        rv = adj_audio_init(adj, audio_in, track ? track->bpm : 0.0f);
+        if (rt.net_prio) adj_rt_inherit(0);
+        if (rv != ADJ_OK) {
+            init_error_i("error: audio init failed: %i\n", rv);
+        } else {
+            snprintf(data_change, 161, "audio: locked to %s", audio_in);
+            message_handler(adj, data_change);
+        }
+        startup_mark("audio");
+    }
+
+    // JoyStick handling via modules
+    if (module) {
+        adj_mod_manual_configure(adj, module, joystick_flags);
+    }
+    else if (scan_usb_input) {
+        if (vdj) joystick_flags |= ADJ_HAS_VDJ;
+        if ( adj_mod_autoconfigure(adj, joystick_flags) == 0 ) {
+            // any pad with an adjpad file
+            if ( adj_evdev_input(adj, NULL, joystick_flags) != ADJ_OK ) {
+                fprintf(stderr, "no usb joystick found\n");
+            } else {
+                ui.data_item_handler(&ui, ADJ_ITEM_KEYB, "joystick:", "evdev");
+            }
+        }
+        startup_mark("usb");
     }
 
     // start the midi sequencer
@@ -389,15 +742,31 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    sched_yield();
-    usleep(50000);
+    startup_mark("seq");
 
-    if (auto_start) adj_start(adj);
+    message_handler(adj, startup_report);
+    message_handler(adj, adj_rt_report());
+    if (ctl) {
+        snprintf(data_change, 161, "control: %s", adj_ctl_path());
+        message_handler(adj, data_change);
+    }
 
-    adj_running = 1;
-    while (adj_running) {
-        usleep(50000);
+    if (track) {
+        snprintf(data_change, 161, "track: %.2f bpm, first downbeat %.3fs", track->bpm, track->downbeat_us / 1000000.0);
+        message_handler(adj, data_change);
+    }
+
+    if (auto_start) {
+        adj_start(adj);
+        // the track is started with adj, bar one goes on its first downbeat rather than its first sample
+        if (track && track->downbeat_us) adj_restart_at(adj, adj_time_nanos() + track->downbeat_us * 1000ULL);
     }
+    adj_index_free(&tracks);
+
+    adj_running = 1;
+    // all input is read on this thread until exit
+    adj_reactor_run();
+    signal_exit(exit_signal);
 
     return 0;
 }
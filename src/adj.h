@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
 #include <alsa/asoundlib.h>
 #include <cdj/vdj.h>
 
@@ -10,11 +12,13 @@
 #define ADJ_PPQ                 96    // ticks per quarter note
 #define ADJ_CLOCKS_PER_BEAT     24    // clock signals required per beat (defined by midi spec)
 #define ADJ_BEATS_QUEUED        0.25  // we queue up clock signals on the sequencer, and so loop less often
+#define ADJ_OUTPUT_EVENTS       256   // alsa output buffer and pool size in events, many times the clocks queued
 #define ADJ_MAX_CLIENT_LEN      2048  // max length of USB/ASLA midi clients (not sure if this is too large or if tis unlimited)
 #define ADJ_TICK0               0
 #define ADJ_MIN_BPM             60
 #define ADJ_MAX_BPM             240
 #define ADJ_BEATS_PER_BAR       4     // used by quantized restart, you can stil beat sync other time signatures
+#define ADJ_CLOCK               CLOCK_MONOTONIC  // clock used for timestamps in libadj, e.g. the timeline
 
 // init flags
 #define ADJ_ENTER_TOGGLES       0x01     // flag indicating enter key should toggle on off
@@ -25,6 +29,150 @@
 typedef struct adj_seq_info_s adj_seq_info_t;
 typedef struct adj_ui_s adj_ui_t;
 
+#define ADJ_HISTOGRAM_BUCKETS   20    // power of two buckets in microseconds, the last is anything over ~0.25 seconds
+
+/**
+ * Lock free histogram of latencies, any thread may add values.
+ */
+typedef struct {
+    uint32_t _Atomic    count[ADJ_HISTOGRAM_BUCKETS];
+    uint64_t _Atomic    max;
+} adj_histogram_t;
+
+#define ADJ_RT_STACK            (256 * 1024)  // stack size of realtime threads, locked and faulted in when mlock is on
+
+/**
+ * Real-time profile, SCHED_FIFO priorities are 1 - 99, 0 leaves a thread SCHED_OTHER.
+ * The command thread is not pinned with the clock by default: on one core it is starved by the clock a priority above it.
+ */
+typedef struct {
+    int         clock_prio;     // main loop sending midi clock
+    int         command_prio;   // nudge thread that applies tempo changes
+    int         net_prio;       // threads started by libvdj
+    int         cpu;            // core to pin the clock thread to e.g. one in isolcpus=, -1 for any
+    int         mlock;          // lock and prefault all memory
+    int         command_cpu;    // core for the command thread, -1 for any
+} adj_rt_profile_t;
+
+//SNIP_adjh_trace
+
+// trace event types, a and b depend on the type
+#define ADJ_TRACE_CLOCKS        1   // clock batch queued, a = last tick queued, b = events on the queue
+#define ADJ_TRACE_TEMPO         2   // tempo sent to the queue, a = micros per beat
+#define ADJ_TRACE_NUDGE         3   // nudge requested, a = multiplier, b = millis
+#define ADJ_TRACE_START         4   // midi start
+#define ADJ_TRACE_STOP          5   // midi stop
+#define ADJ_TRACE_RESTART       6   // quantized or timed restart
+#define ADJ_TRACE_BEAT          7   // CDJ beat packet, a = player, b = bpm * 100
+#define ADJ_TRACE_DIFF          8   // CDJ beat diff, a = player, b = diff ms
+#define ADJ_TRACE_MIDI_IN       9   // controller command from midi, a = op, b = value
+#define ADJ_TRACE_PAD          10   // controller command from a game pad, a = op, b = value
+#define ADJ_TRACE_KEY          11   // key press, a = key
+#define ADJ_TRACE_TYPES        12
+
+#define ADJ_TRACE_MAGIC         "ADJTRC01"
+
+/**
+ * one trace event, 24 bytes
+ */
+typedef struct {
+    uint64_t    nanos;      // adj_time_nanos()
+    int64_t     b;
+    int32_t     a;
+    uint16_t    type;
+    uint16_t    reserved;
+} adj_trace_event_t;
+
+/**
+ * trace file: header, then for each thread an adj_trace_thread_t followed by count events oldest first
+ */
+typedef struct {
+    char        magic[8];
+    uint32_t    threads;
+    uint32_t    event_size;
+} adj_trace_header_t;
+
+typedef struct {
+    char        name[16];
+    uint32_t    index;
+    uint32_t    count;
+} adj_trace_thread_t;
+
+//SNIP_adjh_trace
+
+#define ADJ_STATE_VERSION       2
+#define ADJ_STATE_PLAYERS       16    // CDJ player slots, indexed by player_id % ADJ_STATE_PLAYERS
+#define ADJ_STATE_STOPPED       0
+#define ADJ_STATE_RUNNING       1
+
+// each section of the state page has its own seqlock and is written by one thread, see adj_state_t
+
+typedef struct {
+    uint32_t _Atomic    seq;            // odd while an update is in progress
+    uint32_t            state;          // ADJ_STATE_STOPPED or ADJ_STATE_RUNNING
+    uint32_t            tick;           // last tick queued
+    int32_t             queue_events;   // events on the alsa queue after the last batch
+    uint64_t            nanos;          // adj_time_nanos() of the last update
+    uint64_t            underruns;      // batches queued after the alsa queue ran dry
+    uint64_t            jitter_last;    // micros the clock loop woke late, last loop
+    uint64_t            jitter_max;
+    uint64_t            wakeups;
+} adj_state_clock_t;
+
+typedef struct {
+    uint32_t _Atomic    seq;
+    float               bpm;
+    uint64_t            nanos;
+} adj_state_tempo_t;
+
+typedef struct {
+    uint32_t _Atomic    seq;
+    int32_t             player_id;      // difflock target, 0 for none
+    int32_t             ms;
+    uint32_t            reserved;
+    uint64_t            nanos;
+} adj_state_lock_t;
+
+typedef struct {
+    uint32_t _Atomic    seq;
+    uint8_t             player_id;      // 0 for an empty slot
+    uint8_t             bar_pos;        // 1 - 4
+    uint16_t            reserved;
+    float               bpm;
+    int32_t             diff;           // ms, as shown on the UI
+    uint64_t            nanos;          // when the last beat arrived
+} adj_state_player_t;
+
+/**
+ * Live state published in shared memory as /<seq_name>-state e.g. /dev/shm/adj-state.
+ * The clock thread, the command thread, the difflock and each player write their own section so no writer
+ * ever waits for another, readers copy it with adj_state_read() and never block the clock.
+ */
+typedef struct {
+    uint32_t            version;        // ADJ_STATE_VERSION
+    uint32_t            size;           // sizeof(adj_state_t)
+    int32_t             pid;
+    uint32_t            reserved;
+    adj_state_clock_t   clock;          // clock thread
+    adj_state_tempo_t   tempo;          // command thread
+    adj_state_lock_t    lock;           // ui and input threads
+    adj_state_player_t  players[ADJ_STATE_PLAYERS];    // vdj and audio threads
+} adj_state_t;
+
+//SNIP_adjh_timeline
+/**
+ * Position of the queue at a point in time, see adj_timeline_position()
+ */
+typedef struct {
+    double      beat;       // beats since the queue started, including the fraction
+    uint32_t    bar;        // bars since the queue started, zero based
+    uint8_t     bar_pos;    // 1 to ADJ_BEATS_PER_BAR, as per CDJ beat packets
+    double      phase;      // 0.0 to 1.0, how far through the current beat
+    uint32_t    tick;       // queue tick, ADJ_PPQ per beat
+    float       bpm;        // tempo at that time
+} adj_beat_pos_t;
+//SNIP_adjh_timeline
+
 // ui callbacks
 typedef void (*adj_init_error_ui_handler_pt)(adj_ui_t* ui, char* message);
 typedef void (*adj_message_ui_handler_pt)(adj_ui_t* ui, adj_seq_info_t* adj, char* message);
@@ -45,6 +193,39 @@ typedef void (*adj_stop_handler_pt)(adj_seq_info_t* adj);
 typedef void (*adj_start_handler_pt)(adj_seq_info_t* adj);
 typedef void (*adj_exit_handler_pt)(adj_seq_info_t* adj);
 
+/**
+ * Clock output backend, everything the clock loop asks of a sequencer queue.
+ * Functions are called from the clock and nudge threads, tempo may be called while the clock thread is in events() or sleeping.
+ * now, sleep_until, idle, busy and wake are for virtual clocks, NULL uses ADJ_CLOCK.
+ */
+typedef struct adj_backend_s adj_backend_t;
+
+struct adj_backend_s {
+    const char* name;
+    int         (*tempo)(adj_seq_info_t* adj, unsigned int micros_per_beat);
+    int         (*start)(adj_seq_info_t* adj);                              // clear the queue, start it, queue midi start at ADJ_TICK0
+    int         (*stop)(adj_seq_info_t* adj);                               // clear the queue, send midi stop now, stop the queue
+    int         (*clock)(adj_seq_info_t* adj, snd_seq_tick_time_t tick);    // queue a midi clock at tick
+    int         (*flush)(adj_seq_info_t* adj);                              // send buffered output
+    int         (*events)(adj_seq_info_t* adj);                             // events waiting on the queue
+    int         (*sync)(adj_seq_info_t* adj);                               // block until the queue is empty
+    uint64_t    (*now)();
+    void        (*sleep_until)(uint64_t nanos);
+    void        (*idle)();      // the calling thread is about to wait for something other than sleep_until()
+    void        (*busy)();      // a waiting thread was woken, called by the thread that woke it
+    void        (*wake)();      // adj is quitting, return from sleep_until()
+};
+
+/**
+ * a midi event played by the simulated backend
+ */
+typedef struct {
+    uint64_t            due;    // when the queue reached the event's tick
+    uint64_t            sent;   // when it was played, later than due if it was queued late
+    snd_seq_tick_time_t tick;
+    uint8_t             type;   // SND_SEQ_EVENT_CLOCK, SND_SEQ_EVENT_START or SND_SEQ_EVENT_STOP
+} adj_sim_event_t;
+
 struct adj_seq_info_s {
     char*       seq_name;
     int         client_id;
@@ -120,6 +301,7 @@ int adj_init_alsa(adj_seq_info_t* adj);
 
 /**
  * Start the queue, nothing happens until adj_start() is called.
+ * Fails if the clock thread cannot set the tempo, or is not running within a couple of seconds.
  */
 int adj_init(adj_seq_info_t* adj);
 
@@ -129,6 +311,12 @@ int adj_init(adj_seq_info_t* adj);
  */
 void adj_nudge(adj_seq_info_t* adj, int multiplier);
 
+/**
+ * Nudge for one beat, nanos is when the controller event arrived, from adj_time_nanos() or an event timestamp on the same clock.
+ * It is traced and counted in adj_control_latency(), the nudge itself is held for a whole beat from when it is applied.
+ */
+void adj_nudge_at(adj_seq_info_t* adj, int multiplier, uint64_t nanos);
+
 /**
  * Nudge by a specific amount of milliseconds, designed for auto correction, so adj_nudge() takes precidence 
  * as it is designed for human interaction
@@ -156,6 +344,23 @@ void adj_toggle(adj_seq_info_t* adj);
  */
 void adj_quantized_restart(adj_seq_info_t* adj);
 
+/**
+ * Stop/start so that the bar restarts at nanos (adj_time_nanos() clock), e.g. in phase with tapped beats.
+ * A later call replaces a pending restart, 0 cancels it.
+ */
+void adj_restart_at(adj_seq_info_t* adj, uint64_t nanos);
+
+/**
+ * Subscribe one alsa port to another without forking aconnect.
+ * Addresses are as aconnect takes them, client:port by name or number e.g. "nanoKONTROL:0" or "adj-in:control"
+ */
+int adj_connect(adj_seq_info_t* adj, const char* sender, const char* dest);
+
+/**
+ * connect adj:clock to a midi port
+ */
+int adj_connect_out(adj_seq_info_t* adj, const char* port_name);
+
 /**
  * Beat lock and unlock lock a pthread mutex so the main loop is paused and when unlocks a midi start occurs.
  * this is not beat syncing this for quantized restart in time to an external clock (i.e. CDJs).
@@ -197,8 +402,170 @@ void adj_adjust_tempo(adj_seq_info_t* adj, float bpm_diff);
  */
 void adj_set_tempo(adj_seq_info_t* adj, float bpm);
 
+/**
+ * Tempo changes that record when the controller event arrived, so control latency can be measured.
+ */
+void adj_adjust_tempo_at(adj_seq_info_t* adj, float bpm_diff, uint64_t nanos);
+void adj_set_tempo_at(adj_seq_info_t* adj, float bpm, uint64_t nanos);
+
+/**
+ * Histogram of time from a controller event arriving to the tempo change or nudge being sent to the sequencer.
+ */
+adj_histogram_t* adj_control_latency();
+
+/**
+ * Set the real-time profile, call before adj_init(), locks memory immediately if mlock is set.
+ */
+int adj_rt_profile(adj_rt_profile_t* rt);
+
+/**
+ * Switch the calling thread to SCHED_FIFO at prio, or back to SCHED_OTHER if prio is 0.
+ * Threads created meanwhile inherit the policy, this is how libvdj threads get the net priority.
+ */
+int adj_rt_inherit(int prio);
+
+/**
+ * One line saying which real-time settings took effect, e.g. "rt: mlock ok, clock fifo 80 cpu 3 ok, command fifo 79 EPERM"
+ */
+char* adj_rt_report();
+
+/**
+ * Count a thread waking up, loops call this each time they unblock so idle cost can be measured.
+ */
+void adj_wakeup();
+
+/**
+ * Wakeups per second across all threads since adj_init(), should be ~0 while stopped and idle
+ */
+double adj_wakeups_per_second();
+
+/**
+ * choose the clock output backend before adj_init(), NULL for alsa, the default
+ */
+void adj_set_backend(adj_backend_t* backend);
+adj_backend_t* adj_backend_alsa();
+
+/**
+ * Clocks written straight to a rawmidi device e.g. "hw:1,0,0" by a realtime thread, bypassing the sequencer.
+ * For one dedicated device, the sequencer port gets no clocks. Call after adj_rt_profile(), NULL if the device cannot be opened.
+ */
+adj_backend_t* adj_backend_rawmidi(const char* device);
+
+/**
+ * Measure the sequencer path into adj_send_jitter(), a second client listens to adj:clock, call after adj_init_alsa()
+ */
+int adj_measure_seq(adj_seq_info_t* adj);
+
+/**
+ * how late clocks leave libadj, from the rawmidi thread, or from the sequencer when adj_measure_seq() is on
+ */
+adj_histogram_t* adj_send_jitter();
+
+/**
+ * Simulated queue on a virtual clock, for benchmarks, needs no alsa.
+ * Virtual time moves only when libadj's threads and the caller are all waiting on it,
+ * so a run is repeatable and runs as fast as the CPU allows.
+ * Each sleep wakes up to wake_jitter nanos late, pseudo random from seed, as a scheduler would.
+ */
+adj_backend_t* adj_backend_sim(uint64_t wake_jitter, uint32_t seed);
+
+/**
+ * block the calling thread until virtual time reaches nanos, the caller of adj_backend_sim() must use this to wait
+ */
+void adj_sim_sleep_until(uint64_t nanos);
+
+/**
+ * events the simulated queue has played, read them after adj_exit()
+ */
+int adj_sim_events(const adj_sim_event_t** events);
+
 // end public api
 
+// start timeline api
+
+/**
+ * Now, in nanoseconds, from ADJ_CLOCK. All timeline times use this clock.
+ */
+uint64_t adj_time_nanos();
+
+/**
+ * Where the queue is, or will be, at the time nanos.
+ * Backed by a tempo map recorded when the queue starts and on every tempo change (including nudges)
+ * so it is accurate between loop iterations. Lookup is O(log n) and can be called from any thread.
+ * Times in the future are extrapolated at the current tempo.
+ * Only the last 128 to 256 tempo changes are kept, after that many earlier times are forgotten.
+ * returns ADJ_ERR if the queue is not running or nanos is before the queue started or the kept history.
+ */
+int adj_timeline_position(adj_seq_info_t* adj, uint64_t nanos, adj_beat_pos_t* pos);
+
+/**
+ * When beat (beats since the queue started, can be fractional) sounds, or sounded, written to nanos.
+ * e.g. the next down beat is adj_timeline_time(adj, (pos.bar + 1) * ADJ_BEATS_PER_BAR, &nanos)
+ * returns ADJ_ERR if the queue is not running or beat is before the queue started or the kept history.
+ */
+int adj_timeline_time(adj_seq_info_t* adj, double beat, uint64_t* nanos);
+
+// end timeline api
+
+// start trace api
+
+/**
+ * Turn tracing on or off, when off adj_trace() costs one load and a branch.
+ * Each thread that traces gets its own lock free ring of recent events, up to 32 threads at a time,
+ * a thread that exits leaves its ring to the next one, more than 32 at once and the rest are not traced.
+ */
+void adj_trace_enable(int on);
+
+/**
+ * record an event now, or at nanos
+ */
+void adj_trace(uint16_t type, int32_t a, int64_t b);
+void adj_trace_at(uint16_t type, int32_t a, int64_t b, uint64_t nanos);
+
+/**
+ * write every thread's ring to path, uses only open(), write() and close() so is safe from a signal handler
+ */
+int adj_trace_dump(const char* path);
+
+// end trace api
+
+// start state api
+
+/**
+ * Publish live state to shared memory, name is a shm_open() name e.g. "/adj-state".
+ * Values set before this is called are copied to the page.
+ */
+int adj_state_publish(const char* name);
+
+/**
+ * remove the shared memory page
+ */
+void adj_state_unpublish();
+
+/**
+ * CDJ state, called by whoever handles beat packets
+ */
+void adj_state_player(uint8_t player_id, uint8_t bar_pos, float bpm, int32_t diff);
+void adj_state_lock(int32_t player_id, int32_t ms);
+
+/**
+ * map a published page read only, for monitors, returns NULL if adj is not running
+ */
+const adj_state_t* adj_state_attach(const char* name);
+
+/**
+ * consistent copy of a published page, retries while the page is being written
+ * returns ADJ_ERR if the page is not a compatible version
+ */
+int adj_state_read(const adj_state_t* page, adj_state_t* copy);
+
+/**
+ * clock loop wake up lateness, only measured without alsa sync
+ */
+adj_histogram_t* adj_loop_jitter();
+
+// end state api
+
 // start util api
 
 /**
@@ -221,6 +588,21 @@ struct timespec adj_one_beat_time(float bpm);
  */
 void adj_one_beat_sleep(float bpm);
 
+/**
+ * length of s without trailing spaces, alsa pads client and port names
+ */
+size_t adj_rtrim_len(const char* s);
+
+/**
+ * record a latency in a histogram
+ */
+void adj_histogram_add(adj_histogram_t* hist, uint64_t micros);
+
+/**
+ * print a one line summary of a histogram, nothing is printed if it is empty
+ */
+void adj_histogram_print(adj_histogram_t* hist, const char* name, FILE* out);
+
 // end util api
 
 
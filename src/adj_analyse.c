@@ -0,0 +1,349 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <math.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "adj.h"
+#include "adj_beat.h"
+#include "adj_wav.h"
+#include "adj_index.h"
+
+/**
+ * Find the tempo, beat grid and first downbeat of every WAV file in some directories, for adj -t.
+ *
+ * Each file is mapped and streamed through the same tracker adj -A runs on line-in, one file per core.
+ * The tracker only looks backwards, offline the whole track is known, so the grid is its confident beats,
+ * with the gaps and the intro before it locked filled in at the track's median tempo.
+ * The downbeat is whichever beat of four has the strongest onsets, breaks and crashes tend to land on the one.
+ */
+
+#define ANALYSE_CHUNK       2048        // frames per call, under ADJ_BEAT_MAX beats at any tempo
+#define ANALYSE_MIN_BEATS   8           // fewer confident beats than this and the track has no tempo
+#define ANALYSE_CONFIDENCE  0.5         // as adj -A locks to
+
+typedef struct {
+    char*       path;
+    int         rv;             // ADJ_OK, ADJ_IO or ADJ_ERR if it is not a 16 bit PCM WAV
+    int         indexed;        // already in the index, not analysed again
+    uint64_t    hash;
+    float       bpm;
+    uint32_t    downbeat_us;
+    uint32_t*   grid;
+    uint32_t    beats;
+    double      secs;
+} analyse_track;
+
+static analyse_track* tracks = NULL;
+static int track_count = 0;
+static int flac_count = 0;
+static unsigned _Atomic next_track = ATOMIC_VAR_INIT(0);
+static adj_index_t index_in;
+static int force = 0;
+
+static void usage()
+{
+    printf("adj-analyse [-o index] [-j threads] [-f] [-q] dir ...\n");
+    printf("options:\n");
+    printf("    -o - the index to update (default %s)\n", ADJ_INDEX_PATH);
+    printf("    -j - threads (default one per core)\n");
+    printf("    -f - analyse tracks that are already in the index again\n");
+    printf("    -q - print only the summary\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+//SNIP_analyse_grid
+
+static int by_u64(const void* a, const void* b)
+{
+    uint64_t ua = *(const uint64_t*) a, ub = *(const uint64_t*) b;
+    return ua < ub ? -1 : ua > ub ? 1 : 0;
+}
+
+/**
+ * median nanos between the n beats, or 0
+ */
+static uint64_t grid_period(const uint64_t* beats, int n)
+{
+    uint64_t* gaps;
+    uint64_t period;
+    int i;
+
+    if (n < 2 || ! (gaps = malloc((n - 1) * sizeof(uint64_t))) ) return 0;
+    for (i = 1; i < n; i++) gaps[i - 1] = beats[i] - beats[i - 1];
+    qsort(gaps, n - 1, sizeof(uint64_t), by_u64);
+    period = gaps[(n - 1) / 2];
+    free(gaps);
+    return period;
+}
+
+/**
+ * every beat from the start of the track to length, in micros, the n found beats where there are any,
+ * a beat every period where there are not, returns the beats written, at most max
+ */
+static uint32_t grid_fill(const uint64_t* beats, int n, uint64_t period, uint64_t length, uint32_t* grid, uint32_t max)
+{
+    uint64_t at = beats[0] % period;
+    uint32_t count = 0;
+    int k = 0;
+
+    while (at <= length && count < max) {
+        // a found beat within half a beat of the next one due takes its place
+        while (k < n && beats[k] + period / 2 < at) k++;
+        if (k < n && beats[k] <= at + period / 2) at = beats[k++];
+        grid[count++] = (uint32_t) (at / 1000);
+        at += period;
+    }
+    return count;
+}
+
+/**
+ * which of the first four beats is a downbeat, from the onset strength of every beat
+ */
+static int grid_downbeat(const float* strength, uint32_t n)
+{
+    double sum[ADJ_BEATS_PER_BAR] = {0.0};
+    int counts[ADJ_BEATS_PER_BAR] = {0};
+    int i, best = 0;
+
+    for (i = 0; i < (int) n; i++) {
+        sum[i % ADJ_BEATS_PER_BAR] += strength[i];
+        counts[i % ADJ_BEATS_PER_BAR]++;
+    }
+    for (i = 1; i < ADJ_BEATS_PER_BAR; i++) {
+        if (counts[i] && sum[i] / counts[i] > sum[best] / counts[best]) best = i;
+    }
+    return best;
+}
+
+//SNIP_analyse_grid
+
+/**
+ * strongest onset within a hop of the beat at micros
+ */
+static float strength_at(const float* onsets, uint64_t count, uint32_t rate, uint32_t micros)
+{
+    int64_t hop = ((int64_t) micros * rate / 1000000 - ADJ_BEAT_HOP / 2) / ADJ_BEAT_HOP;
+    float s = 0.0f;
+    int64_t i;
+
+    for (i = hop - 1; i <= hop + 1; i++) {
+        if (i >= 0 && i < (int64_t) count && onsets[i] > s) s = onsets[i];
+    }
+    return s;
+}
+
+static void analyse(analyse_track* tr)
+{
+    adj_beat_tracker_t tracker;
+    adj_beat_t found[ADJ_BEAT_MAX];
+    adj_wav_t wav;
+    uint64_t frame, seen = 0, period, *beats = NULL;
+    float* onsets = NULL;
+    float* strength = NULL;
+    int i, n, count = 0;
+
+    if ( (tr->rv = adj_wav_open(tr->path, &wav)) != ADJ_OK ) return;
+    tr->hash = adj_index_hash((const uint8_t*) wav.frames, wav.count * wav.channels * sizeof(int16_t));
+    tr->secs = (double) wav.count / wav.rate;
+    if ( ! force && adj_index_find(&index_in, tr->hash) ) {
+        tr->indexed = 1;
+        adj_wav_close(&wav);
+        return;
+    }
+
+    // beats at most ADJ_BEAT_MAX_BPM, onsets one a hop, the tracker's ring only keeps the last few seconds
+    uint32_t max = (uint32_t) (tr->secs * ADJ_BEAT_MAX_BPM / 60.0) + ADJ_BEAT_MAX + 1;
+    beats = malloc(max * sizeof(uint64_t));
+    onsets = malloc((wav.count / ADJ_BEAT_HOP + 1) * sizeof(float));
+    tr->grid = malloc(max * sizeof(uint32_t));
+    strength = malloc(max * sizeof(float));
+    if ( ! beats || ! onsets || ! tr->grid || ! strength ) {
+        tr->rv = ADJ_ALLOC;
+        goto done;
+    }
+
+    adj_beat_init(&tracker, wav.rate);
+    for (frame = 0; frame < wav.count; frame += ANALYSE_CHUNK) {
+        int len = wav.count - frame < ANALYSE_CHUNK ? wav.count - frame : ANALYSE_CHUNK;
+        n = adj_beat_process(&tracker, wav.frames + frame * wav.channels, len, wav.channels, frame * 1000000000L / wav.rate, found);
+        for (i = 0; i < n; i++) {
+            if (found[i].confidence >= ANALYSE_CONFIDENCE && count < (int) max) beats[count++] = found[i].nanos;
+        }
+        for (; seen < tracker.count; seen++) onsets[seen] = tracker.onsets[seen % ADJ_BEAT_HISTORY];
+    }
+
+    if (count < ANALYSE_MIN_BEATS || ! (period = grid_period(beats, count)) ) goto done;
+    tr->bpm = (float) (60000000000.0 / period);
+    // the grid is in uint32 micros
+    uint64_t length = wav.count * 1000000000L / wav.rate;
+    if (length > UINT32_MAX * 1000ULL) length = UINT32_MAX * 1000ULL;
+    tr->beats = grid_fill(beats, count, period, length, tr->grid, max);
+    for (i = 0; i < (int) tr->beats; i++) strength[i] = strength_at(onsets, seen, wav.rate, tr->grid[i]);
+    if (tr->beats) tr->downbeat_us = tr->grid[grid_downbeat(strength, tr->beats)];
+
+done:
+    free(beats);
+    free(onsets);
+    free(strength);
+    adj_wav_close(&wav);
+}
+
+static void* worker(void* arg)
+{
+    unsigned i;
+
+    while ( (i = next_track++) < (unsigned) track_count ) analyse(&tracks[i]);
+    return NULL;
+}
+
+static int has_suffix(const char* name, const char* suffix)
+{
+    size_t len = strlen(name), slen = strlen(suffix);
+    return len > slen && strcasecmp(name + len - slen, suffix) == 0;
+}
+
+/**
+ * every WAV file under dir
+ */
+static void scan(const char* dir)
+{
+    struct dirent* e;
+    struct stat st;
+    char path[4096];
+    DIR* d;
+
+    if ( ! (d = opendir(dir)) ) {
+        fprintf(stderr, "%s: cannot read\n", dir);
+        return;
+    }
+    while ( (e = readdir(d)) ) {
+        if (e->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        if (stat(path, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            scan(path);
+        } else if (has_suffix(e->d_name, ".wav")) {
+            analyse_track* more = realloc(tracks, (track_count + 1) * sizeof(analyse_track));
+            if ( ! more ) break;
+            tracks = more;
+            memset(&tracks[track_count], 0, sizeof(analyse_track));
+            tracks[track_count++].path = strdup(path);
+        } else if (has_suffix(e->d_name, ".flac")) {
+            // no decoder here, and flac -d makes a WAV of the same audio
+            fprintf(stderr, "%s: flac is not supported, decode it to WAV first e.g. flac -d\n", path);
+            flac_count++;
+        }
+    }
+    closedir(d);
+}
+
+static int by_path(const void* a, const void* b)
+{
+    return strcmp(((const analyse_track*) a)->path, ((const analyse_track*) b)->path);
+}
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char* argv[])
+{
+    char* index_path = ADJ_INDEX_PATH;
+    int c, i, rv, quiet = 0, threads = 0, analysed = 0, indexed = 0, failed = 0;
+    double secs = 0.0;
+    pthread_t* tids;
+
+    while ( ( c = getopt(argc, argv, "o:j:fqh") ) != EOF) {
+        switch (c) {
+            case 'o':
+                index_path = optarg;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'f':
+                force = 1;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            case 'h':
+                usage();
+                break;
+        }
+    }
+    if (optind >= argc) usage();
+
+    if ( (rv = adj_index_load(index_path, &index_in)) == ADJ_SYNTAX ) {
+        fprintf(stderr, "%s: not a track index\n", index_path);
+        return 1;
+    }
+
+    for (i = optind; i < argc; i++) scan(argv[i]);
+    if (track_count == 0) {
+        fprintf(stderr, "no WAV files found\n");
+        return 1;
+    }
+    qsort(tracks, track_count, sizeof(analyse_track), by_path);
+
+    if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > track_count) threads = track_count;
+    if ( ! (tids = calloc(threads, sizeof(pthread_t))) ) return 1;
+
+    double start = now_seconds();
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&tids[i], NULL, worker, NULL) != 0) {
+            threads = i;
+            break;
+        }
+    }
+    // no thread started, this one does the work
+    if (threads == 0) worker(NULL);
+    for (i = 0; i < threads; i++) pthread_join(tids[i], NULL);
+    double wall = now_seconds() - start;
+
+    for (i = 0; i < track_count; i++) {
+        analyse_track* tr = &tracks[i];
+        if (tr->rv != ADJ_OK) {
+            fprintf(stderr, "%s: %s\n", tr->path, tr->rv == ADJ_ERR ? "not a 16 bit PCM WAV file" : "cannot read");
+            failed++;
+            continue;
+        }
+        if (tr->indexed) {
+            indexed++;
+            continue;
+        }
+        if (adj_index_add(&index_in, tr->hash, tr->bpm, tr->downbeat_us, tr->grid, tr->beats) != ADJ_OK) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        analysed++;
+        secs += tr->secs;
+        if ( ! quiet ) {
+            printf("%016" PRIx64 " %7.2f %8.3f %5u %s\n", tr->hash, tr->bpm, tr->downbeat_us / 1000000.0, tr->beats, tr->path);
+        }
+    }
+
+    if (analysed && adj_index_save(index_path, &index_in) != ADJ_OK) {
+        fprintf(stderr, "%s: write failed\n", index_path);
+        return 1;
+    }
+    printf("tracks=%i analysed=%i indexed=%i failed=%i flac=%i\n", track_count, analysed, indexed, failed, flac_count);
+    if (analysed) {
+        printf("%.0fs of audio in %.2fs on %i threads, %.0fx real time\n", secs, wall, threads ? threads : 1, secs / wall);
+    }
+    return failed ? 1 : 0;
+}
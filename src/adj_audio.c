@@ -0,0 +1,220 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE   // pthread_setname_np()
+#endif
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <alsa/asoundlib.h>
+
+#include "adj_audio.h"
+#include "adj_beat.h"
+#include "adj_diff.h"
+#include "adj_sync.h"
+
+/**
+ * One thread blocks in snd_pcm_readi() for a period at a time, runs the tracker and acts on its beats,
+ * the same way the libvdj thread acts on beat packets.
+ */
+
+static adj_seq_info_t* audio_adj = NULL;
+static snd_pcm_t* pcm = NULL;
+static pthread_t audio_thread;
+static unsigned _Atomic audio_running = ATOMIC_VAR_INIT(0);
+static unsigned int rate = ADJ_AUDIO_RATE;
+static unsigned int channels = 2;
+static snd_pcm_uframes_t period = ADJ_AUDIO_PERIOD;
+static adj_beat_tracker_t tracker;
+static adj_histogram_t audio_latency;
+
+//SNIP_audio_diff
+
+/**
+ * millis from the nearest beat of ours to the beat at pos, as CDJ diffs, positive if ours was first
+ */
+static int32_t audio_diff(const adj_beat_pos_t* pos)
+{
+    double beat_ms = 60000.0 / pos->bpm;
+    double ms = pos->phase < 0.5 ? pos->phase * beat_ms : (pos->phase - 1.0) * beat_ms;
+    return (int32_t) lround(ms);
+}
+
+/**
+ * bar position of our beat nearest pos
+ */
+static uint8_t audio_bar_pos(const adj_beat_pos_t* pos)
+{
+    if (pos->phase < 0.5) return pos->bar_pos;
+    return pos->bar_pos % ADJ_BEATS_PER_BAR + 1;
+}
+
+/**
+ * the tracker's tempo wanders by hundredths between updates, only a real change is passed on
+ */
+static float audio_bpm(float held, float bpm)
+{
+    if (fabsf(bpm - held) < ADJ_AUDIO_BPM_STEP) return held;
+    return roundf(bpm * 100.0f) / 100.0f;
+}
+
+//SNIP_audio_diff
+
+static void audio_beat(adj_beat_t* beat, float bpm)
+{
+    static uint8_t stopped_pos = 0;
+    adj_sync_action_t action;
+    adj_beat_pos_t pos;
+    int32_t diff = 0;
+    uint8_t bar_pos;
+
+    adj_histogram_add(&audio_latency, (adj_time_nanos() - beat->nanos) / 1000);
+    adj_trace(ADJ_TRACE_BEAT, ADJ_AUDIO_PLAYER, (int64_t) (bpm * 100));
+
+    if (adj_timeline_position(audio_adj, beat->nanos, &pos) == ADJ_OK) {
+        diff = audio_diff(&pos);
+        bar_pos = audio_bar_pos(&pos);
+        adj_trace(ADJ_TRACE_DIFF, ADJ_AUDIO_PLAYER, diff);
+    } else {
+        // stopped, there is no phase to lock, but the tempo is still copied so adj starts at the record's
+        bar_pos = stopped_pos = stopped_pos % ADJ_BEATS_PER_BAR + 1;
+    }
+    adj_state_player(ADJ_AUDIO_PLAYER, bar_pos, bpm, diff);
+
+    if (beat->confidence < ADJ_AUDIO_CONFIDENCE) return;
+
+    adj_diff_add(ADJ_AUDIO_PLAYER, diff);
+    adj_sync_beat(ADJ_AUDIO_PLAYER, bar_pos, bpm, diff, &action);
+    if (action.nudge_ms) {
+        adj_nudge_millis(audio_adj, action.nudge_ms);
+    }
+    if (action.bpm > 0.0) {
+        adj_set_tempo(audio_adj, action.bpm);
+    }
+}
+
+/**
+ * ADJ_CLOCK time of the first of n frames just read, from the driver's stamp of the hardware pointer
+ */
+static uint64_t capture_nanos(snd_pcm_uframes_t n)
+{
+    snd_pcm_uframes_t avail;
+    snd_pcm_sframes_t now_avail;
+    snd_htimestamp_t ts;
+    uint64_t stamp;
+
+    if (snd_pcm_htimestamp(pcm, &avail, &ts) == 0 && (ts.tv_sec || ts.tv_nsec)) {
+        stamp = (uint64_t) ts.tv_sec * 1000000000L + ts.tv_nsec;
+    } else {
+        stamp = adj_time_nanos();
+        now_avail = snd_pcm_avail(pcm);
+        avail = now_avail > 0 ? now_avail : 0;
+    }
+    return stamp - (uint64_t) (n + avail) * 1000000000L / rate;
+}
+
+static void* audio_loop(void* arg)
+{
+    int16_t* buf;
+    adj_beat_t beats[ADJ_BEAT_MAX];
+    snd_pcm_sframes_t n;
+    float bpm = 0.0f;
+    int i, found;
+
+    if ( ! (buf = calloc(period * channels, sizeof(int16_t))) ) return NULL;
+
+    while (audio_running) {
+        n = snd_pcm_readi(pcm, buf, period);
+        adj_wakeup();
+        if (n < 0) {
+            // an overrun loses some audio, the tracker's next fit puts the beats back
+            if (snd_pcm_recover(pcm, n, 1) < 0) {
+                fprintf(stderr, "audio capture failed (%s)\n", snd_strerror(n));
+                break;
+            }
+            continue;
+        }
+        found = adj_beat_process(&tracker, buf, n, channels, capture_nanos(n), beats);
+        for (i = 0; i < found; i++) {
+            bpm = audio_bpm(bpm, beats[i].bpm);
+            audio_beat(&beats[i], bpm);
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+static int open_pcm(const char* device)
+{
+    snd_pcm_hw_params_t* hw;
+    snd_pcm_sw_params_t* sw;
+    snd_pcm_uframes_t buffer;
+
+    if ( snd_pcm_open(&pcm, device, SND_PCM_STREAM_CAPTURE, 0) < 0 ) return ADJ_IO;
+
+    snd_pcm_hw_params_alloca(&hw);
+    snd_pcm_hw_params_any(pcm, hw);
+    if ( snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED) < 0 ||
+         snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S16_LE) < 0 ||
+         snd_pcm_hw_params_set_channels_near(pcm, hw, &channels) < 0 ||
+         snd_pcm_hw_params_set_rate_near(pcm, hw, &rate, NULL) < 0 ||
+         snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, NULL) < 0 ) {
+        return ADJ_ALSA;
+    }
+    buffer = period * 8;
+    snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &buffer);
+    if ( snd_pcm_hw_params(pcm, hw) < 0 ) return ADJ_ALSA;
+
+    // stamps on the timeline's clock, when the hardware pointer moved, rather than when we read it
+    snd_pcm_sw_params_alloca(&sw);
+    snd_pcm_sw_params_current(pcm, sw);
+    snd_pcm_sw_params_set_tstamp_mode(pcm, sw, SND_PCM_TSTAMP_ENABLE);
+    snd_pcm_sw_params_set_tstamp_type(pcm, sw, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+    snd_pcm_sw_params_set_avail_min(pcm, sw, period);
+    if ( snd_pcm_sw_params(pcm, sw) < 0 ) return ADJ_ALSA;
+
+    return snd_pcm_prepare(pcm) < 0 || snd_pcm_start(pcm) < 0 ? ADJ_IO : ADJ_OK;
+}
+
+int adj_audio_init(adj_seq_info_t* adj, const char* device, float bpm)
+{
+    int rv;
+
+    audio_adj = adj;
+    if ( (rv = open_pcm(device)) != ADJ_OK ) {
+        if (pcm) snd_pcm_close(pcm);
+        pcm = NULL;
+        return rv;
+    }
+    adj_beat_init(&tracker, rate);
+    adj_beat_preset(&tracker, bpm);
+
+    adj_sync_lock(ADJ_AUDIO_PLAYER, 0);
+    adj_sync_follow_tempo(1);
+
+    audio_running = 1;
+    if ( pthread_create(&audio_thread, NULL, audio_loop, NULL) != 0 ) {
+        audio_running = 0;
+        return ADJ_THREAD;
+    }
+    pthread_setname_np(audio_thread, "adj-audio");
+    return ADJ_OK;
+}
+
+adj_histogram_t* adj_audio_latency()
+{
+    return &audio_latency;
+}
+
+void adj_audio_exit()
+{
+    if ( ! audio_running ) return;
+
+    // readi returns within a period
+    audio_running = 0;
+    pthread_join(audio_thread, NULL);
+    snd_pcm_close(pcm);
+    pcm = NULL;
+}
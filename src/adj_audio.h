@@ -0,0 +1,39 @@
+#ifndef _ADJ_AUDIO_INCLUDED_
+#define _ADJ_AUDIO_INCLUDED_
+
+#include <stdint.h>
+
+#include "adj.h"
+
+/**
+ * Line-in beat lock, e.g. a DJ mixer's booth out into a USB sound card, so the midi clock follows vinyl.
+ *
+ * An alsa capture thread feeds adj_beat.c, each beat it finds is diffed against the timeline and goes through
+ * difflock as if it were a CDJ, player ADJ_AUDIO_PLAYER, locked and following tempo.  Capture times come from
+ * the driver's timestamps, not from when the thread woke up, so period size does not add to the diff.
+ */
+
+//SNIP_audio_constants
+
+#define ADJ_AUDIO_PLAYER        15          // beyond any CDJ's id, within the adj_diff and adj_state slots
+#define ADJ_AUDIO_RATE          44100
+#define ADJ_AUDIO_PERIOD        256         // frames, one onset hop
+#define ADJ_AUDIO_CONFIDENCE    0.5         // beats less sure than this are shown but not locked to
+#define ADJ_AUDIO_BPM_STEP      0.05        // tempo changes smaller than this are not copied to the sequencer
+
+//SNIP_audio_constants
+
+/**
+ * start capturing from an alsa PCM e.g. "hw:1,0" or "default", and lock to it,
+ * bpm is the tempo of the record if it is known, or 0.0
+ */
+int adj_audio_init(adj_seq_info_t* adj, const char* device, float bpm);
+
+/**
+ * micros from a beat being captured to it reaching difflock
+ */
+adj_histogram_t* adj_audio_latency();
+
+void adj_audio_exit();
+
+#endif // _ADJ_AUDIO_INCLUDED_
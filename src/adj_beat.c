@@ -0,0 +1,274 @@
+
+#include <string.h>
+#include <math.h>
+
+#include "adj_beat.h"
+
+//SNIP_beat_tracker
+
+/**
+ * four floats, gcc picks the instructions, unaligned loads go through memcpy
+ */
+typedef float beat_v4 __attribute__ ((vector_size (16)));
+
+static float hsum(beat_v4 v)
+{
+    return v[0] + v[1] + v[2] + v[3];
+}
+
+/**
+ * sum of a[i] * b[i], n a multiple of 4
+ */
+static float dot(const float* a, const float* b, int n)
+{
+    beat_v4 acc0 = {0, 0, 0, 0}, acc1 = {0, 0, 0, 0}, va, vb;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        memcpy(&va, a + i, sizeof(va));
+        memcpy(&vb, b + i, sizeof(vb));
+        acc0 += va * vb;
+        memcpy(&va, a + i + 4, sizeof(va));
+        memcpy(&vb, b + i + 4, sizeof(vb));
+        acc1 += va * vb;
+    }
+    for (; i < n; i += 4) {
+        memcpy(&va, a + i, sizeof(va));
+        memcpy(&vb, b + i, sizeof(vb));
+        acc0 += va * vb;
+    }
+    return hsum(acc0 + acc1);
+}
+
+static float log_energy(const float* x)
+{
+    return logf(1.0f + dot(x, x, ADJ_BEAT_HOP) / ADJ_BEAT_HOP * 1.0e-3f);
+}
+
+static double bpm_of(adj_beat_tracker_t* t, double period)
+{
+    return 60.0 * t->rate / (period * ADJ_BEAT_HOP);
+}
+
+static double period_of(adj_beat_tracker_t* t, double bpm)
+{
+    return 60.0 * t->rate / (bpm * ADJ_BEAT_HOP);
+}
+
+/**
+ * relative weight of a tempo, a log normal around the preset tempo, or ADJ_BEAT_PRIOR_BPM
+ */
+static float prior(adj_beat_tracker_t* t, double bpm)
+{
+    double centre = t->preset > 0.0 ? bpm_of(t, t->preset) : ADJ_BEAT_PRIOR_BPM;
+    double octaves = log2(bpm / centre);
+    return (float) exp(-0.5 * octaves * octaves / (0.6 * 0.6));
+}
+
+/**
+ * lag of the largest autocorrelation within one of lag, to a fraction, by a parabola through the peak
+ */
+static double peak(float* w, int n, int lag)
+{
+    float r[5];
+    int i, best = 1;
+
+    for (i = 0; i < 5; i++) r[i] = dot(w, w + lag - 2 + i, (n - lag - 2) & ~3);
+    for (i = 2; i <= 3; i++) if (r[i] > r[best]) best = i;
+    float a = r[best - 1], b = r[best], c = r[best + 1];
+    float d = a - 2.0f * b + c;
+    return lag - 2 + best + (d < 0.0f ? 0.5f * (a - c) / d : 0.0f);
+}
+
+/**
+ * best tempo of the onsets in w, as a period in onset samples, sets confidence, 0 if there is no beat
+ */
+static double find_period(adj_beat_tracker_t* t, float* w, int n)
+{
+    int min_lag = (int) period_of(t, ADJ_BEAT_MAX_BPM);
+    int max_lag = (int) ceil(period_of(t, ADJ_BEAT_MIN_BPM));
+    float acf[ADJ_BEAT_HISTORY];
+    int lag, k, best = 0;
+    float score, best_score = 0.0f;
+
+    float energy = dot(w, w, n & ~3);
+    if (energy <= 0.0f) return 0.0;
+
+    // too few onsets to search, but a preset tempo can be checked against four beats of them
+    if (max_lag * 2 + 4 >= n) {
+        if (t->preset <= 0.0 || t->preset * 4 + 4 >= n) return 0.0;
+        best = (int) (t->preset + 0.5);
+        t->confidence = fminf(1.0f, fmaxf(0.0f, dot(w, w + best, (n - best) & ~3) / (n - best) / (energy / n)));
+        return peak(w, n, best);
+    }
+
+    for (lag = min_lag - 1; lag <= max_lag * 2 + 1; lag++) {
+        acf[lag] = dot(w, w + lag, (n - lag) & ~3) / (n - lag);
+    }
+    // a beat at lag also has one at twice lag, so the score includes it, which keeps the tempo out of the octave below
+    for (lag = min_lag; lag <= max_lag; lag++) {
+        score = (acf[lag] + 0.5f * acf[lag * 2]) * prior(t, bpm_of(t, lag));
+        if (score > best_score && acf[lag] >= acf[lag - 1] && acf[lag] >= acf[lag + 1]) {
+            best_score = score;
+            best = lag;
+        }
+    }
+    if ( ! best ) return 0.0;
+
+    t->confidence = acf[best] / (energy / n);
+    if (t->confidence > 1.0f) t->confidence = 1.0f;
+    if (t->confidence < 0.0f) t->confidence = 0.0f;
+
+    // the peaks at two, three and four beats are as sharp, but four times as far out, so they pin the tempo down
+    double period = peak(w, n, best), sum = period, weight = 1.0;
+    for (k = 2; k <= 4; k++) {
+        int lag = (int) (k * period + 0.5);
+        if (lag + 2 >= n / 2) break;
+        double p = peak(w, n, lag) / k;
+        if (fabs(p - period) > 0.5) break;
+        sum += k * p;
+        weight += k;
+    }
+    return sum / weight;
+}
+
+/**
+ * onset sample index of the latest beat in w, the best fit of a comb of four beats period apart
+ */
+static double find_phase(float* w, int n, double period)
+{
+    int phase, k, best = 0;
+    float sum, best_sum = -1.0f;
+
+    for (phase = 0; phase < (int) period; phase++) {
+        sum = 0.0f;
+        for (k = 0; k < 4; k++) {
+            int i = n - 1 - phase - (int) (k * period + 0.5);
+            if (i >= 0) sum += w[i] + 0.5f * ((i > 0 ? w[i - 1] : 0.0f) + (i < n - 1 ? w[i + 1] : 0.0f));
+        }
+        if (sum > best_sum) {
+            best_sum = sum;
+            best = phase;
+        }
+    }
+    return n - 1 - best;
+}
+
+static void update(adj_beat_tracker_t* t)
+{
+    int n = t->count < ADJ_BEAT_HISTORY ? (int) t->count : ADJ_BEAT_HISTORY;
+    float w[ADJ_BEAT_HISTORY];
+    beat_v4 vmean;
+    int i;
+
+    // the window, oldest first, less its mean
+    memcpy(w, t->onsets + (t->count % ADJ_BEAT_HISTORY) + (ADJ_BEAT_HISTORY - n), n * sizeof(float));
+    float mean = 0.0f;
+    for (i = 0; i < n; i++) mean += w[i];
+    mean /= n;
+    vmean = (beat_v4) {mean, mean, mean, mean};
+    for (i = 0; i + 4 <= n; i += 4) {
+        beat_v4 v;
+        memcpy(&v, w + i, sizeof(v));
+        v -= vmean;
+        memcpy(w + i, &v, sizeof(v));
+    }
+    for (; i < n; i++) w[i] -= mean;
+
+    double period = find_period(t, w, n);
+    if (period <= 0.0) return;
+
+    // tempo moves slowly, unless the new one is far off, a new record
+    if (t->period > 0.0 && fabs(period - t->period) < 0.05 * t->period) {
+        period = t->period + ADJ_BEAT_SMOOTH * (period - t->period);
+    }
+    t->period = period;
+    t->bpm = (float) bpm_of(t, period);
+
+    double latest = (double) (t->count - n) + find_phase(w, n, period);
+    double fit = latest + period;
+    while (fit < (double) t->count - 0.5 * period) fit += period;
+
+    if (t->next_beat <= 0.0) {
+        t->next_beat = fit;
+        return;
+    }
+    // move the prediction part of the way to the fit, by the shortest way round the beat
+    double error = fmod(fit - t->next_beat, period);
+    if (error > period / 2.0) error -= period;
+    if (error < -period / 2.0) error += period;
+    t->next_beat += ADJ_BEAT_SMOOTH * error;
+}
+
+static uint64_t nanos_of(adj_beat_tracker_t* t, double onset)
+{
+    // onset samples are timed at the middle of their hop
+    double frame = onset * ADJ_BEAT_HOP + ADJ_BEAT_HOP / 2.0;
+    return t->chunk_nanos + (int64_t) ((frame - (double) t->chunk_frame) * 1000000000.0 / t->rate);
+}
+
+/**
+ * one hop of mono audio is complete
+ */
+static int hop(adj_beat_tracker_t* t, adj_beat_t* beats, int found)
+{
+    float full = log_energy(t->block);
+    float low = log_energy(t->low);
+    float onset = fmaxf(0.0f, low - t->prev_low) + 0.25f * fmaxf(0.0f, full - t->prev_full);
+    t->prev_full = full;
+    t->prev_low = low;
+
+    uint64_t i = t->count % ADJ_BEAT_HISTORY;
+    t->onsets[i] = t->onsets[i + ADJ_BEAT_HISTORY] = onset;
+    t->count++;
+
+    if (t->count % ADJ_BEAT_UPDATE == 0 && (t->count >= ADJ_BEAT_HISTORY / 2 || t->preset > 0.0)) update(t);
+
+    while (t->period > 0.0 && t->next_beat <= (double) t->count && found < ADJ_BEAT_MAX) {
+        beats[found].nanos = nanos_of(t, t->next_beat);
+        beats[found].bpm = t->bpm;
+        beats[found].confidence = t->confidence;
+        found++;
+        t->next_beat += t->period;
+    }
+    return found;
+}
+
+void adj_beat_init(adj_beat_tracker_t* t, uint32_t rate)
+{
+    memset(t, 0, sizeof(adj_beat_tracker_t));
+    t->rate = rate;
+    // two one pole low passes
+    t->lp_coef = 1.0f - expf(-2.0f * (float) M_PI * ADJ_BEAT_LOW_HZ / rate);
+}
+
+void adj_beat_preset(adj_beat_tracker_t* t, float bpm)
+{
+    t->preset = bpm > 0.0f ? period_of(t, bpm) : 0.0;
+}
+
+int adj_beat_process(adj_beat_tracker_t* t, const int16_t* frames, int n, int channels, uint64_t nanos, adj_beat_t* beats)
+{
+    int i, c, found = 0;
+    float x;
+
+    t->chunk_frame = t->frames;
+    t->chunk_nanos = nanos;
+    t->frames += n;
+
+    for (i = 0; i < n; i++) {
+        x = 0.0f;
+        for (c = 0; c < channels; c++) x += frames[i * channels + c];
+        x /= channels;
+        t->lp1 += t->lp_coef * (x - t->lp1);
+        t->lp2 += t->lp_coef * (t->lp1 - t->lp2);
+        t->block[t->fill] = x;
+        t->low[t->fill] = t->lp2;
+        if (++t->fill == ADJ_BEAT_HOP) {
+            t->fill = 0;
+            found = hop(t, beats, found);
+        }
+    }
+    return found;
+}
+
+//SNIP_beat_tracker
@@ -0,0 +1,74 @@
+#ifndef _ADJ_BEAT_INCLUDED_
+#define _ADJ_BEAT_INCLUDED_
+
+#include <stdint.h>
+
+/**
+ * Audio beat tracker, finds the tempo and the beats in a line-in feed, e.g. a DJ mixer's booth out playing vinyl.
+ *
+ * Onsets are the rise in log energy of each hop of audio, mostly the kick drum's band.  The tempo is the best
+ * autocorrelation lag of the last few seconds of onsets, weighted towards dance tempos, and the beat phase is
+ * the best fit of a comb of beats at that tempo.  Predicted beats are smoothed towards each new fit so a
+ * break or a scratch does not throw them about.
+ *
+ * No alsa, adj_audio.c feeds it from a PCM and adj-beat from a WAV file.  The inner loops are written with
+ * gcc vector extensions, they compile to NEON on a Pi and SSE or AVX on x86.
+ */
+
+//SNIP_beat_constants
+
+#define ADJ_BEAT_HOP            256         // frames per onset sample, 5.8ms at 44.1kHz
+#define ADJ_BEAT_HISTORY        1024        // onset samples the tempo is found from, ~6s at 44.1kHz
+#define ADJ_BEAT_UPDATE         64          // onset samples between tempo updates
+#define ADJ_BEAT_LOW_HZ         150.0       // kick drum band
+#define ADJ_BEAT_MIN_BPM        70.0
+#define ADJ_BEAT_MAX_BPM        200.0
+#define ADJ_BEAT_PRIOR_BPM      122.0       // tempo the weighting prefers, halves the chance of octave errors
+#define ADJ_BEAT_SMOOTH         0.25        // fraction of a new phase fit taken per update
+#define ADJ_BEAT_MAX            4           // beats returned by one call
+
+/**
+ * one beat, a prediction, it may be a little in the past when it is returned
+ */
+typedef struct {
+    uint64_t    nanos;
+    float       bpm;
+    float       confidence;     // 0 - 1, how much the onsets agree with the tempo
+} adj_beat_t;
+
+typedef struct {
+    uint32_t    rate;
+    float       lp_coef;
+    float       lp1, lp2;                           // low band filter state
+    float       block[ADJ_BEAT_HOP];                // mono, filling
+    float       low[ADJ_BEAT_HOP];
+    int         fill;
+    float       prev_full, prev_low;                // log energy of the last hop
+    float       onsets[ADJ_BEAT_HISTORY * 2];       // ring, written twice so any window is contiguous
+    uint64_t    count;                              // onset samples so far
+    uint64_t    frames;                             // frames so far
+    uint64_t    chunk_frame;                        // the first frame of the last chunk, and its time
+    uint64_t    chunk_nanos;
+    double      period;                             // onset samples per beat, 0 until the tempo is known
+    double      next_beat;                          // onset sample index of the next beat
+    double      preset;                             // period of a tempo known in advance, 0 for none
+    float       bpm;
+    float       confidence;
+} adj_beat_tracker_t;
+
+//SNIP_beat_constants
+
+void adj_beat_init(adj_beat_tracker_t* t, uint32_t rate);
+
+/**
+ * the tempo is known, e.g. from adj-analyse, tempos near it are preferred and beats start sooner
+ */
+void adj_beat_preset(adj_beat_tracker_t* t, float bpm);
+
+/**
+ * feed n interleaved 16 bit frames, the first frame was captured at nanos.
+ * Beats that are now due are written to beats, returns how many.
+ */
+int adj_beat_process(adj_beat_tracker_t* t, const int16_t* frames, int n, int channels, uint64_t nanos, adj_beat_t* beats);
+
+#endif // _ADJ_BEAT_INCLUDED_
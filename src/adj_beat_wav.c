@@ -0,0 +1,101 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include "adj.h"
+#include "adj_beat.h"
+#include "adj_wav.h"
+
+/**
+ * Run the audio beat tracker over a WAV file, as adj -A would run it on line-in, and print the beats it finds
+ * and how much CPU it took.  For trying the tracker on records without a mixer, and for checking it fits the
+ * budget of a Pi.
+ */
+
+#define BEAT_CHUNK      512         // frames per call, about what an alsa period is
+
+static void usage()
+{
+    printf("adj-beat [-q] [-b bpm] file.wav\n");
+    printf("options:\n");
+    printf("    -q - print only the summary\n");
+    printf("    -b - the tempo is known, as adj -t presets it from the track index\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static double cpu_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static int by_float(const void* a, const void* b)
+{
+    float fa = *(const float*) a, fb = *(const float*) b;
+    return fa < fb ? -1 : fa > fb ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    adj_beat_tracker_t tracker;
+    adj_beat_t beats[ADJ_BEAT_MAX];
+    adj_wav_t wav;
+    uint64_t frame;
+    float* bpms;
+    int c, i, n, quiet = 0, count = 0, confident = 0;
+    float preset = 0.0f;
+
+    while ( ( c = getopt(argc, argv, "qb:h") ) != EOF) {
+        switch (c) {
+            case 'q':
+                quiet = 1;
+                break;
+            case 'b':
+                preset = strtof(optarg, NULL);
+                break;
+            case 'h':
+                usage();
+                break;
+        }
+    }
+    if (optind >= argc) usage();
+
+    if ( (n = adj_wav_open(argv[optind], &wav)) != ADJ_OK ) {
+        fprintf(stderr, "%s: %s\n", argv[optind], n == ADJ_IO ? "cannot read" : "not a 16 bit PCM WAV file");
+        return 1;
+    }
+    double secs = (double) wav.count / wav.rate;
+    if ( ! (bpms = calloc(secs * ADJ_BEAT_MAX_BPM / 60.0 + ADJ_BEAT_MAX, sizeof(float))) ) return 1;
+
+    adj_beat_init(&tracker, wav.rate);
+    adj_beat_preset(&tracker, preset);
+    double cpu = cpu_seconds();
+    for (frame = 0; frame < wav.count; frame += BEAT_CHUNK) {
+        int len = wav.count - frame < BEAT_CHUNK ? wav.count - frame : BEAT_CHUNK;
+        uint64_t nanos = frame * 1000000000L / wav.rate;
+        n = adj_beat_process(&tracker, wav.frames + frame * wav.channels, len, wav.channels, nanos, beats);
+        for (i = 0; i < n; i++) {
+            if ( ! quiet ) printf("%9.3f %7.2f %.2f\n", beats[i].nanos / 1000000000.0, beats[i].bpm, beats[i].confidence);
+            bpms[count++] = beats[i].bpm;
+            if (beats[i].confidence >= 0.5) confident++;
+        }
+    }
+    cpu = cpu_seconds() - cpu;
+
+    if (count) {
+        qsort(bpms, count, sizeof(float), by_float);
+        printf("beats=%i confident=%i bpm=%.2f\n", count, confident, bpms[count / 2]);
+    } else {
+        printf("no beats found\n");
+    }
+    printf("%.1fs of %uHz %u channel audio in %.3fs cpu, %.2f%% of a core\n", secs, wav.rate, wav.channels, cpu, 100.0 * cpu / secs);
+    free(bpms);
+    adj_wav_close(&wav);
+    return 0;
+}
@@ -0,0 +1,138 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "adj.h"
+
+/**
+ * Runs the clock loop on the simulated backend and reports inter-clock jitter, drift against the ideal tempo,
+ * and how far nudges move the beat compared to what was asked for.  Virtual time, so a minute takes milliseconds
+ * and every run gives the same numbers.
+ */
+
+#define BENCH_NUDGE_NONE    0
+#define BENCH_NUDGE_MULT    1   // adj_nudge_at(), arg is the multiplier
+#define BENCH_NUDGE_MS      2   // adj_nudge_millis(), arg is millis
+
+typedef struct {
+    char*       name;
+    float       bpm;
+    uint64_t    wake_jitter;    // nanos
+    int         alsa_sync;
+    int         nudge;
+    int         arg;
+} bench_scenario;
+
+static bench_scenario scenarios[] = {
+    {"steady 120",          120.0,   200000, 0, BENCH_NUDGE_NONE,  0},
+    {"steady 123.4",        123.4,   200000, 0, BENCH_NUDGE_NONE,  0},
+    {"steady 174 sync",     174.0,   200000, 1, BENCH_NUDGE_NONE,  0},
+    {"overloaded 120",      120.0, 90000000, 0, BENCH_NUDGE_NONE,  0},
+    {"nudge +10 120",       120.0,   200000, 0, BENCH_NUDGE_MULT, 10},
+    {"nudge -20 128",       128.0,   200000, 0, BENCH_NUDGE_MULT, -20},
+    {"nudge_ms +20 120",    120.0,   200000, 0, BENCH_NUDGE_MS,   20},
+    {"nudge_ms -5 140",     140.0,   200000, 0, BENCH_NUDGE_MS,   -5},
+    {NULL, 0, 0, 0, 0, 0}
+};
+
+#define BENCH_SECONDS       60
+#define BENCH_NUDGE_AT      20   // seconds after start
+#define BENCH_SETTLE_BEATS  4    // beats after the nudge before measuring the shift
+
+static void run(bench_scenario* b)
+{
+    const adj_sim_event_t* ev;
+    double ideal = 60000000000.0 / (b->bpm * ADJ_CLOCKS_PER_BEAT);
+    double sum_sq = 0.0, max_jitter = 0.0, pre_interval = 0.0;
+    int i, n, clocks = 0, late = 0, intervals = 0, first = -1, pre_last = -1, post = -1;
+
+    adj_set_backend(adj_backend_sim(b->wake_jitter, 1));
+    adj_seq_info_t* adj = adj_calloc();
+    adj->bpm = b->bpm;
+    adj->alsa_sync = b->alsa_sync;
+    if (adj_init(adj) != ADJ_OK) {
+        printf("%-20s init failed\n", b->name);
+        exit(1);
+    }
+    uint64_t t0 = adj_time_nanos();
+    uint64_t nudge_at = t0 + BENCH_NUDGE_AT * 1000000000L;
+    uint64_t nudge_end = nudge_at + (uint64_t) ((BENCH_SETTLE_BEATS - 1) * 60000000000.0 / b->bpm);
+    adj_start(adj);
+
+    if (b->nudge) {
+        adj_sim_sleep_until(nudge_at);
+        if (b->nudge == BENCH_NUDGE_MULT) {
+            adj_nudge_at(adj, b->arg, adj_time_nanos());
+        } else {
+            adj_nudge_millis(adj, b->arg);
+        }
+    }
+    adj_sim_sleep_until(t0 + BENCH_SECONDS * 1000000000L);
+    adj_exit(adj);
+
+    n = adj_sim_events(&ev);
+    for (i = 0; i < n; i++) {
+        if (ev[i].type != SND_SEQ_EVENT_CLOCK) continue;
+        clocks++;
+        if (ev[i].sent > ev[i].due) late++;
+        if (first < 0) first = i;
+        if ( ! b->nudge || ev[i].sent < nudge_at ) {
+            pre_last = i;
+        } else if (post < 0 && ev[i].sent > nudge_end) {
+            post = i;
+        }
+        // jitter between consecutive clocks, not counting the nudge itself
+        if (i > first && (! b->nudge || ev[i].sent < nudge_at || ev[i - 1].sent > nudge_end)) {
+            double d = fabs((double) (ev[i].sent - ev[i - 1].sent) - ideal);
+            sum_sq += d * d;
+            if (d > max_jitter) max_jitter = d;
+            intervals++;
+        }
+    }
+    if (clocks < 2 || pre_last <= first) {
+        printf("%-20s no clocks\n", b->name);
+        exit(1);
+    }
+
+    // drift, how far the queue's tempo is from the requested bpm
+    pre_interval = (double) (ev[pre_last].sent - ev[first].sent) / (ev[pre_last].tick - ev[first].tick) * 4;
+    double minutes = (ev[pre_last].sent - ev[first].sent) / 60000000000.0;
+    double drift = ((ev[pre_last].sent - ev[first].sent) - ideal * (ev[pre_last].tick - ev[first].tick) / 4) / 1000.0 / minutes;
+
+    printf("%-20s %7i %5i %10.1f %10.1f %12.1f", b->name, clocks, late, max_jitter / 1000.0, sqrt(sum_sq / intervals) / 1000.0, drift);
+
+    if (b->nudge && post > 0) {
+        // shift is how much earlier the beat arrives than it would have without the nudge
+        double projected = ev[pre_last].sent + pre_interval * (ev[post].tick - ev[pre_last].tick) / 4;
+        double shift = (projected - ev[post].sent) / 1000.0;
+        double expect = b->nudge == BENCH_NUDGE_MULT ? 60000000.0 * 0.1 * b->arg / (b->bpm * b->bpm) : -1000.0 * b->arg;
+        printf(" %10.1f %10.1f %10.1f", expect, shift, shift - expect);
+    }
+    printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+    int i, status, rv = 0;
+
+    printf("%-20s %7s %5s %10s %10s %12s %10s %10s %10s\n", "scenario", "clocks", "late", "jitter max", "jitter rms", "drift us/min", "nudge us", "moved us", "error us");
+    fflush(stdout);
+
+    // libadj holds its state in globals, each scenario gets a fresh process
+    for (i = 0; scenarios[i].name; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(&scenarios[i]);
+            fflush(stdout);
+            _exit(0);
+        }
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            rv = 1;
+        }
+    }
+    return rv;
+}
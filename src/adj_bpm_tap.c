@@ -6,34 +6,145 @@
 #include "adj.h"
 #include "adj_bpm_tap.h"
 
-// timestamp of last recorded beat
-static uint64_t tap_start;
-static int pos = 0;
+/**
+ * Tap tempo shared by all input devices.
+ * Taps should carry the device's event timestamp. Tempo is a least squares fit of tap time against beat
+ * number over a sliding window, so it gets more precise the longer you tap. Mis-taps are rejected and a
+ * missed tap is bridged.
+ */
 
-static uint64_t
-time_micros()
+static uint64_t taps[ADJ_TAP_WINDOW];   // tap times, nanos
+static int beats[ADJ_TAP_WINDOW];       // beat number of each tap, first tap is beat 0
+static int count = 0;                   // taps in the window
+static int rejects = 0;                 // consecutive rejected taps
+static int phase = 0;                   // restart the bar in phase with the taps
+static int armed = 0;                   // the bar restart is set for this run of taps
+
+/**
+ * least squares fit of time = offset + period * beat, relative to the first tap to keep doubles precise
+ */
+static double fit_period(double* offset)
 {
-    struct timespec now;
-    clock_gettime(CDJ_CLOCK, &now);
-    uint64_t m = now.tv_sec * 1000000;
-    return m + (now.tv_nsec / 1000);
+    int i;
+    double n = count, sx = 0, sy = 0, sxx = 0, sxy = 0, x, y;
+
+    for (i = 0; i < count; i++) {
+        x = beats[i];
+        y = (double) (taps[i] - taps[0]);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    double period = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    *offset = (sy - period * sx) / n;
+    return period;
+}
+
+static void start_taps(uint64_t nanos)
+{
+    taps[0] = nanos;
+    beats[0] = 0;
+    count = 1;
+    rejects = 0;
+    armed = 0;
+}
+
+/**
+ * place a tap on the beat grid, returns beats since the last tap or 0 to reject it
+ */
+static int beats_since_last(uint64_t nanos)
+{
+    double period, offset, n;
+    uint64_t since = nanos - taps[count - 1];
+
+    if (count == 1) {
+        // any tempo adj can play
+        return since > 60000000000L / ADJ_MAX_BPM && since < 60000000000L / ADJ_MIN_BPM ? 1 : 0;
+    }
+
+    if (count == 2) {
+        period = (double) (taps[1] - taps[0]) / (beats[1] - beats[0]);
+    } else {
+        period = fit_period(&offset);
+    }
+
+    n = since / period;
+    if ( n < 0.5 || n > 2.5 ) {
+        return 0;
+    }
+    int k = (int) (n + 0.5);
+    if ( n - k > ADJ_TAP_TOLERANCE || k - n > ADJ_TAP_TOLERANCE ) {
+        return 0;
+    }
+    return k;
 }
 
 int adj_bpm_tap(adj_seq_info_t* adj)
 {
-    uint64_t now = time_micros();
-    if (pos++ == 0) {
-        tap_start = now;
-    } else if (pos == 4) {
-        adj_set_tempo(adj, adj_micros_to_bpm( (now - tap_start) / 3));
-        pos = 0;
-        return 4;
-    }
-    return 0;
+    return adj_bpm_tap_at(adj, adj_time_nanos());
+}
+
+int adj_bpm_tap_at(adj_seq_info_t* adj, uint64_t nanos)
+{
+    int i, k;
+    double period, offset;
+
+    if (count == 0 || nanos <= taps[count - 1] || nanos - taps[count - 1] > ADJ_TAP_TIMEOUT) {
+        start_taps(nanos);
+        return 0;
+    }
+
+    if ( (k = beats_since_last(nanos)) == 0 ) {
+        // a run of rejects means the tempo changed, start again from here
+        if (++rejects == ADJ_TAP_REJECTS) {
+            start_taps(nanos);
+        }
+        return 0;
+    }
+    rejects = 0;
+
+    if (count == ADJ_TAP_WINDOW) {
+        for (i = 1; i < ADJ_TAP_WINDOW; i++) {
+            taps[i - 1] = taps[i];
+            beats[i - 1] = beats[i];
+        }
+        count--;
+    }
+    taps[count] = nanos;
+    beats[count] = beats[count - 1] + k;
+    count++;
+
+    if (count < ADJ_TAP_MIN) {
+        return 0;
+    }
+
+    period = fit_period(&offset);
+    float bpm = 60000000000.0 / period;
+    if (bpm < ADJ_MIN_BPM || bpm > ADJ_MAX_BPM) {
+        return 0;
+    }
+    adj_set_tempo(adj, bpm);
+
+    if (phase && ! armed) {
+        // the first tap is a downbeat, the bar restarts on the next downbeat of the fitted grid after the last tap.
+        // Once per run of taps, tapping on must not restart every bar.
+        armed = 1;
+        int bar = (beats[count - 1] / ADJ_BEATS_PER_BAR + 1) * ADJ_BEATS_PER_BAR;
+        adj_restart_at(adj, taps[0] + (uint64_t) (offset + period * bar));
+    }
+
+    return count;
 }
 
 void adj_bpm_tap_reset()
 {
-    pos = 0;
+    count = 0;
+    rejects = 0;
+    armed = 0;
 }
 
+void adj_bpm_tap_phase(int on)
+{
+    phase = on;
+}
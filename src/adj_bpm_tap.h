@@ -2,11 +2,28 @@
 #ifndef _ADJ_BPM_TAP_INCLUDED_
 #define _ADJ_BPM_TAP_INCLUDED_
 
+#define ADJ_TAP_WINDOW      16            // taps in the least squares fit
+#define ADJ_TAP_MIN         4             // taps before tempo is set
+#define ADJ_TAP_TIMEOUT     2000000000L   // nanos, a longer gap starts a new sequence
+#define ADJ_TAP_TOLERANCE   0.2           // fraction of a beat a tap may be off the fit
+#define ADJ_TAP_REJECTS     3             // consecutive mis-taps that start a new sequence
+
 /**
- * The forth time you call this function bpm is set and it returns 4
+ * Tap tempo, from the forth tap on bpm is set each tap and it returns the number of taps used, otherwise 0
  */
 int adj_bpm_tap(adj_seq_info_t* adj);
+
+/**
+ * As adj_bpm_tap() but the tap happened at nanos, e.g. the timestamp of a midi event
+ */
+int adj_bpm_tap_at(adj_seq_info_t* adj, uint64_t nanos);
+
 void adj_bpm_tap_reset();
 
+/**
+ * when on, once tapping stops the bar restarts in phase with the taps
+ */
+void adj_bpm_tap_phase(int on);
+
 
-#endif // _ADJ_BPM_TAP_INCLUDED_
\ No newline at end of file
+#endif // _ADJ_BPM_TAP_INCLUDED_
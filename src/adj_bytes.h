@@ -0,0 +1,44 @@
+#ifndef _ADJ_BYTES_INCLUDED_
+#define _ADJ_BYTES_INCLUDED_
+
+#include <stdint.h>
+
+/**
+ * Big endian (network order) fields of wire formats, AppleMIDI, Link, OSC and ProLink,
+ * read and written a byte at a time so the buffer need not be aligned.
+ */
+
+static inline void put16(uint8_t* p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void put32(uint8_t* p, uint32_t v)
+{
+    put16(p, v >> 16);
+    put16(p + 2, v);
+}
+
+static inline void put64(uint8_t* p, uint64_t v)
+{
+    put32(p, v >> 32);
+    put32(p + 4, v);
+}
+
+static inline uint16_t get16(const uint8_t* p)
+{
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static inline uint32_t get32(const uint8_t* p)
+{
+    return (uint32_t) get16(p) << 16 | get16(p + 2);
+}
+
+static inline uint64_t get64(const uint8_t* p)
+{
+    return (uint64_t) get32(p) << 32 | get32(p + 4);
+}
+
+#endif // _ADJ_BYTES_INCLUDED_
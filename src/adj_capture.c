@@ -0,0 +1,184 @@
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "adj_bytes.h"
+#include "adj_capture.h"
+#include "adj_reactor.h"
+
+/**
+ * Records go through a stdio buffer on the reactor thread, about 20 packets a second per deck, so writes
+ * to disk are rare.  The file is flushed on exit, a crash loses the last buffer.
+ */
+
+static const int capture_ports[] = { ADJ_CAPTURE_DISCOVERY, ADJ_CAPTURE_BEAT, ADJ_CAPTURE_STATUS };
+
+static int capture_fds[3] = { -1, -1, -1 };
+static FILE* capture_file = NULL;
+static uint64_t _Atomic capture_count = ATOMIC_VAR_INIT(0);
+
+//SNIP_capture_parse
+
+static const uint8_t prolink_header[10] = { 'Q', 's', 'p', 't', '1', 'W', 'm', 'J', 'O', 'L' };
+
+/**
+ * track bpm * 100 and pitch, 0x00100000 is 0%
+ */
+static float pitched_bpm(const uint8_t* bpm, const uint8_t* pitch)
+{
+    return get16(bpm) / 100.0 * get32(pitch) / 0x00100000;
+}
+
+int adj_capture_parse(const uint8_t* buf, int len, adj_capture_packet_t* pkt)
+{
+    memset(pkt, 0, sizeof(adj_capture_packet_t));
+    if (len < 0x25 || memcmp(buf, prolink_header, sizeof(prolink_header)) != 0) return ADJ_ERR;
+
+    pkt->type = buf[0x0a];
+    switch (pkt->type) {
+        case ADJ_CAPTURE_KEEPALIVE:
+            pkt->player_id = buf[0x24];
+            return ADJ_OK;
+        case ADJ_CAPTURE_CDJ_BEAT:
+            if (len < 0x60) return ADJ_ERR;
+            pkt->player_id = buf[0x21];
+            pkt->bar_pos = buf[0x5c];
+            pkt->bpm = pitched_bpm(buf + 0x5a, buf + 0x54);
+            return ADJ_OK;
+        case ADJ_CAPTURE_CDJ_STATUS:
+            if (len < 0xa8) return ADJ_ERR;
+            pkt->player_id = buf[0x21];
+            pkt->flags = buf[0x89];
+            pkt->bar_pos = buf[0xa6];
+            pkt->bpm = get16(buf + 0x92) == 0xffff ? 0.0 : pitched_bpm(buf + 0x92, buf + 0x8c);
+            return ADJ_OK;
+    }
+    return ADJ_ERR;
+}
+
+//SNIP_capture_parse
+
+FILE* adj_capture_open(const char* path, adj_capture_header_t* hdr)
+{
+    FILE* f = fopen(path, "r");
+    if ( ! f ) return NULL;
+
+    if ( fread(hdr, sizeof(adj_capture_header_t), 1, f) != 1 || memcmp(hdr->magic, ADJ_CAPTURE_MAGIC, sizeof(hdr->magic)) != 0 ) {
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+int adj_capture_next(FILE* f, adj_capture_record_t* rec, uint8_t* buf)
+{
+    if (fread(rec, sizeof(adj_capture_record_t), 1, f) != 1) return feof(f) ? ADJ_ERR : ADJ_IO;
+    if (rec->len > ADJ_CAPTURE_PACKET || fread(buf, rec->len, 1, f) != 1) return ADJ_IO;
+    return ADJ_OK;
+}
+
+static void read_socket(int fd, uint32_t events, void* data)
+{
+    uint8_t buf[ADJ_CAPTURE_PACKET];
+    adj_capture_record_t rec;
+    struct sockaddr_in from;
+    socklen_t from_len;
+    ssize_t rv;
+
+    while (1) {
+        from_len = sizeof(from);
+        if ( (rv = recvfrom(fd, buf, sizeof(buf), MSG_TRUNC, (struct sockaddr*) &from, &from_len)) < 0 ) break;
+        if (rv > (ssize_t) sizeof(buf) || ! capture_file) continue;
+
+        rec.nanos = adj_time_nanos();
+        rec.addr = from.sin_addr.s_addr;
+        rec.port = (uint16_t) (uintptr_t) data;
+        rec.len = rv;
+        if ( fwrite(&rec, sizeof(rec), 1, capture_file) != 1 || fwrite(buf, rv, 1, capture_file) != 1 ) {
+            fprintf(stderr, "capture write failed (%s)\n", strerror(errno));
+            fclose(capture_file);
+            capture_file = NULL;
+            return;
+        }
+        capture_count++;
+    }
+    if (errno != EAGAIN && errno != EINTR) {
+        fprintf(stderr, "capture read failed (%s)\n", strerror(errno));
+    }
+}
+
+/**
+ * a socket on port that shares it with libvdj's
+ */
+static int open_port(int port)
+{
+    struct sockaddr_in addr;
+    int on = 1;
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if ( bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int adj_capture_init(adj_seq_info_t* adj, const char* path, uint8_t self)
+{
+    adj_capture_header_t hdr;
+    int i;
+
+    if ( ! (capture_file = fopen(path, "w")) ) return ADJ_IO;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, ADJ_CAPTURE_MAGIC, sizeof(hdr.magic));
+    hdr.self = self;
+    hdr.start = adj_time_nanos();
+    if (fwrite(&hdr, sizeof(hdr), 1, capture_file) != 1) {
+        adj_capture_exit();
+        return ADJ_IO;
+    }
+
+    for (i = 0; i < 3; i++) {
+        if ( (capture_fds[i] = open_port(capture_ports[i])) < 0 ||
+             adj_reactor_add(capture_fds[i], read_socket, (void*) (uintptr_t) capture_ports[i]) != ADJ_OK ) {
+            adj_capture_exit();
+            return ADJ_IO;
+        }
+    }
+    return ADJ_OK;
+}
+
+uint64_t adj_capture_count()
+{
+    return capture_count;
+}
+
+void adj_capture_exit()
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (capture_fds[i] < 0) continue;
+        adj_reactor_remove(capture_fds[i]);
+        close(capture_fds[i]);
+        capture_fds[i] = -1;
+    }
+    if (capture_file) {
+        fclose(capture_file);
+        capture_file = NULL;
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef _ADJ_CAPTURE_INCLUDED_
+#define _ADJ_CAPTURE_INCLUDED_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "adj.h"
+
+/**
+ * ProLink capture, records the raw keepalive, beat and status packets the CDJs send, with their arrival times,
+ * so sync trouble at a venue can be replayed at home with adj-replay.
+ *
+ * Recording listens on the ProLink ports beside libvdj, broadcasts are delivered to every socket on a port,
+ * runs on the input reactor.
+ */
+
+//SNIP_capture_constants
+
+#define ADJ_CAPTURE_MAGIC       "ADJCAP01"
+#define ADJ_CAPTURE_PACKET      1536            // bigger datagrams are dropped
+
+#define ADJ_CAPTURE_DISCOVERY   50000
+#define ADJ_CAPTURE_BEAT        50001
+#define ADJ_CAPTURE_STATUS      50002
+
+#define ADJ_CAPTURE_KEEPALIVE   0x06            // packet types
+#define ADJ_CAPTURE_CDJ_STATUS  0x0a
+#define ADJ_CAPTURE_CDJ_BEAT    0x28
+
+#define ADJ_CAPTURE_FLAG_PLAY   0x40            // status flags
+#define ADJ_CAPTURE_FLAG_MASTER 0x20
+#define ADJ_CAPTURE_FLAG_SYNC   0x10
+
+/**
+ * capture file: header, then records each followed by len bytes of packet
+ */
+typedef struct {
+    char        magic[8];
+    uint8_t     self;           // adj's player id when recording started, its own beats are in the capture too
+    uint8_t     pad[7];
+    uint64_t    start;          // adj_time_nanos() when recording started
+} adj_capture_header_t;
+
+typedef struct {
+    uint64_t    nanos;          // arrival, adj_time_nanos()
+    uint32_t    addr;           // sender, network order
+    uint16_t    port;
+    uint16_t    len;
+} adj_capture_record_t;
+
+/**
+ * the fields of a packet that sync uses
+ */
+typedef struct {
+    uint8_t     type;
+    uint8_t     player_id;
+    uint8_t     bar_pos;        // beats
+    uint8_t     flags;          // status
+    float       bpm;            // beats and status, track bpm with the pitch applied
+} adj_capture_packet_t;
+
+//SNIP_capture_constants
+
+/**
+ * record to path, call after adj_reactor_init() and after the vdj has its sockets
+ */
+int adj_capture_init(adj_seq_info_t* adj, const char* path, uint8_t self);
+
+/**
+ * packets recorded
+ */
+uint64_t adj_capture_count();
+
+void adj_capture_exit();
+
+/**
+ * decode a ProLink packet, returns ADJ_ERR for packets sync does not use
+ */
+int adj_capture_parse(const uint8_t* buf, int len, adj_capture_packet_t* pkt);
+
+/**
+ * open a capture for reading, returns NULL if it is missing or not a capture
+ */
+FILE* adj_capture_open(const char* path, adj_capture_header_t* hdr);
+
+/**
+ * read the next record and its packet into buf, ADJ_OK, ADJ_ERR at the end or ADJ_IO for a truncated file
+ */
+int adj_capture_next(FILE* f, adj_capture_record_t* rec, uint8_t* buf);
+
+#endif // _ADJ_CAPTURE_INCLUDED_
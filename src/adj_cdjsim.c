@@ -0,0 +1,477 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "adj_bytes.h"
+
+/**
+ * Simulated CDJs, sends ProLink keepalive, beat and status packets so difflock can be tried without decks.
+ * Decks have programmable tempo, pitch drift, network jitter and packet loss, a pitch change and a master handoff
+ * can be scheduled.  With -w the beats of anything else on the network, e.g. adj, are timed against the master's.
+ *
+ * adj's vdj listens on the ProLink ports itself, so run one of them in a network namespace on a veth pair,
+ * readme.md has the commands.  Packet layouts are the ones documented by the dysentery project, only the fields
+ * libcdj reads are filled in.
+ */
+
+#define CDJSIM_PORT_DISCOVERY   50000
+#define CDJSIM_PORT_BEAT        50001
+#define CDJSIM_PORT_STATUS      50002
+#define CDJSIM_PLAYERS          4
+#define CDJSIM_KEEPALIVE        1500000000L     // nanos
+#define CDJSIM_STATUS           200000000L
+#define CDJSIM_PITCH_NORMAL     0x00100000      // pitch field value for 0%
+
+#define CDJSIM_KEEPALIVE_LEN    0x36
+#define CDJSIM_BEAT_LEN         0x60
+#define CDJSIM_STATUS_LEN       0xd4
+
+#define CDJSIM_FLAG_PLAY        0x40
+#define CDJSIM_FLAG_MASTER      0x20
+#define CDJSIM_FLAG_SYNC        0x10
+#define CDJSIM_FLAG_ONAIR       0x08
+
+static const uint8_t header[10] = { 'Q', 's', 'p', 't', '1', 'W', 'm', 'J', 'O', 'L' };
+
+typedef struct {
+    uint8_t     device;
+    uint64_t    beat_at;        // nanos, the beat that is due
+    uint64_t    send_at;        // when its packet goes out, after jitter
+    uint64_t    last_beat;      // the previous beat
+    uint64_t    status_at;
+    uint32_t    beat;           // beats since start, 1 based
+    uint32_t    counter;        // status packet counter
+    int         lost;           // the due beat's packet is dropped
+} cdjsim_player;
+
+static cdjsim_player players[CDJSIM_PLAYERS];
+static int player_count = 2;
+static float track_bpm = 120.0;
+static float drift = 0.0;           // bpm per minute
+static float pitch = 0.0;           // percent
+static float step = 0.0;            // percent pitch change at step_at
+static int step_at = 0;             // seconds, 0 for none
+static int handoff_at = 0;          // seconds, master moves to player 2, 0 for none
+static int offset = 0;              // millis each player is behind the one before
+static int jitter = 0;              // micros
+static int loss = 0;                // percent of beat packets
+static int seconds = 0;             // run time, 0 for forever
+static uint8_t master = 1;
+static uint64_t start;
+static volatile sig_atomic_t running = 1;
+
+static int out_fd = -1;
+static int watch_fd = -1;
+static struct sockaddr_in dest;
+
+static struct {
+    uint32_t    count;
+    double      sum2;
+    double      max;
+} watched;
+
+static void usage()
+{
+    printf("adj-cdjsim [-i iface] [-a address] [-n players] [-b bpm] [-p pitch] [-d drift] [-j micros] [-l loss]\n");
+    printf("           [-o millis] [-c secs:percent] [-m secs] [-t secs] [-w]\n");
+    printf("options:\n");
+    printf("    -i - interface to broadcast on (default the first that is up and not loopback)\n");
+    printf("    -a - address to send to instead of the interface's broadcast address\n");
+    printf("    -n - number of players, 1 to %i (default 2), player 1 starts as master\n", CDJSIM_PLAYERS);
+    printf("    -b - track tempo (default 120.0)\n");
+    printf("    -p - pitch in percent (default 0.0)\n");
+    printf("    -d - tempo drift in bpm per minute\n");
+    printf("    -j - uniform random network delay in microseconds\n");
+    printf("    -l - percent of beat packets lost\n");
+    printf("    -o - milliseconds each player is behind the one before\n");
+    printf("    -c - change pitch by percent after secs\n");
+    printf("    -m - hand master to player 2 after secs\n");
+    printf("    -t - exit after secs\n");
+    printf("    -w - print when other devices' beats arrive, in millis after the master's beat\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static void signal_exit(int sig)
+{
+    running = 0;
+}
+
+static uint64_t now_nanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * tempo the decks are playing at, t nanos since start
+ */
+static double effective_bpm(uint64_t t)
+{
+    return track_bpm * (1.0 + pitch / 100.0) + drift * (t / 60000000000.0);
+}
+
+static uint32_t pitch_field(uint64_t t)
+{
+    return (uint32_t) (CDJSIM_PITCH_NORMAL * effective_bpm(t) / track_bpm);
+}
+
+static uint8_t bar_pos(uint32_t beat)
+{
+    return (beat - 1) % 4 + 1;
+}
+
+/**
+ * common start of every packet, name is at 0x0b in beat and status packets, 0x0c in keepalives
+ */
+static void packet_header(uint8_t* buf, int len, uint8_t type, int name_at)
+{
+    memset(buf, 0, len);
+    memcpy(buf, header, sizeof(header));
+    buf[0x0a] = type;
+    snprintf((char*) buf + name_at, 20, "CDJ-2000nexus");
+}
+
+static void send_packet(uint8_t* buf, int len, int port)
+{
+    dest.sin_port = htons(port);
+    if (sendto(out_fd, buf, len, 0, (struct sockaddr*) &dest, sizeof(dest)) != len) {
+        perror("sendto");
+    }
+}
+
+static void send_keepalive(cdjsim_player* p)
+{
+    uint8_t buf[CDJSIM_KEEPALIVE_LEN];
+    packet_header(buf, sizeof(buf), 0x06, 0x0c);
+    buf[0x20] = 0x01;
+    buf[0x21] = 0x02;
+    put16(buf + 0x22, sizeof(buf));
+    buf[0x24] = p->device;
+    buf[0x25] = 0x01;
+    buf[0x26] = 0x02;                   // locally administered mac, 02:00:00:00:00:device
+    buf[0x2b] = p->device;
+    memcpy(buf + 0x2c, &dest.sin_addr, 4);
+    buf[0x30] = 0x01;
+    buf[0x34] = 0x01;
+    send_packet(buf, sizeof(buf), CDJSIM_PORT_DISCOVERY);
+}
+
+static void send_beat(cdjsim_player* p)
+{
+    uint8_t buf[CDJSIM_BEAT_LEN];
+    uint64_t t = p->beat_at - start;
+    uint32_t beat_ms = (uint32_t) (60000.0 / effective_bpm(t));
+    uint8_t pos = bar_pos(p->beat);
+
+    packet_header(buf, sizeof(buf), 0x28, 0x0b);
+    buf[0x1f] = 0x01;
+    buf[0x21] = p->device;
+    put16(buf + 0x22, sizeof(buf) - 0x24);
+    put32(buf + 0x24, beat_ms);                         // next beat
+    put32(buf + 0x28, beat_ms * 2);                     // second beat
+    put32(buf + 0x2c, beat_ms * (5 - pos));             // next bar
+    put32(buf + 0x30, beat_ms * 4);                     // fourth beat
+    put32(buf + 0x34, beat_ms * (9 - pos));             // second bar
+    put32(buf + 0x38, beat_ms * 8);                     // eighth beat
+    memset(buf + 0x3c, 0xff, 0x54 - 0x3c);
+    put32(buf + 0x54, pitch_field(t));
+    put16(buf + 0x5a, (uint16_t) (track_bpm * 100.0 + 0.5));
+    buf[0x5c] = pos;
+    buf[0x5f] = p->device;
+    send_packet(buf, sizeof(buf), CDJSIM_PORT_BEAT);
+}
+
+static void send_status(cdjsim_player* p)
+{
+    uint8_t buf[CDJSIM_STATUS_LEN];
+    uint8_t flags = CDJSIM_FLAG_PLAY | CDJSIM_FLAG_ONAIR | 0x84;
+    uint32_t pf = pitch_field(now_nanos() - start);
+
+    if (p->device == master) flags |= CDJSIM_FLAG_MASTER;
+    else flags |= CDJSIM_FLAG_SYNC;
+
+    packet_header(buf, sizeof(buf), 0x0a, 0x0b);
+    buf[0x1f] = 0x01;
+    buf[0x20] = 0x03;
+    buf[0x21] = p->device;
+    put16(buf + 0x22, sizeof(buf) - 0x24);
+    buf[0x24] = p->device;
+    buf[0x26] = 0x01;
+    buf[0x27] = p->device;                              // track loaded from its own usb
+    buf[0x28] = 0x03;
+    buf[0x29] = 0x01;
+    put32(buf + 0x2c, 1);                               // rekordbox id
+    buf[0x7b] = 0x03;                                   // playing
+    buf[0x89] = flags;
+    put32(buf + 0x8c, pf);
+    buf[0x90] = 0x80;
+    put16(buf + 0x92, (uint16_t) (track_bpm * 100.0 + 0.5));
+    put32(buf + 0x98, pf);
+    buf[0x9d] = p->device == master ? 0x01 : 0x00;
+    buf[0x9e] = 0xff;
+    put32(buf + 0xa0, p->beat ? p->beat : 0xffffffff);
+    put16(buf + 0xa4, 0x01ff);                          // no cue ahead
+    buf[0xa6] = p->beat ? bar_pos(p->beat) : 0;
+    put32(buf + 0xc0, pf);
+    put32(buf + 0xc4, pf);
+    put32(buf + 0xc8, p->counter++);
+    buf[0xcc] = 0x0f;
+    send_packet(buf, sizeof(buf), CDJSIM_PORT_STATUS);
+}
+
+/**
+ * pick the next beat's time, jitter and fate
+ */
+static void next_beat(cdjsim_player* p)
+{
+    p->last_beat = p->beat_at;
+    p->beat_at += (uint64_t) (60000000000.0 / effective_bpm(p->beat_at - start));
+    p->send_at = p->beat_at + (jitter ? (uint64_t) (rand() % jitter) * 1000L : 0);
+    p->lost = rand() % 100 < loss;
+    p->beat++;
+}
+
+/**
+ * a beat packet from some other device, time it against the master's nearest beat
+ */
+static void read_watch(uint64_t arrival)
+{
+    uint8_t buf[512];
+    ssize_t len = recv(watch_fd, buf, sizeof(buf), 0);
+    int i;
+
+    if (len < CDJSIM_BEAT_LEN || memcmp(buf, header, sizeof(header)) != 0 || buf[0x0a] != 0x28) return;
+    for (i = 0; i < player_count; i++) {
+        if (buf[0x21] == players[i].device) return;
+    }
+
+    cdjsim_player* m = &players[master - 1];
+    double period = (m->beat_at - m->last_beat) / 1000000.0;
+    double error = ((int64_t) arrival - (int64_t) m->last_beat) / 1000000.0;
+    if (period <= 0.0) return;
+    error = fmod(error, period);
+    if (error > period / 2.0) error -= period;
+
+    watched.count++;
+    watched.sum2 += error * error;
+    if (fabs(error) > watched.max) watched.max = fabs(error);
+    printf("%02i beat %i error %+7.2fms\n", buf[0x21], buf[0x5c], error);
+    fflush(stdout);
+}
+
+/**
+ * broadcast address of iface, or of the first interface that is up and not loopback
+ */
+static int broadcast_addr(char* iface, struct in_addr* addr)
+{
+    struct ifaddrs *ifs, *i;
+    int rv = -1;
+
+    if (getifaddrs(&ifs) != 0) return -1;
+    for (i = ifs; i; i = i->ifa_next) {
+        if ( ! i->ifa_addr || i->ifa_addr->sa_family != AF_INET || ! (i->ifa_flags & IFF_UP) ) continue;
+        if ( ! (i->ifa_flags & IFF_BROADCAST) || ! i->ifa_broadaddr ) continue;
+        if ( iface ? strcmp(iface, i->ifa_name) != 0 : (i->ifa_flags & IFF_LOOPBACK) != 0 ) continue;
+        *addr = ((struct sockaddr_in*) i->ifa_broadaddr)->sin_addr;
+        rv = 0;
+        break;
+    }
+    freeifaddrs(ifs);
+    return rv;
+}
+
+static int watch_socket()
+{
+    struct sockaddr_in addr;
+    int on = 1;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(CDJSIM_PORT_BEAT);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char* argv[])
+{
+    char* iface = NULL;
+    char* address = NULL;
+    int watch = 0;
+    int on = 1;
+    int i, c;
+    uint64_t keepalive_at, now, next;
+
+    while ( ( c = getopt(argc, argv, "i:a:n:b:p:d:j:l:o:c:m:t:wh") ) != EOF) {
+        switch (c) {
+            case 'i':
+                iface = optarg;
+                break;
+            case 'a':
+                address = optarg;
+                break;
+            case 'n':
+                player_count = atoi(optarg);
+                if (player_count < 1 || player_count > CDJSIM_PLAYERS) usage();
+                break;
+            case 'b':
+                track_bpm = strtof(optarg, NULL);
+                if (track_bpm < 20.0 || track_bpm > 300.0) usage();
+                break;
+            case 'p':
+                pitch = strtof(optarg, NULL);
+                break;
+            case 'd':
+                drift = strtof(optarg, NULL);
+                break;
+            case 'j':
+                jitter = atoi(optarg);
+                break;
+            case 'l':
+                loss = atoi(optarg);
+                break;
+            case 'o':
+                offset = atoi(optarg);
+                break;
+            case 'c':
+                if (sscanf(optarg, "%i:%f", &step_at, &step) != 2 || step_at <= 0) usage();
+                break;
+            case 'm':
+                handoff_at = atoi(optarg);
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            case 'w':
+                watch = 1;
+                break;
+            case 'h':
+                usage();
+                break;
+        }
+    }
+    if (handoff_at && player_count < 2) {
+        fprintf(stderr, "a master handoff needs two players\n");
+        return 1;
+    }
+
+    memset(&dest, 0, sizeof(dest));
+    dest.sin_family = AF_INET;
+    if (address) {
+        if (inet_pton(AF_INET, address, &dest.sin_addr) != 1) {
+            fprintf(stderr, "bad address %s\n", address);
+            return 1;
+        }
+    } else if (broadcast_addr(iface, &dest.sin_addr) != 0) {
+        fprintf(stderr, "no broadcast address for %s\n", iface ? iface : "any interface");
+        return 1;
+    }
+
+    if ( (out_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ) {
+        perror("socket");
+        return 1;
+    }
+    setsockopt(out_fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+    if (watch && (watch_fd = watch_socket()) < 0) {
+        perror("watch port 50001");
+        return 1;
+    }
+
+    signal(SIGINT, signal_exit);
+    signal(SIGTERM, signal_exit);
+    srand(1);
+
+    // decks start on the next second, each offset millis behind the one before
+    start = now_nanos();
+    keepalive_at = start;
+    for (i = 0; i < player_count; i++) {
+        cdjsim_player* p = &players[i];
+        p->device = i + 1;
+        p->beat_at = start + 1000000000L + (uint64_t) i * offset * 1000000L;
+        p->last_beat = p->beat_at - (uint64_t) (60000000000.0 / effective_bpm(0));
+        p->send_at = p->beat_at;
+        p->beat = 1;
+        p->status_at = start + i * CDJSIM_STATUS / player_count;
+    }
+
+    while (running) {
+        now = now_nanos();
+        if (seconds && now - start >= (uint64_t) seconds * 1000000000L) break;
+
+        if (step_at && now - start >= (uint64_t) step_at * 1000000000L) {
+            pitch += step;
+            step_at = 0;
+            printf("pitch %+.2f%%, %.2f bpm\n", pitch, effective_bpm(now - start));
+            fflush(stdout);
+        }
+        if (handoff_at && now - start >= (uint64_t) handoff_at * 1000000000L) {
+            master = 2;
+            handoff_at = 0;
+            printf("master 02\n");
+            fflush(stdout);
+        }
+
+        if (now >= keepalive_at) {
+            for (i = 0; i < player_count; i++) send_keepalive(&players[i]);
+            keepalive_at += CDJSIM_KEEPALIVE;
+        }
+        for (i = 0; i < player_count; i++) {
+            cdjsim_player* p = &players[i];
+            if (now >= p->status_at) {
+                send_status(p);
+                p->status_at += CDJSIM_STATUS;
+            }
+            if (now >= p->send_at) {
+                if ( ! p->lost ) send_beat(p);
+                next_beat(p);
+            }
+        }
+
+        // sleep until whatever is due next, reading other devices' beats meanwhile
+        next = keepalive_at;
+        for (i = 0; i < player_count; i++) {
+            if (players[i].status_at < next) next = players[i].status_at;
+            if (players[i].send_at < next) next = players[i].send_at;
+        }
+        now = now_nanos();
+        if (next <= now) continue;
+        if (watch_fd >= 0) {
+            struct pollfd pfd = { .fd = watch_fd, .events = POLLIN };
+            int timeout = (int) ((next - now) / 1000000L);
+            if (poll(&pfd, 1, timeout) > 0) {
+                read_watch(now_nanos());
+                continue;
+            }
+            if (now_nanos() >= next) continue;
+        }
+        struct timespec ts = { .tv_sec = next / 1000000000L, .tv_nsec = next % 1000000000L };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+
+    if (watched.count) {
+        printf("beats=%u rms=%.2fms max=%.2fms\n", watched.count, sqrt(watched.sum2 / watched.count), watched.max);
+    }
+    close(out_fd);
+    if (watch_fd >= 0) close(watch_fd);
+    return 0;
+}
@@ -76,12 +76,61 @@ set(adj_conf* conf, char* name, char* value)
     else if (strcmp("vdj_offset", name) == 0) {
         conf->vdj_offset = atoi(value);
     }
+    else if (strcmp("tap_phase", name) == 0) {
+        conf->tap_phase = ltrim(value)[0] == 't';
+    }
+    else if (strcmp("rt_prio", name) == 0) {
+        conf->rt_prio = atoi(value);
+    }
+    else if (strcmp("rt_cpu", name) == 0) {
+        conf->rt_cpu = atoi(value);
+    }
+    else if (strcmp("rt_command_cpu", name) == 0) {
+        conf->rt_command_cpu = atoi(value);
+    }
+    else if (strcmp("rt_mlock", name) == 0) {
+        conf->rt_mlock = ltrim(value)[0] == 't';
+    }
+    else if (strcmp("trace_file", name) == 0) {
+        conf->trace_file = copy(ltrim(value));
+    }
+    else if (strcmp("rawmidi", name) == 0) {
+        conf->rawmidi = copy(ltrim(value));
+    }
+    else if (strcmp("measure_seq", name) == 0) {
+        conf->measure_seq = ltrim(value)[0] == 't';
+    }
+    else if (strcmp("rtpmidi_port", name) == 0) {
+        conf->rtpmidi_port = atoi(value);
+    }
+    else if (strcmp("rtpmidi_peer", name) == 0) {
+        conf->rtpmidi_peer = copy(ltrim(value));
+    }
+    else if (strcmp("link_iface", name) == 0) {
+        conf->link_iface = copy(ltrim(value));
+    }
+    else if (strcmp("link_follow", name) == 0) {
+        conf->link_follow = ltrim(value)[0] == 't';
+    }
+    else if (strcmp("osc_port", name) == 0) {
+        conf->osc_port = atoi(value);
+    }
+    else if (strcmp("capture_file", name) == 0) {
+        conf->capture_file = copy(ltrim(value));
+    }
+    else if (strcmp("audio_in", name) == 0) {
+        conf->audio_in = copy(ltrim(value));
+    }
+    else if (strcmp("track_index", name) == 0) {
+        conf->track_index = copy(ltrim(value));
+    }
 }
 
 static adj_conf*
 adj_parse(int in)
 {
-    int rc;
+    struct stat st;
+    ssize_t rc, len = 0, pos = 0;
     char  c;
     char line[256];
     char* value = NULL;
@@ -89,22 +138,42 @@ adj_parse(int in)
     int is_name = 1;
     int is_comment = 0;
 
+    // one read() for the whole file, rather than one per byte
+    if ( fstat(in, &st) == -1 ) {
+        close(in);
+        return NULL;
+    }
+    char* buf = malloc(st.st_size + 1);
+    if (buf == NULL) {
+        close(in);
+        return NULL;
+    }
+    while ( len < st.st_size && (rc = read(in, buf + len, st.st_size - len)) > 0 ) {
+        len += rc;
+    }
+    close(in);
+    if ( len < st.st_size ) {
+        fprintf(stderr, "read error\n");
+        free(buf);
+        return NULL;
+    }
+
     adj_conf* conf = (adj_conf*) calloc(1, sizeof(adj_conf));
-    if (conf == NULL) return NULL;
+    if (conf == NULL) {
+        free(buf);
+        return NULL;
+    }
+    conf->rt_cpu = -1;
+    conf->rt_command_cpu = -1;
 
     for (line_pos = 0 ; line_pos < 256;) {
 
-        rc = read(in, &c, 1);
-
-        if ( rc == 0 ) {
+        if ( pos == len ) {
             // EoF
+            free(buf);
             return conf;
         }
-        else if ( rc < 0 ) {
-            fprintf(stderr, "read error\n");
-            free(conf);
-            return NULL;
-        }
+        c = buf[pos++];
 
         if (line_pos == 0 && c == '#') {
             is_comment = 1;
@@ -136,6 +205,8 @@ adj_parse(int in)
         }
 
     }
+    free(buf);
+    free(conf);
     return NULL;
 }
 
@@ -17,6 +17,22 @@ struct adj_conf_s {
     char*       vdj_iface;
     uint8_t     vdj_player;
     int32_t     vdj_offset;
+    uint8_t     tap_phase;
+    int32_t     rt_prio;
+    int32_t     rt_cpu;
+    int32_t     rt_command_cpu;
+    uint8_t     rt_mlock;
+    char*       trace_file;
+    char*       rawmidi;
+    uint8_t     measure_seq;
+    int32_t     rtpmidi_port;
+    char*       rtpmidi_peer;
+    char*       link_iface;
+    uint8_t     link_follow;
+    int32_t     osc_port;
+    char*       capture_file;
+    char*       audio_in;
+    char*       track_index;
 };
 
 adj_conf* adj_conf_init();
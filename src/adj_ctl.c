@@ -0,0 +1,325 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE   // accept4()
+#endif
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "adj_ctl.h"
+#include "adj_reactor.h"
+#include "adj_bpm_tap.h"
+#include "adj_vdj.h"
+#include "adj_store.h"
+
+/**
+ * Control socket, a UNIX stream socket on the reactor. Each client has a line buffer,
+ * complete lines are parsed and run at once, there is no queue between a client and the clock.
+ */
+
+typedef struct {
+    int fd;                     // -1 for a free slot
+    size_t len;
+    char line[ADJ_CTL_LINE];
+} ctl_client;
+
+static adj_seq_info_t* ctl_adj = NULL;
+static int ctl_fd = -1;
+static char ctl_path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+static ctl_client clients[ADJ_CTL_CLIENTS];
+
+//SNIP_ctl_parse
+
+typedef struct {
+    char* name;
+    int   op;
+    int   has_arg;
+} ctl_command;
+
+static ctl_command commands[] = {
+    {"start",        ADJ_CTL_START,         0},
+    {"stop",         ADJ_CTL_STOP,          0},
+    {"toggle",       ADJ_CTL_TOGGLE,        0},
+    {"restart",      ADJ_CTL_RESTART,       0},
+    {"nudge",        ADJ_CTL_NUDGE,         1},
+    {"nudge_ms",     ADJ_CTL_NUDGE_MS,      1},
+    {"bpm",          ADJ_CTL_BPM,           1},
+    {"tempo",        ADJ_CTL_TEMPO,         1},
+    {"tap",          ADJ_CTL_TAP,           0},
+    {"lock",         ADJ_CTL_LOCK,          1},
+    {"unlock",       ADJ_CTL_UNLOCK,        0},
+    {"status",       ADJ_CTL_STATUS,        0},
+    {"quit",         ADJ_CTL_QUIT,          0},
+    {"tap_reset",    ADJ_CTL_TAP_RESET,     0},
+    {"save",         ADJ_CTL_SAVE,          0},
+    {"copy_bpm",     ADJ_CTL_COPY_BPM,      1},
+    {"trigger",      ADJ_CTL_TRIGGER,       1},
+    {"track_start",  ADJ_CTL_TRACK_START,   1},
+    {"lock_default", ADJ_CTL_LOCK_DEFAULT,  1},
+    {"lock_nudge",   ADJ_CTL_LOCK_NUDGE,    1},
+    {"lock_master",  ADJ_CTL_LOCK_MASTER,   1},
+    {"master",       ADJ_CTL_MASTER,        0},
+    {"follow",       ADJ_CTL_FOLLOW,        1},
+    {NULL, 0, 0}
+};
+
+/**
+ * parse one command line e.g. "nudge -10" or "bpm 124.5"
+ * @return the op, or 0 if the command is unknown or is missing its argument
+ */
+static int parse_command(const char* line, float* arg)
+{
+    char name[32];
+    int i, n;
+
+    *arg = 0.0;
+    n = sscanf(line, "%31s %f", name, arg);
+    if (n < 1) return 0;
+
+    for (i = 0; commands[i].name; i++) {
+        if (strcmp(commands[i].name, name) == 0) {
+            return n > 1 || ! commands[i].has_arg ? commands[i].op : 0;
+        }
+    }
+    return 0;
+}
+
+//SNIP_ctl_parse
+
+static void reply(int fd, const char* msg)
+{
+    // a client that does not read its replies loses them, the reactor never waits on a client
+    if ( send(fd, msg, strlen(msg), MSG_NOSIGNAL | MSG_DONTWAIT) < 0 ) {
+        fprintf(stderr, "ctl reply dropped (%s)\n", strerror(errno));
+    }
+}
+
+/**
+ * commands for the Pioneer decks, the same calls the keyboard and controller modules make
+ */
+static void run_vdj_command(adj_seq_info_t* adj, int op, float arg)
+{
+    switch (op) {
+        case ADJ_CTL_LOCK:
+            adj_vdj_difflock(adj, (uint8_t) arg, 0);
+            break;
+        case ADJ_CTL_UNLOCK:
+            adj_vdj_difflock_arff(adj);
+            break;
+        case ADJ_CTL_COPY_BPM:
+            adj_vdj_copy_bpm(adj, (uint8_t) arg);
+            break;
+        case ADJ_CTL_TRIGGER:
+            adj_vdj_trigger_from_player(adj, (uint8_t) arg);
+            break;
+        case ADJ_CTL_TRACK_START:
+            adj_vdj_track_start(adj, (uint8_t) arg);
+            break;
+        case ADJ_CTL_LOCK_DEFAULT:
+            adj_vdj_difflock(adj, (uint8_t) arg, 1);
+            break;
+        case ADJ_CTL_LOCK_NUDGE:
+            adj_vdj_difflock_nudge(adj, (int32_t) arg);
+            break;
+        case ADJ_CTL_LOCK_MASTER:
+            adj_vdj_difflock_master(adj, arg != 0.0);
+            break;
+        case ADJ_CTL_MASTER:
+            adj_vdj_become_master(adj);
+            break;
+        case ADJ_CTL_FOLLOW:
+            adj_vdj_follow_tempo(adj, arg != 0.0);
+            break;
+    }
+}
+
+static void run_command(adj_seq_info_t* adj, int fd, char* line, uint64_t nanos)
+{
+    char buf[ADJ_CTL_LINE];
+    float arg;
+    int op = parse_command(line, &arg);
+
+    switch (op) {
+        case ADJ_CTL_START:
+            adj_start(adj);
+            break;
+        case ADJ_CTL_STOP:
+            adj_stop(adj);
+            break;
+        case ADJ_CTL_TOGGLE:
+            adj_toggle(adj);
+            break;
+        case ADJ_CTL_RESTART:
+            adj_quantized_restart(adj);
+            break;
+        case ADJ_CTL_NUDGE:
+            adj_nudge_at(adj, (int) arg, nanos);
+            break;
+        case ADJ_CTL_NUDGE_MS:
+            adj_nudge_millis(adj, (int) arg);
+            break;
+        case ADJ_CTL_BPM:
+            if (arg < ADJ_MIN_BPM || arg > ADJ_MAX_BPM) {
+                reply(fd, "error bpm out of range\n");
+                return;
+            }
+            adj_set_tempo_at(adj, arg, nanos);
+            break;
+        case ADJ_CTL_TEMPO:
+            adj_adjust_tempo_at(adj, arg, nanos);
+            break;
+        case ADJ_CTL_TAP:
+            adj_bpm_tap_at(adj, nanos);
+            break;
+        case ADJ_CTL_TAP_RESET:
+            adj_bpm_tap_reset();
+            break;
+        case ADJ_CTL_SAVE:
+            adj_save_bpm(adj);
+            break;
+        case ADJ_CTL_LOCK:
+        case ADJ_CTL_UNLOCK:
+        case ADJ_CTL_COPY_BPM:
+        case ADJ_CTL_TRIGGER:
+        case ADJ_CTL_TRACK_START:
+        case ADJ_CTL_LOCK_DEFAULT:
+        case ADJ_CTL_LOCK_NUDGE:
+        case ADJ_CTL_LOCK_MASTER:
+        case ADJ_CTL_MASTER:
+        case ADJ_CTL_FOLLOW:
+            if ( ! adj->vdj ) {
+                reply(fd, "error no vdj\n");
+                return;
+            }
+            run_vdj_command(adj, op, arg);
+            break;
+        case ADJ_CTL_STATUS:
+            snprintf(buf, sizeof(buf), "bpm=%.2f state=%s vdj=%i\n", adj->bpm, adj_is_paused() ? "stopped" : "running", adj->vdj ? 1 : 0);
+            reply(fd, buf);
+            return;
+        case ADJ_CTL_QUIT:
+            reply(fd, "ok\n");
+            adj_exit(adj);
+            return;
+        default:
+            reply(fd, "error unknown command\n");
+            return;
+    }
+    reply(fd, "ok\n");
+}
+
+static void close_client(ctl_client* c)
+{
+    adj_reactor_remove(c->fd);
+    close(c->fd);
+    c->fd = -1;
+}
+
+static void read_client(int fd, uint32_t events, void* data)
+{
+    ctl_client* c = data;
+    uint64_t nanos = adj_time_nanos();
+    char* nl;
+    ssize_t rv;
+
+    while ( (rv = read(fd, c->line + c->len, sizeof(c->line) - 1 - c->len)) > 0 ) {
+        c->len += rv;
+        c->line[c->len] = 0;
+        while ( (nl = strchr(c->line, '\n')) ) {
+            *nl = 0;
+            if (nl > c->line && nl[-1] == '\r') nl[-1] = 0;
+            run_command(ctl_adj, fd, c->line, nanos);
+            if (c->fd < 0) return; // quit closed everything
+            c->len -= nl + 1 - c->line;
+            memmove(c->line, nl + 1, c->len + 1);
+        }
+        if (c->len == sizeof(c->line) - 1) {
+            reply(fd, "error line too long\n");
+            close_client(c);
+            return;
+        }
+    }
+    if (rv == 0 || (errno != EAGAIN && errno != EINTR)) {
+        close_client(c);
+    }
+}
+
+static void accept_client(int fd, uint32_t events, void* data)
+{
+    int i, cfd;
+
+    while ( (cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0 ) {
+        for (i = 0; i < ADJ_CTL_CLIENTS && clients[i].fd >= 0; i++);
+        if (i == ADJ_CTL_CLIENTS || adj_reactor_add(cfd, read_client, &clients[i]) != ADJ_OK) {
+            reply(cfd, "error too many clients\n");
+            close(cfd);
+            continue;
+        }
+        clients[i].fd = cfd;
+        clients[i].len = 0;
+    }
+}
+
+int adj_ctl_init(adj_seq_info_t* adj)
+{
+    struct sockaddr_un addr;
+    char* dir = getenv(ADJ_CTL_DIR_ENV);
+    int i, fd, in_use = 0;
+
+    for (i = 0; i < ADJ_CTL_CLIENTS; i++) clients[i].fd = -1;
+    ctl_adj = adj;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if ( snprintf(addr.sun_path, sizeof(addr.sun_path), ADJ_CTL_PATH, dir ? dir : ADJ_CTL_DIR, adj->seq_name) >= sizeof(addr.sun_path) ) {
+        return ADJ_ERR;
+    }
+
+    // a socket left by a crash is stale, one that answers belongs to a running adj with the same name
+    if ( (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ) {
+        return ADJ_IO;
+    }
+    if ( connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0 || errno == EAGAIN ) {
+        in_use = 1;
+    }
+    close(fd);
+    if (in_use) {
+        return ADJ_ERR;
+    }
+
+    if ( (ctl_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ) {
+        return ADJ_IO;
+    }
+    unlink(addr.sun_path);
+    if ( bind(ctl_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(ctl_fd, ADJ_CTL_CLIENTS) != 0 ) {
+        close(ctl_fd);
+        ctl_fd = -1;
+        return ADJ_IO;
+    }
+    snprintf(ctl_path, sizeof(ctl_path), "%s", addr.sun_path);
+
+    return adj_reactor_add(ctl_fd, accept_client, adj);
+}
+
+char* adj_ctl_path()
+{
+    return ctl_path;
+}
+
+void adj_ctl_exit()
+{
+    int i;
+    if (ctl_fd < 0) return;
+
+    for (i = 0; i < ADJ_CTL_CLIENTS; i++) {
+        if (clients[i].fd >= 0) close_client(&clients[i]);
+    }
+    adj_reactor_remove(ctl_fd);
+    close(ctl_fd);
+    ctl_fd = -1;
+    unlink(ctl_path);
+}
@@ -0,0 +1,66 @@
+#ifndef _ADJ_CTL_INCLUDED_
+#define _ADJ_CTL_INCLUDED_
+
+#include "adj.h"
+
+/**
+ * Control socket, clients (adjc, a UI, a controller process) send one command per line and get one reply line.
+ * A client can come and go without touching the clock, commands are handled on the input reactor.
+ *
+ * Commands:
+ *   start | stop | toggle | restart | tap | tap_reset | save | unlock | master | status | quit
+ *   nudge <multiplier> | nudge_ms <millis> | bpm <bpm> | tempo <+/- bpm> | lock <player>
+ *   copy_bpm <player> | trigger <player> | track_start <player> | lock_default <player>
+ *   lock_nudge <+/- amount> | lock_master <0|1> | follow <0|1>
+ * Replies:
+ *   ok | error <reason> | bpm=<bpm> state=<running|stopped> vdj=<0|1>
+ */
+
+//SNIP_ctl_constants
+
+#define ADJ_CTL_START          1
+#define ADJ_CTL_STOP           2
+#define ADJ_CTL_TOGGLE         3
+#define ADJ_CTL_RESTART        4
+#define ADJ_CTL_NUDGE          5
+#define ADJ_CTL_NUDGE_MS       6
+#define ADJ_CTL_BPM            7
+#define ADJ_CTL_TEMPO          8
+#define ADJ_CTL_TAP            9
+#define ADJ_CTL_LOCK          10
+#define ADJ_CTL_UNLOCK        11
+#define ADJ_CTL_STATUS        12
+#define ADJ_CTL_QUIT          13
+#define ADJ_CTL_TAP_RESET     14
+#define ADJ_CTL_SAVE          15
+#define ADJ_CTL_COPY_BPM      16
+#define ADJ_CTL_TRIGGER       17
+#define ADJ_CTL_TRACK_START   18
+#define ADJ_CTL_LOCK_DEFAULT  19
+#define ADJ_CTL_LOCK_NUDGE    20
+#define ADJ_CTL_LOCK_MASTER   21
+#define ADJ_CTL_MASTER        22
+#define ADJ_CTL_FOLLOW        23
+
+#define ADJ_CTL_LINE          256
+#define ADJ_CTL_CLIENTS       8
+#define ADJ_CTL_DIR_ENV       "XDG_RUNTIME_DIR"   // socket directory, /tmp if unset
+#define ADJ_CTL_DIR           "/tmp"
+#define ADJ_CTL_PATH          "%s/%s.sock"        // directory, sequencer name
+
+//SNIP_ctl_constants
+
+/**
+ * listen on the control socket, call after adj_reactor_init().
+ * Returns ADJ_ERR if another adj is answering on the socket, its path is left alone.
+ */
+int adj_ctl_init(adj_seq_info_t* adj);
+
+/**
+ * path the control socket is listening on, for display
+ */
+char* adj_ctl_path();
+
+void adj_ctl_exit();
+
+#endif // _ADJ_CTL_INCLUDED_
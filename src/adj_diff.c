@@ -62,7 +62,7 @@ adj_diff_avg(uint8_t player)
     int32_t avg = 0;
 
     if (diff_count[player] >= AVG_SIZE) {
-        for (i = 0; i < AVG_SIZE + 1; i++) {
+        for (i = 0; i < AVG_SIZE; i++) {
             avg += diff_set[player * AVG_SIZE + i];
         }
         return avg / AVG_SIZE;
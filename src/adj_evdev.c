@@ -0,0 +1,378 @@
+/*
+ * # evdev game pad input
+ *
+ * Reads /dev/input/event* rather than the legacy /dev/input/js* api.
+ * The kernel timestamps every event, the clock is switched to CLOCK_MONOTONIC so the
+ * times are comparable with adj_time_nanos() and tap tempo and nudges use the time
+ * the button was pressed, not when this process got round to reading it.
+ *
+ * Buttons and axes are mapped by /etc/adj/pads/<vendor:product>.adjpad e.g.
+ *
+ * # op         type  code   value
+ * toggle       key   310    1
+ * nudge:10     abs   0      >240
+ * ^exit        key   308    1
+ */
+
+#include <stdatomic.h>
+#include <dirent.h>
+#include <linux/input.h>
+
+#include "adj.h"
+#include "adj_evdev.h"
+#include "adj_vdj.h"
+#include "adj_store.h"
+#include "adj_bpm_tap.h"
+#include "adj_reactor.h"
+
+static unsigned _Atomic adj_evdev_running = ATOMIC_VAR_INIT(0);
+
+static int ev_fd = -1;
+static int has_vdj = 0;
+static int ctrl_down = 0;
+static uint8_t player_id = 1;
+
+//SNIP_evdev_parser
+
+/**
+ * parse a line in an adjpad file
+ */
+static int parse_pad_line(char* line, int line_no, adj_evdev_map* map)
+{
+    adj_evdev_mapping m;
+    char* endptr;
+    char* colon;
+
+    if (line[0] == '#') return ADJ_OK;
+    if (strlen(line) == 0) return ADJ_OK;
+    if (strcmp("\n", line) == 0) return ADJ_OK;
+
+    char* name = strtok(line, " \t");
+    char* type = strtok(NULL, " \t");
+    char* code = strtok(NULL, " \t");
+    char* value = strtok(NULL, " \t\n");
+
+    if (!value) {
+        fprintf(stderr, "syntax error, expect 4 entries line:%i\n", line_no);
+        return ADJ_SYNTAX;
+    }
+    if (map->count == ADJ_EVDEV_MAX_MAPPINGS) {
+        fprintf(stderr, "syntax error, too many mappings line:%i\n", line_no);
+        return ADJ_SYNTAX;
+    }
+
+    memset(&m, 0, sizeof(m));
+    if (name[0] == '^') {
+        m.ctrl = 1;
+        name++;
+    }
+    if ( (colon = index(name, ':')) ) {
+        *colon++ = '\0';
+        m.arg = strtof(colon, &endptr);
+        if (*endptr != '\0') {
+            fprintf(stderr, "syntax error line:%i NaN arg: '%s'\n", line_no, colon);
+            return ADJ_SYNTAX;
+        }
+    }
+
+         if ( strcmp("start", name) == 0 )         m.op = ADJ_EVDEV_START;
+    else if ( strcmp("stop", name) == 0 )          m.op = ADJ_EVDEV_STOP;
+    else if ( strcmp("toggle", name) == 0 )        m.op = ADJ_EVDEV_TOGGLE;
+    else if ( strcmp("q_restart", name) == 0 )     m.op = ADJ_EVDEV_Q_RESTART;
+    else if ( strcmp("nudge", name) == 0 )         m.op = ADJ_EVDEV_NUDGE;
+    else if ( strcmp("tempo", name) == 0 )         m.op = ADJ_EVDEV_TEMPO;
+    else if ( strcmp("tap", name) == 0 )           m.op = ADJ_EVDEV_TAP;
+    else if ( strcmp("tap_reset", name) == 0 )     m.op = ADJ_EVDEV_TAP_RESET;
+    else if ( strcmp("ctrl", name) == 0 )          m.op = ADJ_EVDEV_CTRL;
+    else if ( strcmp("exit", name) == 0 )          m.op = ADJ_EVDEV_EXIT;
+    else if ( strcmp("save_bpm", name) == 0 )      m.op = ADJ_EVDEV_SAVE_BPM;
+    else if ( strcmp("copy_bpm", name) == 0 )      m.op = ADJ_EVDEV_COPY_BPM;
+    else if ( strcmp("trigger", name) == 0 )       m.op = ADJ_EVDEV_TRIGGER;
+    else if ( strcmp("difflock", name) == 0 )      m.op = ADJ_EVDEV_DIFFLOCK;
+    else if ( strcmp("difflock_arff", name) == 0 ) m.op = ADJ_EVDEV_DIFFLOCK_ARFF;
+    else {
+        fprintf(stderr, "syntax error line:%i invalid name: '%s'\n", line_no, name);
+        return ADJ_SYNTAX;
+    }
+
+         if ( strcmp("key", type) == 0 ) m.type = EV_KEY;
+    else if ( strcmp("abs", type) == 0 ) m.type = EV_ABS;
+    else {
+        fprintf(stderr, "syntax error line:%i invalid type: '%s'\n", line_no, type);
+        return ADJ_SYNTAX;
+    }
+
+    long c = strtol(code, &endptr, 10);
+    if (*endptr != '\0' || c < 0 || c > KEY_MAX) {
+        fprintf(stderr, "syntax error line:%i invalid code: '%s'\n", line_no, code);
+        return ADJ_SYNTAX;
+    }
+    m.code = (unsigned short) c;
+
+    if (value[0] == '*') {
+        m.match = ADJ_EVDEV_MATCH_ANY;
+    }
+    else {
+        m.match = ADJ_EVDEV_MATCH_EQ;
+        if (value[0] == '>') {
+            m.match = ADJ_EVDEV_MATCH_GT;
+            value++;
+        } else if (value[0] == '<') {
+            m.match = ADJ_EVDEV_MATCH_LT;
+            value++;
+        }
+        m.value = (int) strtol(value, &endptr, 10);
+        if (*endptr != '\0' || *value == '\0') {
+            fprintf(stderr, "syntax error line:%i NaN value: '%s'\n", line_no, value);
+            return ADJ_SYNTAX;
+        }
+    }
+
+    map->mapping[map->count++] = m;
+    return ADJ_OK;
+}
+
+static int value_matches(adj_evdev_mapping* m, int value)
+{
+    switch (m->match) {
+        case ADJ_EVDEV_MATCH_ANY: return 1;
+        case ADJ_EVDEV_MATCH_EQ:  return value == m->value;
+        case ADJ_EVDEV_MATCH_GT:  return value > m->value;
+        case ADJ_EVDEV_MATCH_LT:  return value < m->value;
+    }
+    return 0;
+}
+
+/**
+ * find the mapping fired by an event, axes fire when they cross the threshold not while they stay past it.
+ * returns the mapping index or -1
+ */
+static int match_event(adj_evdev_map* map, unsigned short type, unsigned short code, int value, int ctrl)
+{
+    int i, hit = -1;
+    adj_evdev_mapping* m;
+
+    for (i = 0; i < map->count; i++) {
+        m = &map->mapping[i];
+        if (m->type != type || m->code != code) continue;
+
+        if ( ! value_matches(m, value) ) {
+            m->active = 0;
+            continue;
+        }
+        if (m->active) continue;
+        if (type == EV_ABS) m->active = 1;
+
+        if (hit == -1 && (m->op == ADJ_EVDEV_CTRL || m->ctrl == ctrl)) {
+            hit = i;
+        }
+    }
+    return hit;
+}
+
+//SNIP_evdev_parser
+
+static adj_evdev_map* read_pad_map(uint16_t vendor, uint16_t product)
+{
+    char path[256];
+    char* line = NULL;
+    size_t len = 0;
+    int i;
+
+    snprintf(path, sizeof(path), "/etc/adj/pads/%04x:%04x.adjpad", vendor, product);
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    adj_evdev_map* map = calloc(1, sizeof(adj_evdev_map));
+    if (map) {
+        for (i = 1; getline(&line, &len, fp) != -1; i++) {
+            parse_pad_line(line, i, map);
+        }
+    }
+
+    free(line);
+    fclose(fp);
+    return map;
+}
+
+static void dispatch(adj_seq_info_t* adj, adj_evdev_mapping* m, uint64_t nanos)
+{
+    adj_trace_at(ADJ_TRACE_PAD, m->op, m->value, nanos);
+    switch (m->op) {
+        case ADJ_EVDEV_START:
+            adj_start(adj);
+            break;
+        case ADJ_EVDEV_STOP:
+            adj_stop(adj);
+            break;
+        case ADJ_EVDEV_TOGGLE:
+            adj_toggle(adj);
+            break;
+        case ADJ_EVDEV_Q_RESTART:
+            adj_quantized_restart(adj);
+            break;
+        case ADJ_EVDEV_NUDGE:
+            adj_nudge_at(adj, (int) m->arg, nanos);
+            break;
+        case ADJ_EVDEV_TEMPO:
+            adj_adjust_tempo_at(adj, m->arg, nanos);
+            break;
+        case ADJ_EVDEV_TAP:
+            adj_bpm_tap_at(adj, nanos);
+            break;
+        case ADJ_EVDEV_TAP_RESET:
+            adj_bpm_tap_reset();
+            break;
+        case ADJ_EVDEV_CTRL:
+            ctrl_down = 1;
+            break;
+        case ADJ_EVDEV_EXIT:
+            adj_exit(adj);
+            break;
+        case ADJ_EVDEV_SAVE_BPM:
+            adj_save_bpm(adj);
+            break;
+        case ADJ_EVDEV_COPY_BPM:
+            if (has_vdj) {
+                adj_vdj_copy_bpm(adj, player_id = (uint8_t) m->arg);
+                adj_vdj_track_start(adj, player_id);
+            }
+            break;
+        case ADJ_EVDEV_TRIGGER:
+            if (has_vdj) adj_vdj_trigger_from_player(adj, player_id);
+            break;
+        case ADJ_EVDEV_DIFFLOCK:
+            if (has_vdj) adj_vdj_difflock(adj, player_id, 0);
+            break;
+        case ADJ_EVDEV_DIFFLOCK_ARFF:
+            if (has_vdj) adj_vdj_difflock_arff(adj);
+            break;
+    }
+}
+
+struct evdev_reactor_info {
+    adj_seq_info_t* adj;
+    adj_evdev_map*  map;
+};
+
+static void handle_event(adj_seq_info_t* adj, adj_evdev_map* map, struct input_event* ev)
+{
+    int i;
+    uint64_t nanos;
+
+    if (ev->type != EV_KEY && ev->type != EV_ABS) return;
+
+    // releasing ctrl, like the js modules, ends a tap sequence
+    if (ev->type == EV_KEY && ev->value == 0 && ctrl_down) {
+        for (i = 0; i < map->count; i++) {
+            if (map->mapping[i].op == ADJ_EVDEV_CTRL && map->mapping[i].code == ev->code) {
+                ctrl_down = 0;
+                adj_bpm_tap_reset();
+            }
+        }
+    }
+
+    if ( (i = match_event(map, ev->type, ev->code, ev->value, ctrl_down)) < 0 ) return;
+
+    nanos = (uint64_t) ev->input_event_sec * 1000000000L + (uint64_t) ev->input_event_usec * 1000L;
+    dispatch(adj, &map->mapping[i], nanos);
+}
+
+static void read_evdev(int fd, uint32_t events, void* data)
+{
+    struct evdev_reactor_info* info = data;
+    struct input_event ev[32];
+    ssize_t i, n;
+
+    n = read(fd, ev, sizeof(ev));
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        // unplugged
+        adj_reactor_remove(fd);
+        close(fd);
+        ev_fd = -1;
+        return;
+    }
+    for (i = 0; adj_evdev_running && i < n / (ssize_t) sizeof(struct input_event); i++) {
+        handle_event(info->adj, info->map, &ev[i]);
+    }
+}
+
+/**
+ * open dev and load its adjpad file, returns the fd or -1
+ */
+static int open_pad(char* dev, adj_evdev_map** map)
+{
+    struct input_id id;
+    int clk = ADJ_CLOCK;
+
+    int fd = open(dev, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) return -1;
+
+    if ( ioctl(fd, EVIOCGID, &id) < 0 || (*map = read_pad_map(id.vendor, id.product)) == NULL ) {
+        close(fd);
+        return -1;
+    }
+    // timestamps on the same clock as adj_time_nanos()
+    if ( ioctl(fd, EVIOCSCLOCKID, &clk) < 0 ) {
+        fprintf(stderr, "warn: %s timestamps are not monotonic\n", dev);
+    }
+    fprintf(stderr, "connected %s %04x:%04x\n", dev, id.vendor, id.product);
+    return fd;
+}
+
+/**
+ * first /dev/input/event* with an adjpad file
+ */
+static int find_pad(adj_evdev_map** map)
+{
+    char path[256 + 12];
+    struct dirent* de;
+    int fd = -1;
+
+    DIR* dir = opendir("/dev/input");
+    if (dir == NULL) return -1;
+
+    while (fd < 0 && (de = readdir(dir))) {
+        if (strncmp(de->d_name, "event", 5) != 0) continue;
+        snprintf(path, sizeof(path), "/dev/input/%s", de->d_name);
+        fd = open_pad(path, map);
+    }
+    closedir(dir);
+    return fd;
+}
+
+int adj_evdev_input(adj_seq_info_t* adj, char* dev, unsigned int flags)
+{
+    int rv;
+    adj_evdev_map* map = NULL;
+    if (flags & ADJ_HAS_VDJ) has_vdj = 1;
+
+    ev_fd = dev ? open_pad(dev, &map) : find_pad(&map);
+    if (ev_fd < 0) {
+        return ADJ_IO;
+    }
+
+    struct evdev_reactor_info* info = calloc(1, sizeof(struct evdev_reactor_info));
+    if (info == NULL) {
+        close(ev_fd);
+        return ADJ_ALLOC;
+    }
+    info->adj = adj;
+    info->map = map;
+
+    adj_evdev_running = 1;
+    if ( (rv = adj_reactor_add(ev_fd, read_evdev, info)) != ADJ_OK ) {
+        close(ev_fd);
+        return rv;
+    }
+
+    return ADJ_OK;
+}
+
+void adj_evdev_exit()
+{
+    adj_evdev_running = 0;
+    if (ev_fd >= 0) adj_reactor_remove(ev_fd);
+}
@@ -0,0 +1,65 @@
+#ifndef _ADJ_EVDEV_INCLUDED_
+#define _ADJ_EVDEV_INCLUDED_
+
+#include "adj.h"
+
+/**
+ * evdev game pad input, /dev/input/event*
+ * Events are timestamped by the kernel and buttons and axes are mapped by a data file per device
+ * /etc/adj/pads/<vendor:product>.adjpad, so a new pad needs no new module.
+ */
+
+//SNIP_evdev_constants
+
+#define ADJ_EVDEV_START          1
+#define ADJ_EVDEV_STOP           2
+#define ADJ_EVDEV_TOGGLE         3
+#define ADJ_EVDEV_Q_RESTART      4
+#define ADJ_EVDEV_NUDGE          5   // arg is the nudge multiplier e.g. nudge:-10
+#define ADJ_EVDEV_TEMPO          6   // arg is bpm e.g. tempo:0.1
+#define ADJ_EVDEV_TAP            7
+#define ADJ_EVDEV_TAP_RESET      8
+#define ADJ_EVDEV_CTRL           9   // held down selects the ^ mappings
+#define ADJ_EVDEV_EXIT           10
+#define ADJ_EVDEV_SAVE_BPM       11
+#define ADJ_EVDEV_COPY_BPM       12  // arg is the player e.g. copy_bpm:1
+#define ADJ_EVDEV_TRIGGER        13
+#define ADJ_EVDEV_DIFFLOCK       14
+#define ADJ_EVDEV_DIFFLOCK_ARFF  15
+
+#define ADJ_EVDEV_MAX_MAPPINGS   64
+
+#define ADJ_EVDEV_MATCH_ANY      0   // *
+#define ADJ_EVDEV_MATCH_EQ       1   // 1
+#define ADJ_EVDEV_MATCH_GT       2   // >30000
+#define ADJ_EVDEV_MATCH_LT       3   // <-30000
+
+/**
+ * one line of an adjpad file
+ */
+typedef struct {
+    unsigned char  op;
+    unsigned char  ctrl;      // only applies while the ctrl button is held
+    unsigned char  match;
+    unsigned char  active;    // axis is past the threshold, fires once per crossing
+    unsigned short type;      // EV_KEY or EV_ABS
+    unsigned short code;
+    int            value;
+    float          arg;
+} adj_evdev_mapping;
+
+typedef struct {
+    adj_evdev_mapping mapping[ADJ_EVDEV_MAX_MAPPINGS];
+    int               count;
+} adj_evdev_map;
+
+//SNIP_evdev_constants
+
+/**
+ * open an evdev device e.g. /dev/input/event3, if dev is NULL the first device with an adjpad file is used
+ */
+int adj_evdev_input(adj_seq_info_t* adj, char* dev, unsigned int flags);
+
+void adj_evdev_exit();
+
+#endif // _ADJ_EVDEV_INCLUDED_
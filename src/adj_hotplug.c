@@ -0,0 +1,235 @@
+
+#include <string.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <stdatomic.h>
+
+#include "adj_hotplug.h"
+#include "adj_midiin.h"
+#include "adj_reactor.h"
+
+/**
+ * Hotplug has its own alsa client subscribed to System:Announce,
+ * when a port starts that matches a configured pattern we subscribe it, no polling, no aconnect.
+ */
+
+#define ADJ_HOTPLUG_RULES       8
+#define ADJ_HOTPLUG_NAME_LEN    256
+
+#define ADJ_HOTPLUG_OUT         1   // connect adj:clock -> port
+#define ADJ_HOTPLUG_IN          2   // connect port -> adj-in:control
+
+typedef struct {
+    int dir;
+    int any_hardware;                  // no pattern, any hardware port will do
+    char pattern[ADJ_HOTPLUG_NAME_LEN];
+} hotplug_rule;
+
+static unsigned _Atomic adj_hotplug_running = ATOMIC_VAR_INIT(1);
+static adj_seq_info_t* hp_adj = NULL;
+static snd_seq_t* hp_seq = NULL;
+static int hp_port = -1;
+static struct pollfd* hp_pfd = NULL;
+static int hp_npfd = 0;
+static hotplug_rule rules[ADJ_HOTPLUG_RULES];
+static int rule_count = 0;
+
+//SNIP_hotplug_match
+
+/**
+ * match "client:port" names against a pattern, ignoring alsa's trailing whitespace.
+ * A pattern without a ':' matches the client name only, as aconnect does.
+ */
+static int match_port(const char* pattern, const char* client, const char* port)
+{
+    char p[ADJ_HOTPLUG_NAME_LEN];
+    char n[ADJ_HOTPLUG_NAME_LEN * 2];
+
+    snprintf(p, sizeof(p), "%.*s", (int) adj_rtrim_len(pattern), pattern);
+    if (strchr(p, ':')) {
+        snprintf(n, sizeof(n), "%s:%.*s", client, (int) adj_rtrim_len(port), port);
+    } else {
+        snprintf(n, sizeof(n), "%.*s", (int) adj_rtrim_len(client), client);
+    }
+    return fnmatch(p, n, 0) == 0;
+}
+
+//SNIP_hotplug_match
+
+static int add_rule(int dir, const char* pattern)
+{
+    if (rule_count == ADJ_HOTPLUG_RULES) {
+        return ADJ_ERR;
+    }
+    hotplug_rule* rule = &rules[rule_count];
+    rule->dir = dir;
+    rule->any_hardware = pattern == NULL;
+    if (pattern) {
+        snprintf(rule->pattern, ADJ_HOTPLUG_NAME_LEN, "%s", pattern);
+    }
+    rule_count++;
+    return ADJ_OK;
+}
+
+static int rule_matches(hotplug_rule* rule, snd_seq_client_info_t* cinfo, snd_seq_port_info_t* pinfo)
+{
+    unsigned int caps = snd_seq_port_info_get_capability(pinfo);
+    char id[32];
+
+    if (rule->dir == ADJ_HOTPLUG_OUT) {
+        if ( (caps & (SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE)) != (SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE) ) return 0;
+    } else {
+        if ( (caps & (SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ)) != (SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ) ) return 0;
+    }
+
+    if (rule->any_hardware) {
+        return (snd_seq_port_info_get_type(pinfo) & SND_SEQ_PORT_TYPE_HARDWARE) != 0;
+    }
+
+    snprintf(id, sizeof(id), "%i:%i", snd_seq_port_info_get_client(pinfo), snd_seq_port_info_get_port(pinfo));
+    return match_port(rule->pattern, snd_seq_client_info_get_name(cinfo), snd_seq_port_info_get_name(pinfo))
+        || strcmp(rule->pattern, id) == 0;
+}
+
+static void port_start(adj_seq_info_t* adj, snd_seq_addr_t* addr)
+{
+    snd_seq_client_info_t* cinfo;
+    snd_seq_port_info_t* pinfo;
+    snd_seq_port_subscribe_t* subs;
+    snd_seq_addr_t self;
+    char name[ADJ_HOTPLUG_NAME_LEN * 2];
+    int i;
+
+    // our own clients come and go too
+    if (addr->client == adj->client_id || addr->client == snd_seq_client_id(hp_seq)) return;
+    if (adj_midiin_address(&self) == ADJ_OK && addr->client == self.client) return;
+
+    snd_seq_client_info_alloca(&cinfo);
+    snd_seq_port_info_alloca(&pinfo);
+    if (snd_seq_get_any_client_info(hp_seq, addr->client, cinfo) < 0) return;
+    if (snd_seq_get_any_port_info(hp_seq, addr->client, addr->port, pinfo) < 0) return;
+
+    for (i = 0; i < rule_count; i++) {
+        if ( ! rule_matches(&rules[i], cinfo, pinfo) ) continue;
+
+        snd_seq_port_subscribe_alloca(&subs);
+        if (rules[i].dir == ADJ_HOTPLUG_OUT) {
+            self.client = adj->client_id;
+            self.port = adj->alsa_port;
+            snd_seq_port_subscribe_set_sender(subs, &self);
+            snd_seq_port_subscribe_set_dest(subs, addr);
+            snd_seq_port_subscribe_set_queue(subs, adj->q);
+        } else {
+            if (adj_midiin_address(&self) != ADJ_OK) continue;
+            snd_seq_port_subscribe_set_sender(subs, addr);
+            snd_seq_port_subscribe_set_dest(subs, &self);
+        }
+
+        snprintf(name, sizeof(name), "%s:%s", snd_seq_client_info_get_name(cinfo), snd_seq_port_info_get_name(pinfo));
+        int rv = snd_seq_subscribe_port(hp_seq, subs);
+        if (rv < 0 && rv != -EBUSY) {
+            fprintf(stderr, "hotplug connection failed to %s (%s)\n", name, snd_strerror(rv));
+            continue;
+        }
+        if (rules[i].dir == ADJ_HOTPLUG_OUT) {
+            adj->ui->data_item_handler(adj->ui, ADJ_ITEM_MIDI_OUT, "midi out:", name);
+        } else {
+            adj->ui->data_item_handler(adj->ui, ADJ_ITEM_MIDI_IN, "midi in:", name);
+        }
+    }
+}
+
+static void read_announce(int fd, uint32_t events, void* data)
+{
+    adj_seq_info_t* adj = data;
+    snd_seq_event_t* ev = NULL;
+    int rv;
+
+    while ( (rv = snd_seq_event_input(hp_seq, &ev)) >= 0 || rv == -ENOSPC ) {
+        if ( rv == -ENOSPC || ! adj_hotplug_running ) continue;
+        // port exit needs no action, alsa drops the subscription with the port
+        if (ev->type == SND_SEQ_EVENT_PORT_START) {
+            port_start(adj, &ev->data.addr);
+        }
+    }
+}
+
+int adj_hotplug_init(adj_seq_info_t* adj)
+{
+    char name[ADJ_MAX_CLIENT_LEN];
+    int i, rv;
+
+    if ( snd_seq_open(&hp_seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK) < 0 ) {
+        return ADJ_ALSA_SEQ_OPEN;
+    }
+    snprintf(name, ADJ_MAX_CLIENT_LEN, "%s-hotplug", adj->seq_name);
+    snd_seq_set_client_name(hp_seq, name);
+    hp_adj = adj;
+
+    hp_port = snd_seq_create_simple_port(hp_seq, "announce", SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_NO_EXPORT, SND_SEQ_PORT_TYPE_APPLICATION);
+    if (hp_port < 0) {
+        return ADJ_ALSA_PORT_OPEN;
+    }
+    if ( snd_seq_connect_from(hp_seq, hp_port, SND_SEQ_CLIENT_SYSTEM, SND_SEQ_PORT_SYSTEM_ANNOUNCE) < 0 ) {
+        return ADJ_ALSA;
+    }
+
+    hp_npfd = snd_seq_poll_descriptors_count(hp_seq, POLLIN);
+    hp_pfd = calloc(hp_npfd, sizeof(struct pollfd));
+    if (hp_pfd == NULL) {
+        return ADJ_ALLOC;
+    }
+    snd_seq_poll_descriptors(hp_seq, hp_pfd, hp_npfd, POLLIN);
+    for (i = 0; i < hp_npfd; i++) {
+        if ( (rv = adj_reactor_add(hp_pfd[i].fd, read_announce, adj)) != ADJ_OK ) {
+            return rv;
+        }
+    }
+
+    return ADJ_OK;
+}
+
+/**
+ * ports already present when a rule is added are connected now, e.g. when the name is a pattern
+ */
+static void scan_ports()
+{
+    snd_seq_client_info_t* cinfo;
+    snd_seq_port_info_t* pinfo;
+    snd_seq_addr_t addr;
+
+    snd_seq_client_info_alloca(&cinfo);
+    snd_seq_port_info_alloca(&pinfo);
+    snd_seq_client_info_set_client(cinfo, -1);
+    while (snd_seq_query_next_client(hp_seq, cinfo) >= 0) {
+        addr.client = snd_seq_client_info_get_client(cinfo);
+        snd_seq_port_info_set_client(pinfo, addr.client);
+        snd_seq_port_info_set_port(pinfo, -1);
+        while (snd_seq_query_next_port(hp_seq, pinfo) >= 0) {
+            addr.port = snd_seq_port_info_get_port(pinfo);
+            port_start(hp_adj, &addr);
+        }
+    }
+}
+
+int adj_hotplug_out(const char* pattern)
+{
+    int rv = add_rule(ADJ_HOTPLUG_OUT, pattern);
+    if (rv == ADJ_OK && hp_adj) scan_ports();
+    return rv;
+}
+
+int adj_hotplug_in(const char* pattern)
+{
+    int rv = add_rule(ADJ_HOTPLUG_IN, pattern);
+    if (rv == ADJ_OK && hp_adj) scan_ports();
+    return rv;
+}
+
+void adj_hotplug_exit()
+{
+    adj_hotplug_running = 0;
+    for (int i = 0; i < hp_npfd; i++) {
+        adj_reactor_remove(hp_pfd[i].fd);
+    }
+}
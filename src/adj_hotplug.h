@@ -0,0 +1,31 @@
+#ifndef _ADJ_HOTPLUG_INCLUDED_
+#define _ADJ_HOTPLUG_INCLUDED_
+
+#include "adj.h"
+
+/**
+ * Midi hotplug, listens to System:Announce and reconnects ports as they appear.
+ * Handlers run on the input reactor, no polling.
+ *
+ * Patterns are fnmatch() patterns for "client:port" as printed by `aconnect -l`
+ * e.g. "TR-6S:TR-6S MIDI 1" or "nanoKONTROL*:*", trailing whitespace is ignored.
+ */
+
+/**
+ * open the hotplug client and register it with the reactor, call after adj_reactor_init()
+ */
+int adj_hotplug_init(adj_seq_info_t* adj);
+
+/**
+ * connect adj:clock to ports matching pattern, now and when they appear, NULL means any hardware midi output
+ */
+int adj_hotplug_out(const char* pattern);
+
+/**
+ * connect ports matching pattern to adj-in:control, now and when they appear
+ */
+int adj_hotplug_in(const char* pattern);
+
+void adj_hotplug_exit();
+
+#endif // _ADJ_HOTPLUG_INCLUDED_
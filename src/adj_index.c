@@ -0,0 +1,181 @@
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "adj.h"
+#include "adj_wav.h"
+#include "adj_index.h"
+
+//SNIP_index
+
+uint64_t adj_index_hash(const uint8_t* buf, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL, word;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&word, buf + i, 8);
+        h = (h ^ word) * 0x100000001b3ULL;
+    }
+    for (; i < len; i++) h = (h ^ buf[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+/**
+ * position of hash in the sorted tracks, or where it would go
+ */
+static uint32_t find(const adj_index_t* index, uint64_t hash)
+{
+    uint32_t lo = 0, hi = index->count, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (index->tracks[mid].hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+const adj_index_track_t* adj_index_find(const adj_index_t* index, uint64_t hash)
+{
+    uint32_t i = find(index, hash);
+    return i < index->count && index->tracks[i].hash == hash ? &index->tracks[i] : NULL;
+}
+
+int adj_index_add(adj_index_t* index, uint64_t hash, float bpm, uint32_t downbeat_us, const uint32_t* grid, uint32_t beats)
+{
+    uint32_t i = find(index, hash);
+    uint32_t* more_grid;
+
+    if ( ! (more_grid = realloc(index->grid, (index->beats + beats + 1) * sizeof(uint32_t))) ) return ADJ_ALLOC;
+    index->grid = more_grid;
+
+    // a replaced track's old grid is left behind, adj_index_save() drops it
+    if (i == index->count || index->tracks[i].hash != hash) {
+        adj_index_track_t* more = realloc(index->tracks, (index->count + 1) * sizeof(adj_index_track_t));
+        if ( ! more ) return ADJ_ALLOC;
+        index->tracks = more;
+        memmove(index->tracks + i + 1, index->tracks + i, (index->count - i) * sizeof(adj_index_track_t));
+        index->count++;
+    }
+    index->tracks[i].hash = hash;
+    index->tracks[i].bpm = bpm;
+    index->tracks[i].downbeat_us = downbeat_us;
+    index->tracks[i].grid = index->beats;
+    index->tracks[i].beats = beats;
+    memcpy(index->grid + index->beats, grid, beats * sizeof(uint32_t));
+    index->beats += beats;
+    return ADJ_OK;
+}
+
+int adj_index_parse(const uint8_t* buf, size_t len, adj_index_t* index)
+{
+    adj_index_header_t h;
+    uint32_t i;
+
+    memset(index, 0, sizeof(adj_index_t));
+    if (len < sizeof(h)) return ADJ_SYNTAX;
+    memcpy(&h, buf, sizeof(h));
+    if (memcmp(h.magic, ADJ_INDEX_MAGIC, 8) != 0) return ADJ_SYNTAX;
+    if ((uint64_t) h.count * sizeof(adj_index_track_t) + (uint64_t) h.beats * sizeof(uint32_t) != len - sizeof(h)) return ADJ_SYNTAX;
+
+    // + 1 so an empty index is not a failed malloc
+    index->tracks = malloc(h.count * sizeof(adj_index_track_t) + 1);
+    index->grid = malloc(h.beats * sizeof(uint32_t) + 1);
+    if ( ! index->tracks || ! index->grid ) {
+        adj_index_free(index);
+        return ADJ_ALLOC;
+    }
+    memcpy(index->tracks, buf + sizeof(h), h.count * sizeof(adj_index_track_t));
+    memcpy(index->grid, buf + sizeof(h) + h.count * sizeof(adj_index_track_t), h.beats * sizeof(uint32_t));
+    index->count = h.count;
+    index->beats = h.beats;
+
+    // lookups rely on the order, and the grid must be inside the file
+    for (i = 0; i < index->count; i++) {
+        adj_index_track_t* t = &index->tracks[i];
+        if ( (i > 0 && t->hash <= index->tracks[i - 1].hash) || (uint64_t) t->grid + t->beats > index->beats ) {
+            adj_index_free(index);
+            return ADJ_SYNTAX;
+        }
+    }
+    return ADJ_OK;
+}
+
+//SNIP_index
+
+int adj_index_load(const char* path, adj_index_t* index)
+{
+    struct stat st;
+    uint8_t* buf;
+    int fd, rv;
+
+    memset(index, 0, sizeof(adj_index_t));
+    if ( (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 ) return ADJ_IO;
+    if (fstat(fd, &st) != 0 || ! (buf = malloc(st.st_size + 1)) ) {
+        close(fd);
+        return ADJ_IO;
+    }
+    rv = read(fd, buf, st.st_size) == st.st_size ? adj_index_parse(buf, st.st_size, index) : ADJ_IO;
+    free(buf);
+    close(fd);
+    return rv;
+}
+
+int adj_index_save(const char* path, const adj_index_t* index)
+{
+    adj_index_header_t h;
+    adj_index_track_t t;
+    char tmp[4096];
+    uint32_t i, beats = 0;
+    FILE* f;
+
+    snprintf(tmp, sizeof(tmp), "%s.%i", path, getpid());
+    if ( ! (f = fopen(tmp, "w")) ) return ADJ_IO;
+
+    for (i = 0; i < index->count; i++) beats += index->tracks[i].beats;
+    memcpy(h.magic, ADJ_INDEX_MAGIC, 8);
+    h.count = index->count;
+    h.beats = beats;
+    fwrite(&h, sizeof(h), 1, f);
+
+    // tracks with their grids renumbered, then the grids in the same order
+    for (beats = 0, i = 0; i < index->count; i++) {
+        t = index->tracks[i];
+        t.grid = beats;
+        beats += t.beats;
+        fwrite(&t, sizeof(t), 1, f);
+    }
+    for (i = 0; i < index->count; i++) {
+        fwrite(index->grid + index->tracks[i].grid, sizeof(uint32_t), index->tracks[i].beats, f);
+    }
+    int failed = ferror(f);
+    if (fclose(f) != 0) failed = 1;
+    if (failed || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return ADJ_IO;
+    }
+    return ADJ_OK;
+}
+
+int adj_index_hash_file(const char* path, uint64_t* hash)
+{
+    adj_wav_t wav;
+    int rv;
+
+    if ( (rv = adj_wav_open(path, &wav)) != ADJ_OK ) return rv;
+    *hash = adj_index_hash((const uint8_t*) wav.frames, wav.count * wav.channels * sizeof(int16_t));
+    adj_wav_close(&wav);
+    return ADJ_OK;
+}
+
+void adj_index_free(adj_index_t* index)
+{
+    free(index->tracks);
+    free(index->grid);
+    memset(index, 0, sizeof(adj_index_t));
+}
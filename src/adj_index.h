@@ -0,0 +1,81 @@
+#ifndef _ADJ_INDEX_INCLUDED_
+#define _ADJ_INDEX_INCLUDED_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Track index written by adj-analyse, read by adj -t to preset the tempo and phase of a track.
+ *
+ * Tracks are keyed by a hash of their audio, so renaming a file or editing its tags does not lose it.
+ * The file is a header, the tracks sorted by hash, then every track's beat grid, in native byte order,
+ * which is little endian on everything adj runs on.
+ */
+
+//SNIP_index_constants
+
+#define ADJ_INDEX_MAGIC         "ADJIDX01"
+#define ADJ_INDEX_PATH          "/var/lib/adj/tracks.idx"
+
+typedef struct {
+    uint64_t    hash;           // adj_index_hash() of the audio data
+    float       bpm;            // 0.0 if no beat was found
+    uint32_t    downbeat_us;    // first downbeat from the start of the audio
+    uint32_t    grid;           // index of the first beat in the grid
+    uint32_t    beats;          // beats in the grid
+} adj_index_track_t;
+
+typedef struct {
+    char        magic[8];
+    uint32_t    count;          // tracks
+    uint32_t    beats;          // grid entries after the tracks
+} adj_index_header_t;
+
+typedef struct {
+    uint32_t            count;
+    uint32_t            beats;
+    adj_index_track_t*  tracks;
+    uint32_t*           grid;   // micros from the start of the audio of every beat, tracks up to ~71 minutes
+} adj_index_t;
+
+//SNIP_index_constants
+
+/**
+ * FNV-1a, 64 bit, eight bytes at a time
+ */
+uint64_t adj_index_hash(const uint8_t* buf, size_t len);
+
+/**
+ * hash of a WAV file's audio data, returns ADJ_IO if it cannot be read, ADJ_ERR if it is not a WAV
+ */
+int adj_index_hash_file(const char* path, uint64_t* hash);
+
+/**
+ * an empty index is valid, and is what a missing file loads as, with ADJ_IO returned
+ * returns ADJ_SYNTAX if the file is not an index
+ */
+int adj_index_load(const char* path, adj_index_t* index);
+
+/**
+ * copy an index from memory
+ */
+int adj_index_parse(const uint8_t* buf, size_t len, adj_index_t* index);
+
+/**
+ * NULL if the track has not been analysed
+ */
+const adj_index_track_t* adj_index_find(const adj_index_t* index, uint64_t hash);
+
+/**
+ * add or replace a track, the index stays sorted
+ */
+int adj_index_add(adj_index_t* index, uint64_t hash, float bpm, uint32_t downbeat_us, const uint32_t* grid, uint32_t beats);
+
+/**
+ * written to a temporary file and renamed, so adj never reads half an index
+ */
+int adj_index_save(const char* path, const adj_index_t* index);
+
+void adj_index_free(adj_index_t* index);
+
+#endif // _ADJ_INDEX_INCLUDED_
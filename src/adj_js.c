@@ -33,12 +33,13 @@ left bottom (stop) acts like a control key,  when down
 #include "adj_js.h"
 #include "adj_store.h"
 #include "adj_bpm_tap.h"
+#include "adj_reactor.h"
 
 
 static unsigned _Atomic adj_js_running = ATOMIC_VAR_INIT(0);
 
 static unsigned int js_flags;
-static int js_fd = 0;
+static int js_fd = -1;
 static int has_vdj = 0;
 static int stop_down = 0;    // stop button pressed down (used like a control key)
 static char * device_id = NULL;
@@ -48,7 +49,7 @@ static uint8_t player_id = 1;
 static int init_js(char* dev)
 {
 
-    if ((js_fd = open(dev, O_RDONLY)) < 0) {
+    if ((js_fd = open(dev, O_RDONLY | O_NONBLOCK)) < 0) {
         fprintf(stderr, "could not open '%s'\n", dev);
         return ADJ_ERR;
     }
@@ -183,21 +184,25 @@ static void handle_js_event(adj_seq_info_t* adj, struct js_event *evt)
 }
 
 /**
- * Thread that reads events from the joystick
+ * Reactor callback that reads events from the joystick
  */
-static void* read_js_events(void* arg)
+static void read_js_events(int fd, uint32_t events, void* data)
 {
-    adj_seq_info_t* adj = arg;
-    ssize_t sz = sizeof(struct js_event);
-    struct js_event evt;
-    while (adj_js_running) {
-        if (read(js_fd, &evt, sz) == sz) {
-            handle_js_event(adj, &evt);
-        }
+    adj_seq_info_t* adj = data;
+    struct js_event evt[16];
+    ssize_t i, n;
+
+    n = read(fd, evt, sizeof(evt));
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        // unplugged
+        adj_reactor_remove(fd);
+        close(fd);
+        js_fd = -1;
+        return;
+    }
+    for (i = 0; adj_js_running && i < n / (ssize_t) sizeof(struct js_event); i++) {
+        handle_js_event(adj, &evt[i]);
     }
-    close(js_fd);
-
-    return NULL;
 }
 
 /**
@@ -210,8 +215,7 @@ int adj_js_input(adj_seq_info_t* adj, char* args, unsigned int flags)
     js_flags = flags;
     if (js_flags & ADJ_HAS_VDJ) has_vdj = 1;
 
-    pthread_t thread_id;
-    if ( strncmp(args, "/dev/input/", 11) == 0 ) {
+    if ( args && strncmp(args, "/dev/input/", 11) == 0 ) {
         dev = args;
     }
 
@@ -220,10 +224,9 @@ int adj_js_input(adj_seq_info_t* adj, char* args, unsigned int flags)
     }
     adj_js_running = 1;
 
-    int s = pthread_create(&thread_id, NULL, &read_js_events, adj);
-    if (s != 0) {
+    if ( (rv = adj_reactor_add(js_fd, read_js_events, adj)) != ADJ_OK ) {
         close(js_fd);
-        return ADJ_THREAD;
+        return rv;
     }
 
     return ADJ_OK;
@@ -233,4 +236,5 @@ int adj_js_input(adj_seq_info_t* adj, char* args, unsigned int flags)
 void adj_js_exit()
 {
     adj_js_running = 0;
+    if (js_fd >= 0) adj_reactor_remove(js_fd);
 }
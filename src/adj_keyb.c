@@ -4,6 +4,8 @@
 #include "adj.h"
 #include "adj_keyb.h"
 #include "adj_vdj.h"
+#include "adj_reactor.h"
+#include "adj_bpm_tap.h"
 
 /**
  * Normal PC keyboard input (not a midi|piano keyboard)
@@ -18,11 +20,6 @@ static int has_vdj = 0;
 static unsigned _Atomic adj_keyb_running = ATOMIC_VAR_INIT(0);
 
 
-struct thread_info {
-    pthread_t       thread_id;
-    adj_seq_info_t* adj;
-};
-
 static void init_term()
 {
     term_orig = (struct termios*) calloc(1, sizeof(struct termios));
@@ -97,193 +94,219 @@ void adj_keyb_reset_term()
     }
 }
 
-static void* read_keys(void* arg)
-{
-    adj_seq_info_t* adj = arg;
-    char ch;
+// escape sequence state, arrows keys come as Esc[A function keys as EscOP
+#define KEYB_ESC_NONE   0
+#define KEYB_ESC        1  // Esc
+#define KEYB_ESC_CSI    2  // Esc[
+#define KEYB_ESC_SS3    3  // EscO
 
-    while (adj_keyb_running) {
-        if (adj_is_running()) {
-            // arrows keys come as Esc[A
-            ch = getchar();
-            if (EOF == ch) {
-                fprintf(stderr, "EOF keyboard input failed\n");
+static int esc_state = KEYB_ESC_NONE;
+
+static void escape_key(adj_seq_info_t* adj, char ch)
+{
+    int state = esc_state;
+    esc_state = KEYB_ESC_NONE;
+
+    if (state == KEYB_ESC) {
+        if (ch == '[') {
+            esc_state = KEYB_ESC_CSI;
+        } else if (ch == 'O') { // EscOP Function keys
+            esc_state = KEYB_ESC_SS3;
+        } else if (ch == '\033') { // Esc Esc  reset bpm entry & turn of sync
+            reset_char_bpm();
+            if (has_vdj) adj_vdj_difflock_arff(adj);
+        }
+    }
+    else if (state == KEYB_ESC_CSI) {
+        switch(ch) {
+            case 'C':// right
+                adj_nudge(adj, 10);
                 break;
-            }
-            //printf("keyb input '%i'\n", (int)ch);
-            else if (ch == '\033') {
-                ch = getchar();
-                if (ch == '[') {
-                    ch = getchar();
-                    switch(ch) {
-                        case 'C':// right
-                            adj_nudge(adj, 10);
-                            continue;
-                        case 'D':// left
-                            adj_nudge(adj, -10);
-                            continue;
-                        case 'A': // up
-                            adj_nudge(adj, 20);
-                            continue;
-                        case 'B':// down
-                            adj_nudge(adj, -20);
-                            continue;
-                        case 'H':// home key
-                            adj_quantized_restart(adj);
-                            continue;
-                        default: 
-                            continue;
-                    }
-                } else if (ch == 'O'){ // EscOP Function keys
-                    ch = getchar();
-                    switch(ch) {
-                        case 'P':// F1
-                            if (has_vdj) adj_vdj_copy_bpm(adj, 1);
-                            continue;
-                        case 'Q':// F2
-                            if (has_vdj) adj_vdj_copy_bpm(adj, 2);
-                            continue;
-                        case 'R': // F3
-                            if (has_vdj) adj_vdj_copy_bpm(adj, 3);
-                            continue;
-                        case 'S':// F4
-                            if (has_vdj) adj_vdj_copy_bpm(adj, 4);
-                            continue;
-
-                        default: 
-                            continue;
-                    }
-                } else if (ch == '\033'){ // Esc Esc  reset bpm entry & turn of sync
-                    reset_char_bpm();
-                    if (has_vdj) adj_vdj_difflock_arff(adj);
-                }
+            case 'D':// left
+                adj_nudge(adj, -10);
+                break;
+            case 'A': // up
+                adj_nudge(adj, 20);
+                break;
+            case 'B':// down
+                adj_nudge(adj, -20);
+                break;
+            case 'H':// home key
+                adj_quantized_restart(adj);
+                break;
+        }
+    }
+    else if (state == KEYB_ESC_SS3) {
+        switch(ch) {
+            case 'P':// F1
+                if (has_vdj) adj_vdj_copy_bpm(adj, 1);
+                break;
+            case 'Q':// F2
+                if (has_vdj) adj_vdj_copy_bpm(adj, 2);
+                break;
+            case 'R': // F3
+                if (has_vdj) adj_vdj_copy_bpm(adj, 3);
+                break;
+            case 'S':// F4
+                if (has_vdj) adj_vdj_copy_bpm(adj, 4);
+                break;
+        }
+    }
+}
 
-                continue;
-            // space bar or enter
-            } else if (ch == ' ') {
-                adj_toggle(adj);
-            } else if (ch == '\n' && (keyb_flags & ADJ_ENTER_TOGGLES) ) {
-                adj_toggle(adj);
-            } else if (ch == 'r') {
-                adj_adjust_tempo(adj, 1.0);
-            } else if (ch == 'f') {
-                adj_adjust_tempo(adj, 0.1);
-            } else if (ch == 'v') {
-                adj_adjust_tempo(adj, 0.01);
-            } else if (ch == 'w') {
-                adj_adjust_tempo(adj, -1.0);
-            } else if (ch == 's') {
-                adj_adjust_tempo(adj, -0.1);
-            } else if (ch == 'x') {
-                adj_adjust_tempo(adj, -0.01);
-                // plus and minus enables using calculator keyboards, if you can live with 0.1 resolution
-            } else if (ch == '+') {
-                adj_adjust_tempo(adj, 0.1);
-            } else if (ch == '-') {
-                adj_adjust_tempo(adj, -0.1);
-
-            } else if (ch == 'u') {
-                if (has_vdj) adj_vdj_trigger_from_player(adj, 1);
-            } else if (ch == 'i') {
-                if (has_vdj) adj_vdj_trigger_from_player(adj, 2);
-            } else if (ch == 'o') {
-                if (has_vdj) adj_vdj_trigger_from_player(adj, 3);
-            } else if (ch == 'p') {
-                if (has_vdj) adj_vdj_trigger_from_player(adj, 4);
-
-
-            } else if (ch == 'U') {
-                if (has_vdj) adj_vdj_difflock(adj, 1, 0);
-            } else if (ch == 'I') {
-                if (has_vdj) adj_vdj_difflock(adj, 2, 0);
-            } else if (ch == 'O') {
-                if (has_vdj) adj_vdj_difflock(adj, 3, 0);
-            } else if (ch == 'P') {
-                if (has_vdj) adj_vdj_difflock(adj, 4, 0);
-            } else if (ch == 0x3e) {
-                if (has_vdj) adj_vdj_difflock_nudge(adj, 1);
-            } else if (ch == 0x3c) {
-                if (has_vdj) adj_vdj_difflock_nudge(adj, -1);
-            } else if (ch == 'V') {
-                if (has_vdj) adj_vdj_difflock_nudge(adj, 1);
-            } else if (ch == 'X') {
-                if (has_vdj) adj_vdj_difflock_nudge(adj, -1);
-
-            } else if (ch == 'M') {
-                if (has_vdj) adj_vdj_difflock_master(adj, difflock_master = !difflock_master);
-
-            } else if (ch == 'B') {
-                if (has_vdj) adj_vdj_become_master(adj);
-
-            } else if (ch == 'C') {
-                if (has_vdj) adj_vdj_follow_tempo(adj, follow_tempo = !follow_tempo);
-
-            } else if (ch == 'K') { 
-                // quit process, stops all synths
-                adj_exit(adj);
-            } else if (ch == 'b') {
-                setting_bpm = 1;
-                continue;
-            } else if (ch == 'c') {
-                copying_bpm = 1;
-                continue;
-            } else if (ch == 'l') {
-                setting_difflock = 1;
-                continue;
-            } else if (ch == 'd') {
-                setting_default_difflock = 1;
-                continue;
-            } else if (ch == 'z') {
-                setting_track_start = 1;
-                continue;
-            } else if (ch == 't') {
-                setting_trigger = 1;
-                continue;
-            } else if (ch == '.' || (ch >= '0' && ch <= '9')) {
-                if (setting_bpm) {
-                    if (add_char_bpm(ch)) {
-                        float bpm = get_bpm();
-                        if (bpm > 0) {
-                            adj_set_tempo(adj, bpm);
-                            if (has_vdj) adj_vdj_difflock_arff(adj);
-                        }
-                        reset_char_bpm();
-                    }
-                }
-                uint8_t player_id = (uint8_t)(ch - '0');
-                if (copying_bpm) {
-                    if (has_vdj) adj_vdj_copy_bpm(adj, player_id);
+/**
+ * handle one byte of keyboard input
+ */
+static void key_input(adj_seq_info_t* adj, char ch)
+{
+    adj_trace(ADJ_TRACE_KEY, ch, 0);
+    if (esc_state != KEYB_ESC_NONE) {
+        escape_key(adj, ch);
+        return;
+    }
+
+    //printf("keyb input '%i'\n", (int)ch);
+    if (ch == '\033') {
+        esc_state = KEYB_ESC;
+        return;
+    // space bar or enter
+    } else if (ch == ' ') {
+        adj_toggle(adj);
+    } else if (ch == '\n' && (keyb_flags & ADJ_ENTER_TOGGLES) ) {
+        adj_toggle(adj);
+    } else if (ch == 'r') {
+        adj_adjust_tempo(adj, 1.0);
+    } else if (ch == 'f') {
+        adj_adjust_tempo(adj, 0.1);
+    } else if (ch == 'v') {
+        adj_adjust_tempo(adj, 0.01);
+    } else if (ch == 'w') {
+        adj_adjust_tempo(adj, -1.0);
+    } else if (ch == 's') {
+        adj_adjust_tempo(adj, -0.1);
+    } else if (ch == 'x') {
+        adj_adjust_tempo(adj, -0.01);
+        // plus and minus enables using calculator keyboards, if you can live with 0.1 resolution
+    } else if (ch == '+') {
+        adj_adjust_tempo(adj, 0.1);
+    } else if (ch == '-') {
+        adj_adjust_tempo(adj, -0.1);
+
+    } else if (ch == 'u') {
+        if (has_vdj) adj_vdj_trigger_from_player(adj, 1);
+    } else if (ch == 'i') {
+        if (has_vdj) adj_vdj_trigger_from_player(adj, 2);
+    } else if (ch == 'o') {
+        if (has_vdj) adj_vdj_trigger_from_player(adj, 3);
+    } else if (ch == 'p') {
+        if (has_vdj) adj_vdj_trigger_from_player(adj, 4);
+
+
+    } else if (ch == 'U') {
+        if (has_vdj) adj_vdj_difflock(adj, 1, 0);
+    } else if (ch == 'I') {
+        if (has_vdj) adj_vdj_difflock(adj, 2, 0);
+    } else if (ch == 'O') {
+        if (has_vdj) adj_vdj_difflock(adj, 3, 0);
+    } else if (ch == 'P') {
+        if (has_vdj) adj_vdj_difflock(adj, 4, 0);
+    } else if (ch == 0x3e) {
+        if (has_vdj) adj_vdj_difflock_nudge(adj, 1);
+    } else if (ch == 0x3c) {
+        if (has_vdj) adj_vdj_difflock_nudge(adj, -1);
+    } else if (ch == 'V') {
+        if (has_vdj) adj_vdj_difflock_nudge(adj, 1);
+    } else if (ch == 'X') {
+        if (has_vdj) adj_vdj_difflock_nudge(adj, -1);
+
+    } else if (ch == 'M') {
+        if (has_vdj) adj_vdj_difflock_master(adj, difflock_master = !difflock_master);
+
+    } else if (ch == 'B') {
+        if (has_vdj) adj_vdj_become_master(adj);
+
+    } else if (ch == 'C') {
+        if (has_vdj) adj_vdj_follow_tempo(adj, follow_tempo = !follow_tempo);
+
+    } else if (ch == 'T') {
+        adj_bpm_tap(adj);
+    } else if (ch == 'K') { 
+        // quit process, stops all synths
+        adj_exit(adj);
+    } else if (ch == 'b') {
+        setting_bpm = 1;
+        return;
+    } else if (ch == 'c') {
+        copying_bpm = 1;
+        return;
+    } else if (ch == 'l') {
+        setting_difflock = 1;
+        return;
+    } else if (ch == 'd') {
+        setting_default_difflock = 1;
+        return;
+    } else if (ch == 'z') {
+        setting_track_start = 1;
+        return;
+    } else if (ch == 't') {
+        setting_trigger = 1;
+        return;
+    } else if (ch == '.' || (ch >= '0' && ch <= '9')) {
+        if (setting_bpm) {
+            if (add_char_bpm(ch)) {
+                float bpm = get_bpm();
+                if (bpm > 0) {
+                    adj_set_tempo(adj, bpm);
                     if (has_vdj) adj_vdj_difflock_arff(adj);
-                    reset_char_bpm();
-                }
-                else if (setting_difflock) {
-                    if (has_vdj) adj_vdj_difflock(adj, player_id, 0);
-                    reset_char_bpm();
-                }
-                else if (setting_default_difflock) {
-                    if (has_vdj) adj_vdj_difflock(adj, player_id, 1);
-                    reset_char_bpm();
                 }
-                else if (setting_trigger) {
-                    if (has_vdj) adj_vdj_trigger_from_player(adj, player_id);
-                    reset_char_bpm();
-                }
-                else if (setting_track_start) {
-                    if (has_vdj) adj_vdj_track_start(adj, player_id);
-                    reset_char_bpm();
-                }
-                continue;
-            } else {
-                //printf("%i\n", (int)ch);
+                reset_char_bpm();
             }
         }
-
-        reset_char_bpm();
-        // quarter beat sleep
-        adj_one_beat_sleep(adj->bpm * 4);
+        uint8_t player_id = (uint8_t)(ch - '0');
+        if (copying_bpm) {
+            if (has_vdj) adj_vdj_copy_bpm(adj, player_id);
+            if (has_vdj) adj_vdj_difflock_arff(adj);
+            reset_char_bpm();
+        }
+        else if (setting_difflock) {
+            if (has_vdj) adj_vdj_difflock(adj, player_id, 0);
+            reset_char_bpm();
+        }
+        else if (setting_default_difflock) {
+            if (has_vdj) adj_vdj_difflock(adj, player_id, 1);
+            reset_char_bpm();
+        }
+        else if (setting_trigger) {
+            if (has_vdj) adj_vdj_trigger_from_player(adj, player_id);
+            reset_char_bpm();
+        }
+        else if (setting_track_start) {
+            if (has_vdj) adj_vdj_track_start(adj, player_id);
+            reset_char_bpm();
+        }
+        return;
     }
 
-    return NULL;
+    reset_char_bpm();
+}
+
+static void read_keys(int fd, uint32_t events, void* data)
+{
+    adj_seq_info_t* adj = data;
+    char buf[64];
+    ssize_t i, n;
+
+    n = read(fd, buf, sizeof(buf));
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        fprintf(stderr, "EOF keyboard input failed\n");
+        adj_reactor_remove(fd);
+        return;
+    }
+    for (i = 0; i < n && adj_keyb_running; i++) {
+        if (adj_is_running()) {
+            key_input(adj, buf[i]);
+        }
+    }
 }
 
 
@@ -292,21 +315,17 @@ int adj_keyb_input(adj_seq_info_t* adj, uint32_t flags)
     keyb_flags = flags;
     if (keyb_flags & ADJ_HAS_VDJ) has_vdj = 1;
 
-    pthread_t thread_id;
     init_term();
     reset_char_bpm();
     adj_keyb_running = 1;
 
-    int s = pthread_create(&thread_id, NULL, &read_keys, adj);
-    if (s != 0) {
-        return ADJ_THREAD;
-    }
-
-    return ADJ_OK;
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+    return adj_reactor_add(STDIN_FILENO, read_keys, adj);
 }
 
 
 void adj_keyb_exit()
 {
     adj_keyb_running = 0;
+    adj_reactor_remove(STDIN_FILENO);
 }
@@ -0,0 +1,878 @@
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "adj_bytes.h"
+#include "adj_link.h"
+#include "adj_reactor.h"
+
+/**
+ * Link's discovery and measurement protocols, ipv4 only.
+ * Every peer has a ghost clock, its host time plus an offset, and a session's timeline is in ghost time.
+ * A new peer is a session of its own with a ghost clock starting at 0.  When sessions meet the older one,
+ * the one with the later ghost clock, wins, and peers joining it measure the offset of its ghost clock
+ * from their host time by pinging a member.  In a session the timeline with the latest time origin wins,
+ * so a tempo change is a new timeline from now that carries on from the beat the old one had reached.
+ */
+
+#define SYNC_NANOS      50000000L   // how often adj and the session are compared, and pings time out
+#define PHASE_OK_MS     1           // phase difference that is left alone
+#define NUDGE_MAX_MS    20          // most adj is nudged in one beat, as difflock
+#define RESTART_BEATS   250000      // micro beats, further out of phase than this restarts adj's bar with the session's
+#define LOST_RETRY      30          // seconds before a session that lost, or could not be measured, is measured again
+
+typedef struct {
+    int                 used;
+    uint8_t             node[ADJ_LINK_ID_LEN];
+    uint8_t             session[ADJ_LINK_ID_LEN];
+    adj_link_timeline_t timeline;
+    struct sockaddr_in  mep;            // measurement endpoint, port 0 if the peer did not send one
+    uint64_t            expires;        // adj_time_nanos()
+} link_peer;
+
+// another session that is older than ours, or could not be measured
+typedef struct {
+    uint8_t             id[ADJ_LINK_ID_LEN];
+    uint64_t            retry;          // adj_time_nanos()
+} link_lost;
+
+static adj_seq_info_t* link_adj = NULL;
+static int disc_fd = -1;                // multicast, alive messages
+static int uni_fd = -1;                 // responses, pings and pongs, and everything we send
+static int timer_fd = -1;
+static struct sockaddr_in group_addr;
+static struct sockaddr_in local_addr;   // interface address and uni_fd's port, our measurement endpoint
+static uint8_t node_id[ADJ_LINK_ID_LEN];
+static uint8_t session_id[ADJ_LINK_ID_LEN];
+static int64_t ghost_offset = 0;        // ghost time - host time, micros
+static adj_link_timeline_t timeline;    // the session's
+static adj_link_start_stop_t start_stop;
+static link_peer peers[ADJ_LINK_PEERS];
+static link_lost lost[ADJ_LINK_PEERS];
+static int lost_next = 0;
+static unsigned _Atomic peer_count = ATOMIC_VAR_INIT(0);
+static unsigned _Atomic link_following = ATOMIC_VAR_INIT(0);
+static unsigned _Atomic transport = ATOMIC_VAR_INIT(0);
+static unsigned _Atomic transport_seq = ATOMIC_VAR_INIT(0);    // bumped by every start and stop
+static unsigned transport_seen = 0;
+static uint64_t ticks = 0;
+
+// measuring a session's ghost clock, one at a time
+static struct {
+    int                 active;
+    uint8_t             session[ADJ_LINK_ID_LEN];
+    struct sockaddr_in  to;
+    double              data[ADJ_LINK_PINGS + 2];
+    int                 n;
+    int                 tries;
+    uint64_t            sent;           // adj_time_nanos() of the last ping
+} measure;
+static uint64_t measured_at = 0;        // last measurement of our own session
+
+// adj's side
+static float local_bpm = 0.0;           // adj's bpm, last published or followed
+static float pending_bpm = 0.0;         // tempo asked of adj when following, not applied yet
+static uint64_t pending_until = 0;
+static int64_t followed_origin = 0;     // time origin of the session timeline adj last took its tempo from
+static uint64_t hold_until = 0;         // no phase corrections until the last nudge or restart is done
+
+//SNIP_link_codec
+
+static const uint8_t discovery_header[8] = { '_', 'a', 's', 'd', 'p', '_', 'v', 1 };
+static const uint8_t measurement_header[8] = { '_', 'l', 'i', 'n', 'k', '_', 'v', 1 };
+
+static uint8_t* put_entry(uint8_t* p, uint32_t key, uint32_t size)
+{
+    put32(p, key);
+    put32(p + 4, size);
+    return p + 8;
+}
+
+/**
+ * alive, response or byebye, byebye has no payload
+ * @return bytes written, 0 if buf is too small
+ */
+static int link_state_encode(uint8_t* buf, size_t len, const adj_link_state_t* s)
+{
+    uint8_t* p = buf;
+    if (len < 20 + 32 + 16 + 25 + 14) return 0;
+
+    memcpy(p, discovery_header, 8);
+    p[8] = s->type;
+    p[9] = s->ttl;
+    put16(p + 10, 0);                   // group
+    memcpy(p + 12, s->node, ADJ_LINK_ID_LEN);
+    p += 20;
+    if (s->type == ADJ_LINK_BYEBYE) return p - buf;
+
+    p = put_entry(p, ADJ_LINK_KEY_TMLN, 24);
+    put64(p, s->timeline.micros_per_beat);
+    put64(p + 8, s->timeline.beat_origin);
+    put64(p + 16, s->timeline.time_origin);
+    p = put_entry(p + 24, ADJ_LINK_KEY_SESS, ADJ_LINK_ID_LEN);
+    memcpy(p, s->session, ADJ_LINK_ID_LEN);
+    p = put_entry(p + ADJ_LINK_ID_LEN, ADJ_LINK_KEY_STST, 17);
+    p[0] = s->start_stop.playing;
+    put64(p + 1, s->start_stop.beats);
+    put64(p + 9, s->start_stop.timestamp);
+    p = put_entry(p + 17, ADJ_LINK_KEY_MEP4, 6);
+    put32(p, s->mep_addr);
+    put16(p + 4, s->mep_port);
+    return p + 6 - buf;
+}
+
+/**
+ * payload entries into whichever of s or k is given, unknown keys are skipped,
+ * a known key with the wrong size spoils the message
+ */
+static int link_entries(const uint8_t* p, size_t len, adj_link_state_t* s, adj_link_ping_t* k)
+{
+    uint32_t key, size, has = 0;
+
+    while (len >= 8) {
+        key = get32(p);
+        size = get32(p + 4);
+        p += 8;
+        len -= 8;
+        if (size > len) return ADJ_ERR;
+
+        switch (key) {
+            case ADJ_LINK_KEY_TMLN:
+                if (size != 24 || (int64_t) get64(p) <= 0) return ADJ_ERR;
+                if (s) {
+                    s->timeline.micros_per_beat = get64(p);
+                    s->timeline.beat_origin = get64(p + 8);
+                    s->timeline.time_origin = get64(p + 16);
+                }
+                has |= ADJ_LINK_HAS_TMLN;
+                break;
+            case ADJ_LINK_KEY_SESS:
+                if (size != ADJ_LINK_ID_LEN) return ADJ_ERR;
+                memcpy(s ? s->session : k->session, p, ADJ_LINK_ID_LEN);
+                has |= ADJ_LINK_HAS_SESS;
+                break;
+            case ADJ_LINK_KEY_STST:
+                if (size != 17) return ADJ_ERR;
+                if (s) {
+                    s->start_stop.playing = p[0];
+                    s->start_stop.beats = get64(p + 1);
+                    s->start_stop.timestamp = get64(p + 9);
+                }
+                has |= ADJ_LINK_HAS_STST;
+                break;
+            case ADJ_LINK_KEY_MEP4:
+                if (size != 6) return ADJ_ERR;
+                if (s) {
+                    s->mep_addr = get32(p);
+                    s->mep_port = get16(p + 4);
+                }
+                has |= ADJ_LINK_HAS_MEP4;
+                break;
+            case ADJ_LINK_KEY_HT:
+            case ADJ_LINK_KEY_GT:
+            case ADJ_LINK_KEY_PGT:
+                if (size != 8) return ADJ_ERR;
+                if (k) {
+                    if (key == ADJ_LINK_KEY_HT) k->host_time = get64(p);
+                    if (key == ADJ_LINK_KEY_GT) k->ghost_time = get64(p);
+                    if (key == ADJ_LINK_KEY_PGT) k->prev_ghost_time = get64(p);
+                }
+                has |= key == ADJ_LINK_KEY_HT ? ADJ_LINK_HAS_HT : key == ADJ_LINK_KEY_GT ? ADJ_LINK_HAS_GT : ADJ_LINK_HAS_PGT;
+                break;
+        }
+        p += size;
+        len -= size;
+    }
+    if (len) return ADJ_ERR;
+    if (s) s->has = has;
+    if (k) k->has = has;
+    return ADJ_OK;
+}
+
+static int link_state_decode(const uint8_t* buf, size_t len, adj_link_state_t* s)
+{
+    if (len < 20 || memcmp(buf, discovery_header, 8) != 0 || get16(buf + 10) != 0) return ADJ_ERR;
+
+    memset(s, 0, sizeof(adj_link_state_t));
+    s->type = buf[8];
+    s->ttl = buf[9];
+    memcpy(s->node, buf + 12, ADJ_LINK_ID_LEN);
+    return link_entries(buf + 20, len - 20, s, NULL);
+}
+
+/**
+ * ping or pong with the entries flagged in k->has, a pong's ping payload is appended by the caller
+ * @return bytes written, 0 if buf is too small
+ */
+static int link_ping_encode(uint8_t* buf, size_t len, const adj_link_ping_t* k)
+{
+    uint8_t* p = buf;
+    if (len < 9 + 16 * 4) return 0;
+
+    memcpy(p, measurement_header, 8);
+    p[8] = k->type;
+    p += 9;
+    if (k->has & ADJ_LINK_HAS_SESS) {
+        p = put_entry(p, ADJ_LINK_KEY_SESS, ADJ_LINK_ID_LEN);
+        memcpy(p, k->session, ADJ_LINK_ID_LEN);
+        p += ADJ_LINK_ID_LEN;
+    }
+    if (k->has & ADJ_LINK_HAS_GT) {
+        put64(put_entry(p, ADJ_LINK_KEY_GT, 8), k->ghost_time);
+        p += 16;
+    }
+    if (k->has & ADJ_LINK_HAS_HT) {
+        put64(put_entry(p, ADJ_LINK_KEY_HT, 8), k->host_time);
+        p += 16;
+    }
+    if (k->has & ADJ_LINK_HAS_PGT) {
+        put64(put_entry(p, ADJ_LINK_KEY_PGT, 8), k->prev_ghost_time);
+        p += 16;
+    }
+    return p - buf;
+}
+
+static int link_ping_decode(const uint8_t* buf, size_t len, adj_link_ping_t* k)
+{
+    if (len < 9 || memcmp(buf, measurement_header, 8) != 0) return ADJ_ERR;
+
+    memset(k, 0, sizeof(adj_link_ping_t));
+    k->type = buf[8];
+    return link_entries(buf + 9, len - 9, NULL, k);
+}
+
+static int64_t link_round(double x)
+{
+    return (int64_t) (x < 0 ? x - 0.5 : x + 0.5);
+}
+
+/**
+ * session beat, in micro beats, at ghost time
+ */
+static int64_t link_beats_at(const adj_link_timeline_t* tl, int64_t ghost)
+{
+    return tl->beat_origin + link_round((double) (ghost - tl->time_origin) * ADJ_LINK_MICRO_BEATS / tl->micros_per_beat);
+}
+
+/**
+ * ghost time of a session beat, in micro beats
+ */
+static int64_t link_time_at(const adj_link_timeline_t* tl, int64_t beats)
+{
+    return tl->time_origin + link_round((double) (beats - tl->beat_origin) * tl->micros_per_beat / ADJ_LINK_MICRO_BEATS);
+}
+
+/**
+ * position in the bar, 0 to quantum, negative beats count back from bar 0
+ */
+static int64_t link_phase(int64_t beats, int64_t quantum)
+{
+    int64_t p = beats % quantum;
+    return p < 0 ? p + quantum : p;
+}
+
+/**
+ * how far a is ahead of b in the bar, the shorter way round, -quantum / 2 to quantum / 2
+ */
+static int64_t link_phase_diff(int64_t a, int64_t b, int64_t quantum)
+{
+    int64_t d = link_phase(a - b, quantum);
+    return d >= quantum / 2 ? d - quantum : d;
+}
+
+static int cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+static int64_t link_median(double* data, int n)
+{
+    qsort(data, n, sizeof(double), cmp_double);
+    return link_round(n % 2 ? data[n / 2] : (data[n / 2 - 1] + data[n / 2]) / 2);
+}
+
+//SNIP_link_codec
+
+static int64_t host_micros()
+{
+    return adj_time_nanos() / 1000;
+}
+
+static int same_id(const uint8_t* a, const uint8_t* b)
+{
+    return memcmp(a, b, ADJ_LINK_ID_LEN) == 0;
+}
+
+static void message(const char* what)
+{
+    char msg[128];
+    snprintf(msg, sizeof(msg), "link: %s", what);
+    link_adj->message_handler(link_adj, msg);
+}
+
+static void send_to(const uint8_t* buf, int len, struct sockaddr_in* addr)
+{
+    if (len && sendto(uni_fd, buf, len, MSG_DONTWAIT, (struct sockaddr*) addr, sizeof(*addr)) < 0) {
+        fprintf(stderr, "link send failed (%s)\n", strerror(errno));
+    }
+}
+
+static void send_state(uint8_t type, struct sockaddr_in* to)
+{
+    uint8_t buf[ADJ_LINK_MESSAGE];
+    adj_link_state_t s;
+
+    s.type = type;
+    s.ttl = type == ADJ_LINK_BYEBYE ? 0 : ADJ_LINK_TTL;
+    memcpy(s.node, node_id, ADJ_LINK_ID_LEN);
+    s.timeline = timeline;
+    memcpy(s.session, session_id, ADJ_LINK_ID_LEN);
+    s.start_stop = start_stop;
+    s.mep_addr = ntohl(local_addr.sin_addr.s_addr);
+    s.mep_port = ntohs(local_addr.sin_port);
+    send_to(buf, link_state_encode(buf, sizeof(buf), &s), to);
+}
+
+static void send_ping(int64_t prev_ghost_time)
+{
+    uint8_t buf[ADJ_LINK_MESSAGE];
+    adj_link_ping_t k;
+
+    memset(&k, 0, sizeof(k));
+    k.type = ADJ_LINK_PING;
+    k.has = ADJ_LINK_HAS_HT | (prev_ghost_time ? ADJ_LINK_HAS_PGT : 0);
+    k.host_time = host_micros();
+    k.prev_ghost_time = prev_ghost_time;
+    measure.sent = adj_time_nanos();
+    send_to(buf, link_ping_encode(buf, sizeof(buf), &k), &measure.to);
+}
+
+/**
+ * answer a ping with our session and ghost time, followed by the ping's own payload
+ */
+static void send_pong(const uint8_t* ping, size_t len, struct sockaddr_in* to)
+{
+    uint8_t buf[ADJ_LINK_MESSAGE];
+    adj_link_ping_t k;
+    int n;
+
+    memset(&k, 0, sizeof(k));
+    k.type = ADJ_LINK_PONG;
+    k.has = ADJ_LINK_HAS_SESS | ADJ_LINK_HAS_GT;
+    memcpy(k.session, session_id, ADJ_LINK_ID_LEN);
+    k.ghost_time = host_micros() + ghost_offset;
+    n = link_ping_encode(buf, sizeof(buf), &k);
+    if (n == 0 || n + len - 9 > sizeof(buf)) return;
+    memcpy(buf + n, ping + 9, len - 9);
+    send_to(buf, n + len - 9, to);
+}
+
+static link_peer* find_peer(const uint8_t* node)
+{
+    for (int i = 0; i < ADJ_LINK_PEERS; i++) {
+        if (peers[i].used && same_id(peers[i].node, node)) return &peers[i];
+    }
+    return NULL;
+}
+
+static link_peer* find_free()
+{
+    for (int i = 0; i < ADJ_LINK_PEERS; i++) {
+        if ( ! peers[i].used ) {
+            memset(&peers[i], 0, sizeof(link_peer));
+            peers[i].used = 1;
+            return &peers[i];
+        }
+    }
+    return NULL;
+}
+
+static void count_peers()
+{
+    unsigned n = 0;
+    char what[32];
+
+    for (int i = 0; i < ADJ_LINK_PEERS; i++) {
+        if (peers[i].used && same_id(peers[i].session, session_id)) n++;
+    }
+    if (n != peer_count) {
+        peer_count = n;
+        snprintf(what, sizeof(what), "%u peer%s", n, n == 1 ? "" : "s");
+        message(what);
+    }
+}
+
+static int is_lost(const uint8_t* session, uint64_t now)
+{
+    for (int i = 0; i < ADJ_LINK_PEERS; i++) {
+        if (lost[i].retry > now && same_id(lost[i].id, session)) return 1;
+    }
+    return 0;
+}
+
+static void lose(const uint8_t* session)
+{
+    memcpy(lost[lost_next].id, session, ADJ_LINK_ID_LEN);
+    lost[lost_next].retry = adj_time_nanos() + LOST_RETRY * 1000000000L;
+    lost_next = (lost_next + 1) % ADJ_LINK_PEERS;
+}
+
+static void measure_start(const uint8_t* session, struct sockaddr_in* to)
+{
+    measure.active = 1;
+    memcpy(measure.session, session, ADJ_LINK_ID_LEN);
+    measure.to = *to;
+    measure.n = 0;
+    measure.tries = 0;
+    send_ping(0);
+}
+
+/**
+ * Join another session, its ghost clock is at offset from our host time.
+ * Its timeline is the latest its members have sent, start stop state is only kept on the old ghost clock
+ * so it is forgotten.
+ */
+static void join(const uint8_t* session, int64_t offset)
+{
+    memcpy(session_id, session, ADJ_LINK_ID_LEN);
+    ghost_offset = offset;
+    timeline.time_origin = INT64_MIN;
+    for (int i = 0; i < ADJ_LINK_PEERS; i++) {
+        if (peers[i].used && same_id(peers[i].session, session) && peers[i].timeline.time_origin > timeline.time_origin) {
+            timeline = peers[i].timeline;
+        }
+    }
+    start_stop.timestamp = 0;
+    followed_origin = INT64_MIN;
+    measured_at = adj_time_nanos();
+    message("joined a session");
+    count_peers();
+    send_state(ADJ_LINK_ALIVE, &group_addr);
+}
+
+/**
+ * the older session wins, ghost clocks start at 0 with the session so the older one is ahead,
+ * sessions the same age go to the lower id
+ */
+static void measured(int ok)
+{
+    measure.active = 0;
+    if ( ! ok ) {
+        if ( ! same_id(measure.session, session_id) ) lose(measure.session);
+        return;
+    }
+    int64_t offset = link_median(measure.data, measure.n);
+    if (same_id(measure.session, session_id)) {
+        // our own session measured again, clocks drift
+        ghost_offset = offset;
+        measured_at = adj_time_nanos();
+        return;
+    }
+    int64_t diff = offset - ghost_offset;
+    if (diff > ADJ_LINK_SESSION_EPS || (llabs(diff) < ADJ_LINK_SESSION_EPS && memcmp(measure.session, session_id, ADJ_LINK_ID_LEN) < 0)) {
+        join(measure.session, offset);
+    } else {
+        lose(measure.session);
+    }
+}
+
+/**
+ * two data points from each pong, the ping's host time against the ghost time halfway and
+ * the previous ghost time against the host time halfway
+ */
+static void pong(adj_link_ping_t* k, struct sockaddr_in* from)
+{
+    if ( ! measure.active || from->sin_addr.s_addr != measure.to.sin_addr.s_addr || from->sin_port != measure.to.sin_port ) return;
+    if ( ! (k->has & ADJ_LINK_HAS_SESS) || ! same_id(k->session, measure.session) ) {
+        measured(0);
+        return;
+    }
+    int64_t now = host_micros();
+    if (k->ghost_time && k->host_time) {
+        measure.data[measure.n++] = k->ghost_time - (now + k->host_time) / 2.0;
+        if (k->prev_ghost_time) {
+            measure.data[measure.n++] = (k->ghost_time + k->prev_ghost_time) / 2.0 - k->host_time;
+        }
+    }
+    if (measure.n > ADJ_LINK_PINGS) {
+        measured(1);
+    } else {
+        measure.tries = 0;
+        send_ping(k->ghost_time);
+    }
+}
+
+/**
+ * alive or response from another peer
+ */
+static void saw_peer(adj_link_state_t* s, struct sockaddr_in* from)
+{
+    link_peer* p;
+    uint64_t now = adj_time_nanos();
+
+    if ( (s->has & (ADJ_LINK_HAS_TMLN | ADJ_LINK_HAS_SESS)) != (ADJ_LINK_HAS_TMLN | ADJ_LINK_HAS_SESS) ) return;
+    if ( ! (p = find_peer(s->node)) && ! (p = find_free()) ) return;
+
+    memcpy(p->node, s->node, ADJ_LINK_ID_LEN);
+    memcpy(p->session, s->session, ADJ_LINK_ID_LEN);
+    p->timeline = s->timeline;
+    p->expires = now + s->ttl * 1000000000L;
+    if (s->has & ADJ_LINK_HAS_MEP4) {
+        p->mep.sin_family = AF_INET;
+        p->mep.sin_addr.s_addr = htonl(s->mep_addr);
+        p->mep.sin_port = htons(s->mep_port);
+    }
+
+    if (same_id(s->session, session_id)) {
+        // someone changed the tempo
+        if (s->timeline.time_origin > timeline.time_origin) timeline = s->timeline;
+    } else if ( ! measure.active && p->mep.sin_port && ! is_lost(s->session, now) ) {
+        measure_start(s->session, &p->mep);
+    }
+    count_peers();
+}
+
+static void discovery(uint8_t* buf, size_t len, struct sockaddr_in* from)
+{
+    adj_link_state_t s;
+    link_peer* p;
+
+    if (link_state_decode(buf, len, &s) != ADJ_OK || same_id(s.node, node_id)) return;
+    switch (s.type) {
+        case ADJ_LINK_ALIVE:
+            saw_peer(&s, from);
+            send_state(ADJ_LINK_RESPONSE, from);
+            break;
+        case ADJ_LINK_RESPONSE:
+            saw_peer(&s, from);
+            break;
+        case ADJ_LINK_BYEBYE:
+            if ( (p = find_peer(s.node)) ) p->used = 0;
+            count_peers();
+            break;
+    }
+}
+
+static void measurement(uint8_t* buf, size_t len, struct sockaddr_in* from)
+{
+    adj_link_ping_t k;
+
+    if (link_ping_decode(buf, len, &k) != ADJ_OK) return;
+    if (k.type == ADJ_LINK_PING) {
+        send_pong(buf, len, from);
+    } else if (k.type == ADJ_LINK_PONG) {
+        pong(&k, from);
+    }
+}
+
+static void read_socket(int fd, uint32_t events, void* data)
+{
+    uint8_t buf[ADJ_LINK_MESSAGE];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len;
+
+    while ( (len = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr*) &from, &from_len)) >= 0 ) {
+        if (len >= 8 && memcmp(buf, discovery_header, 8) == 0) {
+            discovery(buf, len, &from);
+        } else if (len >= 8 && memcmp(buf, measurement_header, 8) == 0 && fd == uni_fd) {
+            measurement(buf, len, &from);
+        }
+        from_len = sizeof(from);
+    }
+}
+
+/**
+ * A new session timeline from now at adj's tempo.  It carries on from the session's beat so peers do not jump,
+ * or when adj leads, from the nearest beat in phase with adj's bars.
+ */
+static void publish(uint64_t now, int lead)
+{
+    adj_beat_pos_t pos;
+    int64_t ghost = (int64_t) (now / 1000) + ghost_offset;
+
+    if (ghost <= timeline.time_origin) ghost = timeline.time_origin + 1;
+    int64_t beats = link_beats_at(&timeline, ghost);
+    if (lead && adj_timeline_position(link_adj, now, &pos) == ADJ_OK) {
+        beats += link_phase_diff(link_round(pos.beat * ADJ_LINK_MICRO_BEATS), beats, ADJ_LINK_QUANTUM * ADJ_LINK_MICRO_BEATS);
+    }
+    timeline.micros_per_beat = adj_bpm_to_micros(local_bpm);
+    timeline.beat_origin = beats;
+    timeline.time_origin = ghost;
+    followed_origin = ghost;
+}
+
+/**
+ * how far adj's bar is ahead of the session's at now, in micro beats
+ */
+static int64_t phase_diff(uint64_t now, adj_beat_pos_t* pos)
+{
+    int64_t ghost = (int64_t) (now / 1000) + ghost_offset;
+    return link_phase_diff(link_round(pos->beat * ADJ_LINK_MICRO_BEATS), link_beats_at(&timeline, ghost),
+        ADJ_LINK_QUANTUM * ADJ_LINK_MICRO_BEATS);
+}
+
+/**
+ * Nudge adj into phase with the session's bars, as difflock does with CDJs.
+ * Too far out to nudge, adj restarts its bar on the session's next one.
+ */
+static void align(uint64_t now, adj_beat_pos_t* pos)
+{
+    int64_t diff = phase_diff(now, pos);
+    int64_t ms = link_round((double) diff * timeline.micros_per_beat / ADJ_LINK_MICRO_BEATS / 1000);
+    uint64_t beat_nanos = timeline.micros_per_beat * 1000;
+
+    if (llabs(diff) > RESTART_BEATS) {
+        int64_t quantum = ADJ_LINK_QUANTUM * ADJ_LINK_MICRO_BEATS;
+        int64_t beats = link_beats_at(&timeline, (int64_t) (now / 1000) + ghost_offset);
+        int64_t bar = beats - link_phase(beats, quantum) + quantum;
+        uint64_t at = (uint64_t) (link_time_at(&timeline, bar) - ghost_offset) * 1000;
+        adj_restart_at(link_adj, at);
+        hold_until = at + beat_nanos;
+    } else if (llabs(ms) > PHASE_OK_MS) {
+        adj_nudge_millis(link_adj, ms > NUDGE_MAX_MS ? NUDGE_MAX_MS : ms < -NUDGE_MAX_MS ? -NUDGE_MAX_MS : ms);
+        hold_until = now + beat_nanos + SYNC_NANOS;
+    }
+}
+
+/**
+ * compare adj with the session, publish what changed on adj, and follow or lead the session
+ */
+static void sync_adj(uint64_t now)
+{
+    adj_beat_pos_t pos;
+    int changed = 0;
+    int follow = link_following;
+    float bpm = link_adj->bpm;
+    unsigned seq = transport_seq;
+
+    // a tempo asked for when following takes a moment to reach adj->bpm
+    if (pending_bpm > 0.0) {
+        if (bpm != pending_bpm && now < pending_until) return;
+        local_bpm = bpm;
+        pending_bpm = 0.0;
+    }
+    if (bpm != local_bpm) {
+        // changed on adj, e.g. from the keyboard
+        local_bpm = bpm;
+        publish(now, ! follow);
+        changed = 1;
+    }
+    if (seq != transport_seen) {
+        transport_seen = seq;
+        if ( ! follow && transport ) publish(now, 1);
+        start_stop.playing = transport;
+        start_stop.timestamp = (int64_t) (now / 1000) + ghost_offset;
+        start_stop.beats = link_beats_at(&timeline, start_stop.timestamp);
+        changed = 1;
+    }
+
+    int running = adj_timeline_position(link_adj, now, &pos) == ADJ_OK;
+    int64_t micros = adj_bpm_to_micros(local_bpm);
+
+    if (follow) {
+        if (timeline.time_origin != followed_origin) {
+            followed_origin = timeline.time_origin;
+            float session_bpm = adj_micros_to_bpm(timeline.micros_per_beat);
+            if (timeline.micros_per_beat != micros && session_bpm >= ADJ_MIN_BPM && session_bpm <= ADJ_MAX_BPM) {
+                pending_bpm = session_bpm;
+                pending_until = now + 1000000000L;
+                adj_set_tempo(link_adj, session_bpm);
+            }
+        }
+        // adj_bpm_to_micros() truncates, so a followed tempo can be a micro out
+        if (running && pending_bpm == 0.0 && now >= hold_until && llabs(timeline.micros_per_beat - micros) <= 1) {
+            align(now, &pos);
+        }
+    } else if (now >= hold_until) {
+        // leading, put back adj's tempo and bars if a peer changed them, or adj was nudged
+        int64_t ms = running ? link_round((double) phase_diff(now, &pos) * timeline.micros_per_beat / ADJ_LINK_MICRO_BEATS / 1000) : 0;
+        if (timeline.micros_per_beat != micros || llabs(ms) > PHASE_OK_MS) {
+            publish(now, 1);
+            hold_until = now + micros * 1000;
+            changed = 1;
+        }
+    }
+    if (changed) send_state(ADJ_LINK_ALIVE, &group_addr);
+}
+
+/**
+ * every SYNC_NANOS, pings time out, adj is synced with the session, and at the broadcast rate
+ * peers expire, our own session is measured again and we tell everyone we are alive
+ */
+static void tick(int fd, uint32_t events, void* data)
+{
+    uint64_t now = adj_time_nanos();
+    int i;
+
+    if (measure.active && now - measure.sent > ADJ_LINK_PING_TIMEOUT) {
+        if (++measure.tries == ADJ_LINK_PING_RETRIES) {
+            measured(0);
+        } else {
+            send_ping(0);
+        }
+    }
+
+    if (ticks++ % (ADJ_LINK_BROADCAST / SYNC_NANOS) == 0) {
+        for (i = 0; i < ADJ_LINK_PEERS; i++) {
+            if (peers[i].used && peers[i].expires < now) peers[i].used = 0;
+        }
+        count_peers();
+        if ( ! measure.active && ! same_id(session_id, node_id) && now - measured_at > ADJ_LINK_REMEASURE * 1000000000L ) {
+            for (i = 0; i < ADJ_LINK_PEERS; i++) {
+                if (peers[i].used && peers[i].mep.sin_port && same_id(peers[i].session, session_id)) {
+                    measure_start(session_id, &peers[i].mep);
+                    break;
+                }
+            }
+        }
+        send_state(ADJ_LINK_ALIVE, &group_addr);
+    }
+
+    sync_adj(now);
+}
+
+static void transport_change(int run)
+{
+    transport = run;
+    transport_seq++;
+}
+
+void adj_link_start()
+{
+    if (link_adj) transport_change(1);
+}
+
+void adj_link_stop()
+{
+    if (link_adj) transport_change(0);
+}
+
+void adj_link_follow(int on)
+{
+    link_following = on;
+}
+
+int adj_link_peers()
+{
+    return peer_count;
+}
+
+/**
+ * ipv4 address of iface, or of the first interface up that is not loopback
+ */
+static int iface_addr(const char* iface, struct in_addr* addr)
+{
+    struct ifaddrs *ifs, *i;
+    int rv = ADJ_ERR;
+
+    if (getifaddrs(&ifs) != 0) return ADJ_IO;
+    for (i = ifs; i; i = i->ifa_next) {
+        if ( ! i->ifa_addr || i->ifa_addr->sa_family != AF_INET || ! (i->ifa_flags & IFF_UP) ) continue;
+        if ( iface ? strcmp(iface, i->ifa_name) != 0 : (i->ifa_flags & IFF_LOOPBACK) != 0 ) continue;
+        *addr = ((struct sockaddr_in*) i->ifa_addr)->sin_addr;
+        rv = ADJ_OK;
+        break;
+    }
+    freeifaddrs(ifs);
+    return rv;
+}
+
+static void random_id(uint8_t* id)
+{
+    uint64_t seed = adj_time_nanos() ^ ((uint64_t) getpid() << 32);
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0 || read(fd, id, ADJ_LINK_ID_LEN) != ADJ_LINK_ID_LEN) {
+        for (int i = 0; i < ADJ_LINK_ID_LEN; i++) {
+            seed = seed * 6364136223846793005u + 1442695040888963407u;
+            id[i] = seed >> 56;
+        }
+    }
+    if (fd >= 0) close(fd);
+}
+
+int adj_link_init(adj_seq_info_t* adj, const char* iface, int follow)
+{
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    socklen_t addr_len = sizeof(local_addr);
+    int one = 1;
+
+    link_adj = adj;
+    link_following = follow;
+    random_id(node_id);
+    memcpy(session_id, node_id, ADJ_LINK_ID_LEN);
+
+    // a new session, its ghost clock starts now
+    ghost_offset = -host_micros();
+    local_bpm = adj->bpm;
+    timeline.micros_per_beat = adj_bpm_to_micros(local_bpm);
+    timeline.beat_origin = 0;
+    timeline.time_origin = 0;
+    followed_origin = 0;
+
+    memset(&group_addr, 0, sizeof(group_addr));
+    group_addr.sin_family = AF_INET;
+    group_addr.sin_port = htons(ADJ_LINK_PORT);
+    inet_pton(AF_INET, ADJ_LINK_GROUP, &group_addr.sin_addr);
+
+    memset(&local_addr, 0, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    if (iface_addr(iface, &local_addr.sin_addr) != ADJ_OK) return ADJ_ERR;
+
+    // alive messages from everyone, other Link apps on this host bind the same port
+    if ( (disc_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ) return ADJ_IO;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(ADJ_LINK_PORT);
+    mreq.imr_multiaddr = group_addr.sin_addr;
+    mreq.imr_interface = local_addr.sin_addr;
+    if ( setsockopt(disc_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+         bind(disc_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ||
+         setsockopt(disc_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0 ||
+         adj_reactor_add(disc_fd, read_socket, NULL) != ADJ_OK ) {
+        return ADJ_IO;
+    }
+
+    // our own port, it is the measurement endpoint too
+    if ( (uni_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ) return ADJ_IO;
+    if ( bind(uni_fd, (struct sockaddr*) &local_addr, sizeof(local_addr)) != 0 ||
+         getsockname(uni_fd, (struct sockaddr*) &local_addr, &addr_len) != 0 ||
+         setsockopt(uni_fd, IPPROTO_IP, IP_MULTICAST_IF, &local_addr.sin_addr, sizeof(local_addr.sin_addr)) != 0 ||
+         setsockopt(uni_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &one, sizeof(one)) != 0 ||
+         adj_reactor_add(uni_fd, read_socket, NULL) != ADJ_OK ) {
+        return ADJ_IO;
+    }
+
+    if ( ! adj_is_paused() ) adj_link_start();
+    if ( (timer_fd = adj_reactor_timer(SYNC_NANOS, 1, tick, NULL)) < 0 ) return ADJ_IO;
+    return ADJ_OK;
+}
+
+void adj_link_exit()
+{
+    if (uni_fd < 0) return;
+
+    send_state(ADJ_LINK_BYEBYE, &group_addr);
+    adj_reactor_remove(timer_fd);
+    adj_reactor_remove(disc_fd);
+    adj_reactor_remove(uni_fd);
+    close(timer_fd);
+    close(disc_fd);
+    close(uni_fd);
+    uni_fd = -1;
+}
@@ -0,0 +1,130 @@
+#ifndef _ADJ_LINK_INCLUDED_
+#define _ADJ_LINK_INCLUDED_
+
+#include "adj.h"
+
+/**
+ * Ableton Link peer, joins the Link session on a local interface and shares tempo and bar phase with
+ * Link enabled software on the network.
+ *
+ * adj publishes its tempo, and by default leads: the session gets adj's tempo and bars, including nudges.
+ * Following, adj takes tempo changes from the session instead, and nudges itself into phase with the session's bars.
+ *
+ * Link host time is ADJ_CLOCK in micros, the clock the libadj timeline records the queue's tempo changes on,
+ * so session beats map to queue ticks with adj_timeline_position() and adj_timeline_time().
+ * Runs on the input reactor.
+ */
+
+//SNIP_link_constants
+
+#define ADJ_LINK_GROUP          "224.76.78.75"
+#define ADJ_LINK_PORT           20808
+#define ADJ_LINK_ID_LEN         8
+#define ADJ_LINK_MESSAGE        512
+#define ADJ_LINK_TTL            5           // seconds peers remember us without hearing from us
+#define ADJ_LINK_BROADCAST      250000000L  // nanos between alive messages, ttl / 20 as Link does
+#define ADJ_LINK_PEERS          16
+#define ADJ_LINK_PINGS          100         // data points in a measurement of a session's ghost time
+#define ADJ_LINK_PING_TIMEOUT   50000000L   // nanos
+#define ADJ_LINK_PING_RETRIES   5
+#define ADJ_LINK_REMEASURE      30          // seconds between measurements of the session we are in
+#define ADJ_LINK_SESSION_EPS    500000      // micros, sessions closer in age than this are the same age
+#define ADJ_LINK_QUANTUM        ADJ_BEATS_PER_BAR
+#define ADJ_LINK_MICRO_BEATS    1000000     // beats are sent in millionths
+
+// discovery message types, after "_asdp_v\x01"
+#define ADJ_LINK_ALIVE          1
+#define ADJ_LINK_RESPONSE       2
+#define ADJ_LINK_BYEBYE         3
+
+// measurement message types, after "_link_v\x01"
+#define ADJ_LINK_PING           1
+#define ADJ_LINK_PONG           2
+
+// payload entry keys, four ascii letters
+#define ADJ_LINK_KEY_TMLN       0x746d6c6e  // timeline
+#define ADJ_LINK_KEY_SESS       0x73657373  // session membership
+#define ADJ_LINK_KEY_STST       0x73747374  // start stop state
+#define ADJ_LINK_KEY_MEP4       0x6d657034  // ipv4 measurement endpoint
+#define ADJ_LINK_KEY_HT         0x5f5f6874  // host time
+#define ADJ_LINK_KEY_GT         0x5f5f6774  // ghost time
+#define ADJ_LINK_KEY_PGT        0x5f706774  // previous ghost time
+
+// which entries a message had
+#define ADJ_LINK_HAS_TMLN       0x01
+#define ADJ_LINK_HAS_SESS       0x02
+#define ADJ_LINK_HAS_STST       0x04
+#define ADJ_LINK_HAS_MEP4       0x08
+#define ADJ_LINK_HAS_HT         0x10
+#define ADJ_LINK_HAS_GT         0x20
+#define ADJ_LINK_HAS_PGT        0x40
+
+/**
+ * beats at ghost time t are beat_origin + (t - time_origin) / micros_per_beat
+ */
+typedef struct {
+    int64_t     micros_per_beat;
+    int64_t     beat_origin;        // micro beats
+    int64_t     time_origin;        // ghost micros
+} adj_link_timeline_t;
+
+typedef struct {
+    uint8_t     playing;
+    int64_t     beats;              // micro beats
+    int64_t     timestamp;          // ghost micros of the change
+} adj_link_start_stop_t;
+
+// discovery message
+typedef struct {
+    uint8_t                 type;
+    uint8_t                 ttl;
+    uint8_t                 node[ADJ_LINK_ID_LEN];
+    uint32_t                has;
+    adj_link_timeline_t     timeline;
+    uint8_t                 session[ADJ_LINK_ID_LEN];
+    adj_link_start_stop_t   start_stop;
+    uint32_t                mep_addr;   // host byte order
+    uint16_t                mep_port;
+} adj_link_state_t;
+
+// ping or pong
+typedef struct {
+    uint8_t     type;
+    uint32_t    has;
+    uint8_t     session[ADJ_LINK_ID_LEN];
+    int64_t     host_time;
+    int64_t     ghost_time;
+    int64_t     prev_ghost_time;
+} adj_link_ping_t;
+
+//SNIP_link_constants
+
+/**
+ * join the Link session on iface, e.g. "eth0", NULL for the first interface that is up.
+ * follow takes tempo and phase from the session, otherwise adj leads.
+ * Call after adj_reactor_init().
+ */
+int adj_link_init(adj_seq_info_t* adj, const char* iface, int follow);
+
+/**
+ * switch between following and leading the session
+ */
+void adj_link_follow(int on);
+
+/**
+ * transport, published to peers with start stop sync enabled, call from the start and stop handlers
+ */
+void adj_link_start();
+void adj_link_stop();
+
+/**
+ * peers in the session, not counting adj
+ */
+int adj_link_peers();
+
+/**
+ * say goodbye to the session
+ */
+void adj_link_exit();
+
+#endif // _ADJ_LINK_INCLUDED_
@@ -1,35 +1,78 @@
 
-#include <pthread.h>
 #include <stdatomic.h>
+#include <poll.h>
 
 #include "adj_midiin.h"
+#include "adj_bpm_tap.h"
+#include "adj_reactor.h"
 
 // Global state
 static unsigned _Atomic adj_midiin_running = ATOMIC_VAR_INIT(1);
 
+// input has its own alsa client so reads never block or share buffers with clock output
+static snd_seq_t* in_seq = NULL;
+static int in_port = -1;
+static char in_client_name[ADJ_MAX_CLIENT_LEN];
+static struct pollfd* in_pfd = NULL;
+static int in_npfd = 0;
+
+// input timestamps, adj->q stops when paused so input is timestamped by a queue that is always running
+static int tsq = -1;
+static uint64_t tsq_epoch = 0;  // adj_time_nanos() when tsq started
+
+// time from a midi event arriving to it being handled
+static adj_histogram_t input_latency;
+static struct mm_reactor_info* in_info = NULL;     // set once the map is loaded
+
 
 // slider magic, use two buttons and any volume type control as a pitch adjust slider
 
 static unsigned int slider_on = 0;
 static int slider_value = -1;
+static float slider_smooth = -1.0;
+static float slider_applied = -1.0;     // smoothed position the tempo was last adjusted to
 
-static void do_slider(adj_seq_info_t *adj, int value)
+static void do_slider(adj_seq_info_t *adj, int value, uint64_t nanos)
 {
     if (slider_value == -1) {
         slider_value = value;
         return;
     }
     if (value - slider_value) {
-        adj_adjust_tempo(adj, (value - slider_value) * 0.1);
+        adj_adjust_tempo_at(adj, (value - slider_value) * 0.1, nanos);
         slider_value = value;
     }
 }
 
+/**
+ * 14 bit slider, same throw as the 7 bit slider in 128 times smaller steps.
+ * Input is smoothed so lsb jitter from the fader does not wobble the tempo, movement smaller than half a step
+ * is carried over until it adds up so a slow move still gets every step.
+ */
+static void do_slider14(adj_seq_info_t *adj, int value, uint64_t nanos)
+{
+    if (slider_smooth < 0) {
+        slider_smooth = slider_applied = value;
+        return;
+    }
+    slider_smooth += (value - slider_smooth) * 0.25;
+    if (slider_smooth - slider_applied > 0.5 || slider_applied - slider_smooth > 0.5) {
+        adj_adjust_tempo_at(adj, (slider_smooth - slider_applied) * 0.1 / 128, nanos);
+        slider_applied = slider_smooth;
+    }
+}
+
+// 14 bit controller state per channel
+static unsigned char cc_msb[ADJ_MIDIIN_CHANNELS][32];
+static unsigned short nrpn_number[ADJ_MIDIIN_CHANNELS];
+static unsigned char nrpn_msb[ADJ_MIDIIN_CHANNELS];
+static unsigned char nrpn_selected[ADJ_MIDIIN_CHANNELS];   // data entry is for an nrpn, not an rpn
+
 /**
  * MIDI in module for receiving cue, nudges and tempo from a midi controller
  */
 
-struct mm_thread_info {
+struct mm_reactor_info {
     adj_seq_info_t* adj;
     adj_midiin_map* map;
 };
@@ -60,6 +103,10 @@ static int range_check(const char* item, int line_no, long int num, char* endptr
  ()
  * # name      ch ctrl  val
  * start       0  80    127
+ * tap         0  n36   *
+ * slider      0  pb    *
+ * slider      0  h7    *
+ * slider      0  r1234 *
  */
 static int parse_line(char* line, int line_no, adj_midiin_map* map) 
 {
@@ -101,6 +148,8 @@ static int parse_line(char* line, int line_no, adj_midiin_map* map)
     else if ( strcmp("slider_on", name) == 0 )   idx = ADJ_MIDIIN_SLIDER_ON - 1;
     else if ( strcmp("slider_off", name) == 0 )  idx = ADJ_MIDIIN_SLIDER_OFF - 1;
 
+    else if ( strcmp("tap", name) == 0 )         idx = ADJ_MIDIIN_TAP - 1;
+
     else {
         fprintf(stderr, "syntax error line:%i invalid name: '%s'\n", line_no, name);
         return ADJ_SYNTAX;
@@ -118,17 +167,42 @@ static int parse_line(char* line, int line_no, adj_midiin_map* map)
         map->op[idx].channel = (unsigned char) ch;
     }
 
-    // controller
-    ctl = strtol(controller, &endptr, 10);
-    if ( range_check("controller", line_no, ctl, endptr, 0, 127) ) {
-        return ADJ_SYNTAX;
+    // controller, note number, pitch bend or 14 bit controller
+    if (strncmp("pb", controller, 2) == 0) {
+        map->op[idx].type = ADJ_MIDIIN_TYPE_PITCHBEND;
+        map->op[idx].controller = 0;
+    }
+    else {
+        long int max = 127;
+        if (controller[0] == 'n') {
+            map->op[idx].type = ADJ_MIDIIN_TYPE_NOTE;
+            controller++;
+        } else if (controller[0] == 'h') {
+            map->op[idx].type = ADJ_MIDIIN_TYPE_CC14;
+            max = 31;
+            controller++;
+        } else if (controller[0] == 'r') {
+            map->op[idx].type = ADJ_MIDIIN_TYPE_NRPN;
+            max = 16383;
+            controller++;
+        } else {
+            map->op[idx].type = ADJ_MIDIIN_TYPE_CC;
+        }
+        ctl = strtol(controller, &endptr, 10);
+        if ( range_check("controller", line_no, ctl, endptr, 0, max) ) {
+            return ADJ_SYNTAX;
+        }
+        map->op[idx].controller = (unsigned short) ctl;
     }
-    map->op[idx].controller = (unsigned char) ctl;
 
     // value
     if (strncmp("*", value, 1) == 0) {
         map->op[idx].value = ADJ_ANY_VALUE;
     }
+    else if (map->op[idx].type >= ADJ_MIDIIN_TYPE_PITCHBEND) {
+        fprintf(stderr, "syntax error line:%i 14 bit controls only support value '*'\n", line_no);
+        return ADJ_SYNTAX;
+    }
     else {
         val = strtol(value, &endptr, 10);
         if ( range_check("ctrl value", line_no, val, endptr, 0, 127) ) {
@@ -140,6 +214,93 @@ static int parse_line(char* line, int line_no, adj_midiin_map* map)
     return ADJ_OK;
 }
 
+/**
+ * build the lookup table from the ops read from the file, ops with the same key are chained in op order
+ */
+static void compile_map(adj_midiin_map* map)
+{
+    int i, j, c;
+    unsigned char* head;
+    adj_midiin_map_op* op;
+
+    memset(map->lut, 0, sizeof(map->lut));
+    memset(map->next, 0, sizeof(map->next));
+    map->nrpn_count = 0;
+
+    for ( i = 0; i < ADJ_MAX_OP; i++ ) {
+        op = &map->op[i];
+        if (op->channel == ADJ_UNSET_VALUE) continue;
+
+        if (op->type == ADJ_MIDIIN_TYPE_NRPN) {
+            if (map->nrpn_count < ADJ_MIDIIN_MAX_NRPN) {
+                map->nrpn[map->nrpn_count++] = i + 1;
+            }
+            continue;
+        }
+
+        for ( c = 0; c < ADJ_MIDIIN_CHANNELS; c++ ) {
+            if (op->channel != ADJ_ANY_CHANNNEL && op->channel != c) continue;
+            head = &map->lut[op->type][c][op->controller & 0x7f];
+            if (*head == 0) {
+                *head = i + 1;
+            }
+            else {
+                // append, links only go to higher ops so a chain may pass through ops for other channels
+                j = *head;
+                while (map->next[j]) j = map->next[j];
+                if (j != i + 1) map->next[j] = i + 1;
+            }
+        }
+    }
+}
+
+/**
+ * a midi message reduced to what the map can match on
+ */
+typedef struct {
+    unsigned char type;
+    unsigned char channel;
+    unsigned short number;
+    int           value;
+} midi_msg;
+
+static int match_value(adj_midiin_map_op* op, midi_msg* msg)
+{
+    if (op->value == ADJ_ANY_VALUE) {
+        // for notes any value matches note on only, so buttons that send note off do not fire twice
+        return msg->type != ADJ_MIDIIN_TYPE_NOTE || msg->value;
+    }
+    return op->value == msg->value;
+}
+
+/**
+ * match a read midi event to an adj operation
+ */
+static int match_midi(adj_midiin_map* map, midi_msg* msg)
+{
+    int i;
+    adj_midiin_map_op* op;
+
+    if (msg->type == ADJ_MIDIIN_TYPE_NRPN) {
+        for ( i = 0; i < map->nrpn_count; i++ ) {
+            op = &map->op[map->nrpn[i] - 1];
+            if ( (op->channel == ADJ_ANY_CHANNNEL || op->channel == msg->channel) && op->controller == msg->number ) {
+                return map->nrpn[i];
+            }
+        }
+        return 0;
+    }
+
+    for ( i = map->lut[msg->type][msg->channel & 0x0f][msg->number & 0x7f]; i ; i = map->next[i] ) {
+        op = &map->op[i - 1];
+        if ( (op->channel == ADJ_ANY_CHANNNEL || op->channel == msg->channel) && match_value(op, msg) ) {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
 /**
  * read a midi mapper file, e.g. /etc/adj-midimap.adjmm
  */
@@ -149,6 +310,7 @@ static adj_midiin_map* read_map(adj_seq_info_t *adj, const char* path)
 
     adj_midiin_map* map = calloc(1, sizeof(adj_midiin_map));
     for ( i = 0; i < ADJ_MAX_OP; i++ ) {
+        map->op[i].type = ADJ_MIDIIN_TYPE_CC;
         map->op[i].channel = ADJ_UNSET_VALUE;    // 128 == impossible channel value
         map->op[i].controller = ADJ_UNSET_VALUE; // 128 == impossible controller value
     }
@@ -171,6 +333,8 @@ static adj_midiin_map* read_map(adj_seq_info_t *adj, const char* path)
     free(line);
     fclose(fp);
 
+    compile_map(map);
+
     /*
     for ( i = 0; i < ADJ_MAX_OP; i++ ) {
         if (map->op[i].controller == ADJ_UNSET_VALUE) {
@@ -184,170 +348,340 @@ static adj_midiin_map* read_map(adj_seq_info_t *adj, const char* path)
 
 //SNIP_midiin_parser
 
+static int set_msg(midi_msg* msg, unsigned char type, unsigned char channel, unsigned short number, int value)
+{
+    msg->type = type;
+    msg->channel = channel;
+    msg->number = number;
+    msg->value = value;
+    return 1;
+}
+
 /**
- * match a read midi control event to an adj operation
+ * convert an alsa event to midi_msgs, returns how many, 0 for events that cannot be mapped.
+ * A controller can be a 7 bit cc and also complete a 14 bit cc or nrpn, 14 bit values are complete when the lsb arrives.
  */
-static int match_midi(adj_midiin_map* map, snd_seq_event_t* ev)
+static int decode_midi(snd_seq_event_t* ev, midi_msg msg[3])
 {
-    int i;
-    snd_seq_ev_ctrl_t ctrl = ev->data.control;
+    int n = 0;
+    unsigned char ch;
+    unsigned int param;
+    int value;
+
+    switch (ev->type) {
+        case SND_SEQ_EVENT_CONTROLLER:
+            ch = ev->data.control.channel & 0x0f;
+            param = ev->data.control.param & 0x7f;
+            value = ev->data.control.value & 0x7f;
+            n += set_msg(&msg[n], ADJ_MIDIIN_TYPE_CC, ch, param, value);
+            if (param < 32) {
+                cc_msb[ch][param] = value;
+            }
+            else if (param < 64) {
+                n += set_msg(&msg[n], ADJ_MIDIIN_TYPE_CC14, ch, param - 32, cc_msb[ch][param - 32] << 7 | value);
+            }
+            if (param == 99) {
+                nrpn_number[ch] = value << 7 | (nrpn_number[ch] & 0x7f);
+                nrpn_selected[ch] = 1;
+            }
+            else if (param == 98) {
+                nrpn_number[ch] = (nrpn_number[ch] & 0x3f80) | value;
+                nrpn_selected[ch] = 1;
+            }
+            else if (param == 101 || param == 100) {
+                // data entry after an rpn select is for the rpn, e.g. pitch bend range
+                nrpn_selected[ch] = 0;
+            }
+            else if (param == 6) {
+                nrpn_msb[ch] = value;
+            }
+            else if (param == 38 && nrpn_selected[ch]) {
+                n += set_msg(&msg[n], ADJ_MIDIIN_TYPE_NRPN, ch, nrpn_number[ch], nrpn_msb[ch] << 7 | value);
+            }
+            return n;
+        case SND_SEQ_EVENT_CONTROL14:
+            // alsa has already paired msb and lsb
+            if (ev->data.control.param < 32) {
+                return set_msg(&msg[0], ADJ_MIDIIN_TYPE_CC14, ev->data.control.channel & 0x0f, ev->data.control.param, ev->data.control.value & 0x3fff);
+            }
+            return 0;
+        case SND_SEQ_EVENT_NONREGPARAM:
+            return set_msg(&msg[0], ADJ_MIDIIN_TYPE_NRPN, ev->data.control.channel & 0x0f, ev->data.control.param & 0x3fff, ev->data.control.value & 0x3fff);
+        case SND_SEQ_EVENT_NOTEON:
+        case SND_SEQ_EVENT_NOTEOFF:
+            return set_msg(&msg[0], ADJ_MIDIIN_TYPE_NOTE, ev->data.note.channel & 0x0f, ev->data.note.note & 0x7f,
+                ev->type == SND_SEQ_EVENT_NOTEON ? ev->data.note.velocity : 0);
+        case SND_SEQ_EVENT_PITCHBEND:
+            // -8192 to 8191
+            return set_msg(&msg[0], ADJ_MIDIIN_TYPE_PITCHBEND, ev->data.control.channel & 0x0f, 0, (ev->data.control.value + 8192) & 0x3fff);
+    }
+    return 0;
+}
 
-    for ( i = 0; i < ADJ_MAX_OP; i++ ) {
-        if (
-            (map->op[i].channel == ADJ_ANY_CHANNNEL || map->op[i].channel == ctrl.channel) &&
-            map->op[i].controller == ctrl.param &&
-            ( map->op[i].value == ADJ_ANY_VALUE || map->op[i].value == ctrl.value)
-            ) {
-            return i + 1;
-        }
+/**
+ * when the event arrived, from the timestamp alsa added to the event, on the same clock as adj_time_nanos()
+ */
+static uint64_t event_nanos(snd_seq_event_t* ev)
+{
+    if (tsq_epoch && ev->queue == tsq && (ev->flags & SND_SEQ_TIME_STAMP_MASK) == SND_SEQ_TIME_STAMP_REAL) {
+        return tsq_epoch + (uint64_t) ev->time.time.tv_sec * 1000000000L + ev->time.time.tv_nsec;
     }
+    return adj_time_nanos();
+}
 
-    return 0;
+static void dispatch(adj_seq_info_t* adj, int op, midi_msg* msg, uint64_t nanos)
+{
+    adj_trace_at(ADJ_TRACE_MIDI_IN, op, msg->value, nanos);
+    switch (op) {
+        case ADJ_MIDIIN_START:
+            adj_start(adj);
+            break;
+        case ADJ_MIDIIN_STOP:
+            adj_stop(adj);
+            break;
+        case ADJ_MIDIIN_TOGGLE:
+            adj_toggle(adj);
+            break;
+        case ADJ_MIDIIN_Q_RESTART:
+            adj_quantized_restart(adj);
+            break;
+
+        case ADJ_MIDIIN_NUDGE_FWD:
+            adj_nudge_at(adj, 10, nanos);
+            break;
+        case ADJ_MIDIIN_NUDGE_FFWD:
+            adj_nudge_at(adj, 20, nanos);
+            break;
+        case ADJ_MIDIIN_NUDGE_REW:
+            adj_nudge_at(adj, -10, nanos);
+            break;
+        case ADJ_MIDIIN_NUDGE_FREW:
+            adj_nudge_at(adj, -20, nanos);
+            break;
+
+        case ADJ_MIDIIN_TEMPO_INC_MIN:
+            adj_adjust_tempo_at(adj, 0.01, nanos);
+            break;
+        case ADJ_MIDIIN_TEMPO_INC:
+            adj_adjust_tempo_at(adj, 0.1, nanos);
+            break;
+        case ADJ_MIDIIN_TEMPO_INC_1:
+            adj_adjust_tempo_at(adj, 1.0, nanos);
+            break;
+        case ADJ_MIDIIN_TEMPO_DEC_MIN:
+            adj_adjust_tempo_at(adj, -0.01, nanos);
+            break;
+        case ADJ_MIDIIN_TEMPO_DEC:
+            adj_adjust_tempo_at(adj, -0.1, nanos);
+            break;
+        case ADJ_MIDIIN_TEMPO_DEC_1:
+            adj_adjust_tempo_at(adj, -1.0, nanos);
+            break;
+
+        case ADJ_MIDIIN_SLIDER_ON:
+            adj->data_change_handler(adj, ADJ_ITEM_OP, "slide on");
+            slider_on = 1;
+            slider_value = -1;
+            slider_smooth = -1.0;
+            slider_applied = -1.0;
+            break;
+        case ADJ_MIDIIN_SLIDER_OFF:
+            adj->data_change_handler(adj, ADJ_ITEM_OP, "slide off");
+            slider_on = 0;
+            slider_value = -1;
+            slider_smooth = -1.0;
+            slider_applied = -1.0;
+            break;
+        case ADJ_MIDIIN_SLIDER:
+            if (! slider_on) {
+                adj->message_handler(adj, "slider is off");
+            } else if (msg->type == ADJ_MIDIIN_TYPE_CC || msg->type == ADJ_MIDIIN_TYPE_NOTE) {
+                do_slider(adj, msg->value, nanos);
+            } else {
+                do_slider14(adj, msg->value, nanos);
+            }
+            break;
+
+        case ADJ_MIDIIN_TAP:
+            if (adj_bpm_tap_at(adj, nanos)) {
+                adj->data_change_handler(adj, ADJ_ITEM_OP, "tapped");
+            }
+            break;
+    }
 }
 
-static void* read_midiin(void* arg)
+static void handle_event(adj_seq_info_t* adj, adj_midiin_map* map, snd_seq_event_t* ev, uint64_t nanos)
 {
-    struct mm_thread_info* tinfo = arg;
-    adj_seq_info_t* adj = tinfo->adj;
-    adj_midiin_map* map = tinfo->map;
+    midi_msg msg[3];
+    int i, n, op;
+    uint64_t now;
 
-    //int unread = 0;
+    if ( ! (n = decode_midi(ev, msg)) ) return;
 
-    // set blocking mode, snd_seq_event_input() returns if there is an event,or timeout
-    snd_seq_nonblock(adj->alsa_seq, 0);
+    for ( i = 0; i < n; i++ ) {
+        if ( (op = match_midi(map, &msg[i])) ) {
+            dispatch(adj, op, &msg[i], nanos);
+            now = adj_time_nanos();
+            adj_histogram_add(&input_latency, now > nanos ? (now - nanos) / 1000 : 0);
+        }
+    }
+}
 
+/**
+ * handle all pending input, the handle is non-blocking so this returns when the alsa buffer is empty
+ */
+static void drain_midiin(adj_seq_info_t* adj, adj_midiin_map* map)
+{
     snd_seq_event_t* ev = NULL;
+    int rv;
 
-    while (adj_midiin_running) {
-        
-        //unread = snd_seq_event_input_pending(adj->alsa_seq, 1);
-        //while (unread && snd_seq_event_input_pending(adj->alsa_seq, 0) > 0) {
-
-            if ( snd_seq_event_input(adj->alsa_seq, &ev) < 0 ) continue;
-
-            if (ev->type == SND_SEQ_EVENT_CONTROLLER) {
-                switch (match_midi(map, ev)) {
-                    case 0: {
-                        // printf("unused midi in message\n");
-                        continue;
-                    }
-                    case ADJ_MIDIIN_START: {
-                        adj_start(adj);
-                        continue;
-                    }
-                    case ADJ_MIDIIN_STOP: {
-                        adj_stop(adj);
-                        continue;
-                    }
-                    case ADJ_MIDIIN_TOGGLE: {
-                        adj_toggle(adj);
-                        continue;
-                    }
-                    case ADJ_MIDIIN_Q_RESTART: {
-                        adj_quantized_restart(adj);
-                        continue;
-                    }
-
-                    case ADJ_MIDIIN_NUDGE_FWD: {
-                        adj_nudge(adj, 10);
-                        continue;
-                    }
-                    case ADJ_MIDIIN_NUDGE_FFWD: {
-                        adj_nudge(adj, 20);
-                        continue;
-                    }
-                    case ADJ_MIDIIN_NUDGE_REW: {
-                        adj_nudge(adj, -10);
-                        continue;
-                    }
-                    case ADJ_MIDIIN_NUDGE_FREW: {
-                        adj_nudge(adj, -20);
-                        continue;
-                    }
-
-                    case ADJ_MIDIIN_TEMPO_INC_MIN: {
-                        adj_adjust_tempo(adj, 0.01);
-                        continue;
-                    }
-                    case ADJ_MIDIIN_TEMPO_INC: {
-                        adj_adjust_tempo(adj, 0.1);
-                        continue;
-                    }
-                    case ADJ_MIDIIN_TEMPO_INC_1: {
-                        adj_adjust_tempo(adj, 1.0);
-                        continue;
-                    }
-                    case ADJ_MIDIIN_TEMPO_DEC_MIN: {
-                        adj_adjust_tempo(adj, -0.01);
-                        continue;
-                    }
-                    case ADJ_MIDIIN_TEMPO_DEC: {
-                        adj_adjust_tempo(adj, -0.1);
-                        continue;
-                    }
-                    case ADJ_MIDIIN_TEMPO_DEC_1: {
-                        adj_adjust_tempo(adj, -1.0);
-                        continue;
-                    }
-
-                    case ADJ_MIDIIN_SLIDER_ON: {
-                        adj->data_change_handler(adj, ADJ_ITEM_OP, "slide on");
-                        slider_on = 1;
-                        slider_value = -1;
-                        continue;
-                    }
-                    case ADJ_MIDIIN_SLIDER_OFF: {
-                        adj->data_change_handler(adj, ADJ_ITEM_OP, "slide off");
-                        slider_on = 0;
-                        slider_value = -1;
-                        continue;
-                    }
-                    case ADJ_MIDIIN_SLIDER: {
-                        if (slider_on) {
-                            do_slider(adj, ev->data.control.value);
-                        } else {
-                            adj->message_handler(adj, "slider is off");
-                        }
-                        continue;
-                    }
-                    // default, is sleep
-                }
-            }
-        //}
-        // thus stop resolution is 1/4 beat
-        //adj_one_beat_sleep(adj->bpm * 4);
+    while ( (rv = snd_seq_event_input(in_seq, &ev)) >= 0 || rv == -ENOSPC ) {
+
+        if (rv == -ENOSPC) {
+            adj->message_handler(adj, "warn: midi in overrun");
+            continue;
+        }
+
+        handle_event(adj, map, ev, event_nanos(ev));
+    }
+}
+
+static void read_midiin(int fd, uint32_t events, void* data)
+{
+    struct mm_reactor_info* tinfo = data;
+
+    if (adj_midiin_running) {
+        drain_midiin(tinfo->adj, tinfo->map);
+    }
+}
+
+/**
+ * create alsa client "<seq_name>-in" with a "control" port
+ */
+static int init_seq(adj_seq_info_t* adj)
+{
+    if ( snd_seq_open(&in_seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK) < 0 ) {
+        return ADJ_ALSA_SEQ_OPEN;
+    }
+    snprintf(in_client_name, ADJ_MAX_CLIENT_LEN, "%s-in", adj->seq_name);
+    snd_seq_set_client_name(in_seq, in_client_name);
+
+    in_port = snd_seq_create_simple_port(in_seq, "control", SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE, SND_SEQ_PORT_TYPE_APPLICATION);
+    if (in_port < 0) {
+        return ADJ_ALSA_PORT_OPEN;
+    }
+
+    return ADJ_OK;
+}
+
+/**
+ * timestamp midi events on arrival with a queue that is always running
+ */
+static int init_timestamps()
+{
+    snd_seq_port_info_t* pinfo;
+
+    tsq = snd_seq_alloc_named_queue(in_seq, "adjin");
+    if (tsq < 0) {
+        return ADJ_ALSA_QUEUE_ALLOC;
     }
+    snd_seq_start_queue(in_seq, tsq, NULL);
+    snd_seq_drain_output(in_seq);
 
-    return NULL;
+    snd_seq_port_info_alloca(&pinfo);
+    if (snd_seq_get_port_info(in_seq, in_port, pinfo) < 0) {
+        return ADJ_ALSA;
+    }
+    snd_seq_port_info_set_timestamping(pinfo, 1);
+    snd_seq_port_info_set_timestamp_real(pinfo, 1);
+    snd_seq_port_info_set_timestamp_queue(pinfo, tsq);
+    if (snd_seq_set_port_info(in_seq, in_port, pinfo) < 0) {
+        return ADJ_ALSA;
+    }
+
+    tsq_epoch = adj_time_nanos();
+    return ADJ_OK;
 }
 
 
 int adj_midiin(adj_seq_info_t *adj)
 {
-    pthread_t thread_id;
+    int i;
 
     adj_midiin_map* map = read_map(adj, "/etc/adj-midimap.adjmm");
     if (map == NULL) {
         return ADJ_SYNTAX;
     }
 
-    struct mm_thread_info *tinfo = calloc(1, sizeof(struct mm_thread_info));
+    int rv;
+    if ( (rv = init_seq(adj)) != ADJ_OK ) {
+        return rv;
+    }
+
+    if (init_timestamps() != ADJ_OK) {
+        adj->message_handler(adj, "warn: midi input is not timestamped");
+    }
+
+    struct mm_reactor_info *tinfo = calloc(1, sizeof(struct mm_reactor_info));
     if (tinfo == NULL) {
         return ADJ_ALLOC;
     }
 
     tinfo->adj = adj;
     tinfo->map = map;
+    in_info = tinfo;
 
-    int s = pthread_create(&thread_id, NULL, &read_midiin, tinfo);
-    if (s != 0) {
-        return ADJ_THREAD;
+    // register alsa's descriptors with the input reactor
+    in_npfd = snd_seq_poll_descriptors_count(in_seq, POLLIN);
+    in_pfd = calloc(in_npfd, sizeof(struct pollfd));
+    if (in_pfd == NULL) {
+        return ADJ_ALLOC;
+    }
+    snd_seq_poll_descriptors(in_seq, in_pfd, in_npfd, POLLIN);
+    for (i = 0; i < in_npfd; i++) {
+        if ( (rv = adj_reactor_add(in_pfd[i].fd, read_midiin, tinfo)) != ADJ_OK ) {
+            return rv;
+        }
     }
 
     return ADJ_OK;
 }
 
+int adj_midiin_event(snd_seq_event_t* ev, uint64_t nanos)
+{
+    if ( ! in_info || ! adj_midiin_running ) return ADJ_RTFM;
+    handle_event(in_info->adj, in_info->map, ev, nanos);
+    return ADJ_OK;
+}
+
 void adj_midiin_exit()
 {
     adj_midiin_running = 0;
+    for (int i = 0; i < in_npfd; i++) {
+        adj_reactor_remove(in_pfd[i].fd);
+    }
+}
+
+/**
+ * alsa client name for midi input, e.g. aconnect 'nanoKONTROL' 'adj-in:control'
+ */
+char* adj_midiin_client_name()
+{
+    return in_client_name;
+}
+
+int adj_midiin_address(snd_seq_addr_t* addr)
+{
+    if (in_seq == NULL) return ADJ_RTFM;
+    addr->client = snd_seq_client_id(in_seq);
+    addr->port = in_port;
+    return ADJ_OK;
+}
+
+/**
+ * histogram of micros from a midi event arriving to it being handled
+ */
+adj_histogram_t* adj_midiin_latency()
+{
+    return &input_latency;
 }
@@ -26,32 +26,61 @@
 #define ADJ_MIDIIN_SLIDER_ON        17
 #define ADJ_MIDIIN_SLIDER_OFF       18
 
-#define ADJ_MAX_OP                  18
+#define ADJ_MIDIIN_TAP              19
+
+#define ADJ_MAX_OP                  19
 
 #define ADJ_ANY_CHANNNEL           0
 #define ADJ_UNSET_VALUE            128
 #define ADJ_ANY_VALUE              129
 
+// midi message types that can be mapped
+#define ADJ_MIDIIN_TYPE_CC         0  // e.g. 80       control change
+#define ADJ_MIDIIN_TYPE_NOTE       1  // e.g. n36      note on, value is velocity, note off is value 0
+#define ADJ_MIDIIN_TYPE_PITCHBEND  2  // pb            pitch bend, 14 bit value 0 - 16383
+#define ADJ_MIDIIN_TYPE_CC14       3  // e.g. h7       14 bit control change, msb on cc 7 lsb on cc 39
+#define ADJ_MIDIIN_TYPE_NRPN       4  // e.g. r1234    14 bit non-registered parameter number
+#define ADJ_MIDIIN_TYPES           4  // types in the lookup table, nrpn numbers are too large
+
+#define ADJ_MIDIIN_CHANNELS        16
+#define ADJ_MIDIIN_MAX_NRPN        8
+
 /**
  * midi map operation
  */
 typedef struct {
+    unsigned char type;
     unsigned char channel;
-    unsigned char controller;
+    unsigned short controller;  // cc or note number, nrpn 0 - 16383
     unsigned char value;
 } adj_midiin_map_op;
 
 /**
- * midi map
+ * midi map, ops as read from the file compiled to a lookup table by (type, channel, number).
+ * lut and next hold op index + 1, 0 is the end of a chain
  */
 typedef struct {
     adj_midiin_map_op op[ADJ_MAX_OP];
+    unsigned char lut[ADJ_MIDIIN_TYPES][ADJ_MIDIIN_CHANNELS][128];
+    unsigned char next[ADJ_MAX_OP + 1];
+    unsigned char nrpn[ADJ_MIDIIN_MAX_NRPN];
+    unsigned char nrpn_count;
 } adj_midiin_map;
 
 //SNIP_midiin_constants
 
 
 int adj_midiin(adj_seq_info_t* adj);
+
+/**
+ * map and dispatch an event from another source, e.g. network midi, as if it had arrived on adj-in:control at nanos.
+ * Call on the reactor thread after adj_midiin().
+ */
+int adj_midiin_event(snd_seq_event_t* ev, uint64_t nanos);
+
 void adj_midiin_exit();
+adj_histogram_t* adj_midiin_latency();
+char* adj_midiin_client_name();
+int adj_midiin_address(snd_seq_addr_t* addr);
 
 #endif // _ADJ_MIDIIN_INCLUDED_
\ No newline at end of file
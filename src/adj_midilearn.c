@@ -16,8 +16,23 @@ static void usage()
 static void print_midi(FILE* f, char* item, snd_seq_event_t* ev)
 {
     snd_seq_ev_ctrl_t ctrl = ev->data.control;
+    snd_seq_ev_note_t note = ev->data.note;
 
-    fprintf(f, "%s    %i    %i    %i\n", item, ctrl.channel, ctrl.param, ctrl.value);
+    if (ev->type == SND_SEQ_EVENT_NOTEON) {
+        fprintf(f, "%s    %i    n%i    *\n", item, note.channel, note.note);
+    }
+    else if (ev->type == SND_SEQ_EVENT_PITCHBEND) {
+        fprintf(f, "%s    %i    pb    *\n", item, ctrl.channel);
+    }
+    else if (ev->type == SND_SEQ_EVENT_CONTROL14) {
+        fprintf(f, "%s    %i    h%i    *\n", item, ctrl.channel, ctrl.param);
+    }
+    else if (ev->type == SND_SEQ_EVENT_NONREGPARAM) {
+        fprintf(f, "%s    %i    r%i    *\n", item, ctrl.channel, ctrl.param);
+    }
+    else {
+        fprintf(f, "%s    %i    %i    %i\n", item, ctrl.channel, ctrl.param, ctrl.value);
+    }
 }
 
 static void midi_discard(adj_seq_info_t* adj)
@@ -39,7 +54,8 @@ static void midi_learn(adj_seq_info_t* adj, FILE* f, char* item)
 
     // read and print the first event
     snd_seq_event_input(adj->alsa_seq, &ev);
-    if (ev && ev->type == SND_SEQ_EVENT_CONTROLLER) {
+    if (ev && (ev->type == SND_SEQ_EVENT_CONTROLLER || ev->type == SND_SEQ_EVENT_NOTEON || ev->type == SND_SEQ_EVENT_PITCHBEND ||
+               ev->type == SND_SEQ_EVENT_CONTROL14 || ev->type == SND_SEQ_EVENT_NONREGPARAM)) {
         print_midi(f, item, ev);
     }
 
@@ -124,5 +140,8 @@ int main(int argc, char* argv[])
     midi_learn(adj, f, "slider_on");
     midi_learn(adj, f, "slider_off");
 
+    // tap tempo, typically a drum pad
+    midi_learn(adj, f, "tap");
+
     return 0;
 }
\ No newline at end of file
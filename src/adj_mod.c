@@ -9,54 +9,31 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <glob.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "adj.h"
+#include "adj_mod.h"
+#include "adj_reactor.h"
 
 /**
- * code to read /etc/adj/modules.conf and auto laod any modules for 
- * known USB devices
+ * code to read /etc/adj/modules.conf and load modules for known USB devices
+ * as they are plugged in, and unload them when they are unplugged
  */
 
 //SNIP SNIP_mod
 
-static int MAX_DEVS = 640;  // should be enough for everone
-static char* usb_ids[640];  // NULL terminated list of USB devices
+#define ADJ_MOD_CONF_MAX    64   // usb ids in modules.conf
 
+typedef struct {
+    char usb_id[10];
+    char* module;
+    char* args;              // NULL or the rest of the line after the module name
+} mod_conf_entry;
 
-/**
- * iterate all usb devices
- */
-static int
-find_all_usb_devs()
-{
-    libusb_device **list;
-    struct libusb_device_descriptor desc;
-    ssize_t num_devs, i, devi;
-    devi = 0;
-    usb_ids[devi] = NULL;
-
-    libusb_context *ctx;
-    if (libusb_init(&ctx)) {
-        fprintf(stderr, "unable to initialize libusb\n");
-        return ADJ_ERR;
-    }
-
-    num_devs = libusb_get_device_list(ctx, &list);
-    if (num_devs < 0) return ADJ_ERR;
-
-    for (i = 0; i < num_devs && i < MAX_DEVS -1; ++i) {
-        libusb_device *dev = list[i];
-        libusb_get_device_descriptor(dev, &desc);
-
-        char* dev_s = calloc(1, 10);
-        snprintf(dev_s, 10, "%04x:%04x", desc.idVendor, desc.idProduct);
-        //printf("dev found %s\n", dev_s);
-        usb_ids[devi++] = dev_s;
-        usb_ids[devi] = NULL;
-    }
-
-    return ADJ_OK;
-}
+static mod_conf_entry mod_conf[ADJ_MOD_CONF_MAX];
+static int mod_conf_len = 0;
 
 static char*
 copy(char* value)
@@ -73,47 +50,92 @@ static char*
 trim(char* value)
 {
     while ( isspace((unsigned char) value[0]) ) value++;
-    int i = strlen(value);
-    while ( isspace((unsigned char) value[i]) ) value[i--] = '\0';
+    int i = strlen(value) - 1;
+    while ( i >= 0 && isspace((unsigned char) value[i]) ) value[i--] = '\0';
     return value;
 }
 
-static int
-find_device(char* usb_id) 
+static void
+add_conf(char* usb_id, char* value)
+{
+    char* c;
+    if (mod_conf_len == ADJ_MOD_CONF_MAX || *value == '\0') return;
+
+    mod_conf_entry* e = &mod_conf[mod_conf_len++];
+    snprintf(e->usb_id, sizeof(e->usb_id), "%s", usb_id);
+    e->module = copy(value);
+    e->args = NULL;
+    if ( e->module && (c = index(e->module, ' ')) ) {
+        *c++ = '\0';
+        e->args = trim(c);
+    }
+}
+
+/**
+ * module for a usb id e.g. "054c:0268", NULL if there is none
+ */
+static mod_conf_entry*
+lookup_mod(const char* usb_id)
 {
     int i;
-    for (i = 0 ; i < MAX_DEVS; i++) {
-        if ( usb_ids[i] == NULL ) return 0;
-        if ( strncmp(usb_ids[i], usb_id, 10) == 0 ) {
-            return 1;
+    for (i = 0 ; i < mod_conf_len; i++) {
+        if ( strncmp(mod_conf[i].usb_id, usb_id, 10) == 0 ) {
+            return &mod_conf[i];
         }
     }
-    return 0;
+    return NULL;
 }
-
+/**
+ * read the whole file in one go, returns NULL on error, closes in
+ */
 static char*
+read_all(int in, ssize_t* len)
+{
+    struct stat st;
+    ssize_t rc;
+    char* buf = NULL;
+
+    *len = 0;
+    if ( fstat(in, &st) == 0 && (buf = malloc(st.st_size + 1)) ) {
+        while ( *len < st.st_size && (rc = read(in, buf + *len, st.st_size - *len)) > 0 ) {
+            *len += rc;
+        }
+        if (*len < st.st_size) {
+            fprintf(stderr, "read error\n");
+            free(buf);
+            buf = NULL;
+        }
+    }
+    close(in);
+    return buf;
+}
+
+/**
+ * parse modules.conf into mod_conf, returns the number of entries
+ */
+static int
 parse_modules_conf(int in)
 {
-    int rc;
     char  c;
     char line[256];
     char* value = NULL;
     int line_pos = 0;
     int is_name = 1;
     int is_comment = 0;
+    ssize_t pos = 0, len;
 
-    for (line_pos = 0 ; line_pos < 256;) {
+    char* buf = read_all(in, &len);
+    if (buf == NULL) {
+        return 0;
+    }
 
-        rc = read(in, &c, 1);
+    for (line_pos = 0 ; line_pos < 256;) {
 
-        if ( rc == 0 ) {
+        if ( pos == len ) {
             // EoF
-            return NULL;
-        }
-        else if ( rc < 0 ) {
-            fprintf(stderr, "read error\n");
-            return NULL;
+            break;
         }
+        c = buf[pos++];
 
         if (line_pos == 0 && c == '#') {
             is_comment = 1;
@@ -121,11 +143,9 @@ parse_modules_conf(int in)
         }
 
         if ( c == '\n' ) {
-            if (is_comment == 0 && line_pos > 3) {
+            if (is_comment == 0 && line_pos > 3 && value) {
                 line[line_pos++] = '\0';
-                if ( find_device(trim(line)) ) {
-                    return copy(trim(value));
-                }
+                add_conf(trim(line), trim(value));
             }
             value = NULL;
             is_name = 1;
@@ -147,17 +167,18 @@ parse_modules_conf(int in)
         }
 
     }
-    return NULL;
+    free(buf);
+    return mod_conf_len;
 }
 
 
-static char*
-select_mod()
+static int
+read_modules_conf()
 {
     int in = open("/etc/adj/modules.conf", O_RDONLY);
     if ( in == -1 ) {
         fprintf(stderr, "cannot open /etc/adj/modules.conf\n");
-        return NULL;
+        return 0;
     }
     return parse_modules_conf(in);
 }
@@ -165,11 +186,145 @@ select_mod()
 //SNIP SNIP_mod
 
 
-static void*
-adj_load_mod(adj_seq_info_t* adj, char* module, char* args, uint32_t flags)
+// module lifecycle, modules are loaded when their usb device arrives and unloaded when it leaves
+
+#define ADJ_MOD_MAX          8            // modules running at once
+#define ADJ_MOD_PENDING      32           // usb events queued by one libusb_handle_events() call
+#define ADJ_MOD_RETRIES      20           // the joystick device node appears a little after the usb device
+#define ADJ_MOD_RETRY_NANOS  250000000L
+
+typedef struct {
+    mod_conf_entry* conf;    // NULL when the slot is free
+    void* handle;
+    int (*init)(adj_seq_info_t*, char*, uint32_t);
+    void (*exit)();
+    char usb_path[32];       // sysfs name e.g. "1-2.4", "" when loaded by name
+    uint8_t bus;
+    uint8_t address;
+    int running;
+    int retry_fd;
+    int retries;
+} adj_mod_t;
+
+typedef struct {
+    int arrived;
+    uint8_t bus;
+    uint8_t address;
+    char usb_id[10];
+    char usb_path[32];
+} usb_event;
+
+static adj_mod_t mods[ADJ_MOD_MAX];
+static usb_event pending[ADJ_MOD_PENDING];
+static int pending_len = 0;
+
+static adj_seq_info_t* mod_adj = NULL;
+static uint32_t mod_flags = 0;
+static libusb_context* usb_ctx = NULL;
+
+/**
+ * the joystick device created for a usb device, found via sysfs e.g.
+ * /sys/bus/usb/devices/1-2/1-2:1.0/0003:054C:0268.0001/input/input5/js0
+ */
+static int
+find_js_dev(const char* usb_path, char* dev, size_t len)
+{
+    char pattern[128];
+    glob_t g;
+    int found = 0;
+
+    snprintf(pattern, sizeof(pattern), "/sys/bus/usb/devices/%s/%s:*/*/input/input*/js*", usb_path, usb_path);
+    if ( glob(pattern, 0, NULL, &g) == 0 && g.gl_pathc > 0 ) {
+        snprintf(dev, len, "/dev/input/%s", rindex(g.gl_pathv[0], '/') + 1);
+        found = 1;
+    }
+    globfree(&g);
+    return found;
+}
+
+static void
+unload_mod(adj_mod_t* m)
+{
+    if (m->retry_fd >= 0) {
+        adj_reactor_remove(m->retry_fd);
+        close(m->retry_fd);
+        m->retry_fd = -1;
+    }
+    if (m->running && m->exit) m->exit();
+    if (m->handle) dlclose(m->handle);
+    memset(m, 0, sizeof(adj_mod_t));
+    m->retry_fd = -1;
+}
+
+static void retry_mod(int fd, uint32_t events, void* data);
+
+/**
+ * call the module's adj_mod_init(), args from modules.conf win, otherwise pass the device node if we can find it
+ */
+static int
+start_mod(adj_mod_t* m)
+{
+    char dev[64];
+    char* args = m->conf->args;
+
+    if (args == NULL && m->usb_path[0]) {
+        if ( find_js_dev(m->usb_path, dev, sizeof(dev)) ) {
+            args = dev;
+        } else if (m->retries++ < ADJ_MOD_RETRIES) {
+            // wait for udev
+            if (m->retry_fd < 0) {
+                m->retry_fd = adj_reactor_timer(ADJ_MOD_RETRY_NANOS, 1, retry_mod, m);
+            }
+            return ADJ_OK;
+        }
+    }
+
+    if (m->retry_fd >= 0) {
+        adj_reactor_remove(m->retry_fd);
+        close(m->retry_fd);
+        m->retry_fd = -1;
+    }
+
+    if (m->init && m->init(mod_adj, args, mod_flags) != ADJ_OK) {
+        fprintf(stderr, "module %s failed to start\n", m->conf->module);
+        return ADJ_ERR;
+    }
+    m->running = 1;
+    // usb hotplug starts modules on the reactor thread, the ui's data_item_handler takes its own lock
+    mod_adj->ui->data_item_handler(mod_adj->ui, ADJ_ITEM_KEYB, "joystick:", m->conf->module);
+    return ADJ_OK;
+}
+
+static void
+retry_mod(int fd, uint32_t events, void* data)
+{
+    adj_mod_t* m = data;
+    if (m->conf && ! m->running && start_mod(m) != ADJ_OK) {
+        unload_mod(m);
+    }
+}
+
+static adj_mod_t*
+load_mod(mod_conf_entry* conf)
 {
     char mod_path[256];
-    snprintf(mod_path, 255, "/usr/lib/adj/adj_%s.so", module);
+    adj_mod_t* m = NULL;
+    int i;
+
+    for (i = 0; i < ADJ_MOD_MAX; i++) {
+        if (mods[i].conf && strcmp(mods[i].conf->module, conf->module) == 0) {
+            // module state is global to the .so
+            fprintf(stderr, "module %s is already running\n", conf->module);
+            return NULL;
+        }
+        if (m == NULL && mods[i].conf == NULL) m = &mods[i];
+    }
+    if (m == NULL) {
+        fprintf(stderr, "too many modules\n");
+        return NULL;
+    }
+
+    snprintf(mod_path, 255, "/usr/lib/adj/adj_%s.so", conf->module);
 
     void* mod = dlopen(mod_path, RTLD_NOW | RTLD_GLOBAL);
     if (mod == NULL) {
@@ -177,43 +332,215 @@ adj_load_mod(adj_seq_info_t* adj, char* module, char* args, uint32_t flags)
         return NULL;
     }
 
-    int ( * adj_mod_init)(adj_seq_info_t*, char*, uint32_t);
-    void ( * adj_mod_exit)();
+    m->conf = conf;
+    m->handle = mod;
+    m->retry_fd = -1;
+    m->init = (int (*)(adj_seq_info_t*, char*, uint32_t)) dlsym(mod, "adj_mod_init");
+    m->exit = (void (*)()) dlsym(mod, "adj_mod_exit");
+    return m;
+}
 
-    adj_mod_init = (int (*)(adj_seq_info_t*, char*, uint32_t)) dlsym(mod, "adj_mod_init");
-    if (adj_mod_init) {
-        adj_mod_init(adj, args, flags);
+static void
+usb_arrived(usb_event* ev)
+{
+    mod_conf_entry* conf = lookup_mod(ev->usb_id);
+    if (conf == NULL) return;
+
+    adj_mod_t* m = load_mod(conf);
+    if (m == NULL) return;
+
+    m->bus = ev->bus;
+    m->address = ev->address;
+    snprintf(m->usb_path, sizeof(m->usb_path), "%s", ev->usb_path);
+    if (start_mod(m) != ADJ_OK) {
+        unload_mod(m);
     }
-    adj_mod_exit = (void (*)()) dlsym(mod, "adj_mod_exit");
-    if (adj_mod_exit) {
-        return adj_mod_exit;
+}
+
+static void
+usb_left(usb_event* ev)
+{
+    int i;
+    for (i = 0; i < ADJ_MOD_MAX; i++) {
+        if (mods[i].conf && mods[i].usb_path[0] && mods[i].bus == ev->bus && mods[i].address == ev->address) {
+            unload_mod(&mods[i]);
+            mod_adj->ui->data_item_handler(mod_adj->ui, ADJ_ITEM_KEYB, "joystick:", "off");
+        }
+    }
+}
+
+static void
+process_pending()
+{
+    int i;
+    for (i = 0; i < pending_len; i++) {
+        if (pending[i].arrived) {
+            usb_arrived(&pending[i]);
+        } else {
+            usb_left(&pending[i]);
+        }
+    }
+    pending_len = 0;
+}
+
+/**
+ * libusb calls this from libusb_handle_events(), and during registration for devices already plugged in.
+ * Events are only queued, modules are loaded after libusb returns.
+ */
+static int LIBUSB_CALL
+usb_hotplug(libusb_context* ctx, libusb_device* dev, libusb_hotplug_event event, void* data)
+{
+    struct libusb_device_descriptor desc;
+    uint8_t ports[7];
+    int i, n, len;
+
+    if (pending_len == ADJ_MOD_PENDING) {
+        fprintf(stderr, "warn: usb hotplug overrun\n");
+        return 0;
+    }
+    usb_event* ev = &pending[pending_len];
+    ev->arrived = event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED;
+    ev->bus = libusb_get_bus_number(dev);
+    ev->address = libusb_get_device_address(dev);
+    if (ev->arrived) {
+        libusb_get_device_descriptor(dev, &desc);
+        snprintf(ev->usb_id, sizeof(ev->usb_id), "%04x:%04x", desc.idVendor, desc.idProduct);
+        if (lookup_mod(ev->usb_id) == NULL) return 0;
+
+        len = snprintf(ev->usb_path, sizeof(ev->usb_path), "%i-", ev->bus);
+        n = libusb_get_port_numbers(dev, ports, sizeof(ports));
+        for (i = 0; i < n && len < (int) sizeof(ev->usb_path); i++) {
+            len += snprintf(ev->usb_path + len, sizeof(ev->usb_path) - len, i ? ".%i" : "%i", ports[i]);
+        }
+    }
+    pending_len++;
+    return 0;
+}
+
+static void
+read_usb(int fd, uint32_t events, void* data)
+{
+    struct timeval zero = { 0, 0 };
+    libusb_handle_events_timeout_completed(usb_ctx, &zero, NULL);
+    process_pending();
+}
+
+static void
+usb_pollfd_added(int fd, short events, void* data)
+{
+    adj_reactor_add(fd, read_usb, NULL);
+}
+
+static void
+usb_pollfd_removed(int fd, void* data)
+{
+    adj_reactor_remove(fd);
+}
+
+// usb scan runs in parallel with other slow startup e.g. vdj discovery
+static pthread_t scan_thread;
+static int scan_started = 0;
+
+static void*
+scan_usb(void* arg)
+{
+    libusb_hotplug_callback_handle handle;
+
+    if ( read_modules_conf() == 0 ) {
+        return NULL;
+    }
+    if ( libusb_init(&usb_ctx) ) {
+        fprintf(stderr, "unable to initialize libusb\n");
+        return NULL;
+    }
+    if ( ! libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) ||
+         libusb_hotplug_register_callback(usb_ctx,
+             LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT, LIBUSB_HOTPLUG_ENUMERATE,
+             LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+             usb_hotplug, NULL, &handle) != LIBUSB_SUCCESS ) {
+        fprintf(stderr, "libusb hotplug is not supported\n");
+        libusb_exit(usb_ctx);
+        usb_ctx = NULL;
     }
     return NULL;
 }
 
+int
+adj_mod_scan_start()
+{
+    if ( pthread_create(&scan_thread, NULL, scan_usb, NULL) != 0 ) {
+        return ADJ_THREAD;
+    }
+    scan_started = 1;
+    return ADJ_OK;
+}
 
 /**
- * returns exit function if there is one
+ * start modules for devices already plugged in and watch for more, returns the number of modules started
  */
-void*
+int
 adj_mod_autoconfigure(adj_seq_info_t* adj, uint32_t flags)
 {
-    find_all_usb_devs();
-    char *module = select_mod();
-    char *args = NULL;
-    char *c = NULL;
-    if (module) {
-        if ( (c = index(module, ' ')) ) {
-            *c++ = '\0';
-            args = c;
+    const struct libusb_pollfd** fds;
+    int i, count = 0;
+
+    if (scan_started) {
+        pthread_join(scan_thread, NULL);
+        scan_started = 0;
+    } else {
+        scan_usb(NULL);
+    }
+    mod_adj = adj;
+    mod_flags = flags;
+
+    // devices present at startup were queued when the callback was registered
+    process_pending();
+    for (i = 0; i < ADJ_MOD_MAX; i++) {
+        if (mods[i].conf) count++;
+    }
+
+    if (usb_ctx) {
+        // hotplug events arrive on libusb's descriptors, no timeouts are needed since we make no transfers
+        if ( (fds = libusb_get_pollfds(usb_ctx)) ) {
+            for (i = 0; fds[i]; i++) {
+                adj_reactor_add(fds[i]->fd, read_usb, NULL);
+            }
+            libusb_free_pollfds(fds);
         }
-        return adj_load_mod(adj, module, args, flags);
+        libusb_set_pollfd_notifiers(usb_ctx, usb_pollfd_added, usb_pollfd_removed, NULL);
     }
-    return NULL;
+    return count;
 }
 
-void*
+int
 adj_mod_manual_configure(adj_seq_info_t* adj, char *module, uint32_t flags)
 {
-    return adj_load_mod(adj, module, NULL, flags);
+    static mod_conf_entry conf;
+    adj_mod_t* m;
+
+    mod_adj = adj;
+    mod_flags = flags;
+
+    conf.module = module;
+    conf.args = NULL;
+    if ( (m = load_mod(&conf)) == NULL ) {
+        return ADJ_ERR;
+    }
+    if (start_mod(m) != ADJ_OK) {
+        unload_mod(m);
+        return ADJ_ERR;
+    }
+    return ADJ_OK;
+}
+
+void
+adj_mod_stop_all()
+{
+    int i;
+    for (i = 0; i < ADJ_MOD_MAX; i++) {
+        if (mods[i].running && mods[i].exit) {
+            mods[i].running = 0;
+            mods[i].exit();
+        }
+    }
 }
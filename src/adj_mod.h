@@ -1,8 +1,27 @@
 #ifndef _ADJ_MOD_INCLUDED_
 #define _ADJ_MOD_INCLUDED_
 
-void* adj_mod_autoconfigure(adj_seq_info_t* adj, uint32_t flags);
+/**
+ * Controller modules, loaded from /usr/lib/adj when a usb device listed in /etc/adj/modules.conf
+ * is plugged in and unloaded when it is removed. Several modules can run at once.
+ */
 
-void* adj_mod_manual_configure(adj_seq_info_t* adj, char *module, uint32_t flags);
+/**
+ * start scanning usb devices in the background, adj_mod_autoconfigure() waits for it to finish
+ */
+int adj_mod_scan_start();
 
-#endif // _ADJ_MOD_INCLUDED_
\ No newline at end of file
+/**
+ * start modules for devices already plugged in and load others as they arrive, returns the number started
+ */
+int adj_mod_autoconfigure(adj_seq_info_t* adj, uint32_t flags);
+
+int adj_mod_manual_configure(adj_seq_info_t* adj, char *module, uint32_t flags);
+
+/**
+ * call every running module's adj_mod_exit(), at teardown on the reactor thread once adj_reactor_run() returned.
+ * Not safe to call from a signal handler, a module's exit closes its device and may join its threads.
+ */
+void adj_mod_stop_all();
+
+#endif // _ADJ_MOD_INCLUDED_
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+
+#include "adj.h"
+#include "adj_cli.h"
+#include "adj_mod.h"
+#include "adj_reactor.h"
+#include "adj_remote.h"
+
+/**
+ * Controller module host for adjd. Modules are loaded here rather than in the daemon,
+ * their calls to adj_nudge(), adj_vdj_copy_bpm() etc. become commands on the control socket,
+ * so a module that crashes or blocks takes this process down and the clock keeps running.
+ */
+
+static adj_ui_t ui = {0};
+
+static void usage()
+{
+    printf("adj-mod [-n name] [-M module]\n");
+    printf("    runs controller modules for usb devices listed in /etc/adj/modules.conf\n");
+    printf("options:\n");
+    printf("    -n - sequencer name of the adj to control (default 'adj')\n");
+    printf("    -M - load one controller module by name instead of scanning usb devices\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static void message_handler(adj_seq_info_t* adj, char* message)
+{
+    adj->ui->message_handler(adj->ui, adj, message);
+}
+
+static void on_signal(int fd, uint32_t events, void* data)
+{
+    struct signalfd_siginfo si;
+
+    if ( read(fd, &si, sizeof(si)) == sizeof(si) ) {
+        adj_reactor_exit();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    char* seq_name = "adj";
+    char* module = NULL;
+    uint32_t flags = 0;
+    int c, rv, sfd;
+
+    while ( ( c = getopt(argc, argv, "n:M:h") ) != EOF) {
+        switch (c) {
+            case 'n':
+                seq_name = optarg;
+                break;
+            case 'M':
+                module = optarg;
+                break;
+            case 'h':
+                usage();
+                break;
+        }
+    }
+
+    adj_seq_info_t* adj = adj_calloc();
+    adj->seq_name = seq_name;
+    adj->ui = &ui;
+    adj->message_handler = message_handler;
+    initialize_cli(&ui, 0);
+
+    sigset_t signal_mask;
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGINT);
+    sigaddset(&signal_mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signal_mask, NULL);
+
+    if (! module) adj_mod_scan_start();
+
+    if ( adj_reactor_init() != ADJ_OK ) {
+        fprintf(stderr, "input reactor init failed\n");
+        return 1;
+    }
+    if ( (sfd = signalfd(-1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0 || adj_reactor_add(sfd, on_signal, adj) != ADJ_OK ) {
+        fprintf(stderr, "signalfd failed\n");
+        return 1;
+    }
+    if ( (rv = adj_remote_connect(adj, seq_name)) != ADJ_OK ) {
+        fprintf(stderr, "%s: not running? %i\n", adj_remote_path(), rv);
+        return 1;
+    }
+    if (adj_remote_has_vdj()) flags |= ADJ_HAS_VDJ;
+    ui.data_item_handler(&ui, ADJ_ITEM_PORT, "control:", adj_remote_path());
+
+    if (module) {
+        if ( adj_mod_manual_configure(adj, module, flags) != ADJ_OK ) {
+            return 1;
+        }
+    } else if ( adj_mod_autoconfigure(adj, flags) == 0 ) {
+        fprintf(stderr, "no usb controller found, waiting for one\n");
+    }
+
+    // runs until adjd quits or a signal
+    adj_reactor_run();
+
+    adj_mod_stop_all();
+    adj_remote_close();
+    ui.exit_handler(&ui, 0);
+    return 0;
+}
@@ -4,6 +4,7 @@
 #include "adj.h"
 #include "adj_keyb.h"
 #include "adj_vdj.h"
+#include "adj_reactor.h"
 
 /**
  * Number pad PC keyboard input
@@ -19,11 +20,6 @@ static unsigned int difflock = 0;
 static unsigned _Atomic adj_numpad_running = ATOMIC_VAR_INIT(0);
 
 
-struct thread_info {
-    pthread_t       thread_id;
-    adj_seq_info_t* adj;
-};
-
 static void init_term()
 {
     term_orig = (struct termios*) calloc(1, sizeof(struct termios));
@@ -83,141 +79,162 @@ void adj_numpad_reset_term()
     }
 }
 
-static void* read_keys(void* arg)
-{
-    adj_seq_info_t* adj = arg;
-    char ch;
-    uint8_t player_id;
+// escape sequence state, arrows keys come as Esc[A page up as Esc[5~
+#define NUMPAD_ESC_NONE   0
+#define NUMPAD_ESC        1  // Esc
+#define NUMPAD_ESC_CSI    2  // Esc[
+#define NUMPAD_PG_DOWN    3  // Esc[6
+#define NUMPAD_PG_UP      4  // Esc[5
 
-    while (adj_numpad_running) {
-        if (adj_is_running()) {
-            // arrows keys come as Esc[A
-            ch = getchar();
-            if (EOF == ch) {
-                fprintf(stderr, "EOF keyboard input failed\n");
-                break;
-            }
-            //printf("keyb input '%i'\n", (int)ch);
-            else if (ch == '\033') {
-                ch = getchar();
-                if (ch == '[') {
-                    ch = getchar();
-                    switch(ch) {
-                        case 'C':// right
-                            if (difflock) {
-                                adj_vdj_difflock_nudge(adj, 1);
-                            } else {
-                                adj_nudge(adj, 10);
-                            }
-                            continue;
-                        case 'D':// left
-                            if (difflock) {
-                                adj_vdj_difflock_nudge(adj, -1);
-                            } else {
-                                adj_nudge(adj, -10);
-                            }
-                            continue;
-                        case 'A': // up
-                            adj_nudge(adj, 20);
-                            continue;
-                        case 'B':// down
-                            adj_nudge(adj, -20);
-                            continue;
-                        case 'H':// home key
-                            adj_quantized_restart(adj);
-                            continue;
-                        case 'F':// end key
-                            adj_vdj_difflock_arff(adj);
-                            difflock_master = 0;
-                            continue;
-                        case '6': // pg down
-                            ch = getchar();
-                            if (ch == '~') {
-                                if (difflock) {
-                                    adj_vdj_difflock_nudge(adj, -1);
-                                } else {
-                                    adj_adjust_tempo(adj, -0.1);
-                                }
-                            }
-                            continue;
-                        case '5': // pg up
-                            ch = getchar();
-                            if (ch == '~') {
-                                if (difflock) {
-                                    adj_vdj_difflock_nudge(adj, 1);
-                                } else {
-                                    adj_adjust_tempo(adj, 0.1);
-                                }
-                            }
-                            continue;
-                        default: 
-                            continue;
-                            
-                            
-                            
-                    }
-                }
+static int esc_state = NUMPAD_ESC_NONE;
 
-                continue;
-            } 
-            // enter toggles on off
-            else if (ch == '\n') {
-                adj_toggle(adj);
-            } 
-            // plus and minus, 0.1 resolution only
-            else if (ch == '+') {
+static void escape_key(adj_seq_info_t* adj, char ch)
+{
+    int state = esc_state;
+    esc_state = NUMPAD_ESC_NONE;
+
+    if (state == NUMPAD_ESC) {
+        if (ch == '[') esc_state = NUMPAD_ESC_CSI;
+    }
+    else if (state == NUMPAD_ESC_CSI) {
+        switch(ch) {
+            case 'C':// right
                 if (difflock) {
                     adj_vdj_difflock_nudge(adj, 1);
                 } else {
-                    adj_adjust_tempo(adj, 0.1);
+                    adj_nudge(adj, 10);
                 }
-            } 
-            else if (ch == '-') {
+                break;
+            case 'D':// left
                 if (difflock) {
                     adj_vdj_difflock_nudge(adj, -1);
                 } else {
-                    adj_adjust_tempo(adj, -0.1);
-                }
-            }
-            // copy bpm and sync to master player
-            else if (ch == '*') {
-                player_id = adj_vdj_copy_master(adj);
-                if (player_id) {
-                    adj_vdj_difflock(adj, player_id, 1);
-                    difflock = 1;
-                }
-            }
-            // copy bpm and sync to the other player
-            else if (ch == '/') {
-                player_id = adj_vdj_copy_other(adj);
-                if (player_id) {
-                    adj_vdj_difflock(adj, player_id, 1);
-                    difflock = 1;
+                    adj_nudge(adj, -10);
                 }
-            }
-            // numbers, typing bpm directly
-            else if (ch == '.' || (ch >= '0' && ch <= '9')) {
-                    if (add_char_bpm(ch)) {
-                        float bpm = get_bpm();
-                        if (bpm > 0) {
-                            adj_set_tempo(adj, bpm);
-                        }
-                        // setting bpm to 000.00 removes diff lock, but does not set tempo
-                        adj_vdj_difflock_arff(adj);
-                        reset_char_bpm();
-                    }
-                continue;
-            } else {
-                //printf("%i\n", (int)ch);
-            }
+                break;
+            case 'A': // up
+                adj_nudge(adj, 20);
+                break;
+            case 'B':// down
+                adj_nudge(adj, -20);
+                break;
+            case 'H':// home key
+                adj_quantized_restart(adj);
+                break;
+            case 'F':// end key
+                adj_vdj_difflock_arff(adj);
+                difflock_master = 0;
+                break;
+            case '6': // pg down
+                esc_state = NUMPAD_PG_DOWN;
+                break;
+            case '5': // pg up
+                esc_state = NUMPAD_PG_UP;
+                break;
+        }
+    }
+    else if (state == NUMPAD_PG_DOWN && ch == '~') {
+        if (difflock) {
+            adj_vdj_difflock_nudge(adj, -1);
+        } else {
+            adj_adjust_tempo(adj, -0.1);
         }
+    }
+    else if (state == NUMPAD_PG_UP && ch == '~') {
+        if (difflock) {
+            adj_vdj_difflock_nudge(adj, 1);
+        } else {
+            adj_adjust_tempo(adj, 0.1);
+        }
+    }
+}
+
+/**
+ * handle one byte of numpad input
+ */
+static void key_input(adj_seq_info_t* adj, char ch)
+{
+    uint8_t player_id;
+
+    if (esc_state != NUMPAD_ESC_NONE) {
+        escape_key(adj, ch);
+        return;
+    }
 
-        reset_char_bpm();
-        // quarter beat sleep
-        adj_one_beat_sleep(adj->bpm * 4);
+    //printf("keyb input '%i'\n", (int)ch);
+    if (ch == '\033') {
+        esc_state = NUMPAD_ESC;
+        return;
+    } 
+    // enter toggles on off
+    else if (ch == '\n') {
+        adj_toggle(adj);
+    } 
+    // plus and minus, 0.1 resolution only
+    else if (ch == '+') {
+        if (difflock) {
+            adj_vdj_difflock_nudge(adj, 1);
+        } else {
+            adj_adjust_tempo(adj, 0.1);
+        }
+    } 
+    else if (ch == '-') {
+        if (difflock) {
+            adj_vdj_difflock_nudge(adj, -1);
+        } else {
+            adj_adjust_tempo(adj, -0.1);
+        }
+    }
+    // copy bpm and sync to master player
+    else if (ch == '*') {
+        player_id = adj_vdj_copy_master(adj);
+        if (player_id) {
+            adj_vdj_difflock(adj, player_id, 1);
+            difflock = 1;
+        }
+    }
+    // copy bpm and sync to the other player
+    else if (ch == '/') {
+        player_id = adj_vdj_copy_other(adj);
+        if (player_id) {
+            adj_vdj_difflock(adj, player_id, 1);
+            difflock = 1;
+        }
     }
+    // numbers, typing bpm directly
+    else if (ch == '.' || (ch >= '0' && ch <= '9')) {
+        if (add_char_bpm(ch)) {
+            float bpm = get_bpm();
+            if (bpm > 0) {
+                adj_set_tempo(adj, bpm);
+            }
+            // setting bpm to 000.00 removes diff lock, but does not set tempo
+            adj_vdj_difflock_arff(adj);
+            reset_char_bpm();
+        }
+        return;
+    }
+
+    reset_char_bpm();
+}
+
+static void read_keys(int fd, uint32_t events, void* data)
+{
+    adj_seq_info_t* adj = data;
+    char buf[64];
+    ssize_t i, n;
 
-    return NULL;
+    n = read(fd, buf, sizeof(buf));
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        fprintf(stderr, "EOF keyboard input failed\n");
+        adj_reactor_remove(fd);
+        return;
+    }
+    for (i = 0; i < n && adj_numpad_running; i++) {
+        if (adj_is_running()) {
+            key_input(adj, buf[i]);
+        }
+    }
 }
 
 
@@ -226,21 +243,17 @@ int adj_numpad_input(adj_seq_info_t* adj, uint32_t flags)
     numpad_flags = flags;
     if (numpad_flags & ADJ_HAS_VDJ) has_vdj = 1;
 
-    pthread_t thread_id;
     init_term();
     reset_char_bpm();
     adj_numpad_running = 1;
 
-    int s = pthread_create(&thread_id, NULL, &read_keys, adj);
-    if (s != 0) {
-        return ADJ_THREAD;
-    }
-
-    return ADJ_OK;
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+    return adj_reactor_add(STDIN_FILENO, read_keys, adj);
 }
 
 
 void adj_numpad_exit()
 {
     adj_numpad_running = 0;
+    adj_reactor_remove(STDIN_FILENO);
 }
@@ -0,0 +1,356 @@
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "adj_bytes.h"
+#include "adj_osc.h"
+#include "adj_reactor.h"
+#include "adj_vdj.h"
+
+/**
+ * OSC 1.0 over UDP. Packets are parsed into a flat list of items, bundles nested in bundles included.
+ * Items with a timetag in the future wait on a one shot reactor timer, and then run with the timetag as
+ * their control time. A timed restart goes straight to adj_restart_at(), the clock thread restarts the bar
+ * at exactly that time.
+ */
+
+typedef struct {
+    int             fd;         // timer, -1 for a free slot
+    uint64_t        due;        // adj_time_nanos()
+    adj_osc_item_t  item;
+} osc_pending;
+
+static adj_seq_info_t* osc_adj = NULL;
+static int osc_fd = -1;
+static int osc_late = 0;
+static osc_pending pending[ADJ_OSC_PENDING];
+
+//SNIP_osc_parse
+
+typedef struct {
+    char* address;
+    int   op;
+    int   has_arg;
+} osc_command;
+
+static osc_command commands[] = {
+    {"/adj/start",    ADJ_OSC_START,    0},
+    {"/adj/stop",     ADJ_OSC_STOP,     0},
+    {"/adj/toggle",   ADJ_OSC_TOGGLE,   0},
+    {"/adj/restart",  ADJ_OSC_RESTART,  0},
+    {"/adj/nudge",    ADJ_OSC_NUDGE,    1},
+    {"/adj/nudge_ms", ADJ_OSC_NUDGE_MS, 1},
+    {"/adj/bpm",      ADJ_OSC_BPM,      1},
+    {"/adj/tempo",    ADJ_OSC_TEMPO,    1},
+    {"/adj/lock",     ADJ_OSC_LOCK,     1},
+    {"/adj/unlock",   ADJ_OSC_UNLOCK,   0},
+    {"/adj/trigger",  ADJ_OSC_TRIGGER,  1},
+    {NULL, 0, 0}
+};
+
+/**
+ * a nul terminated string padded to 4 bytes starting at off
+ * @return the offset after the padding, or -1 if it overruns len
+ */
+static int osc_string(const uint8_t* buf, int len, int off, const char** s)
+{
+    const uint8_t* nul = memchr(buf + off, 0, len - off);
+    if ( ! nul ) return -1;
+    *s = (const char*) buf + off;
+    off = (nul - buf + 4) & ~3;
+    return off <= len ? off : -1;
+}
+
+/**
+ * @return 1 with item set, 0 for a message adj ignores, -1 if the message is malformed
+ */
+static int osc_message(const uint8_t* buf, int len, uint64_t timetag, adj_osc_item_t* item)
+{
+    const char* address;
+    const char* tags = ",";
+    const char* s;
+    double value = 0.0;
+    uint32_t u;
+    float f;
+    int off, i, op = 0, has_arg = 0;
+
+    if ( (off = osc_string(buf, len, 0, &address)) < 0 ) return -1;
+    // very old senders leave out the type tags
+    if ( off < len && (off = osc_string(buf, len, off, &tags)) < 0 ) return -1;
+    if (tags[0] != ',') return -1;
+
+    memset(item, 0, sizeof(adj_osc_item_t));
+    item->timetag = timetag;
+
+    for (tags++; *tags; tags++) {
+        switch (*tags) {
+            case 'i':
+            case 'f':
+            case 'c':
+            case 'r':
+            case 'm':
+                if (off + 4 > len) return -1;
+                u = get32(buf + off);
+                off += 4;
+                if (*tags == 'i') value = (int32_t) u;
+                else if (*tags == 'f') { memcpy(&f, &u, 4); value = f; }
+                else continue;
+                break;
+            case 'h':
+            case 'd':
+            case 't':
+                if (off + 8 > len) return -1;
+                if (*tags == 'h') value = (int64_t) get64(buf + off);
+                else if (*tags == 'd') { uint64_t d = get64(buf + off); memcpy(&value, &d, 8); }
+                off += 8;
+                if (*tags == 't') continue;
+                break;
+            case 'T':
+                value = 1.0;
+                break;
+            case 'F':
+                value = 0.0;
+                break;
+            case 'N':
+            case 'I':
+                continue;
+            case 's':
+            case 'S':
+                if ( (off = osc_string(buf, len, off, &s)) < 0 ) return -1;
+                continue;
+            case 'b':
+                if (off + 4 > len) return -1;
+                u = get32(buf + off);
+                if (u > (uint32_t) (len - off - 4)) return -1;
+                off += 4 + ((u + 3) & ~3);
+                if (off > len) return -1;
+                continue;
+            default:
+                return -1;
+        }
+        if (item->argc++ == 0) item->arg = (float) value;
+    }
+
+    for (i = 0; commands[i].address; i++) {
+        if (strcmp(commands[i].address, address) == 0) {
+            op = commands[i].op;
+            has_arg = commands[i].has_arg;
+            break;
+        }
+    }
+    if ( ! op ) return 0;
+    if (has_arg && item->argc == 0) return 0;
+    // buttons send 1 on press and 0 on release
+    if ( ! has_arg && item->argc && item->arg == 0.0f) return 0;
+
+    item->op = op;
+    return 1;
+}
+
+/**
+ * parse a message or a bundle into items from n on, nested bundles take the later of their own and the enclosing timetag
+ * @return the number of items, or -1 if the packet is malformed
+ */
+static int osc_packet(const uint8_t* buf, int len, uint64_t timetag, adj_osc_item_t* items, int n, int depth)
+{
+    uint64_t tt;
+    uint32_t size;
+    int off;
+
+    if (len >= 16 && memcmp(buf, "#bundle", 8) == 0) {
+        if (depth == ADJ_OSC_DEPTH) return -1;
+        tt = get64(buf + 8);
+        if (tt < timetag) tt = timetag;
+        for (off = 16; off < len; off += 4 + size) {
+            if (off + 4 > len) return -1;
+            size = get32(buf + off);
+            if ( (size & 3) || size > (uint32_t) (len - off - 4) ) return -1;
+            if ( (n = osc_packet(buf + off + 4, size, tt, items, n, depth + 1)) < 0 ) return -1;
+        }
+        return n;
+    }
+    if (len < 4 || (len & 3) || buf[0] != '/') return -1;
+    if (n == ADJ_OSC_ITEMS) return n;
+
+    int rv = osc_message(buf, len, timetag, &items[n]);
+    return rv < 0 ? -1 : n + rv;
+}
+
+static int osc_parse(const uint8_t* buf, int len, adj_osc_item_t* items)
+{
+    return osc_packet(buf, len, ADJ_OSC_IMMEDIATE, items, 0, 0);
+}
+
+/**
+ * NTP timetag to adj_time_nanos(), offset is the wall clock minus adj_time_nanos()
+ */
+static uint64_t osc_nanos(uint64_t timetag, int64_t offset)
+{
+    int64_t wall = (int64_t) ((timetag >> 32) - ADJ_OSC_NTP_UNIX) * 1000000000L
+                 + (int64_t) (((timetag & 0xffffffff) * 1000000000ULL) >> 32);
+    return wall > offset ? (uint64_t) (wall - offset) : 0;
+}
+
+//SNIP_osc_parse
+
+static void run(adj_seq_info_t* adj, adj_osc_item_t* item, uint64_t nanos)
+{
+    switch (item->op) {
+        case ADJ_OSC_START:
+            adj_start(adj);
+            break;
+        case ADJ_OSC_STOP:
+            adj_stop(adj);
+            break;
+        case ADJ_OSC_TOGGLE:
+            adj_toggle(adj);
+            break;
+        case ADJ_OSC_RESTART:
+            if (item->timetag == ADJ_OSC_IMMEDIATE) adj_quantized_restart(adj);
+            else adj_restart_at(adj, nanos);
+            break;
+        case ADJ_OSC_NUDGE:
+            adj_nudge_at(adj, (int) item->arg, nanos);
+            break;
+        case ADJ_OSC_NUDGE_MS:
+            adj_nudge_millis(adj, (int) item->arg);
+            break;
+        case ADJ_OSC_BPM:
+            if (item->arg >= ADJ_MIN_BPM && item->arg <= ADJ_MAX_BPM) adj_set_tempo_at(adj, item->arg, nanos);
+            break;
+        case ADJ_OSC_TEMPO:
+            adj_adjust_tempo_at(adj, item->arg, nanos);
+            break;
+        case ADJ_OSC_LOCK:
+            if (adj->vdj) adj_vdj_difflock(adj, (uint8_t) item->arg, 0);
+            break;
+        case ADJ_OSC_UNLOCK:
+            if (adj->vdj) adj_vdj_difflock_arff(adj);
+            break;
+        case ADJ_OSC_TRIGGER:
+            if (adj->vdj) adj_vdj_trigger_from_player(adj, (uint8_t) item->arg);
+            break;
+    }
+}
+
+static void fire(int fd, uint32_t events, void* data)
+{
+    osc_pending* p = data;
+
+    adj_reactor_remove(fd);
+    close(fd);
+    p->fd = -1;
+    run(osc_adj, &p->item, p->due);
+}
+
+/**
+ * run item at due, now if it is already late
+ */
+static void schedule(adj_osc_item_t* item, uint64_t due, uint64_t now)
+{
+    int i;
+
+    if (due <= now) {
+        if (now - due > ADJ_OSC_LATE) {
+            osc_late++;
+            due = now;
+        }
+        run(osc_adj, item, due);
+        return;
+    }
+    // the clock thread waits for a restart itself
+    if (item->op == ADJ_OSC_RESTART) {
+        adj_restart_at(osc_adj, due);
+        return;
+    }
+
+    for (i = 0; i < ADJ_OSC_PENDING && pending[i].fd >= 0; i++);
+    if (i == ADJ_OSC_PENDING) {
+        osc_adj->message_handler(osc_adj, "osc: too many bundles pending");
+        return;
+    }
+    pending[i].item = *item;
+    pending[i].due = due;
+    if ( (pending[i].fd = adj_reactor_timer(due - now, 0, fire, &pending[i])) < 0 ) {
+        run(osc_adj, item, now);
+    }
+}
+
+static void read_socket(int fd, uint32_t events, void* data)
+{
+    uint8_t buf[ADJ_OSC_PACKET];
+    adj_osc_item_t items[ADJ_OSC_ITEMS];
+    struct timespec wall;
+    uint64_t now;
+    int64_t offset;
+    ssize_t rv;
+    int i, n;
+
+    while ( (rv = recv(fd, buf, sizeof(buf), MSG_TRUNC)) >= 0 ) {
+        now = adj_time_nanos();
+        if (rv > (ssize_t) sizeof(buf) || (n = osc_parse(buf, rv, items)) <= 0) continue;
+
+        clock_gettime(CLOCK_REALTIME, &wall);
+        offset = (int64_t) wall.tv_sec * 1000000000L + wall.tv_nsec - (int64_t) now;
+        for (i = 0; i < n; i++) {
+            if (items[i].timetag == ADJ_OSC_IMMEDIATE) run(osc_adj, &items[i], now);
+            else schedule(&items[i], osc_nanos(items[i].timetag, offset), now);
+        }
+    }
+    if (errno != EAGAIN && errno != EINTR) {
+        fprintf(stderr, "osc read failed (%s)\n", strerror(errno));
+    }
+}
+
+int adj_osc_init(adj_seq_info_t* adj, int port)
+{
+    struct sockaddr_in addr;
+    int i;
+
+    for (i = 0; i < ADJ_OSC_PENDING; i++) pending[i].fd = -1;
+    osc_adj = adj;
+
+    if ( (osc_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ) {
+        return ADJ_IO;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if ( bind(osc_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ) {
+        close(osc_fd);
+        osc_fd = -1;
+        return ADJ_IO;
+    }
+
+    return adj_reactor_add(osc_fd, read_socket, adj);
+}
+
+int adj_osc_late()
+{
+    return osc_late;
+}
+
+void adj_osc_exit()
+{
+    int i;
+    if (osc_fd < 0) return;
+
+    for (i = 0; i < ADJ_OSC_PENDING; i++) {
+        if (pending[i].fd >= 0) {
+            adj_reactor_remove(pending[i].fd);
+            close(pending[i].fd);
+            pending[i].fd = -1;
+        }
+    }
+    adj_reactor_remove(osc_fd);
+    close(osc_fd);
+    osc_fd = -1;
+}
@@ -0,0 +1,65 @@
+#ifndef _ADJ_OSC_INCLUDED_
+#define _ADJ_OSC_INCLUDED_
+
+#include "adj.h"
+
+/**
+ * OSC control surface, a UDP server for tablet apps and scripts, e.g. TouchOSC or oscsend.
+ *
+ * Addresses:
+ *   /adj/start | /adj/stop | /adj/toggle | /adj/restart | /adj/unlock
+ *   /adj/nudge <multiplier> | /adj/nudge_ms <millis> | /adj/bpm <bpm> | /adj/tempo <+/- bpm>
+ *   /adj/lock <player> | /adj/trigger <player>
+ * Arguments can be i, f, d or h, a button's release (a 0 argument) is ignored by the commands without arguments.
+ *
+ * Messages run on receipt, messages in a bundle run at the bundle's timetag on the queue timeline,
+ * so a sender with a synced wall clock gets its timing without the network jitter.
+ * Runs on the input reactor.
+ */
+
+//SNIP_osc_constants
+
+#define ADJ_OSC_START       1
+#define ADJ_OSC_STOP        2
+#define ADJ_OSC_TOGGLE      3
+#define ADJ_OSC_RESTART     4
+#define ADJ_OSC_NUDGE       5
+#define ADJ_OSC_NUDGE_MS    6
+#define ADJ_OSC_BPM         7
+#define ADJ_OSC_TEMPO       8
+#define ADJ_OSC_LOCK        9
+#define ADJ_OSC_UNLOCK     10
+#define ADJ_OSC_TRIGGER    11
+
+#define ADJ_OSC_PORT        9000
+#define ADJ_OSC_PACKET      1536            // bigger datagrams are dropped
+#define ADJ_OSC_ADDRESS     64
+#define ADJ_OSC_ITEMS       16              // messages in one packet, including nested bundles
+#define ADJ_OSC_DEPTH       4               // bundles nested deeper are dropped
+#define ADJ_OSC_PENDING     32              // bundles waiting for their timetag
+#define ADJ_OSC_IMMEDIATE   1ULL            // the timetag meaning now
+#define ADJ_OSC_NTP_UNIX    2208988800ULL   // seconds from 1900 to 1970
+#define ADJ_OSC_LATE        100000000L      // nanos, bundles later than this run now rather than in the past
+
+typedef struct {
+    int         op;
+    int         argc;       // numeric arguments
+    float       arg;        // the first of them
+    uint64_t    timetag;    // NTP format, ADJ_OSC_IMMEDIATE outside a bundle
+} adj_osc_item_t;
+
+//SNIP_osc_constants
+
+/**
+ * listen for OSC on udp port, call after adj_reactor_init()
+ */
+int adj_osc_init(adj_seq_info_t* adj, int port);
+
+/**
+ * bundles that arrived after their timetag, a sender's clock is off or the network is slow
+ */
+int adj_osc_late();
+
+void adj_osc_exit();
+
+#endif // _ADJ_OSC_INCLUDED_
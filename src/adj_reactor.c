@@ -0,0 +1,179 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "adj.h"
+#include "adj_reactor.h"
+
+/**
+ * Input reactor, replaces a blocking thread per input device with one epoll loop
+ */
+
+#define ADJ_REACTOR_MAX_FDS  64
+#define ADJ_REACTOR_EVENTS   16
+
+typedef struct {
+    int                     fd;
+    adj_reactor_handler_pt  handler;
+    void*                   data;
+    char                    timer;
+    uint32_t                gen;        // bumped each time the slot is reused
+} reactor_source;
+
+static int epfd = -1;
+static int exit_fd = -1;
+static unsigned _Atomic reactor_running = ATOMIC_VAR_INIT(0);
+
+// slots are reused, fd -1 is free
+static reactor_source sources[ADJ_REACTOR_MAX_FDS];
+
+/**
+ * epoll data is the slot and its generation, so an event already returned for a removed source is not
+ * delivered to a new one that took the same slot within the same epoll_wait() batch
+ */
+#define EVENT_DATA(i)   ((uint64_t) sources[i].gen << 32 | (uint32_t) (i))
+#define EVENT_EXIT      UINT64_MAX
+
+static reactor_source* find_source(int fd)
+{
+    int i;
+    for (i = 0; i < ADJ_REACTOR_MAX_FDS; i++) {
+        if (sources[i].fd == fd) return &sources[i];
+    }
+    return NULL;
+}
+
+static int add_source(int fd, adj_reactor_handler_pt handler, void* data, char timer)
+{
+    struct epoll_event ev;
+    reactor_source* src;
+
+    if (epfd < 0) return ADJ_RTFM;
+
+    if ( (src = find_source(-1)) == NULL ) {
+        return ADJ_ALLOC;
+    }
+    src->fd = fd;
+    src->handler = handler;
+    src->data = data;
+    src->timer = timer;
+    src->gen++;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = EVENT_DATA(src - sources);
+    if ( epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0 ) {
+        src->fd = -1;
+        return ADJ_IO;
+    }
+    return ADJ_OK;
+}
+
+int adj_reactor_init()
+{
+    int i;
+    struct epoll_event ev;
+
+    for (i = 0; i < ADJ_REACTOR_MAX_FDS; i++) sources[i].fd = -1;
+
+    if ( (epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ) {
+        return ADJ_IO;
+    }
+    if ( (exit_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ) {
+        return ADJ_IO;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = EVENT_EXIT;
+    if ( epoll_ctl(epfd, EPOLL_CTL_ADD, exit_fd, &ev) < 0 ) {
+        return ADJ_IO;
+    }
+
+    reactor_running = 1;
+    return ADJ_OK;
+}
+
+int adj_reactor_add(int fd, adj_reactor_handler_pt handler, void* data)
+{
+    return add_source(fd, handler, data, 0);
+}
+
+int adj_reactor_remove(int fd)
+{
+    reactor_source* src = find_source(fd);
+    if (src == NULL) return ADJ_ERR;
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    // events already returned by this epoll_wait() are dropped by the generation check
+    src->handler = NULL;
+    src->fd = -1;
+    return ADJ_OK;
+}
+
+int adj_reactor_timer(uint64_t nanos, int repeat, adj_reactor_handler_pt handler, void* data)
+{
+    struct itimerspec its;
+    int fd = timerfd_create(ADJ_CLOCK, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) return -1;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = nanos / 1000000000L;
+    its.it_value.tv_nsec = nanos % 1000000000L;
+    if (repeat) its.it_interval = its.it_value;
+    if ( timerfd_settime(fd, 0, &its, NULL) < 0 || add_source(fd, handler, data, 1) != ADJ_OK ) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int adj_reactor_run()
+{
+    int i, n;
+    uint64_t expirations, data;
+    struct epoll_event events[ADJ_REACTOR_EVENTS];
+    reactor_source* src;
+
+    if (epfd < 0) return ADJ_RTFM;
+
+    while (reactor_running) {
+        n = epoll_wait(epfd, events, ADJ_REACTOR_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return ADJ_IO;
+        }
+        adj_wakeup();
+        for (i = 0; i < n && reactor_running; i++) {
+            data = events[i].data.u64;
+            if (data == EVENT_EXIT) {
+                reactor_running = 0;
+                break;
+            }
+            src = &sources[(uint32_t) data];
+            if (src->gen != data >> 32 || src->handler == NULL) continue;
+            if (src->timer) {
+                if ( read(src->fd, &expirations, sizeof(expirations)) != sizeof(expirations) ) continue;
+            }
+            src->handler(src->fd, events[i].events, src->data);
+        }
+    }
+
+    return ADJ_OK;
+}
+
+void adj_reactor_exit()
+{
+    uint64_t one = 1;
+    reactor_running = 0;
+    if (exit_fd >= 0) {
+        // write() is safe in a signal handler
+        if ( write(exit_fd, &one, sizeof(one)) ) {}
+    }
+}
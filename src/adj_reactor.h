@@ -0,0 +1,46 @@
+#ifndef _ADJ_REACTOR_INCLUDED_
+#define _ADJ_REACTOR_INCLUDED_
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/**
+ * Input reactor, one epoll loop on the main thread reads every input device.
+ * Devices register a file descriptor and a decoder callback that is called when the fd is readable.
+ * Callbacks run on the reactor thread one at a time so must not block.
+ */
+
+/**
+ * called when fd is ready, events is the epoll event mask e.g. EPOLLIN|EPOLLHUP
+ */
+typedef void (*adj_reactor_handler_pt)(int fd, uint32_t events, void* data);
+
+int adj_reactor_init();
+
+/**
+ * watch fd for input, fd should be non-blocking
+ */
+int adj_reactor_add(int fd, adj_reactor_handler_pt handler, void* data);
+
+/**
+ * stop watching fd, does not close it, safe to call from inside a handler
+ */
+int adj_reactor_remove(int fd);
+
+/**
+ * call handler after nanos, and then every nanos if repeat is set, returns the timer fd or -1.
+ * Remove and close the fd to cancel.
+ */
+int adj_reactor_timer(uint64_t nanos, int repeat, adj_reactor_handler_pt handler, void* data);
+
+/**
+ * run the reactor on the calling thread, returns after adj_reactor_exit()
+ */
+int adj_reactor_run();
+
+/**
+ * stop the reactor, safe to call from a signal handler
+ */
+void adj_reactor_exit();
+
+#endif // _ADJ_REACTOR_INCLUDED_
@@ -0,0 +1,261 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "adj.h"
+#include "adj_ctl.h"
+#include "adj_remote.h"
+#include "adj_reactor.h"
+#include "adj_bpm_tap.h"
+#include "adj_store.h"
+#include "adj_vdj.h"
+
+/**
+ * adj control API as control socket commands, for UIs and controller modules in their own process.
+ */
+
+static adj_seq_info_t* remote_adj = NULL;
+static int remote_fd = -1;
+static int remote_vdj = 0;
+static char remote_path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+static char reply_line[ADJ_CTL_LINE];
+static size_t reply_len = 0;
+
+static void remote_send(const char* format, ...)
+{
+    char line[ADJ_CTL_LINE];
+    va_list args;
+    int len;
+
+    if (remote_fd < 0) return;
+
+    va_start(args, format);
+    len = vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+    if (len < 0 || len >= sizeof(line) - 1) return;
+    line[len++] = '\n';
+
+    // the daemon never blocks on a client, and a client never blocks on the daemon
+    if ( send(remote_fd, line, len, MSG_NOSIGNAL | MSG_DONTWAIT) != len ) {
+        remote_adj->message_handler(remote_adj, "command dropped, adj is not reading");
+    }
+}
+
+static void read_replies(int fd, uint32_t events, void* data)
+{
+    char* nl;
+    ssize_t rv;
+
+    while ( (rv = read(fd, reply_line + reply_len, sizeof(reply_line) - 1 - reply_len)) > 0 ) {
+        reply_len += rv;
+        reply_line[reply_len] = 0;
+        while ( (nl = strchr(reply_line, '\n')) ) {
+            *nl = 0;
+            if (strncmp(reply_line, "error", 5) == 0) {
+                remote_adj->message_handler(remote_adj, reply_line);
+            }
+            reply_len -= nl + 1 - reply_line;
+            memmove(reply_line, nl + 1, reply_len + 1);
+        }
+        if (reply_len == sizeof(reply_line) - 1) reply_len = 0;
+    }
+    if (rv == 0 || (errno != EAGAIN && errno != EINTR)) {
+        // the daemon quit, there is nothing left to control
+        adj_remote_close();
+        adj_reactor_exit();
+    }
+}
+
+int adj_remote_connect(adj_seq_info_t* adj, const char* seq_name)
+{
+    struct sockaddr_un addr;
+    struct timeval timeout = { 1, 0 };
+    char* dir = getenv(ADJ_CTL_DIR_ENV);
+    char* nl;
+    ssize_t rv;
+
+    remote_adj = adj;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if ( snprintf(addr.sun_path, sizeof(addr.sun_path), ADJ_CTL_PATH, dir ? dir : ADJ_CTL_DIR, seq_name) >= sizeof(addr.sun_path) ) {
+        return ADJ_ERR;
+    }
+    snprintf(remote_path, sizeof(remote_path), "%s", addr.sun_path);
+
+    if ( (remote_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ) {
+        return ADJ_IO;
+    }
+    setsockopt(remote_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if ( connect(remote_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ) {
+        adj_remote_close();
+        return ADJ_IO;
+    }
+
+    // the one reply we wait for, later replies are read on the reactor
+    remote_send("status");
+    while ( ! (nl = strchr(reply_line, '\n')) && reply_len < sizeof(reply_line) - 1 ) {
+        if ( (rv = read(remote_fd, reply_line + reply_len, sizeof(reply_line) - 1 - reply_len)) <= 0 ) {
+            adj_remote_close();
+            return ADJ_IO;
+        }
+        reply_len += rv;
+        reply_line[reply_len] = 0;
+    }
+    if ( ! nl || strncmp(reply_line, "bpm=", 4) != 0 ) {
+        adj_remote_close();
+        return ADJ_ERR;
+    }
+    remote_vdj = strstr(reply_line, " vdj=1") != NULL;
+    reply_len -= nl + 1 - reply_line;
+    memmove(reply_line, nl + 1, reply_len + 1);
+
+    fcntl(remote_fd, F_SETFL, fcntl(remote_fd, F_GETFL) | O_NONBLOCK);
+    return adj_reactor_add(remote_fd, read_replies, NULL);
+}
+
+int adj_remote_has_vdj()
+{
+    return remote_vdj;
+}
+
+char* adj_remote_path()
+{
+    return remote_path;
+}
+
+void adj_remote_close()
+{
+    if (remote_fd < 0) return;
+    adj_reactor_remove(remote_fd);
+    close(remote_fd);
+    remote_fd = -1;
+}
+
+
+// adj.h
+
+void adj_start(adj_seq_info_t* adj)
+{
+    remote_send("start");
+}
+
+void adj_stop(adj_seq_info_t* adj)
+{
+    remote_send("stop");
+}
+
+void adj_toggle(adj_seq_info_t* adj)
+{
+    remote_send("toggle");
+}
+
+void adj_quantized_restart(adj_seq_info_t* adj)
+{
+    remote_send("restart");
+}
+
+void adj_nudge(adj_seq_info_t* adj, int multiplier)
+{
+    remote_send("nudge %i", multiplier);
+}
+
+void adj_nudge_millis(adj_seq_info_t* adj, int milliseconds)
+{
+    remote_send("nudge_ms %i", milliseconds);
+}
+
+void adj_set_tempo(adj_seq_info_t* adj, float bpm)
+{
+    remote_send("bpm %.2f", bpm);
+}
+
+void adj_adjust_tempo(adj_seq_info_t* adj, float bpm_diff)
+{
+    remote_send("tempo %.2f", bpm_diff);
+}
+
+/**
+ * the same as adj_exit() in process, stops the clock and every client
+ */
+int adj_exit(adj_seq_info_t* adj)
+{
+    remote_send("quit");
+    return ADJ_OK;
+}
+
+unsigned _Atomic adj_is_running()
+{
+    return remote_fd >= 0;
+}
+
+// adj_bpm_tap.h, adj_store.h
+
+int adj_bpm_tap(adj_seq_info_t* adj)
+{
+    remote_send("tap");
+    return ADJ_OK;
+}
+
+void adj_bpm_tap_reset()
+{
+    remote_send("tap_reset");
+}
+
+void adj_save_bpm(adj_seq_info_t* adj)
+{
+    remote_send("save");
+}
+
+// adj_vdj.h
+
+void adj_vdj_copy_bpm(adj_seq_info_t* adj, uint8_t player_id)
+{
+    remote_send("copy_bpm %i", player_id);
+}
+
+void adj_vdj_trigger_from_player(adj_seq_info_t* adj, uint8_t player_id)
+{
+    remote_send("trigger %i", player_id);
+}
+
+void adj_vdj_track_start(adj_seq_info_t* adj, uint8_t player_id)
+{
+    remote_send("track_start %i", player_id);
+}
+
+void adj_vdj_difflock(adj_seq_info_t* adj, uint8_t player_id, int use_default)
+{
+    remote_send(use_default ? "lock_default %i" : "lock %i", player_id);
+}
+
+void adj_vdj_difflock_arff(adj_seq_info_t* adj)
+{
+    remote_send("unlock");
+}
+
+void adj_vdj_difflock_nudge(adj_seq_info_t* adj, int32_t amount)
+{
+    remote_send("lock_nudge %i", amount);
+}
+
+void adj_vdj_difflock_master(adj_seq_info_t* adj, int on_off)
+{
+    remote_send("lock_master %i", on_off ? 1 : 0);
+}
+
+void adj_vdj_become_master(adj_seq_info_t* adj)
+{
+    remote_send("master");
+}
+
+void adj_vdj_follow_tempo(adj_seq_info_t* adj, int on_off)
+{
+    remote_send("follow %i", on_off ? 1 : 0);
+}
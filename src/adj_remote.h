@@ -0,0 +1,31 @@
+#ifndef _ADJ_REMOTE_INCLUDED_
+#define _ADJ_REMOTE_INCLUDED_
+
+#include "adj.h"
+
+/**
+ * Control API for client processes, adj-tui and adj-mod, that run beside adjd rather than inside it.
+ * adj_remote.o defines adj_start(), adj_nudge(), adj_vdj_copy_bpm() etc. as commands on the control socket,
+ * so adj_keyb.c and controller modules work unchanged. A client linking it must never call adj_init(),
+ * the clock is in the daemon, libadj is only used for the clock time and the state page.
+ * Commands are sent without waiting, error replies are passed to the ui's message handler.
+ */
+
+/**
+ * connect to the adj named seq_name and ask its status, call after adj_reactor_init()
+ */
+int adj_remote_connect(adj_seq_info_t* adj, const char* seq_name);
+
+/**
+ * non-zero if the daemon is a Virtual CDJ, for ADJ_HAS_VDJ
+ */
+int adj_remote_has_vdj();
+
+/**
+ * path of the control socket, for display
+ */
+char* adj_remote_path();
+
+void adj_remote_close();
+
+#endif // _ADJ_REMOTE_INCLUDED_
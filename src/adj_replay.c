@@ -0,0 +1,202 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "adj.h"
+#include "adj_bpm.h"
+#include "adj_diff.h"
+#include "adj_sync.h"
+#include "adj_capture.h"
+
+/**
+ * Replay a ProLink capture from adj -w through difflock, adj_sync.c and the diff and bpm estimators, against
+ * the clock loop on the simulated backend.  Virtual time, so an hour's set replays in seconds, and again with
+ * different lock settings or a changed sync algorithm.
+ *
+ * Prints a line per CDJ beat, the diff adj saw live is against adj's own beats in the capture, the replayed
+ * diff is against the simulated clock, which starts on adj's first captured beat.
+ */
+
+typedef struct {
+    uint32_t    beats;
+    uint32_t    nudges;
+    double      sum2;
+    double      max;
+} replay_player;
+
+static replay_player stats[256];
+
+static void usage()
+{
+    printf("adj-replay [-b bpm] [-l player] [-o millis] [-f] [-M] [-q] file\n");
+    printf("options:\n");
+    printf("    -b - start adj at this bpm (default the first beat's)\n");
+    printf("    -l - difflock to this player from the start\n");
+    printf("    -o - difflock offset in milliseconds (default 0)\n");
+    printf("    -f - follow the locked player's tempo\n");
+    printf("    -M - move the lock to whichever player is master\n");
+    printf("    -q - print only the summary\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static struct timespec to_timespec(uint64_t nanos)
+{
+    struct timespec ts = { .tv_sec = nanos / 1000000000L, .tv_nsec = nanos % 1000000000L };
+    return ts;
+}
+
+/**
+ * millis from adj's nearest beat to nanos, positive when nanos is later
+ */
+static int32_t adj_diff_at(adj_seq_info_t* adj, uint64_t nanos)
+{
+    adj_beat_pos_t pos;
+    uint64_t t = 0;
+    if (adj_timeline_position(adj, nanos, &pos) != ADJ_OK) return 0;
+    if (adj_timeline_time(adj, floor(pos.beat + 0.5), &t) != ADJ_OK) return 0;
+    return (int32_t) (((int64_t) nanos - (int64_t) t) / 1000000L);
+}
+
+/**
+ * millis from the nearest of adj's beats in the capture, wrapped to the beat
+ */
+static int32_t live_diff_at(uint64_t self_beat, float bpm, uint64_t nanos)
+{
+    if ( ! self_beat || bpm <= 0.0 ) return 0;
+    double period = 60000.0 / bpm;
+    double diff = fmod((nanos - self_beat) / 1000000.0, period);
+    if (diff > period / 2.0) diff -= period;
+    return (int32_t) lround(diff);
+}
+
+int main(int argc, char* argv[])
+{
+    adj_capture_header_t hdr;
+    adj_capture_record_t rec;
+    adj_capture_packet_t pkt;
+    adj_sync_action_t action;
+    uint8_t buf[ADJ_CAPTURE_PACKET];
+    struct timespec wall0, wall1;
+    uint64_t first = 0, sim0, t, self_beat = 0, packets = 0;
+    float bpm = 0.0, est;
+    uint8_t lock = 0, follow_tempo = 0, follow_master = 0, quiet = 0, started = 0;
+    int32_t lock_ms = 0, diff, live;
+    int c, i, rv;
+
+    while ( ( c = getopt(argc, argv, "b:l:o:fMqh") ) != EOF) {
+        switch (c) {
+            case 'b':
+                bpm = strtof(optarg, NULL);
+                break;
+            case 'l':
+                lock = atoi(optarg);
+                break;
+            case 'o':
+                lock_ms = atoi(optarg);
+                break;
+            case 'f':
+                follow_tempo = 1;
+                break;
+            case 'M':
+                follow_master = 1;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            case 'h':
+                usage();
+                break;
+        }
+    }
+    if (optind >= argc) usage();
+
+    FILE* f = adj_capture_open(argv[optind], &hdr);
+    if ( ! f ) {
+        fprintf(stderr, "%s is not an adj capture\n", argv[optind]);
+        return 1;
+    }
+
+    adj_set_backend(adj_backend_sim(0, 1));
+    adj_seq_info_t* adj = adj_calloc();
+    adj->bpm = bpm >= ADJ_MIN_BPM && bpm <= ADJ_MAX_BPM ? bpm : 120.0;
+    if (adj_init(adj) != ADJ_OK) {
+        fprintf(stderr, "adj init failed\n");
+        return 1;
+    }
+    adj_sync_reset();
+    adj_estimate_bpm_init();
+    adj_sync_follow_tempo(follow_tempo);
+    if (lock) adj_sync_lock(lock, lock_ms);
+    adj_sync_follow_master(follow_master);
+
+    clock_gettime(CLOCK_MONOTONIC, &wall0);
+    sim0 = adj_time_nanos();
+    if ( ! quiet ) printf("secs,player,bar_pos,bpm,live_diff,diff,avg,bpm_estimate,nudge_ms,tempo\n");
+
+    while ( (rv = adj_capture_next(f, &rec, buf)) == ADJ_OK ) {
+        packets++;
+        if ( ! first ) first = rec.nanos;
+        if (rec.nanos < first) continue;
+        t = sim0 + (rec.nanos - first);
+        adj_sim_sleep_until(t);
+
+        if (adj_capture_parse(buf, rec.len, &pkt) != ADJ_OK || ! pkt.player_id) continue;
+
+        if (pkt.type == ADJ_CAPTURE_CDJ_STATUS) {
+            if ( (pkt.flags & ADJ_CAPTURE_FLAG_MASTER) && adj_sync_master(pkt.player_id) && ! quiet ) {
+                printf("# %.3f master %02i\n", (t - sim0) / 1000000000.0, pkt.player_id);
+            }
+            continue;
+        }
+        if (pkt.type != ADJ_CAPTURE_CDJ_BEAT) continue;
+
+        // adj starts on its first beat in the capture, or the first downbeat if it was not recording its own
+        if ( ! started && (hdr.self ? pkt.player_id == hdr.self : pkt.bar_pos == 1) ) {
+            if (bpm < ADJ_MIN_BPM && pkt.bpm >= ADJ_MIN_BPM && pkt.bpm <= ADJ_MAX_BPM) adj_set_tempo(adj, pkt.bpm);
+            adj_start(adj);
+            started = 1;
+        }
+        if (pkt.player_id == hdr.self) {
+            self_beat = rec.nanos;
+            continue;
+        }
+
+        if ( ! started ) continue;
+
+        // measured at the later of the two beats, so it is averaged whichever side it is, what follows is the same as live
+        diff = adj_diff_at(adj, t);
+        live = live_diff_at(self_beat, pkt.bpm, rec.nanos);
+        est = adj_sync_on_beat(adj, pkt.player_id, pkt.bar_pos, pkt.bpm, to_timespec(rec.nanos), diff, 1, 1, &action);
+
+        replay_player* s = &stats[pkt.player_id];
+        s->beats++;
+        s->sum2 += (double) diff * diff;
+        if (abs(diff) > s->max) s->max = abs(diff);
+        if (action.nudge_ms) s->nudges++;
+
+        if ( ! quiet ) {
+            printf("%.3f,%i,%i,%.2f,%i,%i,%i,%.2f,%i,%.2f\n", (t - sim0) / 1000000000.0, pkt.player_id, pkt.bar_pos,
+                pkt.bpm, live, diff, adj_diff_avg(pkt.player_id), est, action.nudge_ms, action.bpm);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wall1);
+    double secs = (adj_time_nanos() - sim0) / 1000000000.0;
+    double took = (wall1.tv_sec - wall0.tv_sec) + (wall1.tv_nsec - wall0.tv_nsec) / 1000000000.0;
+    adj_exit(adj);
+    fclose(f);
+
+    if (rv == ADJ_IO) fprintf(stderr, "capture truncated after %" PRIu64 " packets\n", packets);
+    fprintf(stderr, "%" PRIu64 " packets, %.1fs replayed in %.2fs\n", packets, secs, took);
+    for (i = 0; i < 256; i++) {
+        if ( ! stats[i].beats ) continue;
+        fprintf(stderr, "player %02i beats=%u rms=%.2fms max=%.0fms nudges=%u\n", i, stats[i].beats,
+            sqrt(stats[i].sum2 / stats[i].beats), stats[i].max, stats[i].nudges);
+    }
+    return rv == ADJ_IO ? 1 : 0;
+}
@@ -0,0 +1,692 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE   // pthread_setname_np()
+#endif
+
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "adj_bytes.h"
+#include "adj_rtpmidi.h"
+#include "adj_reactor.h"
+#include "adj_midiin.h"
+
+/**
+ * RTP-MIDI, RFC 6295, with the AppleMIDI session protocol.  No recovery journal, clocks are sent again
+ * 24 times a beat anyway and control input is not worth the complexity.
+ */
+
+#define PEER_FREE       0
+#define PEER_INVITING   1   // we sent IN on the control port
+#define PEER_JOINING    2   // control port accepted, IN on the data port
+#define PEER_CONNECTED  3
+
+#define PEER_TIMEOUT    60  // seconds without hearing from a peer before it is dropped
+
+typedef struct {
+    int                 state;
+    int                 initiator;      // we invited the peer, so we run the clock sync
+    uint32_t            ssrc;
+    uint32_t            token;
+    struct sockaddr_in  ctl_addr;
+    struct sockaddr_in  data_addr;
+    char                name[ADJ_RTPMIDI_NAME_LEN];
+    int                 tries;          // invitations sent, or seconds since connecting
+    uint64_t            heard;          // adj_time_nanos() of the last packet
+    int64_t             offset;         // peer's clock - ours, in timestamp units
+    int                 synced;         // offset is known
+    uint64_t            latency;        // last one way latency, micros
+} rtp_peer;
+
+static adj_seq_info_t* rtp_adj = NULL;
+static int ctl_fd = -1;
+static int data_fd = -1;
+static int timer_fd = -1;
+static uint32_t rtp_ssrc = 0;
+static uint16_t rtp_seq = 0;
+static rtp_peer peers[ADJ_RTPMIDI_PEERS];
+static pthread_mutex_t peers_mutex = PTHREAD_MUTEX_INITIALIZER;    // the reactor changes peers, the clock thread sends to them
+static snd_midi_event_t* rtp_encoder = NULL;
+static adj_histogram_t rtp_latency;
+static adj_histogram_t rtp_jitter;
+
+// clock thread, woken by start, stop and exit
+static pthread_t clock_thread;
+static pthread_mutex_t clock_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t clock_cond;
+static int clock_running = 0;
+static int transport = 0;           // running after a start
+static int transport_seq = 0;       // bumped by every start and stop
+
+//SNIP_rtpmidi_codec
+
+/**
+ * @return the AppleMIDI command, or 0 if buf is not an AppleMIDI packet
+ */
+static int applemidi_command(const uint8_t* buf, size_t len)
+{
+    return len >= 4 && get16(buf) == 0xffff ? get16(buf + 2) : 0;
+}
+
+/**
+ * IN, OK, NO and BY, BY has no name
+ * @return bytes written, 0 if buf is too small
+ */
+static int applemidi_session_encode(uint8_t* buf, size_t len, const adj_applemidi_session_t* s)
+{
+    size_t name_len = s->command == ADJ_APPLEMIDI_BY ? 0 : strlen(s->name) + 1;
+    if (len < 16 + name_len) return 0;
+
+    put16(buf, 0xffff);
+    put16(buf + 2, s->command);
+    put32(buf + 4, s->version);
+    put32(buf + 8, s->token);
+    put32(buf + 12, s->ssrc);
+    memcpy(buf + 16, s->name, name_len);
+    return 16 + name_len;
+}
+
+static int applemidi_session_decode(const uint8_t* buf, size_t len, adj_applemidi_session_t* s)
+{
+    size_t name_len;
+    if (len < 16 || get16(buf) != 0xffff) return ADJ_ERR;
+
+    s->command = get16(buf + 2);
+    s->version = get32(buf + 4);
+    s->token = get32(buf + 8);
+    s->ssrc = get32(buf + 12);
+    name_len = len - 16 < ADJ_RTPMIDI_NAME_LEN - 1 ? len - 16 : ADJ_RTPMIDI_NAME_LEN - 1;
+    memcpy(s->name, buf + 16, name_len);
+    s->name[name_len] = 0;
+    return ADJ_OK;
+}
+
+static int applemidi_sync_encode(uint8_t* buf, size_t len, const adj_applemidi_sync_t* k)
+{
+    if (len < 36) return 0;
+
+    put16(buf, 0xffff);
+    put16(buf + 2, ADJ_APPLEMIDI_CK);
+    put32(buf + 4, k->ssrc);
+    put32(buf + 8, (uint32_t) k->count << 24);
+    put64(buf + 12, k->ts[0]);
+    put64(buf + 20, k->ts[1]);
+    put64(buf + 28, k->ts[2]);
+    return 36;
+}
+
+static int applemidi_sync_decode(const uint8_t* buf, size_t len, adj_applemidi_sync_t* k)
+{
+    if (len < 36 || applemidi_command(buf, len) != ADJ_APPLEMIDI_CK || buf[8] > 2) return ADJ_ERR;
+
+    k->ssrc = get32(buf + 4);
+    k->count = buf[8];
+    k->ts[0] = get64(buf + 12);
+    k->ts[1] = get64(buf + 20);
+    k->ts[2] = get64(buf + 28);
+    return ADJ_OK;
+}
+
+/**
+ * rtp packet with one midi command list, short header when it fits, no journal
+ * @return bytes written, 0 if buf is too small
+ */
+static int rtp_midi_encode(uint8_t* buf, size_t len, uint16_t seq, uint32_t ts, uint32_t ssrc, const uint8_t* midi, int n)
+{
+    int header = n < 16 ? 1 : 2;
+    if (n > 0x0fff || len < 12 + header + n) return 0;
+
+    buf[0] = 0x80;                  // version 2
+    buf[1] = ADJ_RTPMIDI_PT;
+    put16(buf + 2, seq);
+    put32(buf + 4, ts);
+    put32(buf + 8, ssrc);
+    if (header == 1) {
+        buf[12] = n;
+    } else {
+        buf[12] = 0x80 | n >> 8;
+        buf[13] = n;
+    }
+    memcpy(buf + 12 + header, midi, n);
+    return 12 + header + n;
+}
+
+static int midi_data_bytes(uint8_t status)
+{
+    if (status < 0xc0 || (status >= 0xe0 && status < 0xf0) || status == 0xf2) return 2;
+    if (status < 0xe0 || status == 0xf1 || status == 0xf3) return 1;
+    return 0;
+}
+
+/**
+ * midi commands from an rtp-midi packet, delta times removed, running status expanded, sysex dropped
+ * @return bytes written to out, -1 if buf is not rtp-midi
+ */
+static int rtp_midi_decode(const uint8_t* buf, size_t len, uint32_t* ts, uint8_t* out, size_t out_len)
+{
+    size_t pos, end;
+    int i, data, z, first = 1, n = 0;
+    uint8_t status, running = 0;
+
+    if (len < 13 || (buf[0] & 0xc0) != 0x80 || (buf[1] & 0x7f) != ADJ_RTPMIDI_PT) return -1;
+    *ts = get32(buf + 4);
+    pos = 12 + (buf[0] & 0x0f) * 4;     // skip any csrcs
+    if (pos >= len) return -1;
+
+    z = buf[pos] & 0x20;
+    if (buf[pos] & 0x80) {
+        if (pos + 2 > len) return -1;
+        end = pos + 2 + ((buf[pos] & 0x0f) << 8 | buf[pos + 1]);
+        pos += 2;
+    } else {
+        end = pos + 1 + (buf[pos] & 0x0f);
+        pos += 1;
+    }
+    if (end > len) return -1;
+
+    while (pos < end) {
+        if ( ! first || z ) {
+            // delta time, up to 4 bytes, the high bit continues
+            for (i = 0; i < 4 && pos < end; i++) {
+                if ( ! (buf[pos++] & 0x80) ) break;
+            }
+        }
+        first = 0;
+        if (pos >= end) break;
+
+        status = buf[pos];
+        if (status == 0xf0) {
+            while (pos < end && buf[pos++] != 0xf7);
+            running = 0;
+            continue;
+        }
+        if (status & 0x80) {
+            pos++;
+            if (status < 0xf0) running = status;
+            else if (status < 0xf8) running = 0;
+        } else if (running) {
+            status = running;
+        } else {
+            break;
+        }
+        data = midi_data_bytes(status);
+        if (pos + data > end || n + 1 + data > out_len) break;
+        out[n++] = status;
+        memcpy(out + n, buf + pos, data);
+        n += data;
+        pos += data;
+    }
+    return n;
+}
+
+//SNIP_rtpmidi_codec
+
+static uint64_t rtp_now()
+{
+    return adj_time_nanos() / ADJ_RTPMIDI_UNITS;
+}
+
+static void message(const char* what, rtp_peer* p)
+{
+    char msg[128];
+    snprintf(msg, sizeof(msg), "rtpmidi: %.63s %.48s", p->name[0] ? p->name : inet_ntoa(p->ctl_addr.sin_addr), what);
+    rtp_adj->message_handler(rtp_adj, msg);
+}
+
+static void send_to(int fd, const uint8_t* buf, int len, struct sockaddr_in* addr)
+{
+    if (len && sendto(fd, buf, len, MSG_DONTWAIT, (struct sockaddr*) addr, sizeof(*addr)) < 0) {
+        fprintf(stderr, "rtpmidi send failed (%s)\n", strerror(errno));
+    }
+}
+
+static void send_session(int fd, int command, uint32_t token, struct sockaddr_in* addr)
+{
+    uint8_t buf[ADJ_RTPMIDI_PACKET];
+    adj_applemidi_session_t s;
+
+    s.command = command;
+    s.version = ADJ_RTPMIDI_VERSION;
+    s.token = token;
+    s.ssrc = rtp_ssrc;
+    snprintf(s.name, sizeof(s.name), "%s", rtp_adj->seq_name);
+    send_to(fd, buf, applemidi_session_encode(buf, sizeof(buf), &s), addr);
+}
+
+static void send_sync(rtp_peer* p, uint8_t count, uint64_t ts0, uint64_t ts1, uint64_t ts2)
+{
+    uint8_t buf[36];
+    adj_applemidi_sync_t k = { rtp_ssrc, count, { ts0, ts1, ts2 } };
+    send_to(data_fd, buf, applemidi_sync_encode(buf, sizeof(buf), &k), &p->data_addr);
+}
+
+static rtp_peer* find_ssrc(uint32_t ssrc)
+{
+    for (int i = 0; i < ADJ_RTPMIDI_PEERS; i++) {
+        if (peers[i].state != PEER_FREE && peers[i].ssrc == ssrc) return &peers[i];
+    }
+    return NULL;
+}
+
+static rtp_peer* find_token(uint32_t token)
+{
+    for (int i = 0; i < ADJ_RTPMIDI_PEERS; i++) {
+        if (peers[i].state != PEER_FREE && peers[i].initiator && peers[i].token == token) return &peers[i];
+    }
+    return NULL;
+}
+
+static rtp_peer* find_free()
+{
+    for (int i = 0; i < ADJ_RTPMIDI_PEERS; i++) {
+        if (peers[i].state == PEER_FREE) {
+            memset(&peers[i], 0, sizeof(rtp_peer));
+            return &peers[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * a clock sync finished, rtt is on the initiator's clock, offset is the peer's clock - ours
+ */
+static void measured(rtp_peer* p, uint64_t rtt, int64_t offset)
+{
+    uint64_t latency = rtt * (ADJ_RTPMIDI_UNITS / 1000) / 2;
+    adj_histogram_add(&rtp_latency, latency);
+    if (p->synced) {
+        adj_histogram_add(&rtp_jitter, latency > p->latency ? latency - p->latency : p->latency - latency);
+    }
+    p->latency = latency;
+    p->offset = offset;
+    if ( ! p->synced ) {
+        p->synced = 1;
+        char what[64];
+        snprintf(what, sizeof(what), "synced, latency %" PRIu64 "us", latency);
+        message(what, p);
+    }
+}
+
+/**
+ * our time for a timestamp on the peer's clock, the arrival time until the clock sync has run
+ */
+static uint64_t peer_nanos(rtp_peer* p, uint32_t ts)
+{
+    uint64_t now = rtp_now();
+    if ( ! p->synced ) return adj_time_nanos();
+
+    // the peer's 32 bit timestamp is the low bits of its 64 bit clock, nearest to its now
+    uint64_t peer_now = now + p->offset;
+    uint64_t local = peer_now - (uint32_t) ((uint32_t) peer_now - ts) - p->offset;
+    if (local > now || now - local > 1000000000L / ADJ_RTPMIDI_UNITS) return adj_time_nanos();
+    return local * ADJ_RTPMIDI_UNITS;
+}
+
+static void session(int fd, int is_data, uint8_t* buf, size_t len, struct sockaddr_in* from)
+{
+    adj_applemidi_session_t s;
+    adj_applemidi_sync_t k;
+    rtp_peer* p;
+
+    switch (applemidi_command(buf, len)) {
+        case ADJ_APPLEMIDI_IN:
+            if (applemidi_session_decode(buf, len, &s) != ADJ_OK) return;
+            p = find_ssrc(s.ssrc);
+            if (s.version != ADJ_RTPMIDI_VERSION || (is_data && ! p) || ( ! is_data && ! p && ! (p = find_free())) ) {
+                send_session(fd, ADJ_APPLEMIDI_NO, s.token, from);
+                return;
+            }
+            if ( ! is_data ) {
+                p->state = PEER_JOINING;
+                p->initiator = 0;
+                p->ssrc = s.ssrc;
+                p->token = s.token;
+                p->ctl_addr = *from;
+                snprintf(p->name, sizeof(p->name), "%s", s.name);
+            } else if (p->state != PEER_CONNECTED) {
+                p->data_addr = *from;
+                p->state = PEER_CONNECTED;
+                message("joined", p);
+            }
+            p->heard = adj_time_nanos();
+            send_session(fd, ADJ_APPLEMIDI_OK, s.token, from);
+            return;
+
+        case ADJ_APPLEMIDI_OK:
+            if (applemidi_session_decode(buf, len, &s) != ADJ_OK || ! (p = find_token(s.token))) return;
+            p->heard = adj_time_nanos();
+            if ( ! is_data && p->state == PEER_INVITING ) {
+                p->ssrc = s.ssrc;
+                snprintf(p->name, sizeof(p->name), "%s", s.name);
+                p->state = PEER_JOINING;
+                p->tries = 0;
+                send_session(data_fd, ADJ_APPLEMIDI_IN, p->token, &p->data_addr);
+            } else if (is_data && p->state == PEER_JOINING) {
+                p->state = PEER_CONNECTED;
+                p->tries = 0;
+                message("connected", p);
+                send_sync(p, 0, rtp_now(), 0, 0);
+            }
+            return;
+
+        case ADJ_APPLEMIDI_NO:
+            if (applemidi_session_decode(buf, len, &s) != ADJ_OK || ! (p = find_token(s.token))) return;
+            message("rejected the invitation", p);
+            p->state = PEER_FREE;
+            return;
+
+        case ADJ_APPLEMIDI_BY:
+            if (applemidi_session_decode(buf, len, &s) != ADJ_OK || ! (p = find_ssrc(s.ssrc))) return;
+            message("left", p);
+            p->state = PEER_FREE;
+            return;
+
+        case ADJ_APPLEMIDI_CK:
+            if ( ! is_data || applemidi_sync_decode(buf, len, &k) != ADJ_OK ) return;
+            if ( ! (p = find_ssrc(k.ssrc)) || p->state != PEER_CONNECTED ) return;
+            p->heard = adj_time_nanos();
+            if (k.count == 0) {
+                send_sync(p, 1, k.ts[0], rtp_now(), 0);
+            } else if (k.count == 1) {
+                uint64_t now = rtp_now();
+                send_sync(p, 2, k.ts[0], k.ts[1], now);
+                measured(p, now - k.ts[0], (int64_t) k.ts[1] - (int64_t) ((k.ts[0] + now) / 2));
+            } else {
+                measured(p, k.ts[2] - k.ts[0], (int64_t) ((k.ts[0] + k.ts[2]) / 2) - (int64_t) k.ts[1]);
+            }
+            return;
+    }
+}
+
+/**
+ * midi from a peer is control input, mapped by the midimap
+ */
+static void midi_input(uint8_t* buf, size_t len)
+{
+    uint8_t midi[ADJ_RTPMIDI_PACKET];
+    snd_seq_event_t ev;
+    rtp_peer* p;
+    uint32_t ts;
+    int i, n;
+
+    if (len < 12 || ! (p = find_ssrc(get32(buf + 8))) || p->state != PEER_CONNECTED) return;
+    p->heard = adj_time_nanos();
+    if ( (n = rtp_midi_decode(buf, len, &ts, midi, sizeof(midi))) <= 0 ) return;
+
+    uint64_t nanos = peer_nanos(p, ts);
+    for (i = 0; i < n; i++) {
+        // a peer's own clock and transport are not commands
+        if (midi[i] >= 0xf8) continue;
+        if (snd_midi_event_encode_byte(rtp_encoder, midi[i], &ev) == 1) {
+            adj_midiin_event(&ev, nanos);
+        }
+    }
+}
+
+static void read_socket(int fd, uint32_t events, void* data)
+{
+    uint8_t buf[ADJ_RTPMIDI_PACKET];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    int is_data = fd == data_fd;
+    ssize_t len;
+
+    while ( (len = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr*) &from, &from_len)) >= 0 ) {
+        pthread_mutex_lock(&peers_mutex);
+        if (applemidi_command(buf, len)) {
+            session(fd, is_data, buf, len, &from);
+        } else if (is_data) {
+            midi_input(buf, len);
+        }
+        pthread_mutex_unlock(&peers_mutex);
+        from_len = sizeof(from);
+    }
+}
+
+/**
+ * once a second, invitations are resent until answered, initiators sync clocks, silent peers are dropped
+ */
+static void tick_peers(int fd, uint32_t events, void* data)
+{
+    uint64_t now = adj_time_nanos();
+    rtp_peer* p;
+
+    pthread_mutex_lock(&peers_mutex);
+    for (int i = 0; i < ADJ_RTPMIDI_PEERS; i++) {
+        p = &peers[i];
+        if (p->state == PEER_FREE) continue;
+
+        if (p->state != PEER_CONNECTED && p->initiator) {
+            if (p->tries++ == ADJ_RTPMIDI_INVITES) {
+                message("did not answer", p);
+                p->state = PEER_FREE;
+            } else {
+                send_session(p->state == PEER_INVITING ? ctl_fd : data_fd, ADJ_APPLEMIDI_IN, p->token,
+                    p->state == PEER_INVITING ? &p->ctl_addr : &p->data_addr);
+            }
+            continue;
+        }
+        if (now - p->heard > PEER_TIMEOUT * 1000000000L) {
+            message("timed out", p);
+            p->state = PEER_FREE;
+            continue;
+        }
+        if (p->state == PEER_CONNECTED && p->initiator) {
+            p->tries++;
+            if (p->tries < ADJ_RTPMIDI_SYNC_FAST || p->tries % ADJ_RTPMIDI_SYNC_SECS == 0) {
+                send_sync(p, 0, rtp_now(), 0, 0);
+            }
+        }
+    }
+    pthread_mutex_unlock(&peers_mutex);
+}
+
+/**
+ * send to every connected peer, nanos is when the bytes were due on the timeline
+ */
+static void send_midi(uint8_t byte, uint64_t nanos)
+{
+    uint8_t buf[16];
+    int len;
+
+    pthread_mutex_lock(&peers_mutex);
+    len = rtp_midi_encode(buf, sizeof(buf), rtp_seq++, (uint32_t) (nanos / ADJ_RTPMIDI_UNITS), rtp_ssrc, &byte, 1);
+    for (int i = 0; i < ADJ_RTPMIDI_PEERS; i++) {
+        if (peers[i].state == PEER_CONNECTED) {
+            send_to(data_fd, buf, len, &peers[i].data_addr);
+        }
+    }
+    pthread_mutex_unlock(&peers_mutex);
+}
+
+/**
+ * Clocks follow the timeline, each one is sent when it is due and stamped with the time it was due,
+ * so the jitter of this thread waking up is in the packets' arrival but not in their timestamps.
+ */
+static void* clock_loop(void* arg)
+{
+    adj_seq_info_t* adj = arg;
+    struct timespec ts;
+    uint64_t due;
+    int seq = 0, clock = 0;
+
+    pthread_mutex_lock(&clock_mutex);
+    while (clock_running) {
+        if (seq != transport_seq) {
+            seq = transport_seq;
+            clock = 1;
+            pthread_mutex_unlock(&clock_mutex);
+            if ( ! transport ) {
+                send_midi(0xfc, adj_time_nanos());
+            } else {
+                send_midi(0xfa, adj_timeline_time(adj, 0.0, &due) == ADJ_OK ? due : adj_time_nanos());
+            }
+            pthread_mutex_lock(&clock_mutex);
+            continue;
+        }
+        if ( ! transport || adj_timeline_time(adj, (double) clock / ADJ_CLOCKS_PER_BEAT, &due) != ADJ_OK ) {
+            pthread_cond_wait(&clock_cond, &clock_mutex);
+            continue;
+        }
+        if (due > adj_time_nanos()) {
+            // the tempo may change while waiting, so when due is worked out again on waking
+            ts.tv_sec = due / 1000000000L;
+            ts.tv_nsec = due % 1000000000L;
+            pthread_cond_timedwait(&clock_cond, &clock_mutex, &ts);
+            continue;
+        }
+        pthread_mutex_unlock(&clock_mutex);
+        send_midi(0xf8, due);
+        clock++;
+        pthread_mutex_lock(&clock_mutex);
+    }
+    pthread_mutex_unlock(&clock_mutex);
+    return NULL;
+}
+
+static void transport_change(int run)
+{
+    pthread_mutex_lock(&clock_mutex);
+    transport = run;
+    transport_seq++;
+    pthread_cond_broadcast(&clock_cond);
+    pthread_mutex_unlock(&clock_mutex);
+}
+
+void adj_rtpmidi_start()
+{
+    if (clock_running) transport_change(1);
+}
+
+void adj_rtpmidi_stop()
+{
+    if (clock_running) transport_change(0);
+}
+
+static int udp_socket(int port)
+{
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if ( bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || adj_reactor_add(fd, read_socket, NULL) != ADJ_OK ) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * invite "host:port", or "host" on the default port
+ */
+static int invite(const char* peer)
+{
+    struct addrinfo hints, *res;
+    char host[256];
+    char* colon;
+    int port = ADJ_RTPMIDI_PORT;
+    rtp_peer* p;
+
+    snprintf(host, sizeof(host), "%s", peer);
+    if ( (colon = strrchr(host, ':')) ) {
+        *colon = 0;
+        port = atoi(colon + 1);
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if ( port <= 0 || getaddrinfo(host, NULL, &hints, &res) != 0 ) return ADJ_ERR;
+
+    pthread_mutex_lock(&peers_mutex);
+    if ( (p = find_free()) ) {
+        p->state = PEER_INVITING;
+        p->initiator = 1;
+        p->token = rtp_ssrc ^ (uint32_t) adj_time_nanos();
+        p->ctl_addr = *(struct sockaddr_in*) res->ai_addr;
+        p->ctl_addr.sin_port = htons(port);
+        p->data_addr = p->ctl_addr;
+        p->data_addr.sin_port = htons(port + 1);
+        send_session(ctl_fd, ADJ_APPLEMIDI_IN, p->token, &p->ctl_addr);
+    }
+    pthread_mutex_unlock(&peers_mutex);
+    freeaddrinfo(res);
+    return p ? ADJ_OK : ADJ_ERR;
+}
+
+int adj_rtpmidi_init(adj_seq_info_t* adj, int port, const char* peer)
+{
+    pthread_condattr_t attr;
+
+    rtp_adj = adj;
+    rtp_ssrc = (uint32_t) (adj_time_nanos() * 2654435761u) ^ getpid();
+
+    if ( snd_midi_event_new(ADJ_RTPMIDI_PACKET, &rtp_encoder) < 0 ) return ADJ_ALLOC;
+    if ( (ctl_fd = udp_socket(port)) < 0 || (data_fd = udp_socket(port + 1)) < 0 ) return ADJ_IO;
+    if ( (timer_fd = adj_reactor_timer(1000000000L, 1, tick_peers, NULL)) < 0 ) return ADJ_IO;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, ADJ_CLOCK);
+    pthread_cond_init(&clock_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    clock_running = 1;
+    if ( pthread_create(&clock_thread, NULL, clock_loop, adj) != 0 ) {
+        clock_running = 0;
+        return ADJ_THREAD;
+    }
+    pthread_setname_np(clock_thread, "adj-rtpmidi");
+    if ( ! adj_is_paused() ) adj_rtpmidi_start();
+
+    if (peer && invite(peer) != ADJ_OK) return ADJ_ERR;
+    return ADJ_OK;
+}
+
+adj_histogram_t* adj_rtpmidi_latency()
+{
+    return &rtp_latency;
+}
+
+adj_histogram_t* adj_rtpmidi_jitter()
+{
+    return &rtp_jitter;
+}
+
+void adj_rtpmidi_exit()
+{
+    if ( ! clock_running ) return;
+
+    pthread_mutex_lock(&clock_mutex);
+    clock_running = 0;
+    pthread_cond_broadcast(&clock_cond);
+    pthread_mutex_unlock(&clock_mutex);
+    pthread_join(clock_thread, NULL);
+
+    pthread_mutex_lock(&peers_mutex);
+    for (int i = 0; i < ADJ_RTPMIDI_PEERS; i++) {
+        if (peers[i].state != PEER_FREE && peers[i].state != PEER_INVITING) {
+            send_session(ctl_fd, ADJ_APPLEMIDI_BY, peers[i].token, &peers[i].ctl_addr);
+        }
+        peers[i].state = PEER_FREE;
+    }
+    pthread_mutex_unlock(&peers_mutex);
+
+    adj_reactor_remove(ctl_fd);
+    adj_reactor_remove(data_fd);
+    adj_reactor_remove(timer_fd);
+    close(ctl_fd);
+    close(data_fd);
+    close(timer_fd);
+    snd_midi_event_free(rtp_encoder);
+}
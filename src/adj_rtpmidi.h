@@ -0,0 +1,76 @@
+#ifndef _ADJ_RTPMIDI_INCLUDED_
+#define _ADJ_RTPMIDI_INCLUDED_
+
+#include "adj.h"
+
+/**
+ * RTP-MIDI (AppleMIDI) session endpoint, sends clock and transport to network midi peers and reads their
+ * midi as control input, mapped by the midimap the same as adj-in:control.
+ *
+ * Peers can invite adj (macOS Audio MIDI Setup, rtpMIDI, rtpmidid) on the control port, data is on port + 1,
+ * or adj invites a peer given as host:port.  Clocks carry the time on the libadj timeline they were due as
+ * their RTP timestamp and the AppleMIDI clock sync gives receivers the offset, so they can remove network jitter.
+ * Sessions are handled on the input reactor, clocks are sent by their own thread.
+ */
+
+//SNIP_rtpmidi_constants
+
+#define ADJ_RTPMIDI_PORT        5004        // control port, data is on port + 1
+#define ADJ_RTPMIDI_PEERS       4
+#define ADJ_RTPMIDI_VERSION     2
+#define ADJ_RTPMIDI_PT          0x61        // rtp payload type
+#define ADJ_RTPMIDI_NAME_LEN    64
+#define ADJ_RTPMIDI_PACKET      1500
+#define ADJ_RTPMIDI_UNITS       100000      // nanos per timestamp unit, AppleMIDI counts in 100us
+#define ADJ_RTPMIDI_SYNC_FAST   6           // syncs a second apart after joining, then every ADJ_RTPMIDI_SYNC_SECS
+#define ADJ_RTPMIDI_SYNC_SECS   10
+#define ADJ_RTPMIDI_INVITES     12          // invitations sent, a second apart, before giving up on a peer
+
+// AppleMIDI commands, two ascii letters after 0xffff
+#define ADJ_APPLEMIDI_IN        0x494e      // invitation
+#define ADJ_APPLEMIDI_OK        0x4f4b      // invitation accepted
+#define ADJ_APPLEMIDI_NO        0x4e4f      // invitation rejected
+#define ADJ_APPLEMIDI_BY        0x4259      // end session
+#define ADJ_APPLEMIDI_CK        0x434b      // clock sync
+#define ADJ_APPLEMIDI_RS        0x5253      // receiver feedback
+
+typedef struct {
+    uint16_t    command;
+    uint32_t    version;
+    uint32_t    token;
+    uint32_t    ssrc;
+    char        name[ADJ_RTPMIDI_NAME_LEN];
+} adj_applemidi_session_t;
+
+typedef struct {
+    uint32_t    ssrc;
+    uint8_t     count;                      // 0 sent by the initiator, 1 the reply, 2 the initiator's reply
+    uint64_t    ts[3];
+} adj_applemidi_sync_t;
+
+//SNIP_rtpmidi_constants
+
+/**
+ * listen for sessions on port and port + 1, and invite peer, "host:port", if it is not NULL.
+ * Call after adj_reactor_init(), and adj_midiin() for control input.
+ */
+int adj_rtpmidi_init(adj_seq_info_t* adj, int port, const char* peer);
+
+/**
+ * transport, call from the start and stop handlers
+ */
+void adj_rtpmidi_start();
+void adj_rtpmidi_stop();
+
+/**
+ * one way network latency and its jitter in micros, measured by the clock sync exchange
+ */
+adj_histogram_t* adj_rtpmidi_latency();
+adj_histogram_t* adj_rtpmidi_jitter();
+
+/**
+ * say goodbye to the peers
+ */
+void adj_rtpmidi_exit();
+
+#endif // _ADJ_RTPMIDI_INCLUDED_
@@ -0,0 +1,135 @@
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "adj_stamp.h"
+
+/**
+ * The socket is only ever read from the libvdj thread, in adj_stamp_beat(), which drains whatever has arrived
+ * and keeps the latest beat of each player.  SO_TIMESTAMPNS stamps are CLOCK_REALTIME, they are moved to
+ * ADJ_CLOCK with an offset sampled on each drain.
+ */
+
+static int stamp_fd = -1;
+static adj_stamp_beat_t beats[256];
+static adj_histogram_t stamp_latency;
+
+//SNIP_stamp_match
+
+static uint64_t timespec_nanos(const struct timespec* ts)
+{
+    return (uint64_t) ts->tv_sec * 1000000000L + ts->tv_nsec;
+}
+
+/**
+ * kernel stamp of the beat being handled, libcdj's userspace stamp is at user, 0 if it was not seen
+ */
+static uint64_t stamp_match(const adj_stamp_beat_t* b, uint8_t bar_pos, uint64_t user)
+{
+    if ( ! b->nanos || b->bar_pos != bar_pos ) return 0;
+    if (b->nanos > user || user - b->nanos > ADJ_STAMP_MATCH) return 0;
+    return b->nanos;
+}
+
+//SNIP_stamp_match
+
+static void drain()
+{
+    uint8_t buf[ADJ_STAMP_PACKET];
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    struct timespec real, mono;
+    int64_t offset;
+    ssize_t len;
+
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(ADJ_CLOCK, &mono);
+    offset = (int64_t) timespec_nanos(&real) - (int64_t) timespec_nanos(&mono);
+
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if ( (len = recvmsg(stamp_fd, &msg, MSG_DONTWAIT)) < 0 ) break;
+
+        // beat packets, see adj_capture_parse()
+        if (len < 0x60 || buf[0x0a] != 0x28 || memcmp(buf, "Qspt1WmJOL", 10) != 0) continue;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                adj_stamp_beat_t* b = &beats[buf[0x21]];
+                b->nanos = (uint64_t) ((int64_t) timespec_nanos(&ts) - offset);
+                b->bar_pos = buf[0x5c];
+            }
+        }
+    }
+    if (errno != EAGAIN && errno != EINTR) {
+        fprintf(stderr, "stamp read failed (%s)\n", strerror(errno));
+    }
+}
+
+int adj_stamp_init()
+{
+    struct sockaddr_in addr;
+    int on = 1;
+
+    memset(beats, 0, sizeof(beats));
+    if ( (stamp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 ) {
+        return ADJ_IO;
+    }
+    setsockopt(stamp_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if ( setsockopt(stamp_fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) != 0 ) {
+        adj_stamp_exit();
+        return ADJ_ERR;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(ADJ_STAMP_PORT);
+    if ( bind(stamp_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ) {
+        adj_stamp_exit();
+        return ADJ_IO;
+    }
+    return ADJ_OK;
+}
+
+int adj_stamp_beat(uint8_t player_id, uint8_t bar_pos, struct timespec* ts, int64_t* late)
+{
+    uint64_t user, kernel;
+
+    if (stamp_fd < 0) return ADJ_ERR;
+    drain();
+
+    user = timespec_nanos(ts);
+    if ( ! (kernel = stamp_match(&beats[player_id], bar_pos, user)) ) return ADJ_ERR;
+
+    *late = user - kernel;
+    adj_histogram_add(&stamp_latency, *late / 1000);
+    ts->tv_sec = kernel / 1000000000L;
+    ts->tv_nsec = kernel % 1000000000L;
+    beats[player_id].nanos = 0;
+    return ADJ_OK;
+}
+
+adj_histogram_t* adj_stamp_latency()
+{
+    return &stamp_latency;
+}
+
+void adj_stamp_exit()
+{
+    if (stamp_fd < 0) return;
+    close(stamp_fd);
+    stamp_fd = -1;
+}
@@ -0,0 +1,52 @@
+#ifndef _ADJ_STAMP_INCLUDED_
+#define _ADJ_STAMP_INCLUDED_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "adj.h"
+
+/**
+ * Kernel receive timestamps for CDJ beat packets.
+ *
+ * libcdj timestamps a beat in userspace when its pselect loop wakes, so scheduler latency ends up in every diff
+ * and bpm estimate.  A second socket on the beat port, shared with libvdj, has SO_TIMESTAMPNS on, the kernel
+ * delivers each broadcast to both sockets at once, so the beat handler can look up when the packet really arrived.
+ */
+
+//SNIP_stamp_constants
+
+#define ADJ_STAMP_PORT      50001
+#define ADJ_STAMP_PACKET    1536            // bigger datagrams are dropped
+#define ADJ_STAMP_MATCH     50000000L       // nanos, a kernel stamp older than this is not the packet being handled
+
+/**
+ * the latest beat packet from a player
+ */
+typedef struct {
+    uint64_t    nanos;          // kernel receive time on ADJ_CLOCK, 0 for none
+    uint8_t     bar_pos;
+} adj_stamp_beat_t;
+
+//SNIP_stamp_constants
+
+/**
+ * open the timestamped socket, call after libvdj has opened its sockets
+ */
+int adj_stamp_init();
+
+/**
+ * replace ts, libcdj's timestamp of player_id's beat, with the kernel's.
+ * late is set to the nanos libcdj's was behind, returns ADJ_ERR and leaves ts if the packet was not seen.
+ * Called from the libvdj thread that runs the beat handler.
+ */
+int adj_stamp_beat(uint8_t player_id, uint8_t bar_pos, struct timespec* ts, int64_t* late);
+
+/**
+ * how far libcdj's timestamps were behind the kernel's, micros
+ */
+adj_histogram_t* adj_stamp_latency();
+
+void adj_stamp_exit();
+
+#endif // _ADJ_STAMP_INCLUDED_
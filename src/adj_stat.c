@@ -0,0 +1,87 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "adj.h"
+
+/**
+ * Print adj's live state from shared memory, reading it has no effect on the running clock.
+ */
+
+static void usage()
+{
+    printf("adj-stat [-n name] [-i millis] [-1]\n");
+    printf("options:\n");
+    printf("    -n - sequencer name of the adj to watch (default 'adj')\n");
+    printf("    -i - interval between lines in milliseconds (default 1000)\n");
+    printf("    -1 - print once and exit\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static void print_state(adj_state_t* s)
+{
+    int i;
+    printf("bpm=%.2f %s tick=%u queue=%i underruns=%" PRIu64 " jitter=%" PRIu64 "/%" PRIu64 "us wakeups=%" PRIu64,
+        s->tempo.bpm, s->clock.state == ADJ_STATE_RUNNING ? "running" : "stopped", s->clock.tick, s->clock.queue_events,
+        s->clock.underruns, s->clock.jitter_last, s->clock.jitter_max, s->clock.wakeups);
+    if (s->lock.player_id) {
+        printf(" lock=%02i/%+ims", s->lock.player_id, s->lock.ms);
+    }
+    for (i = 0; i < ADJ_STATE_PLAYERS; i++) {
+        adj_state_player_t* p = &s->players[i];
+        if (p->player_id) {
+            printf(" [%02i %.2f %i %+04i]", p->player_id, p->bpm, p->bar_pos, p->diff);
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    const adj_state_t* page;
+    adj_state_t s;
+    char* seq_name = "adj";
+    char name[256];
+    int interval = 1000;
+    char once = 0;
+    int c;
+
+    while ( ( c = getopt(argc, argv, "n:i:1h") ) != EOF) {
+        switch (c) {
+            case 'n':
+                seq_name = optarg;
+                break;
+            case 'i':
+                interval = atoi(optarg);
+                if (interval <= 0) interval = 1000;
+                break;
+            case '1':
+                once = 1;
+                break;
+            case 'h':
+                usage();
+                break;
+        }
+    }
+
+    snprintf(name, sizeof(name), "/%s-state", seq_name);
+    if ( (page = adj_state_attach(name)) == NULL ) {
+        fprintf(stderr, "%s not found, is adj running?\n", name);
+        return 1;
+    }
+
+    do {
+        if ( adj_state_read(page, &s) != ADJ_OK ) {
+            fprintf(stderr, "%s unreadable, wrong version or adj died\n", name);
+            return 1;
+        }
+        print_state(&s);
+        if ( ! once ) usleep(interval * 1000);
+    } while ( ! once );
+
+    return 0;
+}
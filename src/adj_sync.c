@@ -0,0 +1,178 @@
+
+#include <stdatomic.h>
+#include <time.h>
+
+#include "adj.h"
+#include "adj_bpm.h"
+#include "adj_diff.h"
+#include "adj_sync.h"
+
+//SNIP_sync
+/**
+ * Difflock state, set from the ui and input threads, read by the vdj beat handlers.
+ */
+
+// the player_id we are locked to, 0 for none
+static unsigned _Atomic lock_player = ATOMIC_VAR_INIT(0);
+
+// the milliseconds difference we want to maintain
+static int32_t _Atomic lock_ms = ATOMIC_VAR_INIT(0);
+
+static unsigned _Atomic follow_master = ATOMIC_VAR_INIT(0);   // swap difflock when master changes
+static unsigned _Atomic follow_tempo = ATOMIC_VAR_INIT(0);    // copy tempo changes from the locked deck
+
+// our notion of master, so we can detect change
+static uint8_t master = 0;
+
+// our notion of bpm, so we can detect change
+static float bpm = 120.0;
+
+static int32_t
+limit(int32_t diff)
+{
+    if (diff < -ADJ_SYNC_NUDGE_LIMIT) diff = -ADJ_SYNC_NUDGE_LIMIT;
+    if (diff > ADJ_SYNC_NUDGE_LIMIT) diff = ADJ_SYNC_NUDGE_LIMIT;
+    return diff;
+}
+
+/**
+ * Limit the amount we nudge in one beat, seems sometimes beats are delayed.
+ */
+static int32_t
+auto_nudge_amount(uint8_t player_id, int32_t difflock_ms)
+{
+    return limit(adj_diff_avg(player_id) - difflock_ms);
+}
+
+void
+adj_sync_reset()
+{
+    lock_player = 0;
+    lock_ms = 0;
+    master = 0;
+    adj_diff_reset();
+}
+
+void
+adj_sync_lock(uint8_t player_id, int32_t ms)
+{
+    lock_player = player_id;
+    lock_ms = ms;
+    adj_state_lock(player_id, ms);
+
+    // if explicit lock against not master, stop follow master
+    if (master != player_id) follow_master = 0;
+}
+
+void
+adj_sync_unlock()
+{
+    lock_player = 0;
+    adj_state_lock(0, 0);
+    adj_diff_reset();
+}
+
+uint8_t
+adj_sync_player()
+{
+    return lock_player;
+}
+
+int32_t
+adj_sync_ms()
+{
+    return lock_ms;
+}
+
+void
+adj_sync_adjust(int32_t amount)
+{
+    lock_ms += amount;
+}
+
+void
+adj_sync_follow_master(int on)
+{
+    follow_master = on;
+}
+
+int
+adj_sync_follows_master()
+{
+    return follow_master;
+}
+
+void
+adj_sync_follow_tempo(int on)
+{
+    follow_tempo = on;
+}
+
+int
+adj_sync_master(uint8_t player_id)
+{
+    if (master == player_id) return 0;
+
+    master = player_id;
+    if (follow_master) {
+        lock_player = master;
+        adj_state_lock(lock_player, lock_ms);
+    }
+    return 1;
+}
+
+uint8_t
+adj_sync_get_master()
+{
+    return master;
+}
+
+void
+adj_sync_copied(float copied)
+{
+    bpm = copied;
+}
+
+void
+adj_sync_beat(uint8_t player_id, uint8_t bar_pos, float beat_bpm, int32_t diff, adj_sync_action_t* action)
+{
+    action->nudge_ms = 0;
+    action->bpm = 0.0;
+    if (lock_player != player_id) return;
+
+    // auto nudge on the last beat, in theory the down beat should then always be in time.
+    if (bar_pos == 4 && diff - lock_ms) {
+        action->nudge_ms = auto_nudge_amount(player_id, lock_ms);
+    }
+    if (follow_tempo && bpm != beat_bpm) {
+        bpm = beat_bpm;
+        action->bpm = bpm;
+    }
+}
+//SNIP_sync
+
+float
+adj_sync_on_beat(adj_seq_info_t* adj, uint8_t player_id, uint8_t bar_pos, float beat_bpm, struct timespec stamp,
+                 int32_t diff, int average, int nudge, adj_sync_action_t* action)
+{
+    float est = 0.0;
+
+    if (bar_pos == 1) {
+        est = adj_estimate_bpm(player_id, stamp);
+    }
+
+    adj_trace(ADJ_TRACE_DIFF, player_id, diff);
+    adj_state_player(player_id, bar_pos, beat_bpm, diff);
+    if (average) {
+        adj_diff_add(player_id, diff);
+    }
+
+    adj_sync_beat(player_id, bar_pos, beat_bpm, diff, action);
+    if (nudge && action->nudge_ms) {
+        adj_nudge_millis(adj, action->nudge_ms);
+    }
+    if (action->bpm > 0.0) {
+        adj_set_tempo(adj, action->bpm);
+    }
+    return est;
+}
@@ -0,0 +1,86 @@
+#ifndef _ADJ_SYNC_INCLUDED_
+#define _ADJ_SYNC_INCLUDED_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "adj.h"
+
+/**
+ * Difflock, aka auto-sync, keeps the midi beat a fixed number of millis from a CDJ's beat by nudging on the
+ * last beat of the bar, optionally following the master and copying the CDJ's tempo.
+ *
+ * No network or ui code, adj_vdj.c feeds it the CDJs' beats and diffs, adj-sync-bench feeds it simulated ones,
+ * so changes to the algorithm can be measured without decks.
+ */
+
+//SNIP_sync_constants
+#define ADJ_SYNC_NUDGE_LIMIT   20  // millis, beat packets are sometimes late, so never nudge further than this in one bar
+
+/**
+ * what to do to the sequencer after a beat
+ */
+typedef struct {
+    int32_t     nudge_ms;   // adj_nudge_millis(), 0 for none
+    float       bpm;        // adj_set_tempo(), 0.0 for no change
+} adj_sync_action_t;
+//SNIP_sync_constants
+
+/**
+ * unlock and forget diffs and the master
+ */
+void adj_sync_reset();
+
+/**
+ * keep the beat ms from player_id's beat, an explicit lock on a player that is not master stops following master
+ */
+void adj_sync_lock(uint8_t player_id, int32_t ms);
+void adj_sync_unlock();
+
+/**
+ * locked player, or 0
+ */
+uint8_t adj_sync_player();
+int32_t adj_sync_ms();
+
+/**
+ * move the locked offset by amount millis
+ */
+void adj_sync_adjust(int32_t amount);
+
+/**
+ * move the lock to whichever player becomes master
+ */
+void adj_sync_follow_master(int on);
+int adj_sync_follows_master();
+
+/**
+ * copy tempo changes from the locked player
+ */
+void adj_sync_follow_tempo(int on);
+
+/**
+ * player_id reported master, returns 1 if that is a change of master
+ */
+int adj_sync_master(uint8_t player_id);
+uint8_t adj_sync_get_master();
+
+/**
+ * tempo copied to the sequencer by other means, so following does not copy it again
+ */
+void adj_sync_copied(float bpm);
+
+/**
+ * a beat from player_id, diff is the latest diff in millis, the CDJ's beat minus ours
+ */
+void adj_sync_beat(uint8_t player_id, uint8_t bar_pos, float bpm, int32_t diff, adj_sync_action_t* action);
+
+/**
+ * Everything done with a CDJ's beat once its diff is known, live in adj_vdj.c, in adj-replay and adj-sync-bench.
+ * stamp is when the packet arrived, the bpm estimate from downbeats is returned, 0.0 on other beats.
+ * diff is added to the average if average is set, the lock's nudge is applied if nudge is set, its tempo always is.
+ */
+float adj_sync_on_beat(adj_seq_info_t* adj, uint8_t player_id, uint8_t bar_pos, float bpm, struct timespec stamp,
+                       int32_t diff, int average, int nudge, adj_sync_action_t* action);
+
+#endif // _ADJ_SYNC_INCLUDED_
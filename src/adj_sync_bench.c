@@ -0,0 +1,232 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "adj.h"
+#include "adj_diff.h"
+#include "adj_sync.h"
+
+/**
+ * Difflock benchmark, simulated CDJs drive adj_sync.c, the same code adj_vdj.c runs, against the clock loop on
+ * the simulated backend.  Decks have programmable tempo, pitch changes, drift, network jitter and packet loss,
+ * and can hand master over.  Reports how long difflock takes to lock, the steady state phase error, and how far
+ * the beat moves and how long it takes to recover after a pitch change or a master handoff.
+ *
+ * Phase error is the deck's beat minus adj's, in millis, measured on the master's beats.  Virtual time, so every
+ * run gives the same numbers and two versions of the sync algorithm can be compared.
+ *
+ * The decks' beats go straight to adj_sync_on_beat() with their arrival time, no ProLink packets are sent, a socket
+ * would tie the run to the wall clock.  For the whole path over the network run adj-cdjsim against adj -v -w file,
+ * and replay the capture with adj-replay.
+ */
+
+typedef struct {
+    char*       name;
+    float       bpm;            // adj's tempo
+    float       cdj_bpm;        // the decks' tempo
+    float       drift;          // bpm per minute the decks wander
+    float       step;           // percent pitch change at BENCH_STEP_AT
+    int         handoff;        // millis player 2 is behind player 1, master moves to it at BENCH_STEP_AT, 0 for none
+    int         offset;         // millis the deck's beat is behind adj's at the start
+    int         jitter;         // micros of uniform random network delay
+    int         loss;           // percent of beat packets lost
+    int         follow_tempo;
+} bench_scenario;
+
+static bench_scenario scenarios[] = {
+    {"in phase 120",            120.0, 120.0,  0.0,  0.0,  0,   0,  500,  0, 0},
+    {"60ms behind 120",         120.0, 120.0,  0.0,  0.0,  0,  60,  500,  0, 0},
+    {"60ms ahead 128",          128.0, 128.0,  0.0,  0.0,  0, -60,  500,  0, 0},
+    {"tempo off 0.1%",          120.0, 120.12, 0.0,  0.0,  0,   0,  500,  0, 0},
+    {"jitter 5ms",              120.0, 120.0,  0.0,  0.0,  0,   0, 5000,  0, 0},
+    {"loss 20%",                120.0, 120.0,  0.0,  0.0,  0,  30,  500, 20, 0},
+    {"pitch +2% follow",        124.0, 124.0,  0.0,  2.0,  0,   0,  500,  0, 1},
+    {"pitch -6% follow",        124.0, 124.0,  0.0, -6.0,  0,   0,  500,  0, 1},
+    {"drift 1bpm/min follow",   120.0, 120.0,  1.0,  0.0,  0,   0,  500,  0, 1},
+    {"handoff 15ms",            120.0, 120.0,  0.0,  0.0, 15,   0, 2000,  0, 0},
+    {NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+};
+
+#define BENCH_SECONDS       120
+#define BENCH_LOCK_AT       4           // seconds, lock once the averages have diffs
+#define BENCH_STEP_AT       60          // seconds, pitch change or master handoff
+#define BENCH_LATENCY       1000000L    // nanos from a deck's beat to its packet being read, the lock offset allows for it
+#define BENCH_TOLERANCE     3.0         // millis, locked once every beat from then on is this close
+#define BENCH_PLAYERS       2
+#define BENCH_BEATS         4096
+
+typedef struct {
+    double      t;              // seconds since start
+    double      error;          // millis
+} bench_beat;
+
+static bench_beat beats[BENCH_BEATS];
+static uint32_t seed;
+
+static uint32_t bench_rand()
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+/**
+ * adj's beat nearest to nanos
+ */
+static uint64_t adj_beat_near(adj_seq_info_t* adj, uint64_t nanos, double* beat)
+{
+    adj_beat_pos_t pos;
+    uint64_t t = 0;
+    if (adj_timeline_position(adj, nanos, &pos) != ADJ_OK) return 0;
+    *beat = floor(pos.beat + 0.5);
+    adj_timeline_time(adj, *beat, &t);
+    return t;
+}
+
+/**
+ * first beat in [from, to) after which every beat is within tolerance, -1 if the last beat is still out
+ */
+static int settled(int from, int to)
+{
+    int i, last = from - 1;
+    for (i = from; i < to; i++) {
+        if (fabs(beats[i].error) > BENCH_TOLERANCE) last = i;
+    }
+    return last == to - 1 ? -1 : last + 1;
+}
+
+static void run(bench_scenario* b)
+{
+    adj_sync_action_t action;
+    struct timespec stamp;
+    uint64_t next[BENCH_PLAYERS], arrival, ta, now;
+    uint8_t bar_pos[BENCH_PLAYERS] = { 1, 1 };
+    double beat, k, pitch = 0.0, bpm, rms = 0.0, max = 0.0, step_max = 0.0;
+    int i, p, n = 0, lost = 0, locked = 0, stepped = 0, step_i = -1, lock_i = -1;
+    uint8_t master = 1;
+    int players = b->handoff ? 2 : 1;
+    int32_t diff;
+
+    seed = 1;
+    adj_set_backend(adj_backend_sim(0, 1));
+    adj_seq_info_t* adj = adj_calloc();
+    adj->bpm = b->bpm;
+    if (adj_init(adj) != ADJ_OK) {
+        printf("%-24s init failed\n", b->name);
+        exit(1);
+    }
+    adj_sync_reset();
+    adj_sync_master(master);
+
+    uint64_t t0 = adj_time_nanos();
+    adj_start(adj);
+
+    // decks come in on adj's second bar, offset and handoff millis late
+    next[0] = t0 + (uint64_t) (ADJ_BEATS_PER_BAR * 60000000000.0 / b->bpm) + b->offset * 1000000L;
+    next[1] = next[0] + b->handoff * 1000000L;
+
+    while (1) {
+        p = players == 2 && next[1] < next[0] ? 1 : 0;
+        uint64_t t = next[p];
+        double secs = (t - t0) / 1000000000.0;
+        if (secs > BENCH_SECONDS) break;
+
+        // both decks play the same track, the tempo they are at when a beat starts sets its length
+        if ( ! stepped && secs >= BENCH_STEP_AT && (b->step != 0.0 || b->handoff) ) {
+            stepped = 1;
+            step_i = n;
+            pitch = b->step;
+            if (b->handoff) adj_sync_master(master = 2);
+        }
+        bpm = b->cdj_bpm * (1.0 + pitch / 100.0) + b->drift * secs / 60.0;
+        next[p] = t + (uint64_t) (60000000000.0 / bpm);
+        uint8_t pos = bar_pos[p];
+        bar_pos[p] = pos == ADJ_BEATS_PER_BAR ? 1 : pos + 1;
+
+        if ( ! locked && secs >= BENCH_LOCK_AT ) {
+            locked = 1;
+            lock_i = n;
+            adj_sync_follow_tempo(b->follow_tempo);
+            adj_sync_lock(master, BENCH_LATENCY / 1000000L);
+            if (b->handoff) adj_sync_follow_master(1);
+        }
+
+        if ( (int) (bench_rand() % 100) < b->loss ) {
+            lost++;
+        } else {
+            arrival = t + BENCH_LATENCY + (b->jitter ? (bench_rand() % b->jitter) * 1000L : 0);
+            adj_sim_sleep_until(arrival);
+
+            // the diff is known at whichever of the two beats is later, as in adj_vdj.c
+            while ( (ta = adj_beat_near(adj, arrival, &k)) > (now = adj_time_nanos()) ) {
+                adj_sim_sleep_until(ta);
+            }
+            diff = (int32_t) (((int64_t) arrival - (int64_t) ta) / 1000000L);
+            stamp.tv_sec = arrival / 1000000000L;
+            stamp.tv_nsec = arrival % 1000000000L;
+            adj_sync_on_beat(adj, p + 1, pos, roundf(bpm * 100.0) / 100.0, stamp, diff, 1, 1, &action);
+        }
+
+        if (p + 1 == master && n < BENCH_BEATS) {
+            ta = adj_beat_near(adj, t, &beat);
+            beats[n].t = secs;
+            beats[n].error = ((int64_t) t - (int64_t) ta) / 1000000.0;
+            n++;
+        }
+    }
+    adj_exit(adj);
+
+    if (lock_i < 0) {
+        printf("%-24s no beats\n", b->name);
+        exit(1);
+    }
+    int steady_end = step_i > 0 ? step_i : n;
+    int lock_at = settled(lock_i, steady_end);
+
+    printf("%-24s %6i %5i", b->name, n, lost);
+    if (lock_at < 0) {
+        printf(" %8s %8s %8s", "never", "-", "-");
+    } else {
+        for (i = lock_at; i < steady_end; i++) {
+            rms += beats[i].error * beats[i].error;
+            if (fabs(beats[i].error) > max) max = fabs(beats[i].error);
+        }
+        rms = steady_end > lock_at ? sqrt(rms / (steady_end - lock_at)) : 0.0;
+        printf(" %8.1f %8.2f %8.2f", beats[lock_at].t - beats[lock_i].t, rms, max);
+    }
+    if (step_i > 0) {
+        for (i = step_i; i < n; i++) {
+            if (fabs(beats[i].error) > step_max) step_max = fabs(beats[i].error);
+        }
+        int recovered = settled(step_i, n);
+        printf(" %8.2f", step_max);
+        if (recovered < 0) printf(" %8s", "never");
+        else printf(" %8.1f", beats[recovered].t - beats[step_i].t);
+    }
+    printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+    int i, status, rv = 0;
+
+    printf("%-24s %6s %5s %8s %8s %8s %8s %8s\n", "scenario", "beats", "lost", "lock s", "rms ms", "max ms", "step ms", "recover s");
+    fflush(stdout);
+
+    // libadj and adj_sync hold their state in globals, each scenario gets a fresh process
+    for (i = 0; scenarios[i].name; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(&scenarios[i]);
+            fflush(stdout);
+            _exit(0);
+        }
+        if (pid < 0 || waitpid(pid, &status, 0) < 0 || ! WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            rv = 1;
+        }
+    }
+    return rv;
+}
@@ -0,0 +1,182 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "adj.h"
+
+/**
+ * Convert a trace file written by adj -T, or kill -USR1, to Chrome trace JSON (chrome://tracing, ui.perfetto.dev) or CSV.
+ */
+
+typedef struct {
+    adj_trace_event_t ev;
+    uint32_t          thread;
+} trace_row;
+
+static char* type_names[ADJ_TRACE_TYPES] = {
+    "none", "clocks", "tempo", "nudge", "start", "stop", "restart", "beat", "diff", "midi_in", "pad", "key"
+};
+
+static void usage()
+{
+    printf("adj-trace [-c] file\n");
+    printf("options:\n");
+    printf("    -c - output csv, default is chrome trace json\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static char* type_name(uint16_t type)
+{
+    return type < ADJ_TRACE_TYPES ? type_names[type] : "unknown";
+}
+
+static int by_nanos(const void* a, const void* b)
+{
+    uint64_t an = ((trace_row*) a)->ev.nanos;
+    uint64_t bn = ((trace_row*) b)->ev.nanos;
+    return an < bn ? -1 : an > bn ? 1 : 0;
+}
+
+/**
+ * read every thread's events into one array, returns the row count or -1
+ */
+static int read_trace(FILE* f, adj_trace_thread_t** threads_out, uint32_t* thread_count, trace_row** rows_out)
+{
+    adj_trace_header_t hdr;
+    adj_trace_thread_t* threads;
+    trace_row* rows = NULL;
+    uint32_t i, j;
+    int count = 0;
+
+    if ( fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, ADJ_TRACE_MAGIC, sizeof(hdr.magic)) != 0 ) {
+        fprintf(stderr, "not an adj trace file\n");
+        return -1;
+    }
+    if (hdr.event_size != sizeof(adj_trace_event_t)) {
+        fprintf(stderr, "unsupported event size %u\n", hdr.event_size);
+        return -1;
+    }
+    if ( (threads = calloc(hdr.threads ? hdr.threads : 1, sizeof(adj_trace_thread_t))) == NULL ) return -1;
+
+    for (i = 0; i < hdr.threads; i++) {
+        if ( fread(&threads[i], sizeof(adj_trace_thread_t), 1, f) != 1 ) goto truncated;
+        threads[i].name[sizeof(threads[i].name) - 1] = 0;
+        trace_row* more = realloc(rows, (count + threads[i].count) * sizeof(trace_row));
+        if (more == NULL && threads[i].count) goto truncated;
+        rows = more;
+        for (j = 0; j < threads[i].count; j++) {
+            if ( fread(&rows[count].ev, sizeof(adj_trace_event_t), 1, f) != 1 ) goto truncated;
+            rows[count++].thread = i;
+        }
+    }
+
+    qsort(rows, count, sizeof(trace_row), by_nanos);
+    *threads_out = threads;
+    *thread_count = hdr.threads;
+    *rows_out = rows;
+    return count;
+
+    truncated:
+    fprintf(stderr, "trace file truncated\n");
+    free(threads);
+    free(rows);
+    return -1;
+}
+
+static void print_csv(trace_row* rows, int count, adj_trace_thread_t* threads)
+{
+    int i;
+    printf("nanos,thread,type,a,b\n");
+    for (i = 0; i < count; i++) {
+        trace_row* r = &rows[i];
+        printf("%" PRIu64 ",%s,%s,%i,%" PRIi64 "\n", r->ev.nanos, threads[r->thread].name, type_name(r->ev.type), r->ev.a, r->ev.b);
+    }
+}
+
+static void print_counter(double ts, char* name, char* key, double value)
+{
+    printf(",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"%s\":%.2f}}", name, ts, key, value);
+}
+
+static void print_json(trace_row* rows, int count, adj_trace_thread_t* threads, uint32_t thread_count)
+{
+    char name[32];
+    uint32_t t;
+    int i;
+    uint64_t t0 = count ? rows[0].ev.nanos : 0;
+
+    printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"adj\"}}");
+    for (t = 0; t < thread_count; t++) {
+        printf(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", t, threads[t].name);
+    }
+
+    for (i = 0; i < count; i++) {
+        trace_row* r = &rows[i];
+        double ts = (r->ev.nanos - t0) / 1000.0;
+        printf(",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"args\":{\"a\":%i,\"b\":%" PRIi64 "}}",
+            type_name(r->ev.type), r->thread, ts, r->ev.a, r->ev.b);
+
+        switch (r->ev.type) {
+            case ADJ_TRACE_CLOCKS:
+                print_counter(ts, "queue", "events", r->ev.b);
+                break;
+            case ADJ_TRACE_TEMPO:
+                if (r->ev.a) print_counter(ts, "bpm", "bpm", 60000000.0 / r->ev.a);
+                break;
+            case ADJ_TRACE_BEAT:
+                snprintf(name, sizeof(name), "bpm player %i", r->ev.a);
+                print_counter(ts, name, "bpm", r->ev.b / 100.0);
+                break;
+            case ADJ_TRACE_DIFF:
+                snprintf(name, sizeof(name), "diff player %i", r->ev.a);
+                print_counter(ts, name, "ms", r->ev.b);
+                break;
+        }
+    }
+    printf("\n]}\n");
+}
+
+int main(int argc, char* argv[])
+{
+    adj_trace_thread_t* threads;
+    trace_row* rows;
+    uint32_t thread_count;
+    char csv = 0;
+    int c, count;
+
+    while ( ( c = getopt(argc, argv, "ch") ) != EOF) {
+        switch (c) {
+            case 'c':
+                csv = 1;
+                break;
+            case 'h':
+                usage();
+                break;
+        }
+    }
+    if (optind >= argc) usage();
+
+    FILE* f = fopen(argv[optind], "r");
+    if ( ! f ) {
+        perror(argv[optind]);
+        return 1;
+    }
+    count = read_trace(f, &threads, &thread_count, &rows);
+    fclose(f);
+    if (count < 0) return 1;
+
+    if (csv) {
+        print_csv(rows, count, threads);
+    } else {
+        print_json(rows, count, threads, thread_count);
+    }
+
+    free(threads);
+    free(rows);
+    return 0;
+}
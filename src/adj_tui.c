@@ -10,7 +10,12 @@
 
 static unsigned _Atomic adj_tui_running = ATOMIC_VAR_INIT(1);
 
+#define ADJ_TUI_MESSAGE_NANOS   2500000000L    // how long a message stays on screen
+
 static int message_ticks = 0;
+static pthread_mutex_t message_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t message_cond;
+static uint64_t message_until = 0;      // when to clear the message, 0 when there is none
 
 
 static void data_item(int idx, char* name, char* value)
@@ -90,9 +95,13 @@ static void init_error(adj_ui_t* ui, char* msg)
 }
 
 
+// hotplug and controller modules report ports from the reactor thread
 static void data_item_handler(adj_ui_t* ui, int idx, char* name, char* value)
 {
+    tui_lock();
     data_item(idx, name, value);
+    tui_unlock();
+    fflush(stdout);
 }
 
 static void data_change_handler(adj_ui_t* ui, adj_seq_info_t* adj, int idx, char* value)
@@ -114,6 +123,11 @@ static void message_handler(adj_ui_t* ui, adj_seq_info_t* adj, char* message)
     tui_error_at(message, 2, 0);
     tui_unlock();
     fflush(stdout);
+
+    pthread_mutex_lock(&message_mutex);
+    message_until = adj_time_nanos() + ADJ_TUI_MESSAGE_NANOS;
+    pthread_cond_signal(&message_cond);
+    pthread_mutex_unlock(&message_mutex);
 }
 
 static void tick_handler(adj_ui_t* ui, adj_seq_info_t* adj, snd_seq_tick_time_t tick)
@@ -160,16 +174,28 @@ static void beat_handler(adj_ui_t* ui, adj_seq_info_t* adj, unsigned char player
 
 }
 
+/**
+ * clears messages after a while, sleeps until there is a message to clear
+ */
 static void* run(void* arg)
 {
-    sleep(2);
-    adj_tui_running = 1;
+    struct timespec ts;
+
+    pthread_mutex_lock(&message_mutex);
     while (adj_tui_running) {
-        usleep(50000);
-        if (message_ticks && ++message_ticks > 50) {
+        if (message_until == 0) {
+            pthread_cond_wait(&message_cond, &message_mutex);
+        } else if (adj_time_nanos() >= message_until) {
+            message_until = 0;
             clear_message();
+        } else {
+            ts.tv_sec = message_until / 1000000000L;
+            ts.tv_nsec = message_until % 1000000000L;
+            pthread_cond_timedwait(&message_cond, &message_mutex, &ts);
         }
+        adj_wakeup();
     }
+    pthread_mutex_unlock(&message_mutex);
     return NULL;
 }
 
@@ -186,6 +212,12 @@ void initialize_tui(adj_ui_t* ui, uint64_t flags)
     ui->stop_handler = stop_handler;
     ui->start_handler = start_handler;
     ui->exit_handler = exit_handler;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, ADJ_CLOCK);
+    pthread_cond_init(&message_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
     pthread_t thread_id;
     pthread_create(&thread_id, NULL, &run, NULL);
 }
\ No newline at end of file
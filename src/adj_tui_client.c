@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+
+#include "adj.h"
+#include "adj_keyb.h"
+#include "adj_tui.h"
+#include "adj_reactor.h"
+#include "adj_remote.h"
+
+/**
+ * Terminal UI for adjd in its own process. The display is read from the shared memory state page,
+ * keys are sent as commands on the control socket, so a stuck terminal or a crash here never reaches the clock.
+ */
+
+#define ADJ_TUI_POLL_NANOS  10000000L   // state page poll, a quarter beat is 125ms at 120bpm
+
+static adj_ui_t ui = {0};
+static const adj_state_t* page = NULL;
+static adj_state_t last = {0};
+static int last_q_beat = -1;
+
+static void usage()
+{
+    printf("adj-tui [-n name] [-e]\n");
+    printf("    keys as adj -k, the clock runs in adjd\n");
+    printf("options:\n");
+    printf("    -n - sequencer name of the adj to control (default 'adj')\n");
+    printf("    -e - enter key toggles start/stop\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+static void message_handler(adj_seq_info_t* adj, char* message)
+{
+    adj->ui->message_handler(adj->ui, adj, message);
+}
+
+static void on_signal(int fd, uint32_t events, void* data)
+{
+    struct signalfd_siginfo si;
+
+    if ( read(fd, &si, sizeof(si)) == sizeof(si) ) {
+        adj_reactor_exit();
+    }
+}
+
+/**
+ * repaint what changed since the last poll
+ */
+static void poll_state(int fd, uint32_t events, void* data)
+{
+    adj_seq_info_t* adj = data;
+    adj_state_t s;
+    char buf[32];
+    int q_beat;
+
+    if ( adj_state_read(page, &s) != ADJ_OK ) {
+        return;
+    }
+
+    if (s.tempo.bpm != last.tempo.bpm) {
+        adj->bpm = s.tempo.bpm;
+        snprintf(buf, sizeof(buf), "%f", s.tempo.bpm);
+        ui.data_change_handler(&ui, adj, ADJ_ITEM_BPM, buf);
+    }
+    if (s.clock.queue_events != last.clock.queue_events) {
+        snprintf(buf, sizeof(buf), "%i", s.clock.queue_events);
+        ui.data_change_handler(&ui, adj, ADJ_ITEM_EVENTS, buf);
+    }
+    if (s.clock.state != last.clock.state) {
+        if (s.clock.state == ADJ_STATE_RUNNING) {
+            ui.data_change_handler(&ui, adj, ADJ_ITEM_STATE_Q, "running");
+            ui.start_handler(&ui, adj);
+        } else {
+            ui.data_change_handler(&ui, adj, ADJ_ITEM_STATE_Q, "paused");
+            ui.stop_handler(&ui, adj);
+            last_q_beat = -1;
+        }
+    }
+    if (s.clock.state == ADJ_STATE_RUNNING) {
+        q_beat = s.clock.tick / ADJ_CLOCKS_PER_BEAT;
+        if (q_beat != last_q_beat) {
+            ui.tick_handler(&ui, adj, s.clock.tick);
+            last_q_beat = q_beat;
+        }
+    }
+    if (s.lock.player_id != last.lock.player_id) {
+        if (s.lock.player_id) {
+            snprintf(buf, sizeof(buf), "locked to %02i", s.lock.player_id);
+        } else {
+            snprintf(buf, sizeof(buf), "unlocked");
+        }
+        message_handler(adj, buf);
+    }
+    memcpy(&last, &s, sizeof(adj_state_t));
+}
+
+int main(int argc, char* argv[])
+{
+    char* seq_name = "adj";
+    char name[256];
+    uint32_t keyb_flags = 0;
+    int c, rv, sfd, timer;
+
+    while ( ( c = getopt(argc, argv, "n:eh") ) != EOF) {
+        switch (c) {
+            case 'n':
+                seq_name = optarg;
+                break;
+            case 'e':
+                keyb_flags |= ADJ_ENTER_TOGGLES;
+                break;
+            case 'h':
+                usage();
+                break;
+        }
+    }
+
+    snprintf(name, sizeof(name), "/%s-state", seq_name);
+    if ( (page = adj_state_attach(name)) == NULL ) {
+        fprintf(stderr, "%s not found, is adj running?\n", name);
+        return 1;
+    }
+
+    adj_seq_info_t* adj = adj_calloc();
+    adj->seq_name = seq_name;
+    adj->ui = &ui;
+    adj->message_handler = message_handler;
+
+    sigset_t signal_mask;
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGINT);
+    sigaddset(&signal_mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signal_mask, NULL);
+
+    if ( adj_reactor_init() != ADJ_OK ) {
+        fprintf(stderr, "input reactor init failed\n");
+        return 1;
+    }
+    if ( (sfd = signalfd(-1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0 || adj_reactor_add(sfd, on_signal, adj) != ADJ_OK ) {
+        fprintf(stderr, "signalfd failed\n");
+        return 1;
+    }
+    if ( (rv = adj_remote_connect(adj, seq_name)) != ADJ_OK ) {
+        fprintf(stderr, "%s: not running? %i\n", adj_remote_path(), rv);
+        return 1;
+    }
+    if (adj_remote_has_vdj()) keyb_flags |= ADJ_HAS_VDJ;
+
+    initialize_tui(&ui, keyb_flags & ADJ_HAS_VDJ);
+    ui.data_item_handler(&ui, ADJ_ITEM_PORT, "control:", adj_remote_path());
+    ui.data_change_handler(&ui, adj, ADJ_ITEM_STATE_SEQ, "remote");
+
+    if ( (rv = adj_keyb_input(adj, keyb_flags)) != ADJ_OK ) {
+        ui.init_error_handler(&ui, "keyb init failed");
+    } else {
+        ui.data_item_handler(&ui, ADJ_ITEM_KEYB, "keyb:", "on");
+    }
+
+    // the page is polled, adjd has no idea this process exists
+    if ( (timer = adj_reactor_timer(ADJ_TUI_POLL_NANOS, 1, poll_state, adj)) < 0 ) {
+        ui.init_error_handler(&ui, "timer failed");
+    }
+    last.clock.state = ADJ_STATE_STOPPED;
+    poll_state(timer, 0, adj);
+
+    adj_reactor_run();
+
+    adj_keyb_exit();
+    adj_remote_close();
+    ui.exit_handler(&ui, 0);
+    adj_keyb_reset_term();
+    return 0;
+}
@@ -15,6 +15,8 @@
 #include "adj_bpm.h"
 #include "adj_diff.h"
 #include "adj_vdj.h"
+#include "adj_sync.h"
+#include "adj_stamp.h"
 #include "tui.h"
 
 /**
@@ -29,25 +31,14 @@ static void adj_vdj_beat_hook(vdj_t* v, uint8_t player_id);
 
 static unsigned _Atomic adj_trigger_from = ATOMIC_VAR_INIT(0);    
 static unsigned _Atomic adj_lock_on = ATOMIC_VAR_INIT(0);         // trigger lock, sync to downbeat
-static unsigned _Atomic adj_difflock_master = ATOMIC_VAR_INIT(0); // swap difflock when master changes
-static unsigned _Atomic adj_follow_tempo = ATOMIC_VAR_INIT(0);    // copy tempo changes from the followed deck
 static unsigned _Atomic adj_track_start = ATOMIC_VAR_INIT(0);     // set when we manually mark track start for bpm analysis
 
 
-// difflock aka auto-sync, this holds the player_id we should lock to
-static unsigned _Atomic difflock_player = ATOMIC_VAR_INIT(0);
-
-// this holds the milliseconds difference we want to maintain
-static int32_t difflock_ms = 0;
-
-// default difflock ms offset
+// default difflock ms offset, difflock itself is in adj_sync.c
 static int32_t difflock_default = 0;
 
-// our notion of master, so we can detect change
-static uint8_t master = 0;
-
-// our notion of bpm, so we can detect change
-static float bpm = 120.0;
+// millis libcdj timed each player's last beat after the kernel received it, libvdj's diffs include it
+static int32_t _Atomic beat_late[256];
 
 static int tui = 1;
 
@@ -166,9 +157,9 @@ render_lock(int id, int32_t diff)
         tui_set_cursor_pos(15, BACKLINE_Y);
         if (id == 0) {
             printf("[--] [----]");
-        } else if (difflock_player && adj_difflock_master && id) {
+        } else if (adj_sync_player() && adj_sync_follows_master() && id) {
             printf("[%s%02i%s] [%+04i]", TUI_RED, id, TUI_NORMAL, diff);
-        } else if (difflock_player && id) {
+        } else if (adj_sync_player() && id) {
             printf("[%s%02i%s] [%+04i]", TUI_YELLOW, id, TUI_NORMAL, diff);
         } else {
             printf("[--] [----] [----]");
@@ -229,23 +220,6 @@ render_backline()
 
 //SNIP_adj_vdj_tui
 
-static int32_t
-limit(int32_t diff)
-{
-    if (diff < -20) diff = -20;
-    if (diff > 20) diff = 20;
-    return diff;
-}
-
-/**
- * Limit the amount we nudge in one beat, seems sometimes beats are delayed.
- */
-static int32_t
-auto_nudge_amount(int8_t player_id, int32_t difflock_ms)
-{
-    return limit(adj_diff_avg(player_id) - difflock_ms);
-}
-
 static void
 adj_discovery_ph(vdj_t* v, cdj_discovery_packet_t* d_pkt)
 {
@@ -285,13 +259,9 @@ adj_update_ph(vdj_t* v, cdj_cdj_status_packet_t* cs_pkt)
             slot = get_slot(cs_pkt->player_id);
             render_bpm(slot, m->bpm);
             if (flags & CDJ_STAT_FLAG_MASTER) {
-                if (master != cs_pkt->player_id) {
+                if (adj_sync_master(cs_pkt->player_id)) {
                     // change of master
                     render_master(cs_pkt->player_id);
-                    master = cs_pkt->player_id;
-                    if (adj_difflock_master) {
-                        difflock_player = master;
-                    }
                 }
             }
             render_status(slot, status);
@@ -308,13 +278,21 @@ adj_beat_ph(vdj_t* v, cdj_beat_packet_t* b_pkt)
     uint8_t slot;
     int32_t diff;
     vdj_link_member_t* m;
+    adj_sync_action_t action;
     float est = 0.0, est_track = 0.0;
+    struct timespec stamp = b_pkt->timestamp;
+    int64_t late = 0;
+
+    adj_trace(ADJ_TRACE_BEAT, b_pkt->player_id, (int64_t) (b_pkt->bpm * 100));
+
+    // when the packet arrived rather than when libcdj woke up to read it
+    adj_stamp_beat(b_pkt->player_id, b_pkt->bar_pos, &stamp, &late);
+    beat_late[b_pkt->player_id] = (int32_t) ((late + 500000) / 1000000);
 
     if (b_pkt->bar_pos == 1) {
-        est = adj_estimate_bpm(b_pkt->player_id, b_pkt->timestamp);
-        est_track = adj_estimate_bpm_track(b_pkt->player_id, b_pkt->timestamp);
+        est_track = adj_estimate_bpm_track(b_pkt->player_id, stamp);
         if (adj_track_start == b_pkt->player_id) {
-            adj_estimate_bpm_track_init(b_pkt->player_id, b_pkt->timestamp);
+            adj_estimate_bpm_track_init(b_pkt->player_id, stamp);
             adj_track_start = 0;
         }
     }
@@ -325,7 +303,11 @@ adj_beat_ph(vdj_t* v, cdj_beat_packet_t* b_pkt)
 
     if ( (m = vdj_get_link_member(v, b_pkt->player_id)) ) {
         adj_vdj_beat_hook(v, b_pkt->player_id);
-        diff = vdj_time_diff(v, m);
+        diff = vdj_time_diff(v, m) - beat_late[b_pkt->player_id];
+        // the diff of a player that is ahead is averaged on our beat in adj_vdj_beat(), trigger from OR beat lock not both
+        est = adj_sync_on_beat((adj_seq_info_t*) v->client, b_pkt->player_id, b_pkt->bar_pos, b_pkt->bpm, stamp,
+                               diff, diff > 0, ! adj_trigger_from, &action);
+
         slot = get_slot(b_pkt->player_id);
         tui_lock();
         render_bpm(slot, b_pkt->bpm);
@@ -337,24 +319,11 @@ adj_beat_ph(vdj_t* v, cdj_beat_packet_t* b_pkt)
         // if you are behind, render on your beat, (if you are ahead render on our beat)
         if (diff > 0) {
             render_diff(slot, diff, adj_diff_avg(b_pkt->player_id));
-            adj_diff_add(b_pkt->player_id, diff);
         }
         tui_unlock();
 
-        // trigger from OR beat lock not both
-        if (adj_trigger_from) {
-            if (adj_trigger_from == b_pkt->player_id && b_pkt->bar_pos == 1) {
-                adj_vdj_lock_off(v);
-            }
-        // auto nudge on the last beat, in theory the down beat should then always be in time.
-        } else if (difflock_player == b_pkt->player_id && b_pkt->bar_pos == 4) {
-            if (diff - difflock_ms) {
-                adj_nudge_millis((adj_seq_info_t*) v->client, auto_nudge_amount(difflock_player, difflock_ms));
-            }
-        }
-        if (difflock_player == b_pkt->player_id && adj_follow_tempo && bpm != b_pkt->bpm) {
-            bpm = b_pkt->bpm;
-            adj_set_tempo((adj_seq_info_t*) v->client, bpm);
+        if (adj_trigger_from == b_pkt->player_id && b_pkt->bar_pos == 1) {
+            adj_vdj_lock_off(v);
         }
     }
 }
@@ -373,7 +342,7 @@ adj_vdj_init(adj_seq_info_t* adj, char* iface, uint32_t flags, float bpm, uint32
 {
 
     memset(high_slots, 0, VDJ_MAX_BACKLINE);
-    adj_diff_reset();
+    adj_sync_reset();
     difflock_default = vdj_offset;
     adj_estimate_bpm_init();
     adj_lock_on = 0;
@@ -398,6 +367,11 @@ adj_vdj_init(adj_seq_info_t* adj, char* iface, uint32_t flags, float bpm, uint32
         return NULL;
     }
 
+    memset(beat_late, 0, sizeof(beat_late));
+    if (adj_stamp_init() != ADJ_OK) {
+        fprintf(stderr, "warn: no kernel timestamps for beat packets\n");
+    }
+
     if (vdj_exec_discovery(v) != CDJ_OK) {
         fprintf(stderr, "error: cdj initialization\n");
         vdj_destroy(v);
@@ -424,7 +398,7 @@ adj_vdj_copy_bpm(adj_seq_info_t* adj, uint8_t player_id)
         if ( (m = vdj_get_link_member(adj->vdj, player_id))) {
             if (m->bpm >= ADJ_MIN_BPM && m->bpm <= ADJ_MAX_BPM) {
                 adj_set_tempo(adj, m->bpm);
-                bpm = m->bpm;
+                adj_sync_copied(m->bpm);
                 return;
             }
         }
@@ -436,11 +410,12 @@ adj_vdj_copy_master(adj_seq_info_t* adj)
 {
 
     vdj_link_member_t* m;
+    uint8_t master = adj_sync_get_master();
 
     if (master && adj->vdj && adj->vdj->backline) {
         if ( (m = vdj_get_link_member(adj->vdj, master))) {
             adj_set_tempo(adj, m->bpm);
-            bpm = m->bpm;
+            adj_sync_copied(m->bpm);
             return master;
         }
     }
@@ -452,13 +427,14 @@ adj_vdj_copy_other(adj_seq_info_t* adj)
 {
     uint8_t i;
     vdj_link_member_t* m;
+    uint8_t master = adj_sync_get_master();
 
     if (adj->vdj && adj->vdj->backline) {
         for (i = 1; i <= MAX_PLAYERS; i++) {
             if (i == master || i == adj->vdj->player_id) continue;
             if ( (m = vdj_get_link_member(adj->vdj, i))) {
                 adj_set_tempo(adj, m->bpm);
-                bpm = m->bpm;
+                adj_sync_copied(m->bpm);
                 return i;
             }
         }
@@ -509,7 +485,7 @@ adj_vdj_beat(adj_seq_info_t* adj, uint8_t bar_pos)
             if (i == v->player_id) continue;
             m = vdj_get_link_member(v, i);
             if (m) {
-                diff = vdj_time_diff(v, m);
+                diff = vdj_time_diff(v, m) - beat_late[i];
                 // if we are behind render on our beat (if we are ahead, render on your beat)
                 if (diff < 0) {
                     render_diff(i, diff, adj_diff_avg(i));
@@ -587,16 +563,12 @@ adj_vdj_difflock(adj_seq_info_t* adj, uint8_t player_id, int use_default)
         return;
     }
 
-    difflock_player = player_id;
     if (use_default) {
-        difflock_ms = difflock_default;
+        adj_sync_lock(player_id, difflock_default);
     } else {
-        difflock_ms = adj_diff_get(player_id);  // TODO maybe avg would be better?
+        adj_sync_lock(player_id, adj_diff_get(player_id));  // TODO maybe avg would be better?
     }
 
-    // if explicit lock against not master, stop follow master
-    if (master != player_id) adj_difflock_master = 0;
-
     switch(player_id) {
         case 1 : adj->data_change_handler(adj, ADJ_ITEM_DIFFLOCK, "01");
         case 2 : adj->data_change_handler(adj, ADJ_ITEM_DIFFLOCK, "02");
@@ -606,41 +578,40 @@ adj_vdj_difflock(adj_seq_info_t* adj, uint8_t player_id, int use_default)
     }
 
     tui_lock();
-    render_lock(player_id, difflock_ms);
+    render_lock(player_id, adj_sync_ms());
     tui_unlock();
 }
 
 void
 adj_vdj_difflock_arff(adj_seq_info_t* adj)
 {
-    difflock_player = 0;
+    adj_sync_unlock();
     adj->data_change_handler(adj, ADJ_ITEM_DIFFLOCK, "off");
     tui_lock();
     render_lock(0, 0);
     tui_unlock();
-    adj_diff_reset();
     adj_estimate_bpm_init();
 }
 
 void
 adj_vdj_difflock_nudge(adj_seq_info_t* adj, int32_t amount)
 {
-    difflock_ms += amount;
+    adj_sync_adjust(amount);
     tui_lock();
-    render_lock_amount(difflock_ms);
+    render_lock_amount(adj_sync_ms());
     tui_unlock();
 }
 
 void
 adj_vdj_difflock_master(adj_seq_info_t* adj, int on_off)
 {
-    adj_difflock_master = on_off;
+    adj_sync_follow_master(on_off);
 }
 
 void
 adj_vdj_follow_tempo(adj_seq_info_t* adj, int on_off)
 {
-    adj_follow_tempo = on_off;
+    adj_sync_follow_tempo(on_off);
 }
 
 void
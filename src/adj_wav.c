@@ -0,0 +1,89 @@
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "adj.h"
+#include "adj_wav.h"
+
+//SNIP_wav_parse
+
+static uint32_t le32(const uint8_t* p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint16_t le16(const uint8_t* p)
+{
+    return (uint16_t) (p[0] | p[1] << 8);
+}
+
+int adj_wav_parse(const uint8_t* buf, size_t size, adj_wav_t* wav)
+{
+    size_t pos = 12;
+    int have_fmt = 0;
+
+    if (size < 12 || memcmp(buf, "RIFF", 4) != 0 || memcmp(buf + 8, "WAVE", 4) != 0) return ADJ_ERR;
+
+    while (pos + 8 <= size) {
+        uint32_t len = le32(buf + pos + 4);
+        const uint8_t* chunk = buf + pos + 8;
+
+        if (memcmp(buf + pos, "fmt ", 4) == 0 && len >= 16 && pos + 8 + 16 <= size) {
+            uint16_t format = le16(chunk);
+            // WAVE_FORMAT_EXTENSIBLE has the real format in its sub format guid
+            if (format == 0xfffe && len >= 40 && pos + 8 + 40 <= size) format = le16(chunk + 24);
+            if (format != 1 || le16(chunk + 14) != 16) return ADJ_ERR;
+            wav->channels = le16(chunk + 2);
+            wav->rate = le32(chunk + 4);
+            if (wav->channels == 0 || wav->rate == 0) return ADJ_ERR;
+            have_fmt = 1;
+        }
+        else if (memcmp(buf + pos, "data", 4) == 0 && have_fmt) {
+            // a recording that was cut short has a data length longer than the file
+            if (len > size - pos - 8) len = size - pos - 8;
+            wav->frames = (const int16_t*) chunk;
+            wav->count = len / (2 * wav->channels);
+            return ADJ_OK;
+        }
+        // checked before adding, a length near 4G wraps a 32 bit size_t and the loop would never end
+        if (len > size - pos - 8) return ADJ_ERR;
+        pos += 8 + len + (len & 1);
+    }
+    return ADJ_ERR;
+}
+
+//SNIP_wav_parse
+
+int adj_wav_open(const char* path, adj_wav_t* wav)
+{
+    struct stat st;
+    int rv, fd;
+
+    memset(wav, 0, sizeof(adj_wav_t));
+    if ( (fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 ) return ADJ_IO;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return ADJ_IO;
+    }
+    wav->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (wav->map == MAP_FAILED) {
+        wav->map = NULL;
+        return ADJ_IO;
+    }
+    wav->size = st.st_size;
+    // read once from start to end
+    madvise(wav->map, wav->size, MADV_SEQUENTIAL);
+
+    if ( (rv = adj_wav_parse(wav->map, wav->size, wav)) != ADJ_OK ) adj_wav_close(wav);
+    return rv;
+}
+
+void adj_wav_close(adj_wav_t* wav)
+{
+    if (wav->map) munmap(wav->map, wav->size);
+    memset(wav, 0, sizeof(adj_wav_t));
+}
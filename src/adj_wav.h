@@ -0,0 +1,37 @@
+#ifndef _ADJ_WAV_INCLUDED_
+#define _ADJ_WAV_INCLUDED_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Read only WAV files, memory mapped, the kernel streams the samples in as they are read.
+ * 16 bit PCM only, which is what a CD rip or a recording of a mixer's booth out usually is.
+ */
+
+//SNIP_wav_constants
+
+typedef struct {
+    void*           map;
+    size_t          size;
+    const int16_t*  frames;         // interleaved
+    uint64_t        count;          // frames
+    uint32_t        rate;
+    uint16_t        channels;
+} adj_wav_t;
+
+//SNIP_wav_constants
+
+/**
+ * returns ADJ_IO if the file cannot be read, ADJ_ERR if it is not 16 bit PCM WAV
+ */
+int adj_wav_open(const char* path, adj_wav_t* wav);
+
+/**
+ * find the fmt and data chunks in a whole file already in memory
+ */
+int adj_wav_parse(const uint8_t* buf, size_t size, adj_wav_t* wav);
+
+void adj_wav_close(adj_wav_t* wav);
+
+#endif // _ADJ_WAV_INCLUDED_
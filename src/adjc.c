@@ -0,0 +1,96 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "adj_ctl.h"
+
+/**
+ * Control client for adj and adjd, sends the command line, or each line of stdin, and prints the replies.
+ */
+
+static void usage()
+{
+    printf("adjc [-n name] [command [arg]]\n");
+    printf("    commands: start stop toggle restart tap tap_reset save unlock master status quit\n");
+    printf("              nudge <multiplier> nudge_ms <millis> bpm <bpm> tempo <+/-bpm> lock <player>\n");
+    printf("              copy_bpm <player> trigger <player> track_start <player> lock_default <player>\n");
+    printf("              lock_nudge <+/-amount> lock_master <0|1> follow <0|1>\n");
+    printf("    with no command, commands are read from stdin one per line\n");
+    printf("options:\n");
+    printf("    -n - sequencer name of the adj to control (default 'adj')\n");
+    printf("    -h - display this text\n");
+    exit(0);
+}
+
+/**
+ * send one line and print the reply, returns 0 if the reply was ok
+ */
+static int command(int fd, FILE* in, char* line)
+{
+    char reply[ADJ_CTL_LINE];
+    size_t len = strlen(line);
+
+    if (len == 0 || line[0] == '\n') return 0;
+    if ( write(fd, line, len) != len || (line[len - 1] != '\n' && write(fd, "\n", 1) != 1) ) {
+        perror("write");
+        return 1;
+    }
+    if ( ! fgets(reply, sizeof(reply), in) ) {
+        fprintf(stderr, "no reply\n");
+        return 1;
+    }
+    fputs(reply, stdout);
+    return strncmp(reply, "error", 5) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    struct sockaddr_un addr;
+    char line[ADJ_CTL_LINE];
+    char* seq_name = "adj";
+    char* dir = getenv(ADJ_CTL_DIR_ENV);
+    int c, i, fd, rv = 0;
+    size_t len;
+
+    while ( ( c = getopt(argc, argv, "+n:h") ) != EOF) {
+        switch (c) {
+            case 'n':
+                seq_name = optarg;
+                break;
+            case 'h':
+                usage();
+                break;
+        }
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), ADJ_CTL_PATH, dir ? dir : ADJ_CTL_DIR, seq_name);
+
+    if ( (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ) {
+        fprintf(stderr, "%s: not running? ", addr.sun_path);
+        perror("connect");
+        return 1;
+    }
+    FILE* in = fdopen(fd, "r");
+
+    if (optind < argc) {
+        // the rest of the command line is one command e.g. adjc nudge -10
+        line[0] = 0;
+        for (i = optind, len = 0; i < argc && len < sizeof(line) - 1; i++) {
+            len += snprintf(line + len, sizeof(line) - len, i == optind ? "%s" : " %s", argv[i]);
+        }
+        rv = command(fd, in, line);
+    } else {
+        while ( fgets(line, sizeof(line), stdin) ) {
+            rv |= command(fd, in, line);
+        }
+    }
+
+    fclose(in);
+    return rv;
+}
@@ -13,16 +13,63 @@
 
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE   // pthread_setaffinity_np()
+#endif
+
 #include "adj.h"
 
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // Global state
 static unsigned _Atomic adj_alsa_initialised = ATOMIC_VAR_INIT(0); // setup properly
 static unsigned _Atomic adj_running = ATOMIC_VAR_INIT(0);          // main loop is alive
 static unsigned _Atomic adj_paused = ATOMIC_VAR_INIT(0);           // alive but not making noises
 static unsigned _Atomic adj_q_restart = ATOMIC_VAR_INIT(0);        // lock to start the alsa sequencer again
+static uint64_t _Atomic adj_restart_nanos = ATOMIC_VAR_INIT(0);     // time to restart the bar, 0 for none
+
+// threads block rather than poll, changes to the state above are signalled on run_cond
+static pthread_mutex_t run_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t run_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t clock_thread;
+static int clock_started = 0;
+static int clock_failed = 0;    // error that stopped the clock thread before it was ready, guarded by run_mutex
+
+#define ADJ_INIT_TIMEOUT    2   // seconds adj_init() waits for the clock thread
+
+static uint64_t _Atomic adj_wakeup_count = ATOMIC_VAR_INIT(0);     // times any loop woke up, see adj_wakeups_per_second()
+static uint64_t adj_wakeup_epoch = 0;
+
+static int clock_waiting = 0;   // clock thread is paused, guarded by run_mutex
+
+static void backend_busy();
+
+static void run_signal()
+{
+    pthread_mutex_lock(&run_mutex);
+    if (clock_waiting) {
+        clock_waiting = 0;
+        backend_busy();
+    }
+    pthread_cond_broadcast(&run_cond);
+    pthread_mutex_unlock(&run_mutex);
+}
+
+static void adj_timeline_start(uint64_t nanos);
+static void adj_timeline_tempo(uint64_t nanos, uint32_t micros_per_beat);
+static void adj_timeline_stop();
+
+static void state_tempo(float bpm);
+static void state_run(uint32_t run);
+static void state_clock(uint32_t tick, int32_t events, int underrun, uint64_t jitter);
 
 //noop handlers
 static void nop_message_handler(adj_seq_info_t* adj, char* message){}
@@ -31,66 +78,36 @@ static void nop_tick_handler(adj_seq_info_t* adj, snd_seq_tick_time_t tick){}
 static void nop_stop_handler(adj_seq_info_t* adj){}
 static void nop_start_handler(adj_seq_info_t* adj){}
 
-// start midi
-
-static int set_tempo(adj_seq_info_t* adj, float bpm)
-{
-    char* bpm_s;
-    snd_seq_queue_tempo_t* tempo;
-    snd_seq_queue_tempo_alloca(&tempo);
-    snd_seq_queue_tempo_set_tempo(tempo, (unsigned int) (60000000 / bpm)); // microseconds in a minute / bpm = micros per beat
-    snd_seq_queue_tempo_set_ppq(tempo, ADJ_PPQ);
+// start backend
 
-    if ( snd_seq_set_queue_tempo(adj->alsa_seq, adj->q, tempo) == 0) {
-        if ( (bpm_s = (char*) calloc(1, 11) )) {
-            snprintf(bpm_s, 10, "%f", bpm);
-            adj->data_change_handler(adj, ADJ_ITEM_BPM, bpm_s);
-            free(bpm_s);
-        }
-        return ADJ_OK;
-    } else {
-        return ADJ_ALSA;
-    }
-}
+// alsa sequencer queue, the default backend
 
+static snd_seq_queue_status_t* alsa_status = NULL;
 
-static int set_tempo_micros(adj_seq_info_t* adj, unsigned int micros_per_beat)
+static int alsa_tempo(adj_seq_info_t* adj, unsigned int micros_per_beat)
 {
-    char* bpm_s;
     snd_seq_queue_tempo_t* tempo;
     snd_seq_queue_tempo_alloca(&tempo);
     snd_seq_queue_tempo_set_tempo(tempo, micros_per_beat);
     snd_seq_queue_tempo_set_ppq(tempo, ADJ_PPQ);
 
-    if ( snd_seq_set_queue_tempo(adj->alsa_seq, adj->q, tempo) == 0) {
-        if ( (bpm_s = (char*) calloc(1, 11) )) {
-            snprintf(bpm_s, 10, "%f", adj_micros_to_bpm(micros_per_beat));
-            adj->data_change_handler(adj, ADJ_ITEM_BPM, bpm_s);
-            free(bpm_s);
-        }
-        return ADJ_OK;
-    } else {
-        return ADJ_ALSA;
-    }
+    return snd_seq_set_queue_tempo(adj->alsa_seq, adj->q, tempo) == 0 ? ADJ_OK : ADJ_ALSA;
 }
 
-static int clear_queue(adj_seq_info_t* adj)
+static void alsa_clear(adj_seq_info_t* adj)
 {
     snd_seq_remove_events_t* ev;
     snd_seq_remove_events_alloca(&ev);
     snd_seq_remove_events_set_queue(ev, adj->q);
     snd_seq_remove_events_set_condition(ev, SND_SEQ_REMOVE_OUTPUT | SND_SEQ_REMOVE_IGNORE_OFF);
     snd_seq_remove_events(adj->alsa_seq, ev);
-    adj->data_change_handler(adj, ADJ_ITEM_EVENTS, "0");
-    return ADJ_OK;
 }
 
-static int midi_start(adj_seq_info_t* adj)
+static int alsa_start(adj_seq_info_t* adj)
 {
-    clear_queue(adj);
+    alsa_clear(adj);
     // start the queue, tell midi devices about it
     snd_seq_start_queue(adj->alsa_seq, adj->q, NULL);
-    adj->data_change_handler(adj, ADJ_ITEM_STATE_Q, "running");
 
     // send the start midi event
     snd_seq_event_t ev;
@@ -102,15 +119,12 @@ static int midi_start(adj_seq_info_t* adj)
     snd_seq_ev_schedule_tick(&ev, adj->q, SND_SEQ_TIME_MODE_ABS, ADJ_TICK0);
     snd_seq_event_output(adj->alsa_seq, &ev);
     snd_seq_drain_output(adj->alsa_seq);
-    adj->start_handler(adj);
-
     return ADJ_OK;
 }
 
-static int midi_stop(adj_seq_info_t* adj)
+static int alsa_stop(adj_seq_info_t* adj)
 {
-
-    clear_queue(adj);
+    alsa_clear(adj);
 
     // send STOP now/direct (tick = rel 0)
     snd_seq_event_t ev;
@@ -121,268 +135,1072 @@ static int midi_stop(adj_seq_info_t* adj)
 
     snd_seq_ev_schedule_tick(&ev, adj->q, SND_SEQ_TIME_MODE_REL, ADJ_TICK0);
     snd_seq_event_output_direct(adj->alsa_seq, &ev);
-    adj->stop_handler(adj);
 
     snd_seq_stop_queue(adj->alsa_seq, adj->q, NULL);
     snd_seq_drain_output(adj->alsa_seq) ;
-    adj->data_change_handler(adj, ADJ_ITEM_STATE_Q, "paused");
-
     return ADJ_OK;
 }
 
-static int send_midi_clock(adj_seq_info_t* adj, snd_seq_tick_time_t when)
+static int alsa_clock(adj_seq_info_t* adj, snd_seq_tick_time_t tick)
 {
     snd_seq_event_t ev;
     snd_seq_ev_clear(&ev);
     ev.type = SND_SEQ_EVENT_CLOCK;
     snd_seq_ev_set_source(&ev, adj->alsa_port);
     snd_seq_ev_set_subs(&ev);
-    snd_seq_ev_schedule_tick(&ev, adj->q, SND_SEQ_TIME_MODE_ABS, when);
+    snd_seq_ev_schedule_tick(&ev, adj->q, SND_SEQ_TIME_MODE_ABS, tick);
     snd_seq_event_output(adj->alsa_seq, &ev);
-
     return ADJ_OK;
 }
 
-static snd_seq_tick_time_t adj_next_tick(adj_seq_info_t* adj)
+static int alsa_flush(adj_seq_info_t* adj)
 {
-    return adj->tick += 4;
+    snd_seq_drain_output(adj->alsa_seq);
+    return ADJ_OK;
 }
 
-static int report_events(adj_seq_info_t* adj, snd_seq_queue_status_t* info)
+static int alsa_events(adj_seq_info_t* adj)
 {
-    char buf[23];
-    snd_seq_get_queue_status(adj->alsa_seq, adj->q, info);
-    int events = snd_seq_queue_status_get_events(info);
-
-    snprintf(buf, 23, "%i", events);
-    adj->data_change_handler(adj, ADJ_ITEM_EVENTS, buf);
-    return events;
+    if ( ! alsa_status && snd_seq_queue_status_malloc(&alsa_status) != 0 ) return 0;
+    snd_seq_get_queue_status(adj->alsa_seq, adj->q, alsa_status);
+    return snd_seq_queue_status_get_events(alsa_status);
 }
 
-// end midi
+static int alsa_sync(adj_seq_info_t* adj)
+{
+    // hang until queue is empty
+    snd_seq_sync_output_queue(adj->alsa_seq);
+    return ADJ_OK;
+}
 
-// nudge, thread handles nudges and bpm changes
+static adj_backend_t alsa_backend = {
+    .name = "alsa",
+    .tempo = alsa_tempo,
+    .start = alsa_start,
+    .stop = alsa_stop,
+    .clock = alsa_clock,
+    .flush = alsa_flush,
+    .events = alsa_events,
+    .sync = alsa_sync,
+};
 
-static unsigned _Atomic adj_nudge_running = ATOMIC_VAR_INIT(1);  // loop is running
-static unsigned _Atomic adj_nudge_exec = ATOMIC_VAR_INIT(0);     // instruction to nudge
-static signed _Atomic adj_nudge_multiplier = ATOMIC_VAR_INIT(0); // how much by as multiplier
-static signed _Atomic adj_nudge_ms = ATOMIC_VAR_INIT(0);         // how much by as milliseconds
-static float _Atomic adj_set_bpm = ATOMIC_VAR_INIT(0.0);         // new bpm
-static float _Atomic adj_adjust_bpm = ATOMIC_VAR_INIT(0.0);      // bpm increment or decrement
+static adj_backend_t* clock_backend = &alsa_backend;
 
-/**
- * Returns a value that is greater than or less than the passed in bpm.
- * This is the amount the sequence will be speed up for a beat to beat mix midi instruments
- * Sequence is slowed down if multiplier is negative.
- * Resolution is 0.1 bpm, which is pretty fine, 10 or 20 is more convenient for beat mixing by ear at 120 bpm.
- */
-static float adj_get_nudge_bpm(float bpm, int multiplier)
+static void backend_idle()
 {
-    float tmp_bpm = bpm + (0.1 * multiplier);
-    if ( tmp_bpm < 0 ) {
-        tmp_bpm = 0;
-    }
-    return tmp_bpm;
+    if (clock_backend->idle) clock_backend->idle();
 }
 
-/**
- * return how much we need to change the bpm by for one beat to 
- * shift the sequencer by the specified number of milliseconds.
- * value returned is new bpm in micros_per_beat
- */
-static unsigned int adj_get_nudge_micros(float bpm, int millis)
+static void backend_busy()
 {
-    return adj_bpm_to_micros(bpm) + millis * 1000;
+    if (clock_backend->busy) clock_backend->busy();
 }
 
 /**
- * Thread that implements all tempo changes.  Nudge, adjust bpm and set new bpm
+ * sleep until nanos on the backend's clock
  */
-static void* nudge_loop(void* arg)
+static void backend_sleep_until(uint64_t nanos)
 {
-    adj_seq_info_t* adj = (adj_seq_info_t*) arg;
-
-    while (adj_nudge_running) {
-        if (adj_nudge_exec) {
-            if (adj_nudge_multiplier) {
-                set_tempo(adj, adj_get_nudge_bpm(adj->bpm, adj_nudge_multiplier));
-                adj_one_beat_sleep(adj->bpm);
-                set_tempo(adj, adj->bpm);
-            } else if (adj_nudge_ms) {
-                set_tempo_micros(adj, adj_get_nudge_micros(adj->bpm, adj_nudge_ms));
-                adj_one_beat_sleep(adj->bpm);
-                set_tempo(adj, adj->bpm);
-            }
-            adj_nudge_multiplier = 0;
-            adj_nudge_ms = 0;
-            adj_nudge_exec = 0;
-        } else {
-            usleep(100000);
-        }
-        if (adj_set_bpm > 0) {
-            set_tempo(adj, adj_set_bpm);
-            adj->bpm = adj_set_bpm;
-            adj_set_bpm = 0;
-        }
-        if (adj_adjust_bpm != 0.0) {
-            float new_bpm = adj->bpm + adj_adjust_bpm;
-            set_tempo(adj, new_bpm);
-            adj->bpm = new_bpm;
-            adj_adjust_bpm = 0.0;
-        }
+    struct timespec ts;
+    if (clock_backend->sleep_until) {
+        clock_backend->sleep_until(nanos);
+        return;
     }
-    return ADJ_OK;
+    ts.tv_sec = nanos / 1000000000L;
+    ts.tv_nsec = nanos % 1000000000L;
+    while ( clock_nanosleep(ADJ_CLOCK, TIMER_ABSTIME, &ts, NULL) == EINTR );
 }
 
-static int init_nudge(adj_seq_info_t* adj)
+// backends that schedule their own events keep a queue and a tempo segment,
+// the queue was at tick at nanos and has run at micros per beat since
+
+typedef struct {
+    uint64_t            nanos;
+    double              tick;
+    unsigned int        micros;
+} backend_segment_t;
+
+typedef struct {
+    snd_seq_tick_time_t tick;
+    uint8_t             type;
+    uint64_t            queued;
+} backend_event_t;
+
+typedef struct {
+    backend_event_t     ev[ADJ_OUTPUT_EVENTS];
+    int                 head;
+    int                 len;
+} backend_queue_t;
+
+static double segment_tick_at(backend_segment_t* seg, uint64_t nanos)
 {
-    pthread_t thread_id;
-    return pthread_create(&thread_id, NULL, &nudge_loop, adj);
+    return seg->tick + ((double) nanos - (double) seg->nanos) * ADJ_PPQ / (seg->micros * 1000.0);
 }
 
-// timing
+static uint64_t segment_time_of(backend_segment_t* seg, snd_seq_tick_time_t tick)
+{
+    return seg->nanos + (int64_t) ((tick - seg->tick) * (seg->micros * 1000.0) / ADJ_PPQ + 0.5);
+}
 
 /**
- * @returns loop wait time time spec, potentially removing a tick or two to catch up if the loop is slow
+ * change tempo at now, a stopped queue only remembers the tempo for when it starts
  */
-static struct timespec adj_beats_queued_time(float bpm, int drop_ticks)
+static void segment_tempo(backend_segment_t* seg, int running, uint64_t now, unsigned int micros_per_beat)
 {
-    long int nanos = (long int) (ADJ_BEATS_QUEUED * (60000000000.0 / bpm)); // length of time to sleep, in nanos (0.25 beats)
-    if (drop_ticks) {
-        long int dropping =  (nanos / 6) * drop_ticks;
-        nanos -= dropping;
+    if (running) {
+        seg->tick = segment_tick_at(seg, now);
+        seg->nanos = now;
     }
+    seg->micros = micros_per_beat;
+}
 
-    struct timespec req = {0};
-    req.tv_sec = nanos / 1000000000L;
-    req.tv_nsec = nanos % 1000000000L;
-    return req;
+static void segment_start(backend_segment_t* seg, uint64_t now)
+{
+    seg->nanos = now;
+    seg->tick = ADJ_TICK0;
 }
 
-static void adj_loop_sleep(double bpm, int drop_ticks)
+static void queue_push(backend_queue_t* q, snd_seq_tick_time_t tick, uint8_t type, uint64_t now)
 {
-    struct timespec sl = adj_beats_queued_time(bpm, drop_ticks >= 0 ? drop_ticks : 0);
-    nanosleep(&sl, (struct timespec*) NULL);
+    if (q->len == ADJ_OUTPUT_EVENTS) return;
+    backend_event_t* e = &q->ev[(q->head + q->len++) % ADJ_OUTPUT_EVENTS];
+    e->tick = tick;
+    e->type = type;
+    e->queued = now;
 }
-// timing
 
-static void* main_loop(void* arg)
+static backend_event_t* queue_head(backend_queue_t* q)
 {
-    int i;
-    char buf[161];
+    return q->len ? &q->ev[q->head] : NULL;
+}
 
-    adj_seq_info_t* adj = arg;
+static backend_event_t* queue_last(backend_queue_t* q)
+{
+    return q->len ? &q->ev[(q->head + q->len - 1) % ADJ_OUTPUT_EVENTS] : NULL;
+}
 
-    set_tempo(adj, adj->bpm);
+static void queue_pop(backend_queue_t* q)
+{
+    q->head = (q->head + 1) % ADJ_OUTPUT_EVENTS;
+    q->len--;
+}
 
-    snd_seq_queue_status_t* info;
-    snd_seq_queue_status_malloc(&info);
-    snd_seq_get_queue_status(adj->alsa_seq, adj->q, info);
-    snprintf(buf, 160, "%i", snd_seq_queue_status_get_events(info));
-    adj->data_change_handler(adj, ADJ_ITEM_EVENTS, buf);
+// simulated queue on a virtual clock.
+// Virtual time moves forward only when every thread taking part is blocked in sim_sleep_until(),
+// so the clock, nudge and caller threads interleave the same way on every run.
 
-    // start the midi clock loop
-    adj_running = 1;
-    adj_paused = 1;
-    adj->data_change_handler(adj, ADJ_ITEM_STATE_SEQ, "running");
+#define ADJ_SIM_SLEEPERS    8
+#define ADJ_SIM_START       1000000000L   // virtual time starts at 1s, 0 means unset in places
 
-    init_nudge(adj);
+static pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t _Atomic sim_now = ATOMIC_VAR_INIT(ADJ_SIM_START);
+static int sim_runnable = 1;                        // threads not waiting on the virtual clock, starts with the caller
+static uint64_t sim_sleepers[ADJ_SIM_SLEEPERS];     // wake up times, 0 for a free slot
+static int sim_woken[ADJ_SIM_SLEEPERS];             // woken but the sleeper has not seen it yet, the slot is not free until it has
+static uint64_t sim_wake_jitter = 0;
+static uint32_t sim_seed = 1;
 
-    int was_paused = 1;
-    while (adj_running) {
+static backend_queue_t sim_queue;
+static backend_segment_t sim_seg = { 0, 0.0, 500000 };
+static int sim_q_running = 0;
 
-        // here this thread is in sync with the sequencer to within a tick
-        if (adj_q_restart && 0 == adj->tick % ADJ_PPQ * 4 * ADJ_BEATS_PER_BAR) {
-            midi_stop(adj);
-            adj->tick = ADJ_TICK0;
-            midi_start(adj);
-            adj_q_restart = 0;
-        }
+static adj_sim_event_t* sim_played = NULL;
+static int sim_played_len = 0;
+static int sim_played_size = 0;
 
-        while (adj_paused) {
-            if (! was_paused) {
-                midi_stop(adj);
-            }
-            was_paused = 1;
-            if ( ! adj_running ) goto quit;
-            // pause is a busy loop with 10ms wait
-            usleep(10000);
-        }
+static uint64_t sim_clock()
+{
+    return sim_now;
+}
 
-        if (was_paused) {
-            was_paused = 0;
-            adj->tick = ADJ_TICK0;
-            midi_start(adj);
-        }
-        
+static void sim_record(snd_seq_tick_time_t tick, uint8_t type, uint64_t due, uint64_t sent)
+{
+    if (sim_played_len == sim_played_size) {
+        int size = sim_played_size ? sim_played_size * 2 : 4096;
+        adj_sim_event_t* more = realloc(sim_played, size * sizeof(adj_sim_event_t));
+        if ( ! more ) return;
+        sim_played = more;
+        sim_played_size = size;
+    }
+    adj_sim_event_t* e = &sim_played[sim_played_len++];
+    e->tick = tick;
+    e->type = type;
+    e->due = due;
+    e->sent = sent;
+}
 
-        // send first clock _before_ tick_handler() which may be slow, handler has 1/24th of a beat to finish
-        send_midi_clock(adj, adj_next_tick(adj));
- 
-        adj->tick_handler(adj, adj->tick);
+/**
+ * play queued events the queue has reached, events queued after their time are sent when they were queued
+ */
+static void sim_play(uint64_t now)
+{
+    backend_event_t* e;
+    while (sim_q_running && (e = queue_head(&sim_queue))) {
+        if (e->tick > segment_tick_at(&sim_seg, now)) break;
+        uint64_t due = segment_time_of(&sim_seg, e->tick);
+        sim_record(e->tick, e->type, due, e->queued > due ? e->queued : due);
+        queue_pop(&sim_queue);
+    }
+}
 
-        for (i = 1 ; i < ADJ_CLOCKS_PER_BEAT * ADJ_BEATS_QUEUED; i++) {
-            send_midi_clock(adj, adj_next_tick(adj));
-        }
-        snd_seq_drain_output(adj->alsa_seq);
+static uint64_t sim_next_wake()
+{
+    uint64_t next = 0;
+    for (int i = 0; i < ADJ_SIM_SLEEPERS; i++) {
+        if (sim_sleepers[i] && ! sim_woken[i] && (next == 0 || sim_sleepers[i] < next)) next = sim_sleepers[i];
+    }
+    return next;
+}
 
-        int events = report_events(adj, info);
+static void sim_sleep_until(uint64_t nanos)
+{
+    int slot;
 
-        if (adj->alsa_sync) {
-            // hang until queue is empty
-            snd_seq_sync_output_queue(adj->alsa_seq);
+    pthread_mutex_lock(&sim_mutex);
+    // a woken thread is late by up to the scheduler jitter
+    if (sim_wake_jitter) {
+        sim_seed = sim_seed * 1103515245 + 12345;
+        nanos += (sim_seed >> 8) % sim_wake_jitter;
+    }
+    for (slot = 0; slot < ADJ_SIM_SLEEPERS && sim_sleepers[slot]; slot++);
+    if (slot == ADJ_SIM_SLEEPERS || nanos <= sim_now) {
+        pthread_mutex_unlock(&sim_mutex);
+        return;
+    }
+    sim_sleepers[slot] = nanos;
+    sim_runnable--;
+    while ( ! sim_woken[slot] && adj_running ) {
+        if (sim_runnable == 0) {
+            // everyone is waiting, jump to the next wake up, the threads woken count as running from now
+            sim_now = sim_next_wake();
+            for (int i = 0; i < ADJ_SIM_SLEEPERS; i++) {
+                if (sim_sleepers[i] && ! sim_woken[i] && sim_sleepers[i] <= sim_now) {
+                    sim_woken[i] = 1;
+                    sim_runnable++;
+                }
+            }
+            pthread_cond_broadcast(&sim_cond);
         } else {
-            // non alsa-sync occasionally we have to compensate from CPU cycles taking time
-            // if we ever have less than a beat's worth of events on the queue, sleep for less
-
-            // potentially drop ticks to catch up 
-            adj_loop_sleep(adj->bpm, (int) (ADJ_CLOCKS_PER_BEAT * ADJ_BEATS_QUEUED) - events);
+            pthread_cond_wait(&sim_cond, &sim_mutex);
         }
-
     }
-    quit:
+    if ( ! sim_woken[slot] ) {
+        // quitting, nobody woke us
+        sim_runnable++;
+    }
+    sim_sleepers[slot] = 0;
+    sim_woken[slot] = 0;
+    pthread_mutex_unlock(&sim_mutex);
+}
 
-    // stop midi devices
-    midi_stop(adj);
+static void sim_idle()
+{
+    pthread_mutex_lock(&sim_mutex);
+    sim_runnable--;
+    pthread_cond_broadcast(&sim_cond);
+    pthread_mutex_unlock(&sim_mutex);
+}
 
-    // free
-    //snd_seq_free_queue(adj->alsa_seq, adj->q);
-    //snd_seq_close(adj->alsa_seq);
+static void sim_busy()
+{
+    pthread_mutex_lock(&sim_mutex);
+    sim_runnable++;
+    pthread_mutex_unlock(&sim_mutex);
+}
+
+static void sim_wake()
+{
+    pthread_mutex_lock(&sim_mutex);
+    pthread_cond_broadcast(&sim_cond);
+    pthread_mutex_unlock(&sim_mutex);
+}
 
+static int sim_tempo(adj_seq_info_t* adj, unsigned int micros_per_beat)
+{
+    pthread_mutex_lock(&sim_mutex);
+    sim_play(sim_now);
+    segment_tempo(&sim_seg, sim_q_running, sim_now, micros_per_beat);
+    pthread_mutex_unlock(&sim_mutex);
     return ADJ_OK;
 }
 
-// start public api
+static int sim_start(adj_seq_info_t* adj)
+{
+    pthread_mutex_lock(&sim_mutex);
+    sim_queue.len = 0;
+    sim_q_running = 1;
+    segment_start(&sim_seg, sim_now);
+    queue_push(&sim_queue, ADJ_TICK0, SND_SEQ_EVENT_START, sim_now);
+    sim_play(sim_now);
+    pthread_mutex_unlock(&sim_mutex);
+    return ADJ_OK;
+}
 
-adj_seq_info_t* adj_calloc()
+static int sim_stop(adj_seq_info_t* adj)
 {
-    adj_seq_info_t* adj = (adj_seq_info_t*) calloc(1, sizeof(adj_seq_info_t));
-    if (adj == NULL) {
-        return NULL;
-    }
+    pthread_mutex_lock(&sim_mutex);
+    sim_play(sim_now);
+    sim_queue.len = 0;
+    sim_record(0, SND_SEQ_EVENT_STOP, sim_now, sim_now);
+    sim_q_running = 0;
+    pthread_mutex_unlock(&sim_mutex);
+    return ADJ_OK;
+}
 
-    adj->bpm = 120.0;
-    // TODO might be better to check for NULL
-    adj->message_handler = nop_message_handler;
-    adj->data_change_handler = nop_data_change_handler;
-    adj->tick_handler = nop_tick_handler;
-    adj->stop_handler = nop_stop_handler;
-    adj->start_handler = nop_start_handler;
-    return adj;
+static int sim_clock_event(adj_seq_info_t* adj, snd_seq_tick_time_t tick)
+{
+    pthread_mutex_lock(&sim_mutex);
+    queue_push(&sim_queue, tick, SND_SEQ_EVENT_CLOCK, sim_now);
+    pthread_mutex_unlock(&sim_mutex);
+    return ADJ_OK;
 }
 
-void adj_free(adj_seq_info_t* adj)
+static int sim_flush(adj_seq_info_t* adj)
 {
-    free(adj);
+    pthread_mutex_lock(&sim_mutex);
+    sim_play(sim_now);
+    pthread_mutex_unlock(&sim_mutex);
+    return ADJ_OK;
 }
 
-int adj_init_alsa(adj_seq_info_t* adj)
+static int sim_events(adj_seq_info_t* adj)
 {
-    int rv = ADJ_OK;
+    pthread_mutex_lock(&sim_mutex);
+    sim_play(sim_now);
+    int events = sim_queue.len;
+    pthread_mutex_unlock(&sim_mutex);
+    return events;
+}
 
-    if ( ! adj->seq_name ) adj->seq_name = "adj";
+static int sim_sync(adj_seq_info_t* adj)
+{
+    uint64_t until = 0;
+    pthread_mutex_lock(&sim_mutex);
+    if (sim_q_running && sim_queue.len) {
+        until = segment_time_of(&sim_seg, queue_last(&sim_queue)->tick);
+    }
+    pthread_mutex_unlock(&sim_mutex);
+    if (until) sim_sleep_until(until);
+    return sim_flush(adj);
+}
 
-    // Setup Alsa
+static adj_backend_t sim_backend = {
+    .name = "sim",
+    .tempo = sim_tempo,
+    .start = sim_start,
+    .stop = sim_stop,
+    .clock = sim_clock_event,
+    .flush = sim_flush,
+    .events = sim_events,
+    .sync = sim_sync,
+    .now = sim_clock,
+    .sleep_until = sim_sleep_until,
+    .idle = sim_idle,
+    .busy = sim_busy,
+    .wake = sim_wake,
+};
+
+// rawmidi, clock bytes are written straight to one device by a realtime thread at each clock's deadline,
+// there is no sequencer queue or client routing in between. The thread is started by adj_backend_rawmidi().
+
+#define ADJ_MIDI_CLOCK      0xF8
+#define ADJ_MIDI_START      0xFA
+#define ADJ_MIDI_STOP       0xFC
+
+static snd_rawmidi_t* raw_out = NULL;
+static pthread_mutex_t raw_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t raw_cond;                     // on ADJ_CLOCK, so deadlines are absolute
+static backend_queue_t raw_queue;
+static backend_segment_t raw_seg = { 0, 0.0, 500000 };
+static int raw_q_running = 0;
+static int raw_running = 0;
+static int raw_stopping = 0;                        // a stop byte the thread has yet to write
+static unsigned int raw_dropped = 0;
+
+// how late clocks leave libadj, the rawmidi thread or the sequencer echo writes it
+static adj_histogram_t send_jitter;
+
+/**
+ * The device is opened nonblocking, a byte the driver's buffer has no room for is dropped rather than
+ * holding up the bytes behind it, a late clock is no use to anyone.
+ */
+static void raw_write(uint8_t byte)
+{
+    ssize_t rv = snd_rawmidi_write(raw_out, &byte, 1);
+
+    if (rv == -EAGAIN) {
+        if (raw_dropped++ == 0) fprintf(stderr, "rawmidi buffer full, dropping bytes\n");
+    } else if (rv != 1) {
+        fprintf(stderr, "rawmidi write failed\n");
+    }
+}
+
+/**
+ * Sends each queued event at its deadline. Tempo changes, new events and stops wake the thread early,
+ * and the deadline of the next event is worked out again.
+ * Only this thread writes to the device, and never with raw_mutex held, so a stalled device
+ * cannot block the clock thread queuing the next events.
+ */
+static void* raw_loop(void* arg)
+{
+    struct timespec ts;
+    backend_event_t* e;
+    uint8_t byte;
+
+    pthread_mutex_lock(&raw_mutex);
+    while (raw_running || raw_stopping) {
+        // a stop goes out before the start of the next run
+        if (raw_stopping) {
+            raw_stopping = 0;
+            pthread_mutex_unlock(&raw_mutex);
+            raw_write(ADJ_MIDI_STOP);
+            pthread_mutex_lock(&raw_mutex);
+            continue;
+        }
+        if ( ! raw_q_running || ! (e = queue_head(&raw_queue)) ) {
+            pthread_cond_wait(&raw_cond, &raw_mutex);
+            continue;
+        }
+        uint64_t due = segment_time_of(&raw_seg, e->tick);
+        if (due > adj_time_nanos()) {
+            ts.tv_sec = due / 1000000000L;
+            ts.tv_nsec = due % 1000000000L;
+            pthread_cond_timedwait(&raw_cond, &raw_mutex, &ts);
+            continue;
+        }
+        byte = e->type == SND_SEQ_EVENT_START ? ADJ_MIDI_START : ADJ_MIDI_CLOCK;
+        queue_pop(&raw_queue);
+        if ( ! raw_queue.len ) pthread_cond_broadcast(&raw_cond);
+        pthread_mutex_unlock(&raw_mutex);
+
+        raw_write(byte);
+        uint64_t now = adj_time_nanos();
+        adj_histogram_add(&send_jitter, now > due ? (now - due) / 1000 : 0);
+
+        pthread_mutex_lock(&raw_mutex);
+    }
+    pthread_mutex_unlock(&raw_mutex);
+    return NULL;
+}
+
+static int raw_tempo(adj_seq_info_t* adj, unsigned int micros_per_beat)
+{
+    pthread_mutex_lock(&raw_mutex);
+    segment_tempo(&raw_seg, raw_q_running, adj_time_nanos(), micros_per_beat);
+    pthread_cond_broadcast(&raw_cond);
+    pthread_mutex_unlock(&raw_mutex);
+    return ADJ_OK;
+}
+
+static int raw_start(adj_seq_info_t* adj)
+{
+    pthread_mutex_lock(&raw_mutex);
+    raw_queue.len = 0;
+    raw_q_running = 1;
+    segment_start(&raw_seg, adj_time_nanos());
+    queue_push(&raw_queue, ADJ_TICK0, SND_SEQ_EVENT_START, raw_seg.nanos);
+    pthread_cond_broadcast(&raw_cond);
+    pthread_mutex_unlock(&raw_mutex);
+    return ADJ_OK;
+}
+
+static int raw_stop(adj_seq_info_t* adj)
+{
+    pthread_mutex_lock(&raw_mutex);
+    raw_queue.len = 0;
+    raw_q_running = 0;
+    // the clock loop's last stop comes after adj_quit() woke the thread to exit, then it is written here
+    int write_here = ! raw_running;
+    if (! write_here) raw_stopping = 1;
+    pthread_cond_broadcast(&raw_cond);
+    pthread_mutex_unlock(&raw_mutex);
+    if (write_here) raw_write(ADJ_MIDI_STOP);
+    return ADJ_OK;
+}
+
+static int raw_clock(adj_seq_info_t* adj, snd_seq_tick_time_t tick)
+{
+    pthread_mutex_lock(&raw_mutex);
+    queue_push(&raw_queue, tick, SND_SEQ_EVENT_CLOCK, 0);
+    pthread_mutex_unlock(&raw_mutex);
+    return ADJ_OK;
+}
+
+static int raw_flush(adj_seq_info_t* adj)
+{
+    pthread_mutex_lock(&raw_mutex);
+    pthread_cond_broadcast(&raw_cond);
+    pthread_mutex_unlock(&raw_mutex);
+    return ADJ_OK;
+}
+
+static int raw_events(adj_seq_info_t* adj)
+{
+    pthread_mutex_lock(&raw_mutex);
+    int events = raw_queue.len;
+    pthread_mutex_unlock(&raw_mutex);
+    return events;
+}
+
+static int raw_sync(adj_seq_info_t* adj)
+{
+    pthread_mutex_lock(&raw_mutex);
+    while (raw_running && raw_q_running && raw_queue.len) {
+        pthread_cond_wait(&raw_cond, &raw_mutex);
+    }
+    pthread_mutex_unlock(&raw_mutex);
+    return ADJ_OK;
+}
+
+static void raw_wake()
+{
+    pthread_mutex_lock(&raw_mutex);
+    raw_running = 0;
+    pthread_cond_broadcast(&raw_cond);
+    pthread_mutex_unlock(&raw_mutex);
+}
+
+static adj_backend_t raw_backend = {
+    .name = "rawmidi",
+    .tempo = raw_tempo,
+    .start = raw_start,
+    .stop = raw_stop,
+    .clock = raw_clock,
+    .flush = raw_flush,
+    .events = raw_events,
+    .sync = raw_sync,
+    .wake = raw_wake,
+};
+
+// sequencer echo, a second client subscribed to our own clock port so the sequencer path can be measured
+// the same way as rawmidi, when each clock leaves the kernel queue compared to its time on the timeline
+
+static snd_seq_t* echo_seq = NULL;
+
+static void* echo_loop(void* arg)
+{
+    adj_seq_info_t* adj = arg;
+    snd_seq_event_t* ev;
+    uint64_t due;
+    int rv;
+
+    while ( (rv = snd_seq_event_input(echo_seq, &ev)) >= 0 || rv == -ENOSPC ) {
+        if (rv == -ENOSPC) continue;
+        uint64_t now = adj_time_nanos();
+        if ( ev->type == SND_SEQ_EVENT_CLOCK && adj_timeline_time(adj, (double) ev->time.tick / ADJ_PPQ, &due) == ADJ_OK ) {
+            adj_histogram_add(&send_jitter, now > due ? (now - due) / 1000 : 0);
+        }
+    }
+    return NULL;
+}
+
+// end backend
+
+// start midi
+
+static int set_tempo(adj_seq_info_t* adj, float bpm)
+{
+    char* bpm_s;
+    unsigned int micros_per_beat = (unsigned int) (60000000 / bpm); // microseconds in a minute / bpm = micros per beat
+
+    if ( clock_backend->tempo(adj, micros_per_beat) == ADJ_OK ) {
+        adj_timeline_tempo(adj_time_nanos(), micros_per_beat);
+        adj_trace(ADJ_TRACE_TEMPO, micros_per_beat, 0);
+        state_tempo(bpm);
+        if ( (bpm_s = (char*) calloc(1, 11) )) {
+            snprintf(bpm_s, 10, "%f", bpm);
+            adj->data_change_handler(adj, ADJ_ITEM_BPM, bpm_s);
+            free(bpm_s);
+        }
+        return ADJ_OK;
+    } else {
+        return ADJ_ALSA;
+    }
+}
+
+
+static int set_tempo_micros(adj_seq_info_t* adj, unsigned int micros_per_beat)
+{
+    char* bpm_s;
+
+    if ( clock_backend->tempo(adj, micros_per_beat) == ADJ_OK ) {
+        adj_timeline_tempo(adj_time_nanos(), micros_per_beat);
+        adj_trace(ADJ_TRACE_TEMPO, micros_per_beat, 0);
+        state_tempo(adj_micros_to_bpm(micros_per_beat));
+        if ( (bpm_s = (char*) calloc(1, 11) )) {
+            snprintf(bpm_s, 10, "%f", adj_micros_to_bpm(micros_per_beat));
+            adj->data_change_handler(adj, ADJ_ITEM_BPM, bpm_s);
+            free(bpm_s);
+        }
+        return ADJ_OK;
+    } else {
+        return ADJ_ALSA;
+    }
+}
+
+static int midi_start(adj_seq_info_t* adj)
+{
+    // clears the queue, starts it, and queues the midi start
+    clock_backend->start(adj);
+    adj->data_change_handler(adj, ADJ_ITEM_EVENTS, "0");
+    adj_timeline_start(adj_time_nanos());
+    adj_trace(ADJ_TRACE_START, 0, 0);
+    state_run(ADJ_STATE_RUNNING);
+    adj->data_change_handler(adj, ADJ_ITEM_STATE_Q, "running");
+    adj->start_handler(adj);
+
+    return ADJ_OK;
+}
+
+static int midi_stop(adj_seq_info_t* adj)
+{
+    // clears the queue, sends midi stop directly, and stops the queue
+    clock_backend->stop(adj);
+    adj->data_change_handler(adj, ADJ_ITEM_EVENTS, "0");
+    adj_trace(ADJ_TRACE_STOP, 0, 0);
+    state_run(ADJ_STATE_STOPPED);
+    adj->stop_handler(adj);
+    adj_timeline_stop();
+    adj->data_change_handler(adj, ADJ_ITEM_STATE_Q, "paused");
+
+    return ADJ_OK;
+}
+
+static snd_seq_tick_time_t adj_next_tick(adj_seq_info_t* adj)
+{
+    return adj->tick += 4;
+}
+
+static int report_events(adj_seq_info_t* adj)
+{
+    char buf[23];
+    int events = clock_backend->events(adj);
+
+    snprintf(buf, 23, "%i", events);
+    adj->data_change_handler(adj, ADJ_ITEM_EVENTS, buf);
+    return events;
+}
+
+// end midi
+
+// nudge, thread handles nudges and bpm changes
+
+static unsigned _Atomic adj_nudge_running = ATOMIC_VAR_INIT(1);  // loop is running
+static unsigned _Atomic adj_nudge_exec = ATOMIC_VAR_INIT(0);     // instruction to nudge
+static signed _Atomic adj_nudge_multiplier = ATOMIC_VAR_INIT(0); // how much by as multiplier
+static signed _Atomic adj_nudge_ms = ATOMIC_VAR_INIT(0);         // how much by as milliseconds
+static float _Atomic adj_set_bpm = ATOMIC_VAR_INIT(0.0);         // new bpm
+static float _Atomic adj_adjust_bpm = ATOMIC_VAR_INIT(0.0);      // bpm increment or decrement
+static uint64_t _Atomic adj_control_at = ATOMIC_VAR_INIT(0);     // when the controller event that caused the change arrived
+static adj_histogram_t control_latency;
+static pthread_mutex_t nudge_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t nudge_cond = PTHREAD_COND_INITIALIZER;
+static int nudge_waiting = 0;                                     // nudge thread is idle, guarded by nudge_mutex
+
+/**
+ * tell the nudge thread there is work, call after setting the atomics
+ */
+static void nudge_signal()
+{
+    pthread_mutex_lock(&nudge_mutex);
+    if (nudge_waiting) {
+        nudge_waiting = 0;
+        backend_busy();
+    }
+    pthread_cond_signal(&nudge_cond);
+    pthread_mutex_unlock(&nudge_mutex);
+}
+
+static int nudge_idle()
+{
+    return ! adj_nudge_exec && adj_set_bpm <= 0 && adj_adjust_bpm == 0.0;
+}
+
+/**
+ * Returns a value that is greater than or less than the passed in bpm.
+ * This is the amount the sequence will be speed up for a beat to beat mix midi instruments
+ * Sequence is slowed down if multiplier is negative.
+ * Resolution is 0.1 bpm, which is pretty fine, 10 or 20 is more convenient for beat mixing by ear at 120 bpm.
+ */
+static float adj_get_nudge_bpm(float bpm, int multiplier)
+{
+    float tmp_bpm = bpm + (0.1 * multiplier);
+    if ( tmp_bpm < 0 ) {
+        tmp_bpm = 0;
+    }
+    return tmp_bpm;
+}
+
+/**
+ * return how much we need to change the bpm by for one beat to 
+ * shift the sequencer by the specified number of milliseconds.
+ * value returned is new bpm in micros_per_beat
+ */
+static unsigned int adj_get_nudge_micros(float bpm, int millis)
+{
+    return adj_bpm_to_micros(bpm) + millis * 1000;
+}
+
+/**
+ * sleep until one beat after the nudged tempo was applied, counting from when it was requested would cut a late nudge short
+ * and move the clock less than asked, this way it moves the same amount however long it waited
+ */
+static void adj_nudge_sleep(float bpm, uint64_t applied)
+{
+    backend_sleep_until(applied + (uint64_t) (60000000000.0 / bpm));
+}
+
+static void record_control_latency()
+{
+    uint64_t control_at = atomic_exchange(&adj_control_at, 0);
+    if (control_at) {
+        uint64_t now = adj_time_nanos();
+        adj_histogram_add(&control_latency, now > control_at ? (now - control_at) / 1000 : 0);
+    }
+}
+
+/**
+ * Thread that implements all tempo changes.  Nudge, adjust bpm and set new bpm
+ */
+static void* nudge_loop(void* arg)
+{
+    adj_seq_info_t* adj = (adj_seq_info_t*) arg;
+    uint64_t applied;
+
+    while (adj_nudge_running) {
+        pthread_mutex_lock(&nudge_mutex);
+        while (adj_nudge_running && nudge_idle()) {
+            // a virtual clock must not wait for this thread while it has nothing to do
+            if ( ! nudge_waiting ) {
+                nudge_waiting = 1;
+                backend_idle();
+            }
+            pthread_cond_wait(&nudge_cond, &nudge_mutex);
+        }
+        if (nudge_waiting) {
+            nudge_waiting = 0;
+            backend_busy();
+        }
+        pthread_mutex_unlock(&nudge_mutex);
+        adj_wakeup();
+
+        if (adj_nudge_exec) {
+            if (adj_nudge_multiplier) {
+                set_tempo(adj, adj_get_nudge_bpm(adj->bpm, adj_nudge_multiplier));
+                applied = adj_time_nanos();
+                record_control_latency();
+                adj_nudge_sleep(adj->bpm, applied);
+                set_tempo(adj, adj->bpm);
+            } else if (adj_nudge_ms) {
+                set_tempo_micros(adj, adj_get_nudge_micros(adj->bpm, adj_nudge_ms));
+                applied = adj_time_nanos();
+                record_control_latency();
+                adj_nudge_sleep(adj->bpm, applied);
+                set_tempo(adj, adj->bpm);
+            }
+            adj_nudge_multiplier = 0;
+            adj_nudge_ms = 0;
+            adj_nudge_exec = 0;
+        }
+        if (adj_set_bpm > 0) {
+            set_tempo(adj, adj_set_bpm);
+            adj->bpm = adj_set_bpm;
+            adj_set_bpm = 0;
+            record_control_latency();
+        }
+        if (adj_adjust_bpm != 0.0) {
+            // adjustments accumulate, take them all
+            float new_bpm = adj->bpm + atomic_exchange(&adj_adjust_bpm, 0.0);
+            set_tempo(adj, new_bpm);
+            adj->bpm = new_bpm;
+            record_control_latency();
+        }
+    }
+    backend_idle();
+    return ADJ_OK;
+}
+
+// realtime
+
+#define ADJ_RT_HEAP     (4 * 1024 * 1024)   // heap faulted in and kept when memory is locked
+
+static adj_rt_profile_t rt_profile = { 0, 0, 0, -1, 0, -1 };
+static char rt_mlock_result[32] = "";
+static char rt_clock_result[64] = "";
+static char rt_command_result[64] = "";
+static char rt_net_result[64] = "";
+static char rt_send_result[64] = "";
+static char rt_report[sizeof(rt_mlock_result) + 4 * 64 + 4];   // room for every result
+
+static const char* rt_err(int err)
+{
+    if (err == 0) return "ok";
+    if (err == EPERM) return "EPERM";
+    return strerror(err);
+}
+
+/**
+ * touch the stack and heap now so page faults do not happen later in the clock loop
+ */
+static void rt_prefault()
+{
+    volatile char stack[ADJ_RT_STACK];
+    int i;
+
+    for (i = 0; i < ADJ_RT_STACK; i += 4096) stack[i] = 0;
+    (void) stack[0];
+
+    // freed memory stays in the (locked) heap rather than going back to the kernel
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    char* heap = malloc(ADJ_RT_HEAP);
+    if (heap) {
+        for (i = 0; i < ADJ_RT_HEAP; i += 4096) heap[i] = 0;
+        free(heap);
+    }
+}
+
+/**
+ * set policy and affinity of a thread just created, and note the result for adj_rt_report()
+ */
+static void rt_thread(pthread_t tid, const char* name, int prio, int cpu, char* result, size_t len)
+{
+    struct sched_param sp;
+    cpu_set_t set;
+    int off;
+
+    pthread_setname_np(tid, name);
+    if (prio <= 0 && cpu < 0) return;
+
+    off = snprintf(result, len, ", %s", name + 4);
+    if (prio > 0) {
+        sp.sched_priority = prio;
+        off += snprintf(result + off, len - off, " fifo %i %s", prio, rt_err(pthread_setschedparam(tid, SCHED_FIFO, &sp)));
+    }
+    if (cpu >= 0 && off < len) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        snprintf(result + off, len - off, " cpu %i %s", cpu, rt_err(pthread_setaffinity_np(tid, sizeof(set), &set)));
+    }
+}
+
+static int rt_create(pthread_t* tid, void* (*fn)(void*), void* arg)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (rt_profile.mlock) {
+        // with mlockall(MCL_FUTURE) the whole stack is faulted in when the thread starts
+        pthread_attr_setstacksize(&attr, ADJ_RT_STACK);
+    }
+    int rv = pthread_create(tid, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+    return rv;
+}
+
+// realtime
+
+static int init_nudge(adj_seq_info_t* adj)
+{
+    pthread_t thread_id;
+    backend_busy();
+    int rv = rt_create(&thread_id, &nudge_loop, adj);
+    if (rv == 0) {
+        rt_thread(thread_id, "adj-command", rt_profile.command_prio, rt_profile.command_cpu, rt_command_result, sizeof(rt_command_result));
+    }
+    return rv;
+}
+
+// timing
+
+/**
+ * @returns loop wait time time spec, potentially removing a tick or two to catch up if the loop is slow
+ */
+static struct timespec adj_beats_queued_time(float bpm, int drop_ticks)
+{
+    long int nanos = (long int) (ADJ_BEATS_QUEUED * (60000000000.0 / bpm)); // length of time to sleep, in nanos (0.25 beats)
+    if (drop_ticks) {
+        long int dropping =  (nanos / 6) * drop_ticks;
+        nanos -= dropping;
+    }
+
+    struct timespec req = {0};
+    req.tv_sec = nanos / 1000000000L;
+    req.tv_nsec = nanos % 1000000000L;
+    return req;
+}
+
+static adj_histogram_t loop_jitter;
+
+/**
+ * @returns micros the loop woke up late
+ */
+static uint64_t adj_loop_sleep(double bpm, int drop_ticks)
+{
+    struct timespec sl = adj_beats_queued_time(bpm, drop_ticks >= 0 ? drop_ticks : 0);
+    uint64_t until = adj_time_nanos() + sl.tv_sec * 1000000000L + sl.tv_nsec;
+    backend_sleep_until(until);
+    uint64_t now = adj_time_nanos();
+    uint64_t late = now > until ? (now - until) / 1000 : 0;
+    adj_histogram_add(&loop_jitter, late);
+    return late;
+}
+// timing
+
+static void* main_loop(void* arg)
+{
+    int i;
+
+    adj_seq_info_t* adj = arg;
+
+    int rv = set_tempo(adj, adj->bpm);
+    report_events(adj);
+
+    // start the midi clock loop, unless adj_init() gave up waiting
+    pthread_mutex_lock(&run_mutex);
+    if (rv != ADJ_OK && ! clock_failed) clock_failed = rv;
+    if ( ! clock_failed ) {
+        adj_running = 1;
+        adj_paused = 1;
+    }
+    pthread_cond_broadcast(&run_cond);
+    pthread_mutex_unlock(&run_mutex);
+    if (clock_failed) return NULL;
+    adj->data_change_handler(adj, ADJ_ITEM_STATE_SEQ, "running");
+
+    int was_paused = 1;
+    int fresh = 1;            // the queue was cleared by midi_start(), it cannot have run dry
+    uint64_t jitter = 0;
+    while (adj_running) {
+
+        // here this thread is in sync with the sequencer to within a tick
+        if (adj_q_restart && 0 == adj->tick % ADJ_PPQ * 4 * ADJ_BEATS_PER_BAR) {
+            adj_trace(ADJ_TRACE_RESTART, 0, 0);
+            midi_stop(adj);
+            adj->tick = ADJ_TICK0;
+            midi_start(adj);
+            adj_q_restart = 0;
+        }
+
+        if (adj_paused) {
+            if (! was_paused) {
+                midi_stop(adj);
+            }
+            was_paused = 1;
+            // block until started or quit
+            pthread_mutex_lock(&run_mutex);
+            while (adj_paused && adj_running) {
+                if ( ! clock_waiting ) {
+                    clock_waiting = 1;
+                    backend_idle();
+                }
+                pthread_cond_wait(&run_cond, &run_mutex);
+            }
+            if (clock_waiting) {
+                clock_waiting = 0;
+                backend_busy();
+            }
+            pthread_mutex_unlock(&run_mutex);
+            adj_wakeup();
+            if ( ! adj_running ) goto quit;
+        }
+
+        if (was_paused) {
+            was_paused = 0;
+            fresh = 1;
+            adj->tick = ADJ_TICK0;
+            midi_start(adj);
+        }
+        
+
+        adj_wakeup();
+
+        // send first clock _before_ tick_handler() which may be slow, handler has 1/24th of a beat to finish
+        clock_backend->clock(adj, adj_next_tick(adj));
+ 
+        adj->tick_handler(adj, adj->tick);
+
+        for (i = 1 ; i < ADJ_CLOCKS_PER_BEAT * ADJ_BEATS_QUEUED; i++) {
+            clock_backend->clock(adj, adj_next_tick(adj));
+        }
+        clock_backend->flush(adj);
+
+        int events = report_events(adj);
+        adj_trace(ADJ_TRACE_CLOCKS, adj->tick, events);
+        // without alsa sync only, alsa sync empties the queue every loop
+        state_clock(adj->tick, events, ! fresh && ! adj->alsa_sync && events <= ADJ_CLOCKS_PER_BEAT * ADJ_BEATS_QUEUED, jitter);
+        fresh = 0;
+
+        // timed restart, wait for it exactly once it falls inside the clocks already queued, until then keep queuing
+        uint64_t at = adj_restart_nanos;
+        if (at && ! adj_paused && at <= adj_time_nanos() + (uint64_t) (60000000000.0 / adj->bpm / ADJ_CLOCKS_PER_BEAT * events)) {
+            if ( atomic_compare_exchange_strong(&adj_restart_nanos, &at, 0) ) {
+                backend_sleep_until(at);
+                adj_trace(ADJ_TRACE_RESTART, 0, 0);
+                midi_stop(adj);
+                adj->tick = ADJ_TICK0;
+                midi_start(adj);
+                fresh = 1;
+                continue;
+            }
+        }
+
+        if (adj->alsa_sync) {
+            // hang until queue is empty
+            clock_backend->sync(adj);
+        } else {
+            // non alsa-sync occasionally we have to compensate from CPU cycles taking time
+            // if we ever have less than a beat's worth of events on the queue, sleep for less
+
+            // potentially drop ticks to catch up 
+            jitter = adj_loop_sleep(adj->bpm, (int) (ADJ_CLOCKS_PER_BEAT * ADJ_BEATS_QUEUED) - events);
+        }
+
+    }
+    quit:
+
+    // stop midi devices
+    midi_stop(adj);
+    backend_idle();
+
+    // free
+    //snd_seq_free_queue(adj->alsa_seq, adj->q);
+    //snd_seq_close(adj->alsa_seq);
+
+    return ADJ_OK;
+}
+
+// start public api
+
+adj_seq_info_t* adj_calloc()
+{
+    adj_seq_info_t* adj = (adj_seq_info_t*) calloc(1, sizeof(adj_seq_info_t));
+    if (adj == NULL) {
+        return NULL;
+    }
+
+    adj->bpm = 120.0;
+    // TODO might be better to check for NULL
+    adj->message_handler = nop_message_handler;
+    adj->data_change_handler = nop_data_change_handler;
+    adj->tick_handler = nop_tick_handler;
+    adj->stop_handler = nop_stop_handler;
+    adj->start_handler = nop_start_handler;
+    return adj;
+}
+
+void adj_free(adj_seq_info_t* adj)
+{
+    free(adj);
+}
+
+int adj_init_alsa(adj_seq_info_t* adj)
+{
+    int rv = ADJ_OK;
+
+    if ( ! adj->seq_name ) adj->seq_name = "adj";
+
+    // Setup Alsa
     int alsa_err;
     if ( ( alsa_err = snd_seq_open(&adj->alsa_seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK)) <  0) {
         return ADJ_ALSA_SEQ_OPEN;
@@ -390,145 +1208,952 @@ int adj_init_alsa(adj_seq_info_t* adj)
         snd_seq_set_client_name(adj->alsa_seq, adj->seq_name);
     }
 
-    adj->alsa_port = snd_seq_create_simple_port(adj->alsa_seq, "clock", SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE|SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ, SND_SEQ_PORT_TYPE_APPLICATION);
+    // clock output only, size buffers so a full lookahead of clocks never blocks or fails
+    snd_seq_set_output_buffer_size(adj->alsa_seq, sizeof(snd_seq_event_t) * ADJ_OUTPUT_EVENTS);
+    snd_seq_set_client_pool_output(adj->alsa_seq, ADJ_OUTPUT_EVENTS);
+
+    adj->alsa_port = snd_seq_create_simple_port(adj->alsa_seq, "clock", SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE|SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ, SND_SEQ_PORT_TYPE_APPLICATION);
+
+    if (adj->alsa_port < 0) {
+        return ADJ_ALSA_PORT_OPEN;
+    }
+
+    // get alsa client_id, and print it because its useful for connect
+    snd_seq_client_info_t* info;
+    snd_seq_client_info_malloc(&info);
+
+    if (snd_seq_get_client_info(adj->alsa_seq, info) == 0){
+        adj->client_id = snd_seq_client_info_get_client(info);
+    }
+    snd_seq_client_info_free(info);
+
+        // create sequencer queue
+    adj->q = snd_seq_alloc_named_queue(adj->alsa_seq, "adjq");
+    if (adj->q < 0) {
+        rv = ADJ_ALSA_QUEUE_ALLOC;
+    }
+
+    adj_alsa_initialised = 1;
+
+    return rv;
+}
+
+int adj_init(adj_seq_info_t* adj)
+{
+    if (! adj_alsa_initialised && clock_backend == &alsa_backend) return ADJ_RTFM;
+    if ( ! adj->seq_name ) adj->seq_name = "adj";
+    if (adj_wakeup_epoch == 0) adj_wakeup_epoch = adj_time_nanos();
+
+    backend_busy();
+    int s = rt_create(&clock_thread, main_loop, adj);
+    if (s != 0) {
+        return ADJ_THREAD;
+    }
+    clock_started = 1;
+    rt_thread(clock_thread, "adj-clock", rt_profile.clock_prio, rt_profile.cpu, rt_clock_result, sizeof(rt_clock_result));
+
+    // wait for the loop to be ready so adj_start() can be called as soon as we return
+    struct timespec until;
+    int rv = 0;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += ADJ_INIT_TIMEOUT;
+    pthread_mutex_lock(&run_mutex);
+    while ( ! adj_running && ! clock_failed && rv != ETIMEDOUT ) {
+        rv = pthread_cond_timedwait(&run_cond, &run_mutex, &until);
+    }
+    if ( ! adj_running && ! clock_failed ) clock_failed = ADJ_THREAD;
+    rv = clock_failed;
+    pthread_mutex_unlock(&run_mutex);
+
+    if (rv) {
+        // a thread stuck in the backend cannot be joined, it returns without running if it ever gets here
+        pthread_detach(clock_thread);
+        clock_started = 0;
+        return rv;
+    }
+
+    if (init_nudge(adj) != 0) {
+        return ADJ_THREAD;
+    }
+
+    return ADJ_OK;
+}
+
+void adj_nudge(adj_seq_info_t* adj, int multiplier)
+{
+    adj_nudge_at(adj, multiplier, adj_time_nanos());
+}
+
+void adj_nudge_at(adj_seq_info_t* adj, int multiplier, uint64_t nanos)
+{
+    adj_control_at = nanos;
+    adj_nudge_multiplier = multiplier;
+    adj_nudge_exec = 1;
+    nudge_signal();
+    adj_trace_at(ADJ_TRACE_NUDGE, multiplier, 0, nanos);
+
+    if (multiplier > 10)   adj->data_change_handler(adj, ADJ_ITEM_OP, "  nudge ^");
+    if (multiplier > 0)    adj->data_change_handler(adj, ADJ_ITEM_OP, "  nudge >");
+    if (multiplier < 0)    adj->data_change_handler(adj, ADJ_ITEM_OP, "< nudge ");
+    if (multiplier < -10)  adj->data_change_handler(adj, ADJ_ITEM_OP, "v nudge ");
+}
+
+void adj_nudge_millis(adj_seq_info_t* adj, int millis)
+{
+    adj_nudge_ms = millis;
+    adj_nudge_exec = 1;
+    nudge_signal();
+    adj_trace(ADJ_TRACE_NUDGE, 0, millis);
+
+    if (millis > 0) adj->data_change_handler(adj, ADJ_ITEM_OP, "  nudge >");
+    if (millis < 0) adj->data_change_handler(adj, ADJ_ITEM_OP, "< nudge ");
+}
+
+void adj_start(adj_seq_info_t* adj)
+{
+    adj->data_change_handler(adj, ADJ_ITEM_OP, "start");
+    // midi start is on the loop
+    adj_paused = 0;
+    run_signal();
+}
+
+void adj_stop(adj_seq_info_t* adj)
+{
+    adj->data_change_handler(adj, ADJ_ITEM_OP, "stop");
+    adj_paused = 1;
+    run_signal();
+}
+
+void adj_toggle(adj_seq_info_t* adj)
+{
+    if (adj_paused) {
+        adj_start(adj);
+    } else {
+        adj_stop(adj);
+    }
+}
+
+// restart in time to the playing loop (not perfect)
+void adj_quantized_restart(adj_seq_info_t* adj)
+{
+    adj_q_restart = 1;
+}
+
+void adj_restart_at(adj_seq_info_t* adj, uint64_t nanos)
+{
+    adj_restart_nanos = nanos;
+}
+
+
+void adj_beat_lock(adj_seq_info_t* adj)
+{
+    adj_stop(adj);
+}
+
+void adj_beat_unlock(adj_seq_info_t* adj)
+{
+    adj_start(adj);
+}
+
+
+int adj_exit(adj_seq_info_t* adj)
+{
+    adj->data_change_handler(adj, ADJ_ITEM_STATE_SEQ, "exit");
+    int rv = adj_quit();
+    // the loop sends midi stop on the way out
+    if (clock_started && ! pthread_equal(pthread_self(), clock_thread)) {
+        pthread_join(clock_thread, NULL);
+        clock_started = 0;
+    }
+    if (adj->exit_handler) adj->exit_handler(adj);
+    return rv;
+}
+
+int adj_quit()
+{
+    int rv = 0;
+    if (adj_running) {
+        rv = 1;
+    }
+    adj_running = 0;
+    adj_nudge_running = 0;
+    run_signal();
+    nudge_signal();
+    if (clock_backend->wake) clock_backend->wake();
+    return rv;
+}
+
+unsigned _Atomic adj_is_running()
+{
+    return adj_running;
+}
+
+unsigned _Atomic adj_is_paused()
+{
+    return adj_paused;
+}
+
+void adj_set_tempo(adj_seq_info_t* adj, float bpm)
+{
+    adj_set_bpm = bpm;
+    nudge_signal();
+}
+
+void adj_adjust_tempo(adj_seq_info_t* adj, float bpm_diff)
+{
+    adj_adjust_bpm += bpm_diff;
+    nudge_signal();
+}
+
+void adj_set_tempo_at(adj_seq_info_t* adj, float bpm, uint64_t nanos)
+{
+    adj_control_at = nanos;
+    adj_set_bpm = bpm;
+    nudge_signal();
+}
+
+void adj_adjust_tempo_at(adj_seq_info_t* adj, float bpm_diff, uint64_t nanos)
+{
+    adj_control_at = nanos;
+    adj_adjust_bpm += bpm_diff;
+    nudge_signal();
+}
+
+void adj_wakeup()
+{
+    atomic_fetch_add_explicit(&adj_wakeup_count, 1, memory_order_relaxed);
+}
+
+double adj_wakeups_per_second()
+{
+    uint64_t now = adj_time_nanos();
+    if (adj_wakeup_epoch == 0 || now <= adj_wakeup_epoch) return 0.0;
+    return adj_wakeup_count * 1000000000.0 / (now - adj_wakeup_epoch);
+}
+
+adj_histogram_t* adj_control_latency()
+{
+    return &control_latency;
+}
+
+int adj_rt_profile(adj_rt_profile_t* rt)
+{
+    rt_profile = *rt;
+    if (rt->mlock) {
+        int rv = mlockall(MCL_CURRENT | MCL_FUTURE) ? errno : 0;
+        snprintf(rt_mlock_result, sizeof(rt_mlock_result), " mlock %s", rt_err(rv));
+        if (rv) return ADJ_ERR;
+        rt_prefault();
+    }
+    return ADJ_OK;
+}
+
+int adj_rt_inherit(int prio)
+{
+    struct sched_param sp;
+    sp.sched_priority = prio;
+    int rv = pthread_setschedparam(pthread_self(), prio > 0 ? SCHED_FIFO : SCHED_OTHER, &sp);
+    if (prio > 0) {
+        snprintf(rt_net_result, sizeof(rt_net_result), ", net fifo %i %s", prio, rt_err(rv));
+    }
+    return rv ? ADJ_ERR : ADJ_OK;
+}
+
+char* adj_rt_report()
+{
+    snprintf(rt_report, sizeof(rt_report), "rt:%s%s%s%s%s", rt_mlock_result, rt_clock_result, rt_send_result, rt_command_result, rt_net_result);
+    if (strlen(rt_report) == 3) {
+        return "rt: off";
+    }
+    // no comma after "rt:"
+    if (rt_report[3] == ',') rt_report[3] = ' ';
+    return rt_report;
+}
 
-    if (adj->alsa_port < 0) {
-        return ADJ_ALSA_PORT_OPEN;
+/**
+ * snd_seq_parse_address() only understands port numbers, also accept a port name as aconnect users type them
+ * e.g. "TR-6S:TR-6S MIDI 1    " N.B. alsa port names can have trailing whitespace
+ */
+
+static int parse_address(adj_seq_info_t* adj, snd_seq_addr_t* addr, const char* name)
+{
+    snd_seq_port_info_t* pinfo;
+    const char* port = strchr(name, ':');
+    size_t len;
+
+    if (snd_seq_parse_address(adj->alsa_seq, addr, name) < 0) {
+        return ADJ_ERR;
+    }
+    if (port == NULL || (port[1] >= '0' && port[1] <= '9')) {
+        return ADJ_OK;
     }
 
-    // get alsa client_id, and print it because its useful for connect
-    snd_seq_client_info_t* info;
-    snd_seq_client_info_malloc(&info);
+    port++;
+    if ( (len = adj_rtrim_len(port)) == 0 ) {
+        return ADJ_ERR;
+    }
 
-    if (snd_seq_get_client_info(adj->alsa_seq, info) == 0){
-        adj->client_id = snd_seq_client_info_get_client(info);
+    // the whole name, "TR-6S MIDI 1" is not "TR-6S MIDI 10"
+    snd_seq_port_info_alloca(&pinfo);
+    snd_seq_port_info_set_client(pinfo, addr->client);
+    snd_seq_port_info_set_port(pinfo, -1);
+    while (snd_seq_query_next_port(adj->alsa_seq, pinfo) >= 0) {
+        const char* port_name = snd_seq_port_info_get_name(pinfo);
+        if (adj_rtrim_len(port_name) == len && strncmp(port_name, port, len) == 0) {
+            addr->port = snd_seq_port_info_get_port(pinfo);
+            return ADJ_OK;
+        }
     }
-    snd_seq_client_info_free(info);
+    return ADJ_ERR;
+}
 
-        // create sequencer queue
-    adj->q = snd_seq_alloc_named_queue(adj->alsa_seq, "adjq");
-    if (adj->q < 0) {
-        rv = ADJ_ALSA_QUEUE_ALLOC;
+int adj_connect(adj_seq_info_t* adj, const char* sender_name, const char* dest_name)
+{
+    snd_seq_port_subscribe_t* subs;
+    snd_seq_addr_t sender, dest;
+
+    if (! adj_alsa_initialised) return ADJ_RTFM;
+
+    if (parse_address(adj, &sender, sender_name) != ADJ_OK || parse_address(adj, &dest, dest_name) != ADJ_OK) {
+        return ADJ_ALSA_PORT_OPEN;
     }
 
-    adj_alsa_initialised = 1;
+    snd_seq_port_subscribe_alloca(&subs);
+    snd_seq_port_subscribe_set_sender(subs, &sender);
+    snd_seq_port_subscribe_set_dest(subs, &dest);
+    // already connected is not an error
+    int rv = snd_seq_subscribe_port(adj->alsa_seq, subs);
+    if (rv < 0 && rv != -EBUSY) {
+        return ADJ_ALSA;
+    }
+    return ADJ_OK;
+}
 
-    return rv;
+int adj_connect_out(adj_seq_info_t* adj, const char* port_name)
+{
+    char clock[32];
+    snprintf(clock, sizeof(clock), "%i:%i", adj->client_id, adj->alsa_port);
+    return adj_connect(adj, clock, port_name);
 }
 
-int adj_init(adj_seq_info_t* adj)
+void adj_set_backend(adj_backend_t* backend)
 {
-    if (! adj_alsa_initialised) return ADJ_RTFM;
+    clock_backend = backend ? backend : &alsa_backend;
+}
+
+adj_backend_t* adj_backend_alsa()
+{
+    return &alsa_backend;
+}
+
+uint64_t adj_time_nanos()
+{
+    struct timespec now;
+    if (clock_backend->now) return clock_backend->now();
+    clock_gettime(ADJ_CLOCK, &now);
+    return (uint64_t) now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+adj_backend_t* adj_backend_sim(uint64_t wake_jitter, uint32_t seed)
+{
+    sim_wake_jitter = wake_jitter;
+    sim_seed = seed;
+    return &sim_backend;
+}
+
+adj_backend_t* adj_backend_rawmidi(const char* device)
+{
+    pthread_condattr_t attr;
     pthread_t thread_id;
 
-    int s = pthread_create(&thread_id, NULL, main_loop, adj);
-    if (s != 0) {
-        return ADJ_THREAD;
+    if (raw_out) return &raw_backend;
+    if ( snd_rawmidi_open(NULL, &raw_out, device, SND_RAWMIDI_NONBLOCK) < 0 ) {
+        raw_out = NULL;
+        return NULL;
     }
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, ADJ_CLOCK);
+    pthread_cond_init(&raw_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    // sending is the tightest deadline in libadj, it goes one above the clock loop
+    raw_running = 1;
+    if ( rt_create(&thread_id, raw_loop, NULL) != 0 ) {
+        raw_running = 0;
+        snd_rawmidi_close(raw_out);
+        raw_out = NULL;
+        return NULL;
+    }
+    rt_thread(thread_id, "adj-rawmidi", rt_profile.clock_prio > 0 && rt_profile.clock_prio < 99 ? rt_profile.clock_prio + 1 : rt_profile.clock_prio,
+        rt_profile.cpu, rt_send_result, sizeof(rt_send_result));
+    return &raw_backend;
+}
 
+int adj_measure_seq(adj_seq_info_t* adj)
+{
+    pthread_t thread_id;
+    char name[64];
+    int port;
+
+    if ( ! adj_alsa_initialised ) return ADJ_RTFM;
+    if ( snd_seq_open(&echo_seq, "default", SND_SEQ_OPEN_INPUT, 0) < 0 ) return ADJ_ALSA_SEQ_OPEN;
+    snprintf(name, sizeof(name), "%s-echo", adj->seq_name);
+    snd_seq_set_client_name(echo_seq, name);
+    port = snd_seq_create_simple_port(echo_seq, "echo", SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE, SND_SEQ_PORT_TYPE_APPLICATION);
+    if ( port < 0 ) return ADJ_ALSA_PORT_OPEN;
+    if ( snd_seq_connect_from(echo_seq, port, adj->client_id, adj->alsa_port) < 0 ) return ADJ_ALSA;
+
+    if ( rt_create(&thread_id, echo_loop, adj) != 0 ) return ADJ_THREAD;
+    rt_thread(thread_id, "adj-echo", rt_profile.clock_prio, rt_profile.cpu, rt_send_result, sizeof(rt_send_result));
     return ADJ_OK;
 }
 
-void adj_nudge(adj_seq_info_t* adj, int multiplier)
+adj_histogram_t* adj_send_jitter()
 {
-    adj_nudge_multiplier = multiplier;
-    adj_nudge_exec = 1;
+    return &send_jitter;
+}
 
-    if (multiplier > 10)   adj->data_change_handler(adj, ADJ_ITEM_OP, "  nudge ^");
-    if (multiplier > 0)    adj->data_change_handler(adj, ADJ_ITEM_OP, "  nudge >");
-    if (multiplier < 0)    adj->data_change_handler(adj, ADJ_ITEM_OP, "< nudge ");
-    if (multiplier < -10)  adj->data_change_handler(adj, ADJ_ITEM_OP, "v nudge ");
+void adj_sim_sleep_until(uint64_t nanos)
+{
+    sim_sleep_until(nanos);
 }
 
-void adj_nudge_millis(adj_seq_info_t* adj, int millis)
+int adj_sim_events(const adj_sim_event_t** events)
 {
-    adj_nudge_ms = millis;
-    adj_nudge_exec = 1;
+    *events = sim_played;
+    return sim_played_len;
+}
 
-    if (millis > 0) adj->data_change_handler(adj, ADJ_ITEM_OP, "  nudge >");
-    if (millis < 0) adj->data_change_handler(adj, ADJ_ITEM_OP, "< nudge ");
+// end public api
+
+// start timeline api
+
+//SNIP_timeline
+
+// The timeline is a tempo map: when the queue started, plus every tempo change since then.
+// Writers are the main loop (start/stop) and the nudge thread (tempo), readers can be any thread
+// so the map is protected by a seqlock, readers never block the writers.
+
+#define ADJ_TEMPO_MAP_MAX   256    // tempo changes remembered, when full the oldest half is dropped and earlier lookups fail
+
+typedef struct {
+    uint64_t    nanos;             // when this tempo started
+    double      beat;              // queue position at nanos
+    uint32_t    micros_per_beat;
+} adj_tempo_change_t;
+
+static adj_tempo_change_t tempo_map[ADJ_TEMPO_MAP_MAX];
+static unsigned int tempo_map_len = 0;                              // zero when the queue is stopped
+static uint32_t tempo_map_micros = 500000;                          // tempo to use when the queue starts
+static unsigned _Atomic tempo_map_seq = ATOMIC_VAR_INIT(0);         // odd while writing
+static pthread_mutex_t tempo_map_mutex = PTHREAD_MUTEX_INITIALIZER; // serializes writers only
+
+static void timeline_write_begin()
+{
+    pthread_mutex_lock(&tempo_map_mutex);
+    atomic_fetch_add_explicit(&tempo_map_seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
 }
 
-void adj_start(adj_seq_info_t* adj)
+static void timeline_write_end()
 {
-    adj->data_change_handler(adj, ADJ_ITEM_OP, "start");
-    // midi start is on the loop
-    adj_paused = 0;
+    atomic_fetch_add_explicit(&tempo_map_seq, 1, memory_order_release);
+    pthread_mutex_unlock(&tempo_map_mutex);
 }
 
-void adj_stop(adj_seq_info_t* adj)
+static double timeline_beat_at(adj_tempo_change_t* tc, uint64_t nanos)
 {
-    adj->data_change_handler(adj, ADJ_ITEM_OP, "stop");
-    adj_paused = 1;
+    return tc->beat + ((double) nanos - (double) tc->nanos) / (tc->micros_per_beat * 1000.0);
 }
 
-void adj_toggle(adj_seq_info_t* adj)
+static uint64_t timeline_nanos_at(adj_tempo_change_t* tc, double beat)
 {
-    if (adj_paused) {
-        adj_start(adj);
+    return tc->nanos + (int64_t) ((beat - tc->beat) * tc->micros_per_beat * 1000.0);
+}
+
+// last tempo change at or before nanos, callers check nanos is not before the first
+static adj_tempo_change_t* timeline_find_nanos(unsigned int len, uint64_t nanos)
+{
+    unsigned int lo = 0, hi = len - 1, mid;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (tempo_map[mid].nanos <= nanos) lo = mid;
+        else hi = mid - 1;
+    }
+    return &tempo_map[lo];
+}
+
+// last tempo change at or before beat
+static adj_tempo_change_t* timeline_find_beat(unsigned int len, double beat)
+{
+    unsigned int lo = 0, hi = len - 1, mid;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (tempo_map[mid].beat <= beat) lo = mid;
+        else hi = mid - 1;
+    }
+    return &tempo_map[lo];
+}
+
+static void adj_timeline_start(uint64_t nanos)
+{
+    timeline_write_begin();
+    tempo_map[0].nanos = nanos;
+    tempo_map[0].beat = 0.0;
+    tempo_map[0].micros_per_beat = tempo_map_micros;
+    tempo_map_len = 1;
+    timeline_write_end();
+}
+
+static void adj_timeline_tempo(uint64_t nanos, uint32_t micros_per_beat)
+{
+    timeline_write_begin();
+    tempo_map_micros = micros_per_beat;
+    if (tempo_map_len) {
+        adj_tempo_change_t* last = &tempo_map[tempo_map_len - 1];
+        double beat = timeline_beat_at(last, nanos);
+        if (tempo_map_len == ADJ_TEMPO_MAP_MAX) {
+            memmove(tempo_map, &tempo_map[ADJ_TEMPO_MAP_MAX / 2], sizeof(adj_tempo_change_t) * ADJ_TEMPO_MAP_MAX / 2);
+            tempo_map_len = ADJ_TEMPO_MAP_MAX / 2;
+        }
+        tempo_map[tempo_map_len].nanos = nanos;
+        tempo_map[tempo_map_len].beat = beat;
+        tempo_map[tempo_map_len].micros_per_beat = micros_per_beat;
+        tempo_map_len++;
+    }
+    timeline_write_end();
+}
+
+static void adj_timeline_stop()
+{
+    timeline_write_begin();
+    tempo_map_len = 0;
+    timeline_write_end();
+}
+
+int adj_timeline_position(adj_seq_info_t* adj, uint64_t nanos, adj_beat_pos_t* pos)
+{
+    unsigned int seq, len;
+    double beat = -1.0;
+    uint32_t micros_per_beat = 0;
+
+    do {
+        seq = atomic_load_explicit(&tempo_map_seq, memory_order_acquire);
+        if (seq & 1) continue;
+        len = tempo_map_len;
+        // the first entry is the start of the queue, or the oldest kept once the map has overflowed
+        if (len == 0 || nanos < tempo_map[0].nanos) {
+            beat = -1.0;
+            micros_per_beat = 0;
+        } else {
+            adj_tempo_change_t* tc = timeline_find_nanos(len, nanos);
+            beat = timeline_beat_at(tc, nanos);
+            micros_per_beat = tc->micros_per_beat;
+        }
+        atomic_thread_fence(memory_order_acquire);
+    } while (seq & 1 || seq != atomic_load_explicit(&tempo_map_seq, memory_order_relaxed));
+
+    if (beat < 0.0) return ADJ_ERR;
+
+    pos->beat = beat;
+    pos->bar = (uint32_t) (beat / ADJ_BEATS_PER_BAR);
+    pos->bar_pos = 1 + ((uint64_t) beat) % ADJ_BEATS_PER_BAR;
+    pos->phase = beat - (uint64_t) beat;
+    pos->tick = (uint32_t) (beat * ADJ_PPQ);
+    pos->bpm = 60000000.0 / micros_per_beat;
+    return ADJ_OK;
+}
+
+int adj_timeline_time(adj_seq_info_t* adj, double beat, uint64_t* nanos)
+{
+    unsigned int seq, len = 0;
+    uint64_t when = 0;
+
+    do {
+        seq = atomic_load_explicit(&tempo_map_seq, memory_order_acquire);
+        if (seq & 1) continue;
+        len = tempo_map_len;
+        if (len && beat < tempo_map[0].beat) len = 0;
+        when = len ? timeline_nanos_at(timeline_find_beat(len, beat), beat) : 0;
+        atomic_thread_fence(memory_order_acquire);
+    } while (seq & 1 || seq != atomic_load_explicit(&tempo_map_seq, memory_order_relaxed));
+
+    if (len == 0) return ADJ_ERR;
+
+    *nanos = when;
+    return ADJ_OK;
+}
+
+//SNIP_timeline
+
+// end timeline api
+
+// start trace api
+
+// Each thread writes to its own ring so the only cost is a thread local load and a store.
+// Rings are allocated the first time a thread traces and never freed, the dump reads them without locking.
+// When a thread exits its ring is kept, with its events, until a new thread takes it over, so threads that come
+// and go, e.g. a module's reader per usb plug, do not use up the ADJ_TRACE_THREADS slots.
+
+#define ADJ_TRACE_RING      8192   // events per thread, a power of two
+#define ADJ_TRACE_THREADS   32
+#define ADJ_TRACE_SLACK     256    // oldest events left out of a dump, the writer may be overwriting them
+
+typedef struct {
+    adj_trace_event_t   events[ADJ_TRACE_RING];
+    uint64_t _Atomic    head;      // events ever written, only the owning thread writes
+    uint64_t _Atomic    base;      // head when the current thread took the ring over, earlier events are not its own
+    unsigned _Atomic    free;      // the owning thread exited
+    char                name[16];
+} trace_ring_t;
+
+static unsigned _Atomic trace_enabled = ATOMIC_VAR_INIT(0);
+static trace_ring_t* _Atomic trace_rings[ADJ_TRACE_THREADS];
+static unsigned _Atomic trace_ring_count = ATOMIC_VAR_INIT(0);
+static _Thread_local trace_ring_t* trace_ring = NULL;
+static _Thread_local int trace_ring_failed = 0;
+static pthread_key_t trace_key;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static unsigned _Atomic trace_full_warned = ATOMIC_VAR_INIT(0);
+
+/**
+ * thread exit, leave the ring for the next thread that traces
+ */
+static void trace_release(void* ring)
+{
+    trace_ring_t* r = ring;
+    atomic_store_explicit(&r->free, 1, memory_order_release);
+}
+
+static void trace_key_create()
+{
+    pthread_key_create(&trace_key, trace_release);
+}
+
+/**
+ * a ring left by a thread that exited, or NULL
+ */
+static trace_ring_t* trace_reuse()
+{
+    trace_ring_t* r;
+    unsigned int i, threads = atomic_load(&trace_ring_count);
+    unsigned int was_free;
+
+    if (threads > ADJ_TRACE_THREADS) threads = ADJ_TRACE_THREADS;
+    for (i = 0; i < threads; i++) {
+        was_free = 1;
+        if ( (r = atomic_load_explicit(&trace_rings[i], memory_order_acquire)) &&
+             atomic_compare_exchange_strong(&r->free, &was_free, 0) ) {
+            atomic_store_explicit(&r->base, atomic_load_explicit(&r->head, memory_order_relaxed), memory_order_release);
+            return r;
+        }
+    }
+    return NULL;
+}
+
+static trace_ring_t* trace_register()
+{
+    trace_ring_t* r;
+    char name[16] = "";
+    if (trace_ring_failed) return NULL;
+
+    pthread_once(&trace_key_once, trace_key_create);
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    if ( (r = trace_reuse()) == NULL ) {
+        unsigned int idx = atomic_fetch_add(&trace_ring_count, 1);
+        if (idx >= ADJ_TRACE_THREADS || (r = calloc(1, sizeof(trace_ring_t))) == NULL) {
+            trace_ring_failed = 1;
+            if ( ! atomic_exchange(&trace_full_warned, 1) ) {
+                fprintf(stderr, "trace: more than %i threads tracing, %s is not traced\n", ADJ_TRACE_THREADS, name);
+            }
+            return NULL;
+        }
+        memcpy(r->name, name, sizeof(r->name));
+        atomic_store_explicit(&trace_rings[idx], r, memory_order_release);
     } else {
-        adj_stop(adj);
+        memcpy(r->name, name, sizeof(r->name));
     }
+    pthread_setspecific(trace_key, r);
+    return trace_ring = r;
 }
 
-// restart in time to the playing loop (not perfect)
-void adj_quantized_restart(adj_seq_info_t* adj)
+void adj_trace_enable(int on)
 {
-    adj_q_restart = 1;
+    trace_enabled = on;
 }
 
+void adj_trace_at(uint16_t type, int32_t a, int64_t b, uint64_t nanos)
+{
+    trace_ring_t* r = trace_ring;
+    if ( ! atomic_load_explicit(&trace_enabled, memory_order_relaxed) ) return;
+    if (r == NULL && (r = trace_register()) == NULL) return;
+
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    adj_trace_event_t* e = &r->events[head & (ADJ_TRACE_RING - 1)];
+    e->nanos = nanos;
+    e->a = a;
+    e->b = b;
+    e->type = type;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
 
-void adj_beat_lock(adj_seq_info_t* adj)
+void adj_trace(uint16_t type, int32_t a, int64_t b)
 {
-    adj_stop(adj);
+    if ( ! atomic_load_explicit(&trace_enabled, memory_order_relaxed) ) return;
+    adj_trace_at(type, a, b, adj_time_nanos());
 }
 
-void adj_beat_unlock(adj_seq_info_t* adj)
+static int write_all(int fd, const void* buf, size_t len)
 {
-    adj_start(adj);
+    ssize_t rv;
+    while (len) {
+        if ( (rv = write(fd, buf, len)) <= 0 ) {
+            if (rv < 0 && errno == EINTR) continue;
+            return ADJ_IO;
+        }
+        buf = (const char*) buf + rv;
+        len -= rv;
+    }
+    return ADJ_OK;
 }
 
+int adj_trace_dump(const char* path)
+{
+    adj_trace_header_t hdr;
+    adj_trace_thread_t th;
+    trace_ring_t* r;
+    unsigned int i, threads = atomic_load(&trace_ring_count);
+    uint64_t head, from, base, start, n1;
+    int rv = ADJ_OK;
 
-int adj_exit(adj_seq_info_t* adj)
+    if (threads > ADJ_TRACE_THREADS) threads = ADJ_TRACE_THREADS;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return ADJ_IO;
+
+    memcpy(hdr.magic, ADJ_TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.threads = threads;
+    hdr.event_size = sizeof(adj_trace_event_t);
+    rv |= write_all(fd, &hdr, sizeof(hdr));
+
+    for (i = 0; i < threads; i++) {
+        memset(&th, 0, sizeof(th));
+        th.index = i;
+        head = from = 0;
+        if ( (r = atomic_load_explicit(&trace_rings[i], memory_order_acquire)) ) {
+            memcpy(th.name, r->name, sizeof(th.name));
+            head = atomic_load_explicit(&r->head, memory_order_acquire);
+            from = head > ADJ_TRACE_RING - ADJ_TRACE_SLACK ? head - (ADJ_TRACE_RING - ADJ_TRACE_SLACK) : 0;
+            base = atomic_load_explicit(&r->base, memory_order_acquire);
+            if (from < base) from = base;
+        }
+        th.count = head - from;
+        rv |= write_all(fd, &th, sizeof(th));
+        if (th.count == 0) continue;
+
+        // at most two runs, the end of the ring then the start
+        start = from & (ADJ_TRACE_RING - 1);
+        n1 = th.count < ADJ_TRACE_RING - start ? th.count : ADJ_TRACE_RING - start;
+        rv |= write_all(fd, &r->events[start], n1 * sizeof(adj_trace_event_t));
+        rv |= write_all(fd, &r->events[0], (th.count - n1) * sizeof(adj_trace_event_t));
+    }
+
+    close(fd);
+    return rv ? ADJ_IO : ADJ_OK;
+}
+
+// end trace api
+
+// start state api
+
+// Each section of the page has its own seqlock and one writer, the clock thread, the command thread, the difflock
+// or a player, so no writer waits for another.  A writer that finds its section busy skips the update rather than
+// wait, the page is only for display.  Readers only ever read, the seqlock tells them to retry if they overlapped a write.
+
+static adj_state_t state_local;                         // written until adj_state_publish()
+static adj_state_t* _Atomic state_page = &state_local;
+static char state_name[256];
+
+#define ADJ_STATE_READ_TRIES    10000
+
+static adj_state_t* state_get()
 {
-    adj->data_change_handler(adj, ADJ_ITEM_STATE_SEQ, "exit");
-    int rv = adj_quit();
-    usleep(500000);
-    if (adj->exit_handler) adj->exit_handler(adj);
-    return rv;
+    return atomic_load_explicit(&state_page, memory_order_acquire);
 }
 
-int adj_quit()
+static int section_begin(uint32_t _Atomic* seq)
 {
-    int rv = 0;
-    if (adj_running) {
-        rv = 1;
+    uint32_t s = atomic_load_explicit(seq, memory_order_relaxed);
+    if ( (s & 1) || ! atomic_compare_exchange_strong_explicit(seq, &s, s + 1, memory_order_relaxed, memory_order_relaxed) ) {
+        return 0;
+    }
+    atomic_thread_fence(memory_order_release);
+    return 1;
+}
+
+static void section_end(uint32_t _Atomic* seq)
+{
+    atomic_fetch_add_explicit(seq, 1, memory_order_release);
+}
+
+/**
+ * copy a section, seq is its first member
+ */
+static int section_read(const uint32_t _Atomic* seq, void* copy, size_t size)
+{
+    uint32_t s1, s2;
+    int tries = 0;
+
+    do {
+        // a writer that died mid update leaves seq odd, give up rather than spin forever
+        if (tries++ == ADJ_STATE_READ_TRIES) return ADJ_ERR;
+        s1 = atomic_load_explicit(seq, memory_order_acquire);
+        if (s1 & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(copy, (const void*) seq, size);
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(seq, memory_order_relaxed);
+    } while ( (s1 & 1) || s1 != s2 );
+
+    return ADJ_OK;
+}
+
+static void state_tempo(float bpm)
+{
+    adj_state_tempo_t* t = &state_get()->tempo;
+    if ( ! section_begin(&t->seq) ) return;
+    t->bpm = bpm;
+    t->nanos = adj_time_nanos();
+    section_end(&t->seq);
+}
+
+static void state_run(uint32_t run)
+{
+    adj_state_clock_t* c = &state_get()->clock;
+    if ( ! section_begin(&c->seq) ) return;
+    c->state = run;
+    c->nanos = adj_time_nanos();
+    section_end(&c->seq);
+}
+
+static void state_clock(uint32_t tick, int32_t events, int underrun, uint64_t jitter)
+{
+    adj_state_clock_t* c = &state_get()->clock;
+    if ( ! section_begin(&c->seq) ) return;
+    c->tick = tick;
+    c->queue_events = events;
+    c->underruns += underrun;
+    c->jitter_last = jitter;
+    c->jitter_max = loop_jitter.max;
+    c->wakeups = adj_wakeup_count;
+    c->nanos = adj_time_nanos();
+    section_end(&c->seq);
+}
+
+void adj_state_player(uint8_t player_id, uint8_t bar_pos, float bpm, int32_t diff)
+{
+    adj_state_player_t* p = &state_get()->players[player_id % ADJ_STATE_PLAYERS];
+    if ( ! section_begin(&p->seq) ) return;
+    p->player_id = player_id;
+    p->bar_pos = bar_pos;
+    p->bpm = bpm;
+    p->diff = diff;
+    p->nanos = adj_time_nanos();
+    section_end(&p->seq);
+}
+
+void adj_state_lock(int32_t player_id, int32_t ms)
+{
+    adj_state_lock_t* l = &state_get()->lock;
+    if ( ! section_begin(&l->seq) ) return;
+    l->player_id = player_id;
+    l->ms = ms;
+    l->nanos = adj_time_nanos();
+    section_end(&l->seq);
+}
+
+/**
+ * copy every section of from to a page no one is writing yet
+ */
+static int state_copy(const adj_state_t* from, adj_state_t* to)
+{
+    int i, rv = ADJ_OK;
+
+    if ( section_read(&from->clock.seq, &to->clock, sizeof(to->clock)) != ADJ_OK ) rv = ADJ_ERR;
+    if ( section_read(&from->tempo.seq, &to->tempo, sizeof(to->tempo)) != ADJ_OK ) rv = ADJ_ERR;
+    if ( section_read(&from->lock.seq, &to->lock, sizeof(to->lock)) != ADJ_OK ) rv = ADJ_ERR;
+    for (i = 0; i < ADJ_STATE_PLAYERS; i++) {
+        if ( section_read(&from->players[i].seq, &to->players[i], sizeof(to->players[i])) != ADJ_OK ) rv = ADJ_ERR;
     }
-    adj_running = 0;
     return rv;
 }
 
-unsigned _Atomic adj_is_running()
+int adj_state_publish(const char* name)
 {
-    return adj_running;
+    adj_state_t* page;
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return ADJ_IO;
+    if ( ftruncate(fd, sizeof(adj_state_t)) != 0 ) {
+        close(fd);
+        return ADJ_IO;
+    }
+    page = mmap(NULL, sizeof(adj_state_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) return ADJ_IO;
+
+    // a page left by an adj that died may have a section mid update
+    memset(page, 0, sizeof(adj_state_t));
+    state_copy(&state_local, page);
+    page->version = ADJ_STATE_VERSION;
+    page->size = sizeof(adj_state_t);
+    page->pid = getpid();
+    snprintf(state_name, sizeof(state_name), "%s", name);
+    atomic_store_explicit(&state_page, page, memory_order_release);
+    return ADJ_OK;
 }
 
-unsigned _Atomic adj_is_paused()
+void adj_state_unpublish()
 {
-    return adj_paused;
+    // the page stays mapped, a writer may still hold it, it goes when the process exits
+    if (atomic_exchange(&state_page, &state_local) != &state_local) {
+        shm_unlink(state_name);
+    }
 }
 
-void adj_set_tempo(adj_seq_info_t* adj, float bpm)
+const adj_state_t* adj_state_attach(const char* name)
 {
-    adj_set_bpm = bpm;
+    struct stat st;
+    adj_state_t* page;
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+    if ( fstat(fd, &st) != 0 || st.st_size < sizeof(adj_state_t) ) {
+        close(fd);
+        return NULL;
+    }
+    page = mmap(NULL, sizeof(adj_state_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return page == MAP_FAILED ? NULL : page;
 }
 
-void adj_adjust_tempo(adj_seq_info_t* adj, float bpm_diff)
+int adj_state_read(const adj_state_t* page, adj_state_t* copy)
 {
-    adj_adjust_bpm = bpm_diff;
+    // the header is only written before the page is published
+    copy->version = page->version;
+    copy->size = page->size;
+    copy->pid = page->pid;
+    if (copy->version != ADJ_STATE_VERSION || copy->size != sizeof(adj_state_t)) return ADJ_ERR;
+
+    return state_copy(page, copy);
 }
 
-// end public api
+adj_histogram_t* adj_loop_jitter()
+{
+    return &loop_jitter;
+}
+
+// end state api
 
 // start util api
 
@@ -559,6 +2184,48 @@ void adj_one_beat_sleep(float bpm)
     nanosleep(&sl, (struct timespec*) NULL);
 }
 
+size_t adj_rtrim_len(const char* s)
+{
+    size_t len = strlen(s);
+    while (len && s[len - 1] == ' ') len--;
+    return len;
+}
+
 //SNIP_utils
 
+void adj_histogram_add(adj_histogram_t* hist, uint64_t micros)
+{
+    int bucket = 0;
+    uint64_t max = hist->max;
+    while (bucket < ADJ_HISTOGRAM_BUCKETS - 1 && micros >> bucket) bucket++;
+    hist->count[bucket]++;
+    while (micros > max && ! atomic_compare_exchange_weak(&hist->max, &max, micros));
+}
+
+// upper bound of the bucket containing the percentile
+static uint64_t histogram_percentile(adj_histogram_t* hist, uint64_t total, int percent)
+{
+    int i;
+    uint64_t n = 0;
+    for (i = 0; i < ADJ_HISTOGRAM_BUCKETS; i++) {
+        n += hist->count[i];
+        if (n * 100 >= total * percent) break;
+    }
+    return i >= ADJ_HISTOGRAM_BUCKETS - 1 ? hist->max : 1L << i;
+}
+
+void adj_histogram_print(adj_histogram_t* hist, const char* name, FILE* out)
+{
+    int i;
+    uint64_t total = 0;
+    for (i = 0; i < ADJ_HISTOGRAM_BUCKETS; i++) total += hist->count[i];
+    if (total == 0) return;
+
+    fprintf(out, "%s: n=%" PRIu64 " p50<%" PRIu64 "us p90<%" PRIu64 "us p99<%" PRIu64 "us max=%" PRIu64 "us\n", name, total,
+        histogram_percentile(hist, total, 50),
+        histogram_percentile(hist, total, 90),
+        histogram_percentile(hist, total, 99),
+        (uint64_t) hist->max);
+}
+
 // end util api
@@ -38,6 +38,7 @@
 #include "../adj_vdj.h"
 #include "../adj_store.h"
 #include "../adj_bpm_tap.h"
+#include "../adj_reactor.h"
 #include "adj_mod_api.h"
 
 
@@ -64,7 +65,7 @@
 static unsigned _Atomic adj_ps3_running = ATOMIC_VAR_INIT(0);
 
 static unsigned int js_flags;
-static int js_fd = 0;
+static int js_fd = -1;
 static int has_vdj = 0;
 static int trigger_down = 0;    // left bottom trigger held down (used like a control key)
 static char * device_id = NULL;
@@ -174,7 +175,7 @@ static int pair_bluetooth()
 static int init_logi(char* dev)
 {
 
-    if ((js_fd = open(dev, O_RDONLY)) < 0) {
+    if ((js_fd = open(dev, O_RDONLY | O_NONBLOCK)) < 0) {
         fprintf(stderr, "could not open '%s'\n", dev);
         return ADJ_ERR;
     }
@@ -322,21 +323,25 @@ static void handle_js_event(adj_seq_info_t* adj, struct js_event *evt)
 }
 
 /**
- * Thread that reads events from the joystick
+ * Reactor callback that reads events from the joystick
  */
-static void* read_js_events(void* arg)
+static void read_js_events(int fd, uint32_t events, void* data)
 {
-    adj_seq_info_t* adj = arg;
-    ssize_t sz = sizeof(struct js_event);
-    struct js_event evt;
-    while (adj_ps3_running) {
-        if (read(js_fd, &evt, sz) == sz) {
-            handle_js_event(adj, &evt);
-        }
+    adj_seq_info_t* adj = data;
+    struct js_event evt[16];
+    ssize_t i, n;
+
+    n = read(fd, evt, sizeof(evt));
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        // unplugged
+        adj_reactor_remove(fd);
+        close(fd);
+        js_fd = -1;
+        return;
+    }
+    for (i = 0; adj_ps3_running && i < n / (ssize_t) sizeof(struct js_event); i++) {
+        handle_js_event(adj, &evt[i]);
     }
-    close(js_fd);
-
-    return NULL;
 }
 
 /**
@@ -351,7 +356,6 @@ int adj_mod_init(adj_seq_info_t* adj, char* args, unsigned int flags)
 
     if (js_flags & ADJ_PAIR_BLUETOOTH) pair_bluetooth();
 
-    pthread_t thread_id;
     if ( args == NULL ) {
         dev = "/dev/input/js0";
     }
@@ -367,10 +371,9 @@ int adj_mod_init(adj_seq_info_t* adj, char* args, unsigned int flags)
     }
     adj_ps3_running = 1;
 
-    int s = pthread_create(&thread_id, NULL, &read_js_events, adj);
-    if (s != 0) {
+    if ( (rv = adj_reactor_add(js_fd, read_js_events, adj)) != ADJ_OK ) {
         close(js_fd);
-        return ADJ_THREAD;
+        return rv;
     }
 
     return ADJ_OK;
@@ -380,4 +383,10 @@ int adj_mod_init(adj_seq_info_t* adj, char* args, unsigned int flags)
 void adj_mod_exit()
 {
     adj_ps3_running = 0;
+    if (js_fd >= 0) {
+        // the module is unloaded when its device is unplugged
+        adj_reactor_remove(js_fd);
+        close(js_fd);
+        js_fd = -1;
+    }
 }